@@ -115,6 +115,12 @@ void decodeSetNativeDisplay(DecodeHandler p, NativeDisplay * display)
         ((IVideoDecoder*)p)->setNativeDisplay(display);
 }
 
+void decodeSetSkipPolicy(DecodeHandler p, const VideoSkipPolicy* policy)
+{
+    if(p)
+        ((IVideoDecoder*)p)->setSkipPolicy(policy);
+}
+
 void flushOutport(DecodeHandler p)
 {
     if(p)
@@ -66,6 +66,8 @@ void renderDoneRawData(DecodeHandler p, VideoFrameRawData* buffer);
 
 void decodeSetNativeDisplay(DecodeHandler p, NativeDisplay * display);
 
+void decodeSetSkipPolicy(DecodeHandler p, const VideoSkipPolicy* policy);
+
 void flushOutport(DecodeHandler p);
 
 void enableNativeBuffers(DecodeHandler p);
@@ -0,0 +1,356 @@
+/*
+ *  h264ausplitter.c - access unit splitter for H.264 byte streams
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "nalutils.h"
+#include "h264ausplitter.h"
+
+#include <string.h>
+
+/* start codes fetched from the scanner at a time */
+#define H264_AU_SCAN_BATCH 32
+
+/* The slice header fields 7.4.1.2.4 compares to detect the first VCL
+ * NAL unit of a new primary coded picture */
+typedef struct
+{
+  uint32_t first_mb_in_slice;
+  uint32_t pps_id;
+  uint16_t frame_num;
+  uint8_t field_pic_flag;
+  uint8_t bottom_field_flag;
+  uint8_t ref_idc_zero;
+  uint8_t idr_pic_flag;
+  uint32_t idr_pic_id;
+  uint16_t pic_order_cnt_lsb;
+  int32_t delta_pic_order_cnt_bottom;
+  int32_t delta_pic_order_cnt[2];
+  uint32_t redundant_pic_cnt;
+} H264AuSliceInfo;
+
+/* State of one h264_au_splitter_split() call */
+typedef struct
+{
+  int32_t start;                /* start code of the access unit */
+  int32_t pending;              /* start code of a prefix NAL unit which
+                                   belongs to the next picture if one
+                                   follows */
+  bool end_of_au;               /* an end of sequence/stream was found */
+  bool has_slice;
+  bool slice_valid;             /* @slice could be parsed */
+  H264AuSliceInfo slice;        /* the last VCL NAL unit */
+} H264AuState;
+
+H264AuSplitter *
+h264_au_splitter_new (void)
+{
+  H264AuSplitter *splitter;
+
+  splitter = g_slice_new0 (H264AuSplitter);
+  if (!splitter)
+    return NULL;
+  splitter->parser = h264_nal_parser_new ();
+  if (!splitter->parser) {
+    g_slice_free (H264AuSplitter, splitter);
+    return NULL;
+  }
+  return splitter;
+}
+
+void
+h264_au_splitter_free (H264AuSplitter * splitter)
+{
+  if (!splitter)
+    return;
+  h264_nal_parser_free (splitter->parser);
+  g_free (splitter->nalus);
+  g_slice_free (H264AuSplitter, splitter);
+}
+
+static bool
+h264_au_splitter_add_nalu (H264AuSplitter * splitter, uint32_t offset,
+    uint32_t size)
+{
+  if (splitter->n_nalus == splitter->max_nalus) {
+    uint32_t max_nalus = splitter->max_nalus ? 2 * splitter->max_nalus : 16;
+    H264NalSpan *nalus;
+
+    nalus = g_realloc (splitter->nalus, max_nalus * sizeof (H264NalSpan));
+    if (!nalus)
+      return FALSE;
+    splitter->nalus = nalus;
+    splitter->max_nalus = max_nalus;
+  }
+  splitter->nalus[splitter->n_nalus].offset = offset;
+  splitter->nalus[splitter->n_nalus].size = size;
+  splitter->n_nalus++;
+  return TRUE;
+}
+
+/* Parses the slice header up to redundant_pic_cnt */
+static bool
+h264_au_splitter_parse_slice (H264AuSplitter * splitter, H264NalUnit * nalu,
+    H264AuSliceInfo * info)
+{
+  NalReader nr;
+  uint32_t slice_type;
+  H264PPS *pps;
+  H264SPS *sps;
+
+  memset (info, 0, sizeof (*info));
+  info->ref_idc_zero = !nalu->ref_idc;
+  info->idr_pic_flag = nalu->idr_pic_flag;
+
+  nal_reader_init (&nr, nalu->data + nalu->offset + nalu->header_bytes,
+      nalu->size - nalu->header_bytes);
+
+  READ_UE (&nr, info->first_mb_in_slice);
+  READ_UE (&nr, slice_type);
+  READ_UE_MAX (&nr, info->pps_id, H264_MAX_PPS_COUNT - 1);
+
+  pps = &splitter->parser->pps[info->pps_id];
+  if (!pps->valid || !pps->sequence || !pps->sequence->valid)
+    goto error;
+  sps = pps->sequence;
+
+  if (sps->separate_colour_plane_flag && !nal_reader_skip (&nr, 2))
+    goto error;
+
+  READ_UINT16 (&nr, info->frame_num, sps->log2_max_frame_num_minus4 + 4);
+
+  if (!sps->frame_mbs_only_flag) {
+    READ_UINT8 (&nr, info->field_pic_flag, 1);
+    if (info->field_pic_flag)
+      READ_UINT8 (&nr, info->bottom_field_flag, 1);
+  }
+
+  if (nalu->idr_pic_flag)
+    READ_UE (&nr, info->idr_pic_id);
+
+  if (sps->pic_order_cnt_type == 0) {
+    READ_UINT16 (&nr, info->pic_order_cnt_lsb,
+        sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+    if (pps->pic_order_present_flag && !info->field_pic_flag)
+      READ_SE (&nr, info->delta_pic_order_cnt_bottom);
+  }
+
+  if (sps->pic_order_cnt_type == 1 && !sps->delta_pic_order_always_zero_flag) {
+    READ_SE (&nr, info->delta_pic_order_cnt[0]);
+    if (pps->pic_order_present_flag && !info->field_pic_flag)
+      READ_SE (&nr, info->delta_pic_order_cnt[1]);
+  }
+
+  if (pps->redundant_pic_cnt_present_flag)
+    READ_UE (&nr, info->redundant_pic_cnt);
+
+  return TRUE;
+
+error:
+  return FALSE;
+}
+
+/* 7.4.1.2.4, and a slice starting at the first macroblock always begins
+ * a new primary picture (no arbitrary slice order) */
+static bool
+h264_au_splitter_is_new_picture (const H264AuSliceInfo * prev,
+    const H264AuSliceInfo * cur)
+{
+  if (cur->redundant_pic_cnt)
+    return FALSE;
+
+  return cur->first_mb_in_slice == 0
+      || cur->frame_num != prev->frame_num
+      || cur->pps_id != prev->pps_id
+      || cur->field_pic_flag != prev->field_pic_flag
+      || cur->bottom_field_flag != prev->bottom_field_flag
+      || cur->ref_idc_zero != prev->ref_idc_zero
+      || cur->pic_order_cnt_lsb != prev->pic_order_cnt_lsb
+      || cur->delta_pic_order_cnt_bottom != prev->delta_pic_order_cnt_bottom
+      || cur->delta_pic_order_cnt[0] != prev->delta_pic_order_cnt[0]
+      || cur->delta_pic_order_cnt[1] != prev->delta_pic_order_cnt[1]
+      || cur->idr_pic_flag != prev->idr_pic_flag
+      || (cur->idr_pic_flag && cur->idr_pic_id != prev->idr_pic_id);
+}
+
+/* Handles the NAL unit whose start code is at @sc and which ends at @end.
+ * Returns the start code offset of the next access unit if the NAL unit
+ * does not belong to the current one, or -1 */
+static int32_t
+h264_au_splitter_process_nalu (H264AuSplitter * splitter, H264AuState * state,
+    const uint8_t * data, uint32_t sc, uint32_t end)
+{
+  H264NalUnit nalu;
+  H264AuSliceInfo slice;
+  H264ParserResult result;
+  bool new_au = FALSE;
+
+  if (state->end_of_au)
+    return sc;
+
+  /* drop trailing_zero_8bits, a NAL unit never ends with 0x00 */
+  while (end > sc + 3 && !data[end - 1])
+    end--;
+  if (end < sc + 4)
+    return -1;
+
+  result = h264_parser_identify_nalu_unchecked (splitter->parser, data, sc,
+      end, &nalu);
+  if (result != H264_PARSER_OK) {
+    /* keep it, the decoder reports the error */
+    if (state->start < 0)
+      state->start = sc;
+    h264_au_splitter_add_nalu (splitter, sc + 3 - state->start, end - sc - 3);
+    return -1;
+  }
+
+  switch (nalu.type) {
+    case H264_NAL_SLICE:
+    case H264_NAL_SLICE_DPA:
+    case H264_NAL_SLICE_IDR:{
+      bool valid =
+          h264_au_splitter_parse_slice (splitter, &nalu, &slice);
+
+      if (state->has_slice && valid && state->slice_valid)
+        new_au = h264_au_splitter_is_new_picture (&state->slice, &slice);
+      else if (state->has_slice && valid)
+        new_au = slice.first_mb_in_slice == 0 && !slice.redundant_pic_cnt;
+      if (new_au)
+        return state->pending >= 0 ? state->pending : (int32_t) sc;
+
+      state->has_slice = TRUE;
+      state->slice_valid = valid;
+      if (valid)
+        state->slice = slice;
+      state->pending = -1;
+      break;
+    }
+    case H264_NAL_SEI:
+    case H264_NAL_SPS:
+    case H264_NAL_PPS:
+    case H264_NAL_AU_DELIMITER:
+    case H264_NAL_SUBSET_SPS:
+    case 16:                   /* reserved */
+    case 17:
+    case 18:
+      if (state->has_slice)
+        return state->pending >= 0 ? state->pending : (int32_t) sc;
+      if (nalu.type == H264_NAL_SPS) {
+        H264SPS sps;
+        if (h264_parser_parse_sps (splitter->parser, &nalu, &sps,
+                FALSE) == H264_PARSER_OK)
+          h264_sps_clear (&sps);
+      } else if (nalu.type == H264_NAL_PPS) {
+        H264PPS pps;
+        if (h264_parser_parse_pps (splitter->parser, &nalu,
+                &pps) == H264_PARSER_OK)
+          h264_pps_clear (&pps);
+      }
+      break;
+    case H264_NAL_PREFIX_UNIT:
+      /* precedes a base view slice, which decides where it belongs */
+      if (state->has_slice && state->pending < 0)
+        state->pending = sc;
+      break;
+    case H264_NAL_SEQ_END:
+    case H264_NAL_STREAM_END:
+      state->end_of_au = TRUE;
+      break;
+    default:
+      break;
+  }
+
+  if (state->start < 0)
+    state->start = sc;
+  if (!h264_au_splitter_add_nalu (splitter, nalu.offset - state->start,
+          nalu.size))
+    WARNING ("failed to add nal unit to the access unit");
+  return -1;
+}
+
+/**
+ * h264_au_splitter_split:
+ * @splitter: a #H264AuSplitter
+ * @data: Annex B byte stream data
+ * @size: the size of @data
+ * @eos: no more data follows @data
+ * @au_offset: (out): offset in @data of the first access unit
+ * @au_size: (out): size of the first access unit
+ *
+ * Finds the first access unit of @data. Bytes before its first start code
+ * are skipped. The access unit references @data, its NAL units are stored
+ * in @splitter->nalus. Unless @eos is set, the access unit is only complete
+ * when the first NAL unit of the next one is in @data, so when this
+ * returns %FALSE, call it again on the same data plus more.
+ *
+ * Returns: %TRUE if an access unit was found
+ */
+bool
+h264_au_splitter_split (H264AuSplitter * splitter, const uint8_t * data,
+    uint32_t size, bool eos, uint32_t * au_offset, uint32_t * au_size)
+{
+  uint32_t positions[H264_AU_SCAN_BATCH];
+  uint32_t i, n, offset = 0;
+  int32_t sc = -1, next = -1;
+  H264AuState state;
+
+  g_return_val_if_fail (splitter != NULL, FALSE);
+
+  splitter->n_nalus = 0;
+  memset (&state, 0, sizeof (state));
+  state.start = -1;
+  state.pending = -1;
+
+  do {
+    n = nal_scanner_scan (data, size, offset, positions, H264_AU_SCAN_BATCH);
+    for (i = 0; i < n && next < 0; i++) {
+      if (sc >= 0)
+        next = h264_au_splitter_process_nalu (splitter, &state, data, sc,
+            positions[i]);
+      sc = positions[i];
+    }
+    if (n)
+      offset = positions[n - 1] + 3;
+  } while (n == H264_AU_SCAN_BATCH && next < 0);
+
+  if (next < 0) {
+    if (!eos || sc < 0)
+      return FALSE;
+    next = h264_au_splitter_process_nalu (splitter, &state, data, sc, size);
+    if (next < 0)
+      next = size;
+  }
+  if (state.start < 0)
+    return FALSE;
+
+  /* a prefix NAL unit was added before the slice after it showed that it
+   * starts the next access unit */
+  while (splitter->n_nalus
+      && splitter->nalus[splitter->n_nalus - 1].offset >=
+      (uint32_t) (next - state.start))
+    splitter->n_nalus--;
+
+  *au_offset = state.start;
+  *au_size = next - state.start;
+  return TRUE;
+}
@@ -0,0 +1,72 @@
+/*
+ *  h264ausplitter.h - access unit splitter for H.264 byte streams
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef H264_AU_SPLITTER_H
+#define H264_AU_SPLITTER_H
+
+#include "h264parser.h"
+
+G_BEGIN_DECLS
+
+typedef struct _H264NalSpan H264NalSpan;
+typedef struct _H264AuSplitter H264AuSplitter;
+
+/**
+ * H264NalSpan:
+ * @offset: offset of the NAL unit header, right after its start code
+ * @size: size of the NAL unit, trailing zero bytes excluded
+ */
+struct _H264NalSpan
+{
+  uint32_t offset;
+  uint32_t size;
+};
+
+/**
+ * H264AuSplitter:
+ * @nalus: the NAL units of the last access unit found, with offsets
+ *   relative to the start of the access unit
+ * @n_nalus: number of entries in @nalus
+ *
+ * Splits an Annex B byte stream into access units (7.4.1.2.3), so a
+ * decoder can be fed one picture at a time.
+ */
+struct _H264AuSplitter
+{
+  H264NalSpan *nalus;
+  uint32_t n_nalus;
+
+  /*< private >*/
+  uint32_t max_nalus;
+  H264NalParser *parser;
+};
+
+H264AuSplitter *h264_au_splitter_new (void);
+
+void h264_au_splitter_free (H264AuSplitter * splitter);
+
+bool h264_au_splitter_split (H264AuSplitter * splitter,
+    const uint8_t * data, uint32_t size, bool eos,
+    uint32_t * au_offset, uint32_t * au_size);
+
+G_END_DECLS
+
+#endif /* H264_AU_SPLITTER_H */
@@ -0,0 +1,247 @@
+/*
+ *  h264ausplitter_unittest.c - test of the access unit splitter on hand made streams
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/unittest.h"
+#include "h264ausplitter.h"
+
+#include <string.h>
+
+/* an Annex B stream written bit by bit */
+typedef struct
+{
+  uint8_t data[256];
+  uint32_t bits;
+} Stream;
+
+static void
+put_bits (Stream * s, uint32_t value, uint32_t nbits)
+{
+  while (nbits--) {
+    if (value & (1u << nbits))
+      s->data[s->bits / 8] |= 0x80 >> (s->bits % 8);
+    s->bits++;
+  }
+}
+
+static void
+put_ue (Stream * s, uint32_t value)
+{
+  uint32_t len = 0;
+
+  while ((value + 1) >> (len + 1))
+    len++;
+  put_bits (s, 0, len);
+  put_bits (s, value + 1, len + 1);
+}
+
+/* start code and NAL unit header, returns the offset of the header */
+static uint32_t
+start_nal (Stream * s, uint32_t ref_idc, uint32_t type)
+{
+  uint32_t offset;
+
+  put_bits (s, 1, 24);
+  offset = s->bits / 8;
+  put_bits (s, (ref_idc << 5) | type, 8);
+  return offset;
+}
+
+static void
+end_nal (Stream * s)
+{
+  put_bits (s, 1, 1);
+  while (s->bits % 8)
+    put_bits (s, 0, 1);
+}
+
+/* 16x16 baseline, poc type 0, 4 bits of frame_num and poc lsb */
+static void
+put_sps_pps (Stream * s)
+{
+  start_nal (s, 3, H264_NAL_SPS);
+  put_bits (s, 66, 8);
+  put_bits (s, 0, 8);
+  put_bits (s, 30, 8);
+  put_ue (s, 0);                /* seq_parameter_set_id */
+  put_ue (s, 0);                /* log2_max_frame_num_minus4 */
+  put_ue (s, 0);                /* pic_order_cnt_type */
+  put_ue (s, 0);                /* log2_max_pic_order_cnt_lsb_minus4 */
+  put_ue (s, 1);                /* max_num_ref_frames */
+  put_bits (s, 0, 1);           /* gaps_in_frame_num_value_allowed_flag */
+  put_ue (s, 0);                /* pic_width_in_mbs_minus1 */
+  put_ue (s, 0);                /* pic_height_in_map_units_minus1 */
+  put_bits (s, 1, 1);           /* frame_mbs_only_flag */
+  put_bits (s, 1, 1);           /* direct_8x8_inference_flag */
+  put_bits (s, 0, 1);           /* frame_cropping_flag */
+  put_bits (s, 0, 1);           /* vui_parameters_present_flag */
+  end_nal (s);
+
+  start_nal (s, 3, H264_NAL_PPS);
+  put_ue (s, 0);                /* pic_parameter_set_id */
+  put_ue (s, 0);                /* seq_parameter_set_id */
+  put_bits (s, 0, 2);           /* entropy_coding_mode_flag, bottom_field_pic_order_in_frame_present_flag */
+  put_ue (s, 0);                /* num_slice_groups_minus1 */
+  put_ue (s, 0);                /* num_ref_idx_l0_default_active_minus1 */
+  put_ue (s, 0);                /* num_ref_idx_l1_default_active_minus1 */
+  put_bits (s, 0, 3);           /* weighted_pred_flag, weighted_bipred_idc */
+  put_ue (s, 0);                /* pic_init_qp_minus26 */
+  put_ue (s, 0);                /* pic_init_qs_minus26 */
+  put_ue (s, 0);                /* chroma_qp_index_offset */
+  put_bits (s, 0, 3);           /* deblocking, constrained intra, redundant_pic_cnt_present_flag */
+  end_nal (s);
+}
+
+/* the slice header up to pic_order_cnt_lsb, the splitter reads no more */
+static uint32_t
+put_slice (Stream * s, bool idr, uint32_t frame_num, uint32_t poc_lsb)
+{
+  uint32_t offset = start_nal (s, idr ? 3 : 2,
+      idr ? H264_NAL_SLICE_IDR : H264_NAL_SLICE);
+
+  put_ue (s, 0);                /* first_mb_in_slice */
+  put_ue (s, idr ? 7 : 5);      /* slice_type */
+  put_ue (s, 0);                /* pic_parameter_set_id */
+  put_bits (s, frame_num, 4);
+  if (idr)
+    put_ue (s, 0);              /* idr_pic_id */
+  put_bits (s, poc_lsb, 4);
+  end_nal (s);
+  return offset;
+}
+
+/* svc_extension_flag and the rest of the 3 byte extension header */
+static uint32_t
+put_prefix (Stream * s)
+{
+  uint32_t offset = start_nal (s, 3, H264_NAL_PREFIX_UNIT);
+
+  put_bits (s, 0xc00080, 24);
+  return offset;
+}
+
+static bool
+has_nal (const H264AuSplitter * splitter, uint32_t offset)
+{
+  uint32_t i;
+
+  for (i = 0; i < splitter->n_nalus; i++) {
+    if (splitter->nalus[i].offset == offset)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* every NAL unit is inside the access unit */
+static void
+check_nalus (const H264AuSplitter * splitter, uint32_t au_size)
+{
+  uint32_t i;
+
+  for (i = 0; i < splitter->n_nalus; i++)
+    EXPECT_TRUE (splitter->nalus[i].offset + splitter->nalus[i].size <=
+        au_size);
+}
+
+/* a prefix NAL unit goes with the slice after it, into the next picture */
+static void
+testPrefixStartsPicture (void)
+{
+  Stream s;
+  H264AuSplitter *splitter = h264_au_splitter_new ();
+  uint32_t first_slice, prefix, second_slice, au_offset, au_size, size;
+
+  memset (&s, 0, sizeof (s));
+  put_sps_pps (&s);
+  first_slice = put_slice (&s, TRUE, 0, 0);
+  prefix = put_prefix (&s);
+  second_slice = put_slice (&s, FALSE, 1, 2);
+  size = s.bits / 8;
+
+  EXPECT_TRUE (splitter != NULL);
+  if (!splitter)
+    return;
+  EXPECT_TRUE (h264_au_splitter_split (splitter, s.data, size, TRUE,
+          &au_offset, &au_size));
+  EXPECT_EQ (0u, au_offset);
+  EXPECT_EQ (prefix - 3, au_size);
+  /* sps, pps and the first slice */
+  EXPECT_EQ (3u, splitter->n_nalus);
+  EXPECT_TRUE (has_nal (splitter, first_slice));
+  EXPECT_TRUE (!has_nal (splitter, prefix));
+  check_nalus (splitter, au_size);
+
+  au_offset += au_size;
+  EXPECT_TRUE (h264_au_splitter_split (splitter, s.data + au_offset,
+          size - au_offset, TRUE, &au_offset, &au_size));
+  EXPECT_EQ (0u, au_offset);
+  EXPECT_EQ (size - (prefix - 3), au_size);
+  EXPECT_EQ (2u, splitter->n_nalus);
+  EXPECT_TRUE (has_nal (splitter, 3));
+  EXPECT_TRUE (has_nal (splitter, second_slice - (prefix - 3)));
+  check_nalus (splitter, au_size);
+
+  h264_au_splitter_free (splitter);
+}
+
+/* a prefix NAL unit followed by a slice of the same picture stays in it */
+static void
+testPrefixInPicture (void)
+{
+  Stream s;
+  H264AuSplitter *splitter = h264_au_splitter_new ();
+  uint32_t prefix, au_offset, au_size, size;
+
+  memset (&s, 0, sizeof (s));
+  put_sps_pps (&s);
+  put_slice (&s, TRUE, 0, 0);
+  prefix = put_prefix (&s);
+  /* first_mb_in_slice 1 of the same picture */
+  start_nal (&s, 3, H264_NAL_SLICE_IDR);
+  put_ue (&s, 1);
+  put_ue (&s, 7);
+  put_ue (&s, 0);
+  put_bits (&s, 0, 4);
+  put_ue (&s, 0);
+  put_bits (&s, 0, 4);
+  end_nal (&s);
+  size = s.bits / 8;
+
+  EXPECT_TRUE (splitter != NULL);
+  if (!splitter)
+    return;
+  EXPECT_TRUE (h264_au_splitter_split (splitter, s.data, size, TRUE,
+          &au_offset, &au_size));
+  EXPECT_EQ (0u, au_offset);
+  EXPECT_EQ (size, au_size);
+  EXPECT_EQ (5u, splitter->n_nalus);
+  EXPECT_TRUE (has_nal (splitter, prefix));
+  check_nalus (splitter, au_size);
+
+  h264_au_splitter_free (splitter);
+}
+
+int
+main (void)
+{
+  RUN_TEST (testPrefixStartsPicture);
+  RUN_TEST (testPrefixInPicture);
+  return UNITTEST_RESULT ();
+}
@@ -0,0 +1,211 @@
+/*
+ *  nalscanner.c - start code scanner for byte stream format (Annex B)
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "nalscanner.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NAL_SCANNER_X86 1
+#include <immintrin.h>
+#endif
+
+/* The kernels look for the three byte pattern 0x00 0x00 @code, which is
+ * 0x01 for start codes and 0x03 for emulation prevention */
+typedef uint32_t (*NalScanFunc) (const uint8_t * data, uint32_t size,
+    uint32_t offset, uint8_t code, uint32_t * positions,
+    uint32_t max_positions, uint32_t count);
+
+/* Scalar kernel, also used for the tails of the SIMD kernels.
+ * data[i + 2] not in {0, code} rules out a match at i, i + 1 and i + 2;
+ * data[i + 1] != 0 rules out one at i and i + 1. */
+static uint32_t
+nal_scan_c (const uint8_t * data, uint32_t size, uint32_t i, uint8_t code,
+    uint32_t * positions, uint32_t max_positions, uint32_t count)
+{
+  while (i + 3 <= size && count < max_positions) {
+    if (data[i + 2] && data[i + 2] != code) {
+      i += 3;
+    } else if (data[i + 1]) {
+      i += 2;
+    } else if (data[i] || data[i + 2] != code) {
+      i++;
+    } else {
+      positions[count++] = i;
+      i += 3;
+    }
+  }
+  return count;
+}
+
+#ifdef NAL_SCANNER_X86
+
+/* Each set bit of @mask is a match at @base + bit. Returns the new
+ * count, and updates @next to resume scanning when @positions is full */
+static inline uint32_t
+nal_scan_store_mask (uint32_t mask, uint32_t base, uint32_t * positions,
+    uint32_t max_positions, uint32_t count, uint32_t * next)
+{
+  while (mask) {
+    uint32_t pos = base + __builtin_ctz (mask);
+    positions[count++] = pos;
+    if (count == max_positions) {
+      *next = pos + 3;
+      return count;
+    }
+    mask &= mask - 1;
+  }
+  return count;
+}
+
+__attribute__ ((target ("sse2")))
+static uint32_t
+nal_scan_sse2 (const uint8_t * data, uint32_t size, uint32_t i, uint8_t code,
+    uint32_t * positions, uint32_t max_positions, uint32_t count)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i last = _mm_set1_epi8 (code);
+
+  /* each block tests 16 candidate positions and reads 18 bytes */
+  while (i + 18 <= size && count < max_positions) {
+    __m128i b0 = _mm_loadu_si128 ((const __m128i *) (data + i));
+    __m128i z0 = _mm_cmpeq_epi8 (b0, zero);
+    uint32_t mask;
+
+    if (G_LIKELY (!_mm_movemask_epi8 (z0))) {
+      i += 16;
+      continue;
+    }
+    mask = _mm_movemask_epi8 (_mm_and_si128 (z0,
+            _mm_and_si128 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *)
+                        (data + i + 1)), zero),
+                _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (data +
+                            i + 2)), last))));
+    if (mask) {
+      uint32_t next = i + 16;
+      count = nal_scan_store_mask (mask, i, positions, max_positions, count,
+          &next);
+      i = next;
+    } else {
+      i += 16;
+    }
+  }
+  return nal_scan_c (data, size, i, code, positions, max_positions, count);
+}
+
+__attribute__ ((target ("avx2")))
+static uint32_t
+nal_scan_avx2 (const uint8_t * data, uint32_t size, uint32_t i, uint8_t code,
+    uint32_t * positions, uint32_t max_positions, uint32_t count)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i last = _mm256_set1_epi8 (code);
+
+  /* each block tests 32 candidate positions and reads 34 bytes */
+  while (i + 34 <= size && count < max_positions) {
+    __m256i b0 = _mm256_loadu_si256 ((const __m256i *) (data + i));
+    __m256i z0 = _mm256_cmpeq_epi8 (b0, zero);
+    uint32_t mask;
+
+    if (G_LIKELY (!_mm256_movemask_epi8 (z0))) {
+      i += 32;
+      continue;
+    }
+    mask = _mm256_movemask_epi8 (_mm256_and_si256 (z0,
+            _mm256_and_si256 (_mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const
+                            __m256i *) (data + i + 1)), zero),
+                _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *)
+                        (data + i + 2)), last))));
+    if (mask) {
+      uint32_t next = i + 32;
+      count = nal_scan_store_mask (mask, i, positions, max_positions, count,
+          &next);
+      i = next;
+    } else {
+      i += 32;
+    }
+  }
+  return nal_scan_sse2 (data, size, i, code, positions, max_positions,
+      count);
+}
+
+#endif /* NAL_SCANNER_X86 */
+
+static NalScanFunc
+nal_scanner_select (void)
+{
+#ifdef NAL_SCANNER_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    return nal_scan_avx2;
+  if (__builtin_cpu_supports ("sse2"))
+    return nal_scan_sse2;
+#endif
+  return nal_scan_c;
+}
+
+/* The selection is idempotent, so racing initializations are harmless */
+static NalScanFunc nal_scan_func = NULL;
+
+static inline uint32_t
+nal_scan (const uint8_t * data, uint32_t size, uint32_t offset, uint8_t code,
+    uint32_t * positions, uint32_t max_positions)
+{
+  NalScanFunc func = nal_scan_func;
+
+  if (G_UNLIKELY (!func)) {
+    func = nal_scanner_select ();
+    nal_scan_func = func;
+  }
+  if (!data || !positions || !max_positions)
+    return 0;
+  return func (data, size, offset, code, positions, max_positions, 0);
+}
+
+uint32_t
+nal_scanner_scan (const uint8_t * data, uint32_t size, uint32_t offset,
+    uint32_t * positions, uint32_t max_positions)
+{
+  return nal_scan (data, size, offset, 0x01, positions, max_positions);
+}
+
+int32_t
+nal_scanner_find_start_code (const uint8_t * data, uint32_t size)
+{
+  uint32_t pos;
+
+  if (!nal_scanner_scan (data, size, 0, &pos, 1))
+    return -1;
+  return pos;
+}
+
+int32_t
+nal_scanner_find_emulation_prevention (const uint8_t * data, uint32_t size,
+    uint32_t offset)
+{
+  uint32_t pos;
+
+  if (!nal_scan (data, size, offset, 0x03, &pos, 1))
+    return -1;
+  return pos + 2;
+}
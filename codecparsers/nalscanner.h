@@ -0,0 +1,77 @@
+/*
+ *  nalscanner.h - start code scanner for byte stream format (Annex B)
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef NAL_SCANNER_H
+#define NAL_SCANNER_H
+
+#include "gst/gst.h"
+
+G_BEGIN_DECLS
+
+/**
+ * nal_scanner_scan:
+ * @data: the data to scan
+ * @size: the size of @data in bytes
+ * @offset: the offset from which to start scanning
+ * @positions: (out): where to store the start code offsets found
+ * @max_positions: capacity of @positions
+ *
+ * Scans @data for 0x000001 start code prefixes in a single pass. The
+ * offset (relative to @data) of every prefix found is stored in
+ * @positions, in ascending order, until @max_positions is reached.
+ * If the return value equals @max_positions, the caller may resume
+ * scanning at the last position + 3.
+ *
+ * A SSE2 or AVX2 kernel is used when the CPU supports it.
+ *
+ * Returns: the number of start codes stored in @positions
+ */
+uint32_t nal_scanner_scan (const uint8_t * data, uint32_t size,
+    uint32_t offset, uint32_t * positions, uint32_t max_positions);
+
+/**
+ * nal_scanner_find_start_code:
+ * @data: the data to scan
+ * @size: the size of @data in bytes
+ *
+ * Returns: offset of the first 0x000001 start code prefix in @data,
+ * or -1 if none was found
+ */
+int32_t nal_scanner_find_start_code (const uint8_t * data, uint32_t size);
+
+/**
+ * nal_scanner_find_emulation_prevention:
+ * @data: the NAL unit payload to scan
+ * @size: the size of @data in bytes
+ * @offset: the offset from which to start scanning
+ *
+ * Looks for the next 0x000003 sequence whose first byte is at or after
+ * @offset.
+ *
+ * Returns: offset of its emulation_prevention_three_byte, or -1 if
+ * none was found
+ */
+int32_t nal_scanner_find_emulation_prevention (const uint8_t * data,
+    uint32_t size, uint32_t offset);
+
+G_END_DECLS
+
+#endif /* NAL_SCANNER_H */
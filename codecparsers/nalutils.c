@@ -63,6 +63,10 @@ ceil_log2 (uint32_t v)
 
 /****** Nal parser ******/
 
+/* Emulation prevention bytes are searched in windows of this size, so
+ * parsing a header does not scan the whole slice data behind it */
+#define NAL_READER_EPB_WINDOW 64
+
 void
 nal_reader_init (NalReader * nr, const uint8_t * data, uint32_t size)
 {
@@ -72,44 +76,101 @@ nal_reader_init (NalReader * nr, const uint8_t * data, uint32_t size)
 
   nr->byte = 0;
   nr->bits_in_cache = 0;
-  /* fill with something other than 0 to detect emulation prevention bytes */
-  nr->first_byte = 0xff;
-  nr->cache = 0xff;
+  nr->epb_end = 0;
+  nr->epb_at_end = FALSE;
+  nr->cache = 0;
 }
 
-inline bool
-nal_reader_read (NalReader * nr, uint32_t nbits)
+/* Finds the next emulation prevention byte at or after nr->byte, looking
+ * at most NAL_READER_EPB_WINDOW bytes ahead. A 0x000003 sequence may begin
+ * up to two bytes before nr->byte; it can not overlap a previous emulation
+ * prevention byte since that one is not 0x00 */
+static void
+nal_reader_scan_epb (NalReader * nr)
 {
-  if (G_UNLIKELY (nr->byte * 8 + (nbits - nr->bits_in_cache) > nr->size * 8)) {
-    DEBUG ("Can not read %u bits, bits in cache %u, Byte * 8 %u, size in "
-        "bits %u", nbits, nr->bits_in_cache, nr->byte * 8, nr->size * 8);
-    return FALSE;
+  uint32_t from = nr->byte >= 2 ? nr->byte - 2 : 0;
+  uint32_t limit = MIN (nr->size - nr->byte, NAL_READER_EPB_WINDOW);
+  int32_t pos;
+
+  limit += nr->byte;
+  pos = nal_scanner_find_emulation_prevention (nr->data, limit, from);
+  if (pos >= 0) {
+    nr->epb_end = pos;
+    nr->epb_at_end = TRUE;
+  } else {
+    nr->epb_end = limit;
+    nr->epb_at_end = FALSE;
   }
+}
 
-  while (nr->bits_in_cache < nbits) {
-    uint8_t byte;
-    bool check_three_byte;
-
-    check_three_byte = TRUE;
-  next_byte:
-    if (G_UNLIKELY (nr->byte >= nr->size))
-      return FALSE;
-
-    byte = nr->data[nr->byte++];
-
-    /* check if the byte is a emulation_prevention_three_byte */
-    if (check_three_byte && byte == 0x03 && nr->first_byte == 0x00 &&
-        ((nr->cache & 0xff) == 0)) {
-      /* next byte goes unconditionally to the cache, even if it's 0x03 */
-      check_three_byte = FALSE;
+/* Loads whole bytes into the cache until it holds more than 56 bits or
+ * the data is exhausted. Bits after bits_in_cache are kept zero */
+static inline void
+nal_reader_refill (NalReader * nr)
+{
+  while (nr->bits_in_cache <= 56) {
+    if (G_LIKELY (nr->byte + 8 <= nr->epb_end)) {
+      uint32_t n = (64 - nr->bits_in_cache) >> 3;
+      uint64_t v = GST_READ_UINT64_BE (nr->data + nr->byte);
+
+      nr->cache |= (v >> nr->bits_in_cache) &
+          (~(uint64_t) 0 << (64 - nr->bits_in_cache - 8 * n));
+      nr->byte += n;
+      nr->bits_in_cache += 8 * n;
+      return;
+    }
+    if (nr->byte < nr->epb_end) {
+      nr->cache |= (uint64_t) nr->data[nr->byte++] << (56 - nr->bits_in_cache);
+      nr->bits_in_cache += 8;
+      continue;
+    }
+    if (nr->byte >= nr->size)
+      return;
+    if (nr->epb_at_end) {
+      nr->epb_rbsp[nr->n_epb % NAL_READER_EPB_HISTORY] = nr->byte - nr->n_epb;
+      nr->byte++;
       nr->n_epb++;
-      goto next_byte;
     }
-    nr->cache = (nr->cache << 8) | nr->first_byte;
-    nr->first_byte = byte;
-    nr->bits_in_cache += 8;
+    nal_reader_scan_epb (nr);
+  }
+}
+
+static inline void
+nal_reader_consume (NalReader * nr, uint32_t nbits)
+{
+  /* two steps, nbits may be 64 */
+  if (nbits) {
+    nr->cache = (nr->cache << (nbits - 1)) << 1;
+    nr->bits_in_cache -= nbits;
   }
+}
+
+/* Number of emulation prevention bytes in front of the first rbsp_bytes
+ * bytes of the RBSP. rbsp_bytes is at most 8 bytes behind the loaded ones,
+ * so only the last loaded emulation prevention bytes can be after it */
+static inline uint32_t
+nal_reader_count_epb (const NalReader * nr, uint32_t rbsp_bytes)
+{
+  uint32_t count = nr->n_epb;
+
+  while (count && nr->epb_rbsp[(count - 1) % NAL_READER_EPB_HISTORY] >= rbsp_bytes)
+    count--;
+  return count;
+}
 
+/* Makes sure at least nbits (up to 57) are in the cache */
+inline bool
+nal_reader_read (NalReader * nr, uint32_t nbits)
+{
+  if (G_LIKELY (nr->bits_in_cache >= nbits))
+    return TRUE;
+
+  nal_reader_refill (nr);
+  if (G_UNLIKELY (nr->bits_in_cache < nbits)) {
+    DEBUG ("Can not read %u bits, bits in cache %u, Byte * 8 %u, size in "
+        "bits %u", nbits, nr->bits_in_cache, nr->byte * 8, nr->size * 8);
+    return FALSE;
+  }
   return TRUE;
 }
 
@@ -120,10 +181,15 @@ nal_reader_skip (NalReader * nr, uint32_t nbits)
 {
   g_assert (nbits <= 8 * sizeof (nr->cache));
 
+  if (nbits > 32) {
+    if (G_UNLIKELY (!nal_reader_skip (nr, 32)))
+      return FALSE;
+    nbits -= 32;
+  }
   if (G_UNLIKELY (!nal_reader_read (nr, nbits)))
     return FALSE;
 
-  nr->bits_in_cache -= nbits;
+  nal_reader_consume (nr, nbits);
 
   return TRUE;
 }
@@ -146,43 +212,50 @@ nal_reader_skip_long (NalReader * nr, uint32_t nbits)
   return TRUE;
 }
 
+/* The position and emulation prevention byte count are reported as if
+ * bytes were loaded one at a time, only when needed: an emulation
+ * prevention byte right after the last read bit is not counted yet */
 inline uint32_t
 nal_reader_get_pos (const NalReader * nr)
 {
-  return nr->byte * 8 - nr->bits_in_cache;
+  uint32_t consumed = (nr->byte - nr->n_epb) * 8 - nr->bits_in_cache;
+
+  if (G_LIKELY (!nr->n_epb))
+    return consumed;
+  return consumed + 8 * nal_reader_count_epb (nr, (consumed + 7) / 8);
 }
 
 inline uint32_t
 nal_reader_get_remaining (const NalReader * nr)
 {
-  return (nr->size - nr->byte) * 8 + nr->bits_in_cache;
+  return nr->size * 8 - nal_reader_get_pos (nr);
 }
 
 inline uint32_t
 nal_reader_get_epb_count (const NalReader * nr)
 {
-  return nr->n_epb;
+  uint32_t consumed;
+
+  if (G_LIKELY (!nr->n_epb))
+    return 0;
+  consumed = (nr->byte - nr->n_epb) * 8 - nr->bits_in_cache;
+  return nal_reader_count_epb (nr, (consumed + 7) / 8);
 }
 
 #define NAL_READER_READ_BITS(bits) \
 bool \
 nal_reader_get_bits_uint##bits (NalReader *nr, uint##bits##_t *val, uint32_t nbits) \
 { \
-  uint32_t shift; \
-  \
   if (!nal_reader_read (nr, nbits)) \
     return FALSE; \
   \
-  /* bring the required bits down and truncate */ \
-  shift = nr->bits_in_cache - nbits; \
-  *val = nr->first_byte >> shift; \
-  \
-  *val |= nr->cache << (8 - shift); \
-  /* mask out required bits */ \
-  if (nbits < bits) \
-    *val &= ((uint##bits##_t)1 << nbits) - 1; \
-  \
-  nr->bits_in_cache = shift; \
+  if (G_UNLIKELY (!nbits)) { \
+    *val = 0; \
+    return TRUE; \
+  } \
+  /* the required bits are at the top of the cache */ \
+  *val = nr->cache >> (64 - nbits); \
+  nal_reader_consume (nr, nbits); \
   \
   return TRUE; \
 } \
@@ -206,29 +279,29 @@ NAL_READER_PEEK_BITS (8);
 bool
 nal_reader_get_ue (NalReader * nr, uint32_t * val)
 {
-  uint32_t i = 0;
-  uint8_t bit;
-  uint32_t value;
+  uint32_t i, value;
 
-  if (G_UNLIKELY (!nal_reader_get_bits_uint8 (nr, &bit, 1))) {
+  if (nr->bits_in_cache <= 32)
+    nal_reader_refill (nr);
 
+  /* count the leading zeros, bits after bits_in_cache are zero */
+  i = nr->cache ? __builtin_clzll (nr->cache) : 64;
+  if (G_UNLIKELY (i >= nr->bits_in_cache || i > 32))
     return FALSE;
-  }
 
-  while (bit == 0) {
-    i++;
-    if G_UNLIKELY
-      ((!nal_reader_get_bits_uint8 (nr, &bit, 1)))
-          return FALSE;
+  if (G_LIKELY (2 * i + 1 <= nr->bits_in_cache)) {
+    /* the whole code word is in the cache, it is 2^i + suffix */
+    value = nr->cache >> (63 - 2 * i);
+    nal_reader_consume (nr, 2 * i + 1);
+    *val = value - 1;
+    return TRUE;
   }
 
-  if (G_UNLIKELY (i > 32))
-    return FALSE;
-
+  nal_reader_consume (nr, i + 1);
   if (G_UNLIKELY (!nal_reader_get_bits_uint32 (nr, &value, i)))
     return FALSE;
 
-  *val = (1 << i) - 1 + value;
+  *val = (uint32_t) (((uint64_t) 1 << i) - 1 + value);
 
   return TRUE;
 }
@@ -252,7 +325,8 @@ nal_reader_get_se (NalReader * nr, int32_t * val)
 bool
 nal_reader_is_byte_aligned (NalReader * nr)
 {
-  if (nr->bits_in_cache != 0)
+  /* only whole bytes are loaded into the cache */
+  if (nr->bits_in_cache % 8)
     return FALSE;
   return TRUE;
 }
@@ -303,10 +377,8 @@ nal_reader_has_more_data (NalReader * nr)
 inline int32_t
 scan_for_start_codes (const uint8_t * data, uint32_t size)
 {
-  ByteReader br;
-  byte_reader_init (&br, data, size);
-
   /* NALU not empty, so we can at least expect 1 (even 2) bytes following sc */
-  return byte_reader_masked_scan_uint32 (&br, 0xffffff00, 0x00000100,
-      0, size);
+  if (size < 4)
+    return -1;
+  return nal_scanner_find_start_code (data, size - 1);
 }
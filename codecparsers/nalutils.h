@@ -37,20 +37,27 @@
 
 #include "bytereader.h"
 #include "bitreader.h"
+#include "nalscanner.h"
 #include <string.h>
 
 uint32_t ceil_log2 (uint32_t v);
 
+/* An emulation prevention byte follows two zero bytes, so at most 5 of
+ * them are loaded with the 8 bytes in the cache */
+#define NAL_READER_EPB_HISTORY 8
+
 typedef struct
 {
   const uint8_t *data;
   uint32_t size;
 
-  uint32_t n_epb;                  /* Number of emulation prevention bytes */
-  uint32_t byte;                   /* Byte position */
-  uint32_t bits_in_cache;          /* bitpos in the cache of next bit */
-  uint8_t first_byte;
-  uint64_t cache;                /* cached bytes */
+  uint32_t n_epb;                  /* Number of emulation prevention bytes loaded */
+  uint32_t epb_rbsp[NAL_READER_EPB_HISTORY]; /* RBSP bytes in front of the last loaded ones */
+  uint32_t byte;                   /* Byte position of the next byte to load */
+  uint32_t bits_in_cache;          /* Number of unread bits in the cache */
+  uint32_t epb_end;                /* Bytes before this are not emulation prevention bytes */
+  bool epb_at_end;                 /* The byte at epb_end is an emulation prevention byte */
+  uint64_t cache;                  /* Unread bits, msb first */
 } NalReader;
 
 void nal_reader_init (NalReader * nr, const uint8_t * data, uint32_t size);
@@ -0,0 +1,369 @@
+/*
+ *  nalutils_unittest.c - differential test of the NalReader against a byte at a time reader
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/unittest.h"
+#include "nalutils.h"
+
+/* The reader NalReader replaced: it loads one byte at a time and drops an
+ * emulation prevention byte when it sees it. Everything the parsers read,
+ * and the position and epb count they see, must be the same with both */
+typedef struct
+{
+  const uint8_t *data;
+  uint32_t size;
+  uint32_t n_epb;
+  uint32_t byte;
+  uint32_t bits_in_cache;
+  uint8_t first_byte;
+  uint64_t cache;
+} RefNalReader;
+
+static void
+ref_init (RefNalReader * nr, const uint8_t * data, uint32_t size)
+{
+  memset (nr, 0, sizeof (*nr));
+  nr->data = data;
+  nr->size = size;
+  nr->first_byte = 0xff;
+  nr->cache = 0xff;
+}
+
+static bool
+ref_read (RefNalReader * nr, uint32_t nbits)
+{
+  if (nr->byte * 8 + (nbits - nr->bits_in_cache) > nr->size * 8)
+    return FALSE;
+
+  while (nr->bits_in_cache < nbits) {
+    uint8_t byte;
+    bool check_three_byte = TRUE;
+
+  next_byte:
+    if (nr->byte >= nr->size)
+      return FALSE;
+    byte = nr->data[nr->byte++];
+    if (check_three_byte && byte == 0x03 && nr->first_byte == 0x00
+        && (nr->cache & 0xff) == 0) {
+      check_three_byte = FALSE;
+      nr->n_epb++;
+      goto next_byte;
+    }
+    nr->cache = (nr->cache << 8) | nr->first_byte;
+    nr->first_byte = byte;
+    nr->bits_in_cache += 8;
+  }
+  return TRUE;
+}
+
+static bool
+ref_skip (RefNalReader * nr, uint32_t nbits)
+{
+  if (!ref_read (nr, nbits))
+    return FALSE;
+  nr->bits_in_cache -= nbits;
+  return TRUE;
+}
+
+static bool
+ref_skip_long (RefNalReader * nr, uint32_t nbits)
+{
+  const uint32_t skip_size = 4 * sizeof (nr->cache);
+  uint32_t remaining = nbits;
+
+  nbits %= skip_size;
+  while (remaining > 0) {
+    if (!ref_skip (nr, nbits))
+      return FALSE;
+    remaining -= nbits;
+    nbits = skip_size;
+  }
+  return TRUE;
+}
+
+static uint32_t
+ref_get_pos (const RefNalReader * nr)
+{
+  return nr->byte * 8 - nr->bits_in_cache;
+}
+
+static uint32_t
+ref_get_remaining (const RefNalReader * nr)
+{
+  return (nr->size - nr->byte) * 8 + nr->bits_in_cache;
+}
+
+static bool
+ref_get_bits (RefNalReader * nr, uint32_t * val, uint32_t nbits)
+{
+  uint32_t shift;
+
+  if (!ref_read (nr, nbits))
+    return FALSE;
+  shift = nr->bits_in_cache - nbits;
+  *val = nr->first_byte >> shift;
+  *val |= nr->cache << (8 - shift);
+  if (nbits < 32)
+    *val &= ((uint32_t) 1 << nbits) - 1;
+  nr->bits_in_cache = shift;
+  return TRUE;
+}
+
+static bool
+ref_get_ue (RefNalReader * nr, uint32_t * val)
+{
+  uint32_t i = 0, bit, value;
+
+  if (!ref_get_bits (nr, &bit, 1))
+    return FALSE;
+  while (bit == 0) {
+    i++;
+    if (!ref_get_bits (nr, &bit, 1))
+      return FALSE;
+  }
+  if (i > 31 || !ref_get_bits (nr, &value, i))
+    return FALSE;
+  *val = (1 << i) - 1 + value;
+  return TRUE;
+}
+
+static bool
+ref_has_more_data (const RefNalReader * reader)
+{
+  RefNalReader tmp = *reader;
+  uint32_t remaining, nbits, bits;
+
+  remaining = ref_get_remaining (&tmp);
+  if (remaining == 0)
+    return FALSE;
+  if (!ref_get_bits (&tmp, &bits, 1))
+    return FALSE;
+  if (!bits)
+    return TRUE;
+  nbits = --remaining % 8;
+  while (remaining > 0) {
+    if (!ref_get_bits (&tmp, &bits, nbits))
+      return FALSE;
+    if (bits != 0)
+      return TRUE;
+    remaining -= nbits;
+    nbits = 8;
+  }
+  return FALSE;
+}
+
+static uint32_t seed = 1;
+
+/* deterministic, so a failure can be reproduced */
+static uint32_t
+random_number (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+/* mostly zeros and 0x03, so there are many emulation prevention bytes */
+static void
+random_data (uint8_t * data, uint32_t size)
+{
+  uint32_t i, r;
+
+  for (i = 0; i < size; i++) {
+    r = random_number () % 10;
+    data[i] = r < 4 ? 0 : r < 6 ? 3 : r < 7 ? 1 : random_number () & 0xff;
+  }
+}
+
+/* 00 00 03 00 03: the reference takes the second 0x03 for an emulation
+ * prevention byte too, since it looks at the RBSP bytes before it. That is
+ * a bug of the reference, 7.4.1 looks at the NAL unit bytes */
+static bool
+has_reference_bug (const uint8_t * data, uint32_t size)
+{
+  uint32_t i;
+
+  for (i = 0; i + 4 < size; i++) {
+    if (!data[i] && !data[i + 1] && data[i + 2] == 3 && !data[i + 3]
+        && data[i + 4] == 3)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static bool
+same_state (const NalReader * nr, const RefNalReader * ref)
+{
+  return nal_reader_get_pos (nr) == ref_get_pos (ref)
+      && nal_reader_get_remaining (nr) == ref_get_remaining (ref)
+      && nal_reader_get_epb_count (nr) == ref->n_epb
+      && nal_reader_is_byte_aligned ((NalReader *) nr) == !(ref->bits_in_cache % 8);
+}
+
+/* one random operation on both readers, FALSE when they differ */
+static bool
+same_operation (NalReader * nr, RefNalReader * ref, bool * stop)
+{
+  uint32_t nbits, value = 0, ref_value = 0, pos;
+  int32_t se;
+  uint8_t value8 = 0;
+  bool ret, ref_ret, is_se;
+
+  switch (random_number () % 8) {
+    case 0:
+      nbits = random_number () % 33;
+      ret = nal_reader_get_bits_uint32 (nr, &value, nbits);
+      ref_ret = ref_get_bits (ref, &ref_value, nbits);
+      break;
+    case 1:
+      nbits = random_number () % 9;
+      ret = nal_reader_get_bits_uint8 (nr, &value8, nbits);
+      value = value8;
+      ref_ret = ref_get_bits (ref, &ref_value, nbits);
+      break;
+    case 2:
+    case 3:
+      pos = ref_get_pos (ref);
+      is_se = random_number () % 2;
+      if (is_se) {
+        ret = nal_reader_get_se (nr, &se);
+        value = se;
+      } else {
+        ret = nal_reader_get_ue (nr, &value);
+      }
+      ref_ret = ref_get_ue (ref, &ref_value);
+      if (is_se)
+        ref_value = (ref_value % 2) ? ref_value / 2 + 1 : -(int32_t) (ref_value / 2);
+      /* codes of 32 and more leading zeros are not valid, the readers
+       * give up at different points */
+      if (ref_get_pos (ref) - pos >= 63 || !ref_ret)
+        *stop = TRUE;
+      if (*stop)
+        return TRUE;
+      break;
+    case 4:
+      nbits = random_number () % 45;
+      ret = nal_reader_skip (nr, nbits);
+      ref_ret = ref_skip (ref, nbits);
+      break;
+    case 5:
+      nbits = random_number () % 300;
+      ret = nal_reader_skip_long (nr, nbits);
+      ref_ret = ref_skip_long (ref, nbits);
+      break;
+    case 6:
+      {
+        RefNalReader tmp = *ref;
+        nbits = random_number () % 9;
+        ret = nal_reader_peek_bits_uint8 (nr, &value8, nbits);
+        value = value8;
+        ref_ret = ref_get_bits (&tmp, &ref_value, nbits);
+      }
+      break;
+    default:
+      return nal_reader_has_more_data (nr) == ref_has_more_data (ref);
+  }
+  if (ret != ref_ret || (ret && value != ref_value))
+    return FALSE;
+  /* a failed read leaves the readers in different states */
+  if (!ret) {
+    *stop = TRUE;
+    return TRUE;
+  }
+  return same_state (nr, ref);
+}
+
+static void
+testRandomStreams (void)
+{
+  uint8_t data[128];
+  uint32_t i, size, k;
+  NalReader nr;
+  RefNalReader ref;
+  bool stop;
+
+  for (i = 0; i < 50000; i++) {
+    size = random_number () % sizeof (data);
+    random_data (data, size);
+    if (has_reference_bug (data, size))
+      continue;
+    nal_reader_init (&nr, data, size);
+    ref_init (&ref, data, size);
+    stop = FALSE;
+    for (k = 0; k < 60 && !stop; k++) {
+      if (!same_operation (&nr, &ref, &stop)) {
+        EXPECT_TRUE (!"readers differ");
+        fprintf (stderr, "stream %u, operation %u\n", i, k);
+        return;
+      }
+    }
+  }
+}
+
+/* a run of emulation prevention bytes, more than NAL_READER_EPB_HISTORY
+ * of them are loaded while the cache is refilled */
+static void
+testEpbRun (void)
+{
+  uint8_t data[64];
+  uint32_t i, value, ref_value;
+  NalReader nr;
+  RefNalReader ref;
+
+  for (i = 0; i < sizeof (data); i++)
+    data[i] = (i % 3 == 2) ? 0x03 : 0x00;
+  data[sizeof (data) - 1] = 0x80;
+
+  nal_reader_init (&nr, data, sizeof (data));
+  ref_init (&ref, data, sizeof (data));
+  while (ref_get_remaining (&ref) >= 5) {
+    EXPECT_TRUE (nal_reader_get_bits_uint32 (&nr, &value, 5));
+    EXPECT_TRUE (ref_get_bits (&ref, &ref_value, 5));
+    EXPECT_EQ (ref_value, value);
+    EXPECT_TRUE (same_state (&nr, &ref));
+  }
+  EXPECT_EQ (21u, nal_reader_get_epb_count (&nr));
+}
+
+static void
+testEpbPosition (void)
+{
+  static const uint8_t data[] = { 0x00, 0x00, 0x03, 0x01, 0xff };
+  uint32_t value;
+  NalReader nr;
+
+  nal_reader_init (&nr, data, sizeof (data));
+  EXPECT_TRUE (nal_reader_get_bits_uint32 (&nr, &value, 16));
+  /* the emulation prevention byte right after the read bits is not counted yet */
+  EXPECT_EQ (16u, nal_reader_get_pos (&nr));
+  EXPECT_EQ (0u, nal_reader_get_epb_count (&nr));
+  EXPECT_TRUE (nal_reader_get_bits_uint32 (&nr, &value, 1));
+  EXPECT_EQ (25u, nal_reader_get_pos (&nr));
+  EXPECT_EQ (1u, nal_reader_get_epb_count (&nr));
+  EXPECT_EQ (15u, nal_reader_get_remaining (&nr));
+}
+
+int
+main (void)
+{
+  RUN_TEST (testRandomStreams);
+  RUN_TEST (testEpbRun);
+  RUN_TEST (testEpbPosition);
+  return UNITTEST_RESULT ();
+}
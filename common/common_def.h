@@ -34,6 +34,13 @@ Boston, MA 02110-1301 USA */
 #define CHAR_BIT    8
 #endif
 
+#ifndef DISALLOW_COPY_AND_ASSIGN
+#define DISALLOW_COPY_AND_ASSIGN(className) \
+      className(const className&); \
+      className & operator=(const className&); \
+
+#endif
+
 #ifndef N_ELEMENTS
 #define N_ELEMENTS(array) (sizeof(array)/sizeof(array[0]))
 #endif
@@ -22,8 +22,7 @@
 #ifndef condition_h
 #define condition_h
 
-//TODO: remove this when we put DISALLOW_COPY_AND_ASSIGN to common/
-#include "vaapi/vaapitypes.h"
+#include "common/common_def.h"
 
 #include "lock.h"
 
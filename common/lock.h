@@ -22,8 +22,7 @@
 #ifndef lock_h
 #define lock_h
 
-//TODO: remove this when we put DISALLOW_COPY_AND_ASSIGN to common/
-#include "vaapi/vaapitypes.h"
+#include "common/common_def.h"
 #include <pthread.h>
 
 namespace YamiMediaCodec{
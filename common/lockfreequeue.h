@@ -0,0 +1,127 @@
+/*
+ *  lockfreequeue.h - bounded lock-free queue of indices
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+#ifndef lockfreequeue_h
+#define lockfreequeue_h
+
+#include "common/common_def.h"
+#include <stdint.h>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+/**
+ * \class LockFreeQueue
+ * \brief bounded first-in-first-out queue of indices,
+ * any number of threads may push and pop concurrently without a lock.
+ * each cell carries a sequence number telling whether it is ready for the
+ * next push or the next pop, so push and pop only race on one position
+ * counter each.
+ */
+class LockFreeQueue
+{
+public:
+    explicit LockFreeQueue(uint32_t capacity)
+        : m_pushPos(0)
+        , m_popPos(0)
+    {
+        uint32_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_cells.resize(size);
+        for (uint32_t i = 0; i < size; i++)
+            m_cells[i].sequence = i;
+    }
+
+    /// return false if the queue is full.
+    /// it may briefly spin on a pop still reading the cell it needs.
+    bool push(uint32_t index)
+    {
+        Cell* cell;
+        uint32_t pos = __atomic_load_n(&m_pushPos, __ATOMIC_RELAXED);
+        while (1) {
+            cell = &m_cells[pos & m_mask];
+            uint32_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+            int32_t diff = (int32_t)(seq - pos);
+            if (!diff) {
+                if (__atomic_compare_exchange_n(&m_pushPos, &pos, pos + 1, true,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            } else if (diff < 0) {
+                //full, or the cell is still read by a pop which already claimed it
+                uint32_t last = pos;
+                pos = __atomic_load_n(&m_pushPos, __ATOMIC_ACQUIRE);
+                if (pos == last && (int32_t)(pos
+                        - __atomic_load_n(&m_popPos, __ATOMIC_ACQUIRE)) > (int32_t)m_mask)
+                    return false;
+            } else {
+                pos = __atomic_load_n(&m_pushPos, __ATOMIC_RELAXED);
+            }
+        }
+        cell->index = index;
+        __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /// return false if the queue is empty, or the only pushed index is not written yet
+    bool pop(uint32_t& index)
+    {
+        Cell* cell;
+        uint32_t pos = __atomic_load_n(&m_popPos, __ATOMIC_RELAXED);
+        while (1) {
+            cell = &m_cells[pos & m_mask];
+            uint32_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+            int32_t diff = (int32_t)(seq - (pos + 1));
+            if (!diff) {
+                if (__atomic_compare_exchange_n(&m_popPos, &pos, pos + 1, true,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = __atomic_load_n(&m_popPos, __ATOMIC_RELAXED);
+            }
+        }
+        index = cell->index;
+        __atomic_store_n(&cell->sequence, pos + m_mask + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    struct Cell {
+        uint32_t sequence;
+        uint32_t index;
+    };
+    std::vector<Cell> m_cells;
+    uint32_t m_mask;
+    //keep the two positions on their own cache lines
+    uint8_t m_pad0[64];
+    uint32_t m_pushPos;
+    uint8_t m_pad1[64];
+    uint32_t m_popPos;
+    uint8_t m_pad2[64];
+
+    DISALLOW_COPY_AND_ASSIGN(LockFreeQueue);
+};
+
+} //namespace YamiMediaCodec
+
+#endif //lockfreequeue_h
@@ -0,0 +1,196 @@
+/*
+ *  lockfreequeue_unittest.cpp - multithreaded stress test of the lock-free queue
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/lockfreequeue.h"
+#include "common/unittest.h"
+#include <pthread.h>
+#include <sched.h>
+#include <vector>
+
+using namespace YamiMediaCodec;
+
+#define THREADS 4
+#define INDICES_PER_THREAD 100000
+
+static void testSingleThread()
+{
+    LockFreeQueue queue(5);
+    uint32_t index;
+    EXPECT_TRUE(!queue.pop(index));
+    //the capacity is rounded up to a power of two
+    for (uint32_t i = 0; i < 8; i++)
+        EXPECT_TRUE(queue.push(i));
+    EXPECT_TRUE(!queue.push(8));
+    for (uint32_t i = 0; i < 8; i++) {
+        EXPECT_TRUE(queue.pop(index));
+        EXPECT_EQ(i, index);
+    }
+    EXPECT_TRUE(!queue.pop(index));
+    //positions wrap around the cells
+    for (uint32_t i = 0; i < 100; i++) {
+        EXPECT_TRUE(queue.push(i));
+        EXPECT_TRUE(queue.pop(index));
+        EXPECT_EQ(i, index);
+    }
+}
+
+struct ProducerConsumer {
+    LockFreeQueue* queue;
+    uint32_t thread;
+    //how often each index was popped, each consumer has its own
+    std::vector<uint32_t> popped;
+    uint32_t* producersDone;
+};
+
+static void* produce(void* arg)
+{
+    ProducerConsumer* p = static_cast<ProducerConsumer*>(arg);
+    for (uint32_t i = 0; i < INDICES_PER_THREAD; i++) {
+        uint32_t index = p->thread * INDICES_PER_THREAD + i;
+        while (!p->queue->push(index))
+            sched_yield();
+    }
+    __atomic_add_fetch(p->producersDone, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static void* consume(void* arg)
+{
+    ProducerConsumer* p = static_cast<ProducerConsumer*>(arg);
+    uint32_t index;
+    while (1) {
+        if (p->queue->pop(index)) {
+            p->popped[index]++;
+            continue;
+        }
+        //empty after all pushes are done, nothing comes any more
+        if (__atomic_load_n(p->producersDone, __ATOMIC_SEQ_CST) == THREADS) {
+            if (!p->queue->pop(index))
+                break;
+            p->popped[index]++;
+            continue;
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+// every pushed index is popped exactly once, through a small queue so it is full most of the time
+static void testProducersConsumers()
+{
+    LockFreeQueue queue(16);
+    uint32_t producersDone = 0;
+    ProducerConsumer producers[THREADS], consumers[THREADS];
+    pthread_t threads[2 * THREADS];
+
+    for (uint32_t i = 0; i < THREADS; i++) {
+        producers[i].queue = consumers[i].queue = &queue;
+        producers[i].thread = consumers[i].thread = i;
+        producers[i].producersDone = consumers[i].producersDone = &producersDone;
+        consumers[i].popped.resize(THREADS * INDICES_PER_THREAD);
+    }
+    for (uint32_t i = 0; i < THREADS; i++) {
+        EXPECT_EQ(0, pthread_create(&threads[i], NULL, consume, &consumers[i]));
+        EXPECT_EQ(0, pthread_create(&threads[THREADS + i], NULL, produce, &producers[i]));
+    }
+    for (uint32_t i = 0; i < 2 * THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    uint32_t missing = 0, duplicated = 0;
+    for (uint32_t index = 0; index < THREADS * INDICES_PER_THREAD; index++) {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < THREADS; i++)
+            count += consumers[i].popped[index];
+        missing += !count;
+        duplicated += count > 1;
+    }
+    EXPECT_EQ(0u, missing);
+    EXPECT_EQ(0u, duplicated);
+}
+
+#define POOL_SIZE 8
+#define ROUNDS 100000
+
+struct Pool {
+    LockFreeQueue* queue;
+    //1 while a thread holds the index
+    uint32_t held[POOL_SIZE];
+    uint32_t errors;
+};
+
+static void* cycle(void* arg)
+{
+    Pool* pool = static_cast<Pool*>(arg);
+    uint32_t index;
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        if (!pool->queue->pop(index)) {
+            sched_yield();
+            continue;
+        }
+        if (index >= POOL_SIZE || __atomic_exchange_n(&pool->held[index], 1, __ATOMIC_SEQ_CST)) {
+            __atomic_add_fetch(&pool->errors, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        __atomic_store_n(&pool->held[index], 0, __ATOMIC_SEQ_CST);
+        if (!pool->queue->push(index))
+            __atomic_add_fetch(&pool->errors, 1, __ATOMIC_SEQ_CST);
+    }
+    return NULL;
+}
+
+// the way the surface pools use it, a fixed set of indices goes round between the threads
+static void testPoolCycle()
+{
+    LockFreeQueue queue(POOL_SIZE);
+    Pool pool;
+    pool.queue = &queue;
+    pool.errors = 0;
+    for (uint32_t i = 0; i < POOL_SIZE; i++) {
+        pool.held[i] = 0;
+        EXPECT_TRUE(queue.push(i));
+    }
+
+    pthread_t threads[THREADS];
+    for (uint32_t i = 0; i < THREADS; i++)
+        EXPECT_EQ(0, pthread_create(&threads[i], NULL, cycle, &pool));
+    for (uint32_t i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    EXPECT_EQ(0u, pool.errors);
+
+    //all indices are back, each once
+    std::vector<uint32_t> count(POOL_SIZE);
+    uint32_t index;
+    while (queue.pop(index)) {
+        EXPECT_TRUE(index < POOL_SIZE);
+        if (index < POOL_SIZE)
+            count[index]++;
+    }
+    for (uint32_t i = 0; i < POOL_SIZE; i++)
+        EXPECT_EQ(1u, count[i]);
+}
+
+int main()
+{
+    RUN_TEST(testSingleThread);
+    RUN_TEST(testProducersConsumers);
+    RUN_TEST(testPoolCycle);
+    return UNITTEST_RESULT();
+}
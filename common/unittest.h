@@ -0,0 +1,61 @@
+/*
+ *  unittest.h - checks for the host side unit tests run by make check
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef unittest_h
+#define unittest_h
+
+#include <stdio.h>
+
+/*
+ * each *_unittest program is a main() calling its test functions, they need no GPU.
+ * unlike assert(), a failed check is reported and the test goes on, so one run shows all failures.
+ * main() returns UNITTEST_RESULT(), make check counts a non zero exit as a failed test.
+ * a test may time its code instead when run with --benchmark, make check never passes it.
+ */
+
+static int unittestFailures = 0;
+
+#define EXPECT_TRUE(cond)                                                       \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            unittestFailures++;                                                 \
+        }                                                                       \
+    } while (0)
+
+#define EXPECT_EQ(expected, actual)                                             \
+    do {                                                                        \
+        if (!((expected) == (actual))) {                                        \
+            fprintf(stderr, "%s:%d: check failed: %s == %s\n", __FILE__, __LINE__, #expected, #actual); \
+            unittestFailures++;                                                 \
+        }                                                                       \
+    } while (0)
+
+#define RUN_TEST(test)                                     \
+    do {                                                   \
+        int failures = unittestFailures;                   \
+        test();                                            \
+        fprintf(stderr, "%s %s\n", failures == unittestFailures ? "PASS" : "FAIL", #test); \
+    } while (0)
+
+#define UNITTEST_RESULT() (unittestFailures ? 1 : 0)
+
+#endif //unittest_h
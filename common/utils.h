@@ -41,6 +41,9 @@ bool getPlaneResolution(uint32_t fourcc, uint32_t pixelWidth, uint32_t pixelHeig
 
 bool fillFrameRawData(VideoFrameRawData* frame, uint32_t fourcc, uint32_t width, uint32_t height, uint8_t* data);
 
+/// return system clock in ms
+uint64_t getSystemTime();
+
 class CalcFps
 {
   public:
@@ -42,6 +42,11 @@
 
 #define ANDROID_DISPLAY_HANDLE 0x18C34078
 
+/* buffers queued for the parse thread, decode() returns DECODE_NO_SURFACE beyond it */
+#define PIPELINE_MAX_BUFFERS 4
+/* pictures and outputs queued for the submit thread, the parse thread waits beyond it */
+#define PIPELINE_MAX_JOBS 8
+
 namespace YamiMediaCodec{
 typedef VaapiDecoderBase::PicturePtr PicturePtr;
 
@@ -50,13 +55,28 @@ m_renderTarget(NULL),
 m_lastReference(NULL),
 m_forwardReference(NULL),
 m_VAStarted(false),
-m_currentPTS(INVALID_PTS), m_enableNativeBuffersFlag(false)
+m_VAProfile(VAProfileNone),
+m_currentPTS(INVALID_PTS),
+m_skipToKey(false),
+m_lastKeyTimeStamp(INVALID_PTS),
+m_enableNativeBuffersFlag(false),
+m_pipelined(false),
+m_pipelineRunning(false),
+m_pipelineCond(m_pipelineLock),
+m_pipelineQuit(false),
+m_parsing(false),
+m_submitting(false),
+m_pipelineStalled(false),
+m_pipelineGeneration(0),
+m_pipelineOutputs(0),
+m_pipelineStatus(DECODE_SUCCESS)
 {
     INFO("base: construct()");
     m_externalDisplay.handle = 0,
     m_externalDisplay.type = NATIVE_DISPLAY_AUTO,
     memset(&m_videoFormatInfo, 0, sizeof(VideoFormatInfo));
     memset(&m_configBuffer, 0, sizeof(m_configBuffer));
+    memset(&m_skipPolicy, 0, sizeof(m_skipPolicy));
 }
 
 VaapiDecoderBase::~VaapiDecoderBase()
@@ -104,6 +124,7 @@ Decode_Status VaapiDecoderBase::start(VideoConfigBuffer * buffer)
     }
     m_lowDelay = buffer->flag & WANT_LOW_DELAY;
     m_rawOutput = buffer->flag & WANT_RAW_OUTPUT;
+    m_pipelined = buffer->flag & WANT_PIPELINED_DECODE;
 
     status = setupVA(buffer->surfaceNumber, buffer->profile);
     if (status != DECODE_SUCCESS)
@@ -129,22 +150,36 @@ Decode_Status VaapiDecoderBase::reset(VideoConfigBuffer * buffer)
         return DECODE_INVALID_DATA;
     }
 
+    drainPipeline(true);
     flush();
 
-    status = terminateVA();
+    status = resetVA(buffer);
     if (status != DECODE_SUCCESS)
         return status;
 
-    status = start(buffer);
+    return DECODE_SUCCESS;
+}
+
+Decode_Status VaapiDecoderBase::resetVA(VideoConfigBuffer * buffer)
+{
+    Decode_Status status;
+
+    if (reuseVA(buffer)) {
+        INFO("base: reuse VA context for %d x %d", buffer->width, buffer->height);
+        return DECODE_SUCCESS;
+    }
+
+    status = terminateVA();
     if (status != DECODE_SUCCESS)
         return status;
 
-    return DECODE_SUCCESS;
+    return start(buffer);
 }
 
 void VaapiDecoderBase::stop(void)
 {
     INFO("base: stop()");
+    stopPipeline();
     terminateVA();
 
     m_currentPTS = INVALID_PTS;
@@ -162,6 +197,7 @@ void VaapiDecoderBase::flush(void)
 {
 
     INFO("base: flush()");
+    drainPipeline(true);
     if (m_surfacePool) {
         m_surfacePool->flush();
     }
@@ -170,6 +206,9 @@ void VaapiDecoderBase::flush(void)
     m_renderTarget = NULL;
     m_lastReference = NULL;
     m_forwardReference = NULL;
+
+    AutoLock lock(m_skipLock);
+    m_lastKeyTimeStamp = INVALID_PTS;
 }
 
 void VaapiDecoderBase::flushOutport(void)
@@ -196,9 +235,10 @@ private:
 SharedPtr<VideoFrame> VaapiDecoderBase::getOutput()
 {
     SharedPtr<VideoFrame> frame;
-    if (!m_surfacePool)
+    DecSurfacePoolPtr pool = surfacePool();
+    if (!pool)
         return frame;
-    VideoRenderBuffer *buffer = m_surfacePool->getOutput();
+    VideoRenderBuffer *buffer = pool->getOutput();
     if (buffer) {
         frame.reset(new VideoFrame, BufferRecycler(this, buffer));
         frame->surface = (intptr_t)buffer->surface;
@@ -213,12 +253,16 @@ SharedPtr<VideoFrame> VaapiDecoderBase::getOutput()
 
 const VideoRenderBuffer *VaapiDecoderBase::getOutput(bool draining)
 {
-    if (!m_surfacePool)
-        return NULL;
-    if (draining)
-        flushOutport();
-
-    VideoRenderBuffer *buffer = m_surfacePool->getOutput();
+    uint32_t outputs = pipelineOutputs();
+    DecSurfacePoolPtr pool = surfacePool();
+    VideoRenderBuffer *buffer = pool ? pool->getOutput() : NULL;
+    if (!buffer && draining) {
+        if (waitPipeline(outputs))
+            flushOutport();
+        pool = surfacePool();
+        if (pool)
+            buffer = pool->getOutput();
+    }
 
 #ifdef __ENABLE_DEBUG__
     if (buffer) {
@@ -282,16 +326,19 @@ const VideoFormatInfo *VaapiDecoderBase::getFormatInfo(void)
 
 Decode_Status VaapiDecoderBase::getOutput(VideoFrameRawData* frame, bool draining)
 {
-    if (!m_surfacePool)
-        return RENDER_NO_AVAILABLE_FRAME;
-
     if (!frame)
         return DECODE_INVALID_DATA;
 
-    if (draining)
-        flushOutport();
-
-    if (!m_surfacePool->getOutput(frame))
+    uint32_t outputs = pipelineOutputs();
+    DecSurfacePoolPtr pool = surfacePool();
+    bool got = pool && pool->getOutput(frame);
+    if (!got && draining) {
+        if (waitPipeline(outputs))
+            flushOutport();
+        pool = surfacePool();
+        got = pool && pool->getOutput(frame);
+    }
+    if (!got)
         return RENDER_NO_AVAILABLE_FRAME;
 
 #ifdef __ENABLE_DEBUG__
@@ -304,10 +351,11 @@ Decode_Status VaapiDecoderBase::getOutput(VideoFrameRawData* frame, bool drainin
 
 Decode_Status VaapiDecoderBase::populateOutputHandles(VideoFrameRawData *frames, uint32_t &frameCount)
 {
-    if (!m_surfacePool)
+    DecSurfacePoolPtr pool = surfacePool();
+    if (!pool)
         return RENDER_NO_AVAILABLE_FRAME;
 
-    if (!m_surfacePool->populateOutputHandles(frames, frameCount))
+    if (!pool->populateOutputHandles(frames, frameCount))
         return RENDER_NO_AVAILABLE_FRAME;
     return RENDER_SUCCESS;
 }
@@ -315,21 +363,23 @@ Decode_Status VaapiDecoderBase::populateOutputHandles(VideoFrameRawData *frames,
 void VaapiDecoderBase::renderDone(const VideoRenderBuffer * renderBuf)
 {
     INFO("base: renderDone()");
-    if (!m_surfacePool) {
+    DecSurfacePoolPtr pool = surfacePool();
+    if (!pool) {
         ERROR("surface pool is not initialized yet");
         return;
     }
-    m_surfacePool->recycle(renderBuf);
+    pool->recycle(renderBuf);
 }
 
 void VaapiDecoderBase::renderDone(VideoFrameRawData* frame)
 {
     INFO("base: renderDone()");
-    if (!m_surfacePool) {
+    DecSurfacePoolPtr pool = surfacePool();
+    if (!pool) {
         ERROR("surface pool is not initialized yet");
         return;
     }
-    m_surfacePool->recycle(frame);
+    pool->recycle(frame);
 }
 
 Decode_Status VaapiDecoderBase::updateReference(void)
@@ -394,10 +444,14 @@ Decode_Status
     }
 
     m_configBuffer.surfaceNumber = numSurface;
-    m_surfacePool = VaapiDecSurfacePool::create(m_display, &m_configBuffer);
+    DecSurfacePoolPtr pool = VaapiDecSurfacePool::create(m_display, &m_configBuffer);
     DEBUG("surface pool is created");
-    if (!m_surfacePool)
+    if (!pool)
         return DECODE_FAIL;
+    {
+        AutoLock lock(m_surfacePoolLock);
+        m_surfacePool = pool;
+    }
     std::vector<VASurfaceID> surfaces;
     m_surfacePool->getSurfaceIDs(surfaces);
     if (surfaces.empty())
@@ -424,18 +478,69 @@ Decode_Status
     }
 
     m_VAStarted = true;
+    m_VAProfile = profile;
     return DECODE_SUCCESS;
 }
 
+/* a stream of @profile can be decoded by a config of @allocated */
+static bool isCompatibleProfile(VAProfile allocated, VAProfile profile)
+{
+    if (allocated == profile)
+        return true;
+    switch (allocated) {
+    case VAProfileH264High:
+        return profile == VAProfileH264Main
+            || profile == VAProfileH264ConstrainedBaseline;
+    case VAProfileH264Main:
+        return profile == VAProfileH264ConstrainedBaseline;
+    default:
+        return false;
+    }
+}
+
+bool VaapiDecoderBase::reuseVA(VideoConfigBuffer * buffer)
+{
+    if (!m_VAStarted || !m_surfacePool)
+        return false;
+    if (m_enableNativeBuffersFlag || (buffer->flag & USE_NATIVE_GRAPHIC_BUFFER))
+        return false;
+    if (!isCompatibleProfile(m_VAProfile, buffer->profile))
+        return false;
+    if (!m_surfacePool->reuse(buffer))
+        return false;
+
+    //what start() keeps of @buffer
+    m_configBuffer = *buffer;
+    m_configBuffer.data = NULL;
+    m_configBuffer.size = 0;
+    m_videoFormatInfo.width = buffer->width;
+    m_videoFormatInfo.height = buffer->height;
+    m_videoFormatInfo.surfaceWidth = m_surfacePool->surfaceWidth();
+    m_videoFormatInfo.surfaceHeight = m_surfacePool->surfaceHeight();
+    m_lowDelay = buffer->flag & WANT_LOW_DELAY;
+    m_rawOutput = buffer->flag & WANT_RAW_OUTPUT;
+    return true;
+}
+
 Decode_Status VaapiDecoderBase::terminateVA(void)
 {
     INFO("base: terminate VA");
-    m_surfacePool.reset();
+    //the submit thread may still render to the context
+    if (isParseThread()) {
+        AutoLock lock(m_pipelineLock);
+        while (!m_pipelineJobs.empty() || m_submitting)
+            m_pipelineCond.wait();
+    }
+    {
+        AutoLock lock(m_surfacePoolLock);
+        m_surfacePool.reset();
+    }
     DEBUG("surface pool is reset");
     m_context.reset();
     m_display.reset();
 
     m_VAStarted = false;
+    m_VAProfile = VAProfileNone;
     return DECODE_SUCCESS;
 }
 
@@ -466,10 +571,11 @@ Decode_Status VaapiDecoderBase::flagNativeBuffer(void *pBuffer)
 
 void VaapiDecoderBase::releaseLock(bool lockable)
 {
-    if (!m_surfacePool)
+    DecSurfacePoolPtr pool = surfacePool();
+    if (!pool)
         return;
 
-    m_surfacePool->setWaitable(lockable);
+    pool->setWaitable(lockable);
 }
 
 SurfacePtr VaapiDecoderBase::createSurface()
@@ -483,11 +589,341 @@ SurfacePtr VaapiDecoderBase::createSurface()
 
 Decode_Status VaapiDecoderBase::outputPicture(const PicturePtr& picture)
 {
+    //after the picture is rendered
+    if (isParseThread()) {
+        queueJob(picture, true);
+        return DECODE_SUCCESS;
+    }
     //TODO: reorder poc
     return m_surfacePool->output(picture->getSurface(),
         picture->m_timeStamp)?DECODE_SUCCESS:DECODE_FAIL;
 }
 
+Decode_Status VaapiDecoderBase::submitPicture(const PicturePtr& picture)
+{
+    if (isParseThread()) {
+        queueJob(picture, false);
+        return DECODE_SUCCESS;
+    }
+    return picture->decode() ? DECODE_SUCCESS : DECODE_FAIL;
+}
+
+static bool isKeyOnly(uint32_t mode)
+{
+    return mode == SKIP_NON_KEY || mode == SKIP_KEY_INTERVAL;
+}
+
+void VaapiDecoderBase::setSkipPolicy(const VideoSkipPolicy* policy)
+{
+    if (!policy)
+        return;
+    AutoLock lock(m_skipLock);
+    //the references of the next pictures were skipped
+    if (isKeyOnly(m_skipPolicy.mode) && !isKeyOnly(policy->mode))
+        m_skipToKey = true;
+    if (policy->mode != m_skipPolicy.mode || policy->interval != m_skipPolicy.interval)
+        m_lastKeyTimeStamp = INVALID_PTS;
+    m_skipPolicy = *policy;
+}
+
+bool VaapiDecoderBase::skipPicture(bool isKey, bool isReference, int64_t timeStamp)
+{
+    AutoLock lock(m_skipLock);
+    if (isKey)
+        m_skipToKey = false;
+    switch (m_skipPolicy.mode) {
+    case SKIP_NON_REFERENCE:
+        return m_skipToKey || !isReference;
+    case SKIP_NON_KEY:
+        return !isKey;
+    case SKIP_KEY_INTERVAL:
+        if (!isKey)
+            return true;
+        if (m_lastKeyTimeStamp != (int64_t)INVALID_PTS
+            && timeStamp >= m_lastKeyTimeStamp
+            && timeStamp - m_lastKeyTimeStamp < m_skipPolicy.interval)
+            return true;
+        m_lastKeyTimeStamp = timeStamp;
+        return false;
+    default:
+        return m_skipToKey;
+    }
+}
+
+bool VaapiDecoderBase::decodesKeyOnly()
+{
+    AutoLock lock(m_skipLock);
+    return isKeyOnly(m_skipPolicy.mode) || m_skipToKey;
+}
+
+DecSurfacePoolPtr VaapiDecoderBase::surfacePool()
+{
+    AutoLock lock(m_surfacePoolLock);
+    return m_surfacePool;
+}
+
+Decode_Status VaapiDecoderBase::decode(VideoDecodeBuffer *buffer)
+{
+    if (!buffer)
+        return DECODE_INVALID_DATA;
+    if (!m_pipelined)
+        return doDecode(buffer);
+    if (!m_pipelineRunning && !startPipeline())
+        return DECODE_FAIL;
+
+    //the caller sends this buffer again after it has seen the new format
+    if (takeFormatChange())
+        return DECODE_FORMAT_CHANGE;
+
+    //an unknown extension points to the caller's memory, decode it here once the parse thread is done
+    bool hasNalTable = (buffer->flag & HAS_NAL_UNIT_TABLE) && buffer->ext
+        && buffer->ext->extType == NAL_UNIT_TABLE_TYPE;
+    if (buffer->ext && !hasNalTable) {
+        drainPipeline(false);
+        if (takeFormatChange())
+            return DECODE_FORMAT_CHANGE;
+        Decode_Status status = doDecode(buffer);
+        AutoLock lock(m_pipelineLock);
+        if (status == DECODE_SUCCESS) {
+            status = m_pipelineStatus;
+            m_pipelineStatus = DECODE_SUCCESS;
+        }
+        return status;
+    }
+
+    AutoLock lock(m_pipelineLock);
+    if (m_pipelineInput.size() >= PIPELINE_MAX_BUFFERS)
+        return DECODE_NO_SURFACE;
+    PipelineInputPtr input(new PipelineInput);
+    input->buffer = *buffer;
+    if (buffer->data && buffer->size > 0) {
+        input->data.assign(buffer->data, buffer->data + buffer->size);
+        input->buffer.data = &input->data[0];
+    } else {
+        //end of stream
+        input->buffer.data = NULL;
+        input->buffer.size = 0;
+    }
+    if (hasNalTable) {
+        const VideoExtensionBuffer* ext = buffer->ext;
+        if (ext->extData && ext->extSize > 0)
+            input->extData.assign(ext->extData, ext->extData + ext->extSize);
+        input->ext = *ext;
+        input->ext.extData = input->extData.empty() ? NULL : &input->extData[0];
+        input->ext.extSize = input->extData.size();
+        input->buffer.ext = &input->ext;
+    }
+    m_pipelineInput.push_back(input);
+    m_pipelineCond.broadcast();
+
+    //an error of an earlier buffer
+    Decode_Status status = m_pipelineStatus;
+    m_pipelineStatus = DECODE_SUCCESS;
+    return status;
+}
+
+// the parse thread waits on the buffer which changed the format until the caller has seen it
+bool VaapiDecoderBase::takeFormatChange()
+{
+    AutoLock lock(m_pipelineLock);
+    if (m_pipelineStatus != DECODE_FORMAT_CHANGE)
+        return false;
+    m_pipelineStatus = DECODE_SUCCESS;
+    m_pipelineStalled = false;
+    m_pipelineCond.broadcast();
+    return true;
+}
+
+bool VaapiDecoderBase::startPipeline()
+{
+    //no buffer is queued before we return, so the threads see m_parseThread and m_pipelineRunning set
+    m_pipelineQuit = false;
+    m_pipelineStatus = DECODE_SUCCESS;
+    if (pthread_create(&m_parseThread, NULL, parseThread, this)) {
+        ERROR("failed to create parse thread");
+        return false;
+    }
+    if (pthread_create(&m_submitThread, NULL, submitThread, this)) {
+        ERROR("failed to create submit thread");
+        {
+            AutoLock lock(m_pipelineLock);
+            m_pipelineQuit = true;
+            m_pipelineCond.broadcast();
+        }
+        pthread_join(m_parseThread, NULL);
+        return false;
+    }
+    m_pipelineRunning = true;
+    return true;
+}
+
+void VaapiDecoderBase::stopPipeline()
+{
+    if (!m_pipelineRunning)
+        return;
+    drainPipeline(true);
+    {
+        AutoLock lock(m_pipelineLock);
+        m_pipelineQuit = true;
+        m_pipelineCond.broadcast();
+    }
+    pthread_join(m_parseThread, NULL);
+    pthread_join(m_submitThread, NULL);
+    m_pipelineRunning = false;
+    m_pipelineStalled = false;
+    m_pipelineStatus = DECODE_SUCCESS;
+}
+
+bool VaapiDecoderBase::isParseThread() const
+{
+    return m_pipelineRunning && pthread_equal(pthread_self(), m_parseThread);
+}
+
+bool VaapiDecoderBase::isPipelineIdle() const
+{
+    return (m_pipelineInput.empty() || m_pipelineStalled) && !m_parsing
+        && m_pipelineJobs.empty() && !m_submitting;
+}
+
+void VaapiDecoderBase::drainPipeline(bool discard)
+{
+    if (!m_pipelineRunning || isParseThread())
+        return;
+    DecSurfacePoolPtr pool;
+    if (discard) {
+        AutoLock lock(m_pipelineLock);
+        m_pipelineInput.clear();
+        m_pipelineStalled = false;
+        m_pipelineGeneration++;
+        //the parse thread may wait for a surface the caller holds
+        pool = surfacePool();
+        if (pool)
+            pool->setWaitable(false);
+    }
+    {
+        AutoLock lock(m_pipelineLock);
+        while (!isPipelineIdle())
+            m_pipelineCond.wait();
+        //errors of the dropped buffers
+        if (discard && m_pipelineStatus != DECODE_FORMAT_CHANGE)
+            m_pipelineStatus = DECODE_SUCCESS;
+    }
+    if (pool)
+        pool->setWaitable(true);
+}
+
+uint32_t VaapiDecoderBase::pipelineOutputs()
+{
+    AutoLock lock(m_pipelineLock);
+    return m_pipelineOutputs;
+}
+
+bool VaapiDecoderBase::waitPipeline(uint32_t outputs)
+{
+    if (!m_pipelineRunning || isParseThread())
+        return true;
+    //unlike drainPipeline(false), stop at the first output. the parse thread may wait in
+    //acquireWithWait() for a surface the caller only returns once it got that output
+    AutoLock lock(m_pipelineLock);
+    while (!isPipelineIdle() && outputs == m_pipelineOutputs)
+        m_pipelineCond.wait();
+    return isPipelineIdle();
+}
+
+void VaapiDecoderBase::queueJob(const PicturePtr& picture, bool output)
+{
+    AutoLock lock(m_pipelineLock);
+    while (m_pipelineJobs.size() >= PIPELINE_MAX_JOBS && !m_pipelineQuit)
+        m_pipelineCond.wait();
+    PipelineJob job;
+    job.picture = picture;
+    job.output = output;
+    m_pipelineJobs.push_back(job);
+    m_pipelineCond.broadcast();
+}
+
+void* VaapiDecoderBase::parseThread(void* arg)
+{
+    static_cast<VaapiDecoderBase*>(arg)->parse();
+    return NULL;
+}
+
+void* VaapiDecoderBase::submitThread(void* arg)
+{
+    static_cast<VaapiDecoderBase*>(arg)->submit();
+    return NULL;
+}
+
+void VaapiDecoderBase::parse()
+{
+    while (true) {
+        PipelineInputPtr input;
+        uint32_t generation;
+        {
+            AutoLock lock(m_pipelineLock);
+            while (!m_pipelineQuit && (m_pipelineInput.empty() || m_pipelineStalled))
+                m_pipelineCond.wait();
+            if (m_pipelineQuit)
+                return;
+            input = m_pipelineInput.front();
+            m_pipelineInput.pop_front();
+            generation = m_pipelineGeneration;
+            m_parsing = true;
+        }
+
+        Decode_Status status = doDecode(&input->buffer);
+
+        AutoLock lock(m_pipelineLock);
+        m_parsing = false;
+        if (status == DECODE_FORMAT_CHANGE && generation == m_pipelineGeneration) {
+            //decoded again once the caller has seen the new format
+            m_pipelineInput.push_front(input);
+            m_pipelineStalled = true;
+        }
+        if (status != DECODE_SUCCESS && m_pipelineStatus != DECODE_FORMAT_CHANGE)
+            m_pipelineStatus = status;
+        m_pipelineCond.broadcast();
+    }
+}
+
+void VaapiDecoderBase::submit()
+{
+    while (true) {
+        PipelineJob job;
+        {
+            AutoLock lock(m_pipelineLock);
+            while (!m_pipelineQuit && m_pipelineJobs.empty())
+                m_pipelineCond.wait();
+            if (m_pipelineQuit)
+                return;
+            job = m_pipelineJobs.front();
+            m_pipelineJobs.pop_front();
+            m_submitting = true;
+            m_pipelineCond.broadcast();
+        }
+
+        bool ret;
+        if (job.output) {
+            DecSurfacePoolPtr pool = surfacePool();
+            ret = pool && pool->output(job.picture->getSurface(), job.picture->m_timeStamp);
+        } else {
+            ret = job.picture->decode();
+        }
+        job.picture.reset();
+
+        AutoLock lock(m_pipelineLock);
+        m_submitting = false;
+        if (ret && job.output)
+            m_pipelineOutputs++;
+        if (!ret) {
+            ERROR("failed to %s picture", job.output ? "output" : "render");
+            if (m_pipelineStatus != DECODE_FORMAT_CHANGE)
+                m_pipelineStatus = DECODE_FAIL;
+        }
+        m_pipelineCond.broadcast();
+    }
+}
+
 VADisplay VaapiDecoderBase::getDisplayID()
 {
     if (!m_display)
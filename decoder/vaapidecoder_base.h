@@ -23,12 +23,15 @@
 #ifndef vaapidecoder_base_h
 #define vaapidecoder_base_h
 
+#include "common/condition.h"
+#include "common/lock.h"
 #include "common/log.h"
 #include "interface/VideoDecoderInterface.h"
 #include "vaapi/vaapiptrs.h"
 #include "vaapidecpicture.h"
 #include <deque>
 #include <pthread.h>
+#include <vector>
 #include <va/va.h>
 #include <va/va_tpi.h>
 #ifdef HAVE_VA_X11
@@ -54,7 +57,7 @@ class VaapiDecoderBase:public IVideoDecoder {
     virtual Decode_Status start(VideoConfigBuffer * buffer);
     virtual Decode_Status reset(VideoConfigBuffer * buffer);
     virtual void stop(void);
-    //virtual Decode_Status decode(VideoDecodeBuffer *buffer);
+    virtual Decode_Status decode(VideoDecodeBuffer *buffer);
     virtual void flush(void);
     virtual void flushOutport(void);
     virtual const VideoRenderBuffer *getOutput(bool draining);
@@ -75,15 +78,30 @@ class VaapiDecoderBase:public IVideoDecoder {
                                               void *nativeBufferHandle);
     Decode_Status flagNativeBuffer(void *pBuffer);
     void releaseLock(bool lockable=false);
+    virtual void setSkipPolicy(const VideoSkipPolicy* policy);
 
     //do not use this, we will remove this in near future
     virtual VADisplay getDisplayID();
   protected:
+    /// decodes @buffer, on the parse thread with WANT_PIPELINED_DECODE, on the caller's thread otherwise
+    virtual Decode_Status doDecode(VideoDecodeBuffer *buffer) = 0;
     Decode_Status setupVA(uint32_t numSurface, VAProfile profile);
     Decode_Status terminateVA(void);
+    /// configures VA for a new stream of @buffer, it keeps the context and the surfaces
+    /// if they fit, otherwise it terminates and starts VA again
+    Decode_Status resetVA(VideoConfigBuffer* buffer);
     Decode_Status updateReference(void);
     Decode_Status outputPicture(const PicturePtr& picture);
+    /// sends @picture to the driver, the submit thread does it when called on the parse thread
+    Decode_Status submitPicture(const PicturePtr& picture);
     SurfacePtr createSurface();
+    /// waits until the pipeline is idle, with @discard the queued buffers are dropped.
+    /// it is called before the caller's thread touches the decoding state
+    void drainPipeline(bool discard);
+    /// if the picture of @timeStamp is skipped by the skip policy, once for each picture
+    bool skipPicture(bool isKey, bool isReference, int64_t timeStamp);
+    /// only key pictures are decoded, they can be output in decoding order
+    bool decodesKeyOnly();
 
     NativeDisplay   m_externalDisplay;
     DisplayPtr m_display;
@@ -109,6 +127,8 @@ class VaapiDecoderBase:public IVideoDecoder {
     VideoSurfaceBuffer *m_forwardReference;
 
     bool m_VAStarted;
+    //of the VA config
+    VAProfile m_VAProfile;
 
     /* hold serveral decoded picture coming from the dpb,
      * and rearrange the picture output order according to
@@ -118,6 +138,43 @@ class VaapiDecoderBase:public IVideoDecoder {
     uint64_t m_currentPTS;
 
   private:
+    struct PipelineInput {
+        std::vector<uint8_t> data;
+        //a copy of the nal unit table, buffer.ext points to it
+        std::vector<uint8_t> extData;
+        VideoExtensionBuffer ext;
+        VideoDecodeBuffer buffer;
+    };
+    typedef SharedPtr<PipelineInput> PipelineInputPtr;
+    struct PipelineJob {
+        PicturePtr picture;
+        //output the picture instead of rendering it
+        bool output;
+    };
+
+    DecSurfacePoolPtr surfacePool();
+    bool reuseVA(VideoConfigBuffer* buffer);
+    bool takeFormatChange();
+    bool startPipeline();
+    void stopPipeline();
+    bool isParseThread() const;
+    bool isPipelineIdle() const;
+    uint32_t pipelineOutputs();
+    /// for a draining getOutput(), true once the pipeline is idle,
+    /// false if a picture was output since pipelineOutputs() returned @outputs
+    bool waitPipeline(uint32_t outputs);
+    void queueJob(const PicturePtr& picture, bool output);
+    static void* parseThread(void* arg);
+    static void* submitThread(void* arg);
+    void parse();
+    void submit();
+
+    Lock m_skipLock;
+    VideoSkipPolicy m_skipPolicy;
+    //after a key picture mode, skip to the next key picture
+    bool m_skipToKey;
+    int64_t m_lastKeyTimeStamp;
+
     bool m_lowDelay;
     bool m_rawOutput;
     bool m_enableNativeBuffersFlag;
@@ -125,6 +182,32 @@ class VaapiDecoderBase:public IVideoDecoder {
     int renderPictureCount;
 #endif
 
+    //m_surfacePool is replaced on the parse thread while the caller gets output
+    Lock m_surfacePoolLock;
+
+    /* pipelined decode, the caller queues buffers for the parse thread, which
+     * queues prepared pictures for the submit thread. both queues are bounded.
+     */
+    bool m_pipelined;
+    bool m_pipelineRunning;
+    pthread_t m_parseThread;
+    pthread_t m_submitThread;
+    Lock m_pipelineLock;
+    Condition m_pipelineCond;
+    bool m_pipelineQuit;
+    std::deque<PipelineInputPtr> m_pipelineInput;
+    std::deque<PipelineJob> m_pipelineJobs;
+    bool m_parsing;
+    bool m_submitting;
+    //a format change holds the parse thread until the caller has seen it
+    bool m_pipelineStalled;
+    //bumped when the queued buffers are dropped
+    uint32_t m_pipelineGeneration;
+    //pictures the submit thread has output
+    uint32_t m_pipelineOutputs;
+    //reported by the next decode()
+    Decode_Status m_pipelineStatus;
+
 };
 }
 #endif                          // vaapidecoder_base_h
@@ -59,7 +59,7 @@ Decode_Status VaapiDecoderFake::start(VideoConfigBuffer * buffer)
     return VaapiDecoderBase::start(&config);
 }
 
-Decode_Status VaapiDecoderFake::decode(VideoDecodeBuffer *buffer)
+Decode_Status VaapiDecoderFake::doDecode(VideoDecodeBuffer *buffer)
 {
     if (m_first) {
         m_first = false;
@@ -38,7 +38,9 @@ class VaapiDecoderFake:public VaapiDecoderBase {
     VaapiDecoderFake(int32_t width, int32_t height);
     virtual ~ VaapiDecoderFake();
     virtual Decode_Status start(VideoConfigBuffer * );
-    virtual Decode_Status decode(VideoDecodeBuffer *);
+
+  protected:
+    virtual Decode_Status doDecode(VideoDecodeBuffer *);
 
   private:
     int32_t m_width;
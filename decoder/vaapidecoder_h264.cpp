@@ -30,6 +30,7 @@
 #include "vaapidecoder_h264.h"
 #include "vaapidecoder_factory.h"
 #include "codecparsers/bytereader.h"
+#include "codecparsers/nalscanner.h"
 
 #include "vaapi/vaapiptrs.h"
 #include "vaapi/vaapicontext.h"
@@ -154,28 +155,24 @@ fillIqMatrix8x8(VAIQMatrixBufferH264 *iq_matrix, const H264PPS *pps)
     }
 }
 
-static inline int32_t
-scanForStartCode(const uint8_t * data,
-                 uint32_t offset, uint32_t size, uint32_t * scp)
+/* collect offsets of all start codes in data, in a single pass */
+static void
+scanForStartCodes(const uint8_t * data, uint32_t size,
+                  std::vector<uint32_t>& startCodes)
 {
-/*
-    ByteReader br;
-    byte_reader_init(&br, data, size);
-    return byte_reader_masked_scan_uint32(&br, 0xffffff00, 0x00000100, 0, size) - 1;
-*/
-    uint32_t i;
-    const uint8_t *buf;
-
-    if (offset + 3 > size)
-        return -1;
+    static const uint32_t BatchSize = 64;
+    uint32_t offset = 0;
+    uint32_t count, n;
 
-    for (i = 0; i < size - offset - 3 + 1; i++) {
-        buf = data + offset + i;
-        if (buf[0] == 0 && buf[1] == 0 && buf[2] == 1)
-            return i;
-    }
-
-    return -1;
+    startCodes.clear();
+    do {
+        count = startCodes.size();
+        startCodes.resize(count + BatchSize);
+        n = nal_scanner_scan(data, size, offset, &startCodes[count], BatchSize);
+        startCodes.resize(count + n);
+        if (n)
+            offset = startCodes.back() + 3;
+    } while (n == BatchSize);
 }
 
 VaapiFrameStore::VaapiFrameStore(const PicturePtr& pic)
@@ -391,27 +388,35 @@ void VaapiDecoderH264::initPicturePOC0(const PicturePtr& picture,
     }
 }
 
-void VaapiDecoderH264::initPicturePOC1(const PicturePtr& picture,
-                                       const SliceHeaderPtr& sliceHdr)
+/* FrameNumOffset of the new picture, (8-6) and (8-11) are the same */
+void VaapiDecoderH264::updateFrameNumOffset(bool isIdr, H264SPS * sps)
 {
-    H264PPS *const pps = sliceHdr->pps;
-    H264SPS *const sps = pps->sequence;
     const int32_t maxFrameNum = 1 << (sps->log2_max_frame_num_minus4 + 4);
-    int32_t prevFrameNumOffset, absFrameNum, expectedPOC;
-    uint32_t i;
+    int32_t prevFrameNumOffset;
 
     if (m_prevPicHasMMCO5)
         prevFrameNumOffset = 0;
     else
         prevFrameNumOffset = m_frameNumOffset;
 
-    // (8-6)
-    if (VAAPI_H264_PICTURE_IS_IDR(picture))
+    if (isIdr)
         m_frameNumOffset = 0;
     else if (m_prevFrameNum > m_frameNum)
         m_frameNumOffset = prevFrameNumOffset + maxFrameNum;
     else
         m_frameNumOffset = prevFrameNumOffset;
+}
+
+void VaapiDecoderH264::initPicturePOC1(const PicturePtr& picture,
+                                       const SliceHeaderPtr& sliceHdr)
+{
+    H264PPS *const pps = sliceHdr->pps;
+    H264SPS *const sps = pps->sequence;
+    int32_t absFrameNum, expectedPOC;
+    uint32_t i;
+
+    // (8-6)
+    updateFrameNumOffset(VAAPI_H264_PICTURE_IS_IDR(picture), sps);
 
     // (8-7)
     if (sps->num_ref_frames_in_pic_order_cnt_cycle != 0)
@@ -470,21 +475,10 @@ void VaapiDecoderH264::initPicturePOC2(const PicturePtr& picture,
 {
     H264PPS *const pps = sliceHdr->pps;
     H264SPS *const sps = pps->sequence;
-    const int32_t maxFrameNum = 1 << (sps->log2_max_frame_num_minus4 + 4);
-    int32_t prevFrameNumOffset, tempPOC;
-
-    if (m_prevPicHasMMCO5)
-        prevFrameNumOffset = 0;
-    else
-        prevFrameNumOffset = m_frameNumOffset;
+    int32_t tempPOC;
 
     // (8-11)
-    if (VAAPI_H264_PICTURE_IS_IDR(picture))
-        m_frameNumOffset = 0;
-    else if (m_prevFrameNum > m_frameNum)
-        m_frameNumOffset = prevFrameNumOffset + maxFrameNum;
-    else
-        m_frameNumOffset = prevFrameNumOffset;
+    updateFrameNumOffset(VAAPI_H264_PICTURE_IS_IDR(picture), sps);
 
     // (8-12)
     if (VAAPI_H264_PICTURE_IS_IDR(picture))
@@ -892,6 +886,8 @@ Decode_Status VaapiDecoderH264::ensureContext(H264PPS * pps)
         DPBSize = getMaxDecFrameBuffering(sps, 1);
         m_DPBManager.reset(new VaapiDPBManager(this, DPBSize));
     }
+    m_DPBManager->setMaxNumReorderFrames(
+        getMaxNumReorderFrames(sps, (m_configBuffer.flag & WANT_LOW_DELAY) || decodesKeyOnly()));
 
     parsedProfile = getH264VAProfile(pps);
     if (parsedProfile != m_configBuffer.profile) {
@@ -932,10 +928,12 @@ Decode_Status VaapiDecoderH264::ensureContext(H264PPS * pps)
     if (!resetContext && m_hasContext)
         return DECODE_SUCCESS;
 
+    DPBSize = getMaxDecFrameBuffering(sps, 1);
+    //the picture in decoding and a non-reference field pair waiting for output,
+    //the surface pool adds the ones of the client
+    m_configBuffer.surfaceNumber = DPBSize + 2;
+    m_configBuffer.flag |= HAS_SURFACE_NUMBER;
     if (!m_hasContext) {
-        DPBSize = getMaxDecFrameBuffering(sps, 1);
-        m_configBuffer.surfaceNumber = DPBSize + H264_EXTRA_SURFACE_NUMBER;
-        m_configBuffer.flag |= HAS_SURFACE_NUMBER;
         status = VaapiDecoderBase::start(&m_configBuffer);
         if (status != DECODE_SUCCESS)
             return status;
@@ -943,6 +941,7 @@ Decode_Status VaapiDecoderH264::ensureContext(H264PPS * pps)
         DEBUG("First time to Start VA context");
         m_resetContext = true;
     } else if (resetContext) {
+        //it keeps the context if the surfaces are large enough
         m_hasContext = false;
         status = VaapiDecoderBase::reset(&m_configBuffer);
         if (status != DECODE_SUCCESS)
@@ -1033,6 +1032,61 @@ bool VaapiDecoderH264::isNewPicture(H264NalUnit * nalu,
     return false;
 }
 
+/*
+    a skipped reference picture is not in the DPB, the decoded pictures do not
+    refer to it in the key picture modes. frame_num moves on as if it was decoded,
+    so processForGapsInFrameNum() does not add dummy pictures for it.
+    FrameNumOffset moves on too, a skipped picture can be the one where frame_num
+    wraps, and POC types 1 and 2 of the next decoded picture would miss the wrap.
+*/
+bool VaapiDecoderH264::skipNewPicture(H264NalUnit * nalu,
+                                      const SliceHeaderPtr& sliceHdr)
+{
+    /* the second field follows its decoded first field */
+    if (m_currentPicture && sliceHdr->field_pic_flag
+        && !VAAPI_PICTURE_IS_FRAME(m_currentPicture)
+        && VAAPI_PICTURE_IS_FIRST_FIELD(m_currentPicture)
+        && m_currentPicture->m_frameNum == sliceHdr->frame_num)
+        return false;
+
+    bool isKey = nalu->idr_pic_flag || H264_IS_I_SLICE(sliceHdr)
+        || H264_IS_SI_SLICE(sliceHdr);
+    if (!skipPicture(isKey, nalu->ref_idc != 0, m_currentPTS))
+        return false;
+
+    DEBUG("H264: skip picture of frame_num %d", sliceHdr->frame_num);
+    m_prevFrameNum = m_frameNum;
+    m_frameNum = sliceHdr->frame_num;
+    updateFrameNumOffset(nalu->idr_pic_flag, sliceHdr->pps->sequence);
+    m_skippedSlice = sliceHdr;
+    m_skippedFirstField = sliceHdr->field_pic_flag;
+    return true;
+}
+
+/* the other slices and the second field of a skipped picture */
+bool VaapiDecoderH264::isSkippedPicture(const SliceHeaderPtr& sliceHdr)
+{
+    if (!m_skippedSlice)
+        return false;
+
+    const H264SliceHdr* skipped = m_skippedSlice.get();
+    bool sameFrame = sliceHdr->frame_num == skipped->frame_num
+        && sliceHdr->pps == skipped->pps
+        && sliceHdr->field_pic_flag == skipped->field_pic_flag;
+    bool sameField = sliceHdr->bottom_field_flag == skipped->bottom_field_flag;
+
+    if (sameFrame && sameField && sliceHdr->first_mb_in_slice)
+        return true;
+    if (sameFrame && !sameField && m_skippedFirstField
+        && !sliceHdr->first_mb_in_slice) {
+        m_skippedSlice = sliceHdr;
+        m_skippedFirstField = false;
+        return true;
+    }
+    m_skippedSlice.reset();
+    return false;
+}
+
 bool VaapiDecoderH264::markingPicture(const PicturePtr& pic)
 {
     if (!m_DPBManager->execRefPicMarking(pic, &m_prevPicHasMMCO5))
@@ -1064,6 +1118,8 @@ bool VaapiDecoderH264::storeDecodedPicture(const PicturePtr pic)
 
         ret = m_prevFrame->addPicture(m_currentPicture);
         m_currentPicture.reset();
+        if (ret)
+            ret = m_DPBManager->bumpReorderedDPB();
         return ret;
     }
     // Create new frame store, and split fields if necessary
@@ -1098,7 +1154,7 @@ Decode_Status VaapiDecoderH264::decodeCurrentPicture()
     if (!markingPicture(m_currentPicture))
         goto error;
 
-    if (!m_currentPicture->decode())
+    if (submitPicture(m_currentPicture) != DECODE_SUCCESS)
         goto error;
 
     if (!storeDecodedPicture(m_currentPicture))
@@ -1183,7 +1239,16 @@ Decode_Status VaapiDecoderH264::decodeSlice(H264NalUnit * nalu)
     if (status != DECODE_SUCCESS)
         return status;
 
+    if (isSkippedPicture(sliceHdr))
+        return DECODE_SUCCESS;
+
     if (isNewPicture(nalu, sliceHdr)) {
+        if (skipNewPicture(nalu, sliceHdr)) {
+            //the picture before it is complete
+            status = decodeCurrentPicture();
+            m_currentPicture.reset();
+            return status;
+        }
         status = decodePicture(nalu, sliceHdr);
         if (status != DECODE_SUCCESS)
             return status;
@@ -1267,7 +1332,7 @@ bool VaapiDecoderH264::decodeCodecData(uint8_t * buf, uint32_t bufSize)
         memset(&buffer, 0, sizeof(buffer));
         buffer.data = buf;
         buffer.size = bufSize;
-        status = decode(&buffer);
+        status = doDecode(&buffer);
         return status == DECODE_SUCCESS;
     }
 
@@ -1364,6 +1429,7 @@ VaapiDecoderH264::VaapiDecoderH264()
     m_nalLengthSize = 4;
     m_isAVC = false;
     m_resetContext = false;
+    m_skippedFirstField = false;
 }
 
 VaapiDecoderH264::~VaapiDecoderH264()
@@ -1377,6 +1443,11 @@ Decode_Status VaapiDecoderH264::start(VideoConfigBuffer * buffer)
     Decode_Status status;
     bool gotConfig = false;
 
+    //keep the flags of the caller for the context started by ensureContext()
+    m_configBuffer = *buffer;
+    m_configBuffer.data = NULL;
+    m_configBuffer.size = 0;
+
     if (buffer->data == NULL || buffer->size == 0) {
         gotConfig = false;
         if ((buffer->flag & HAS_SURFACE_NUMBER)
@@ -1404,6 +1475,7 @@ Decode_Status VaapiDecoderH264::start(VideoConfigBuffer * buffer)
 Decode_Status VaapiDecoderH264::reset(VideoConfigBuffer * buffer)
 {
     DEBUG("H264: reset()");
+    drainPipeline(true);
     if (m_DPBManager)
         m_DPBManager->clearDPB();
 
@@ -1428,7 +1500,9 @@ void VaapiDecoderH264::stop(void)
 void VaapiDecoderH264::flush(void)
 {
     DEBUG("H264: flush()");
+    drainPipeline(true);
     decodeCurrentPicture();
+    m_skippedSlice.reset();
 
     if (m_DPBManager)
         m_DPBManager->flushDPB();
@@ -1436,7 +1510,7 @@ void VaapiDecoderH264::flush(void)
     VaapiDecoderBase::flush();
 }
 
-Decode_Status VaapiDecoderH264::decode(VideoDecodeBuffer * buffer)
+Decode_Status VaapiDecoderH264::doDecode(VideoDecodeBuffer * buffer)
 {
     Decode_Status status = DECODE_SUCCESS;
     H264ParserResult result;
@@ -1445,8 +1519,10 @@ Decode_Status VaapiDecoderH264::decode(VideoDecodeBuffer * buffer)
     uint8_t *buf;
     uint32_t bufSize = 0;
     uint32_t i, naluSize, size;
-    int32_t ofs = 0;
-    uint32_t startCode;
+    uint32_t nalIndex = 0, nalBegin, nalEnd;
+    const NalUnitSpan *nalTable = NULL;
+    uint32_t nalCount = 0;
+    bool isAVC, isAnnexB;
     bool isEOS = false;
 
     m_currentPTS = buffer->timeStamp;
@@ -1460,8 +1536,19 @@ Decode_Status VaapiDecoderH264::decode(VideoDecodeBuffer * buffer)
         return DECODE_SUCCESS;
     }
 
+    if ((buffer->flag & HAS_NAL_UNIT_TABLE) && buffer->ext
+        && buffer->ext->extType == NAL_UNIT_TABLE_TYPE) {
+        nalTable = (const NalUnitSpan *) buffer->ext->extData;
+        nalCount = buffer->ext->extSize / sizeof(NalUnitSpan);
+    }
+
+    isAVC = !nalTable && (m_isAVC || buffer->flag & IS_AVCC);
+    isAnnexB = !isAVC && !(buffer->flag & IS_NAL_UNIT);
+    if (isAnnexB && !nalTable)
+        scanForStartCodes(buf, size, m_startCodes);
+
     do {
-        if (m_isAVC || buffer->flag & IS_AVCC) {
+        if (isAVC) {
             if (size < m_nalLengthSize)
                 break;
 
@@ -1480,38 +1567,44 @@ Decode_Status VaapiDecoderH264::decode(VideoDecodeBuffer * buffer)
             size -= bufSize;
             buf += bufSize;
 
+        } else if (nalTable) {
+            /* the nal units were located by the caller, no scanning */
+            if (nalIndex >= nalCount)
+                break;
+            nalBegin = nalTable[nalIndex].offset;
+            nalEnd = nalBegin + nalTable[nalIndex].size;
+            nalIndex++;
+            if (nalBegin < 3 || nalEnd <= nalBegin || nalEnd > size) {
+                ERROR("invalid nal unit table entry (%u, %u)", nalBegin,
+                      nalEnd - nalBegin);
+                return DECODE_INVALID_DATA;
+            }
+
+            result = h264_parser_identify_nalu_unchecked(&m_parser,
+                                                         buf, nalBegin - 3,
+                                                         nalEnd, &nalu);
+        } else if (isAnnexB) {
+            /* the nal spans from its start code to the next one */
+            if (nalIndex >= m_startCodes.size())
+                break;
+            nalBegin = m_startCodes[nalIndex++];
+            nalEnd = nalIndex < m_startCodes.size() ?
+                m_startCodes[nalIndex] : size;
+            if (nalEnd - nalBegin < 4)
+                continue;
+
+            result = h264_parser_identify_nalu_unchecked(&m_parser,
+                                                         buf, nalBegin, nalEnd,
+                                                         &nalu);
         } else {
             if (size < 4)
                 break;
 
-            if (buffer->flag & IS_NAL_UNIT) {
-                bufSize = buffer->size;
-                size = 0;
-            } else {
-                /* skip the un-used bit before start code */
-                ofs = scanForStartCode(buf, 0, size, &startCode);
-                if (ofs < 0)
-                    break;
-
-                buf += ofs;
-                size -= ofs;
-
-                /* find the length of the nal */
-                ofs =
-                    (size < 7) ? -1 : scanForStartCode(buf, 3, size - 3, NULL);
-                if (ofs < 0) {
-                    ofs = size - 3;
-                }
-
-                bufSize = ofs + 3;
-                size -= (ofs + 3);
-            }
-
+            bufSize = size;
+            size = 0;
             result = h264_parser_identify_nalu_unchecked(&m_parser,
                                                          buf, 0, bufSize,
                                                          &nalu);
-
-            buf += bufSize;
         }
 
         status = getStatus(result);
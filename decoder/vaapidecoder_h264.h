@@ -29,6 +29,7 @@
 #include "vaapidecpicture.h"
 #include <limits>
 #include <list>
+#include <vector>
 
 //#define MAX_VIEW_NUM 2
 namespace YamiMediaCodec{
@@ -73,6 +74,8 @@ class VaapiDecPictureH264 : public VaapiDecPicture
     friend class VaapiDPBManager;
     friend class VaapiDecoderH264;
     friend class VaapiFrameStore;
+    //host side test of the output order, see vaapidecoder_h264_dpb_unittest.cpp
+    friend class VaapiDPBManagerTest;
 
     virtual ~VaapiDecPictureH264() {}
 
@@ -204,6 +207,10 @@ class VaapiDPBManager {
     void flushDPB();
     bool addDPB(const VaapiFrameStore::Ptr &newFrameStore, const PicturePtr& pic);
     void resetDPB(H264SPS * sps);
+    /// frames which may wait for output, see getMaxNumReorderFrames()
+    void setMaxNumReorderFrames(uint32_t num);
+    /* C.4.5.3 - output in POC order while more frames wait than can be reordered */
+    bool bumpReorderedDPB();
     /* initialize and reorder reference list */
     void initPictureRefs(const PicturePtr& pic,
                          const SliceHeaderPtr& sliceHdr, int32_t frameNum);
@@ -269,6 +276,7 @@ class VaapiDPBManager {
 
  private:
     VaapiDecoderH264* m_decoder;
+    uint32_t m_maxNumReorderFrames;
     DISALLOW_COPY_AND_ASSIGN(VaapiDPBManager);
 };
 
@@ -282,11 +290,14 @@ class VaapiDecoderH264:public VaapiDecoderBase {
     virtual Decode_Status reset(VideoConfigBuffer * buffer);
     virtual void stop(void);
     virtual void flush(void);
-    virtual Decode_Status decode(VideoDecodeBuffer * buf);
     virtual void flushOutport(void);
 
     //FIXME: make this private
-    Decode_Status outputPicture(PicturePtr& picture);
+    //the DPB outputs through it, virtual so the DPB test can record the output order
+    virtual Decode_Status outputPicture(PicturePtr& picture);
+
+  protected:
+    virtual Decode_Status doDecode(VideoDecodeBuffer * buf);
 
   public:
     VaapiFrameStore::Ptr m_prevFrame;
@@ -306,6 +317,7 @@ class VaapiDecoderH264:public VaapiDecoderBase {
     /* initialize picture */
     void initPicturePOC0(const PicturePtr& picture,
                          const SliceHeaderPtr& sliceHdr);
+    void updateFrameNumOffset(bool isIdr, H264SPS * sps);
     void initPicturePOC1(const PicturePtr& picture,
                          const SliceHeaderPtr& sliceHdr);
     void initPicturePOC2(const PicturePtr& picture,
@@ -334,6 +346,9 @@ class VaapiDecoderH264:public VaapiDecoderBase {
     Decode_Status ensureContext(H264PPS * pps);
     /* decoding functions */
     bool isNewPicture(H264NalUnit * nalu, const SliceHeaderPtr&);
+    /* skip policy, decided on the first slice of a picture */
+    bool skipNewPicture(H264NalUnit * nalu, const SliceHeaderPtr&);
+    bool isSkippedPicture(const SliceHeaderPtr&);
 
     bool markingPicture(const PicturePtr& pic);
     bool storeDecodedPicture(const PicturePtr pic);
@@ -368,6 +383,10 @@ class VaapiDecoderH264:public VaapiDecoderBase {
     uint64_t m_nalLengthSize;
     bool m_isAVC;
     bool m_resetContext;
+    // the first slice of the skipped picture
+    SliceHeaderPtr m_skippedSlice;
+    bool m_skippedFirstField;
+    std::vector<uint32_t> m_startCodes; // start code offsets of current buffer
 
     static const bool s_registered; // VaapiDecoderFactory registration result
 
@@ -375,9 +394,9 @@ class VaapiDecoderH264:public VaapiDecoderBase {
 };
 
 uint32_t getMaxDecFrameBuffering(H264SPS * sps, uint32_t views);
+uint32_t getMaxNumReorderFrames(H264SPS * sps, bool lowDelay);
 
 enum {
-    H264_EXTRA_SURFACE_NUMBER = 11,
     MAX_REF_NUMBER = 16,
     DPB_SIE = 17,
     REF_LIST_SIZE = 32,
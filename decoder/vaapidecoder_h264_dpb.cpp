@@ -235,8 +235,27 @@ uint32_t getMaxDecFrameBuffering(H264SPS * sps, uint32_t views)
     return MAX(1, maxDecFrameBuffering);
 }
 
+/*
+    frames which may wait in the DPB for output before the one to output.
+    with poc type 2 the output order is the decoding order. with WANT_LOW_DELAY the
+    caller accepts decoding order for streams which reorder.
+*/
+uint32_t getMaxNumReorderFrames(H264SPS * sps, bool lowDelay)
+{
+    if (lowDelay || sps->pic_order_cnt_type == 2)
+        return 0;
+
+    if (sps->vui_parameters_present_flag
+        && sps->vui_parameters.bitstream_restriction_flag)
+        return MIN(sps->vui_parameters.num_reorder_frames,
+                   getMaxDecFrameBuffering(sps, 1));
+
+    return getMaxDecFrameBuffering(sps, 1);
+}
+
 VaapiDPBManager::VaapiDPBManager(VaapiDecoderH264* decoder, uint32_t DPBSize)
     :m_decoder(decoder)
+    ,m_maxNumReorderFrames(DPBSize)
 {
     DPBLayer.reset(new VaapiDecPicBufLayer(DPBSize));
 }
@@ -419,7 +438,34 @@ bool VaapiDPBManager::addDPB(const VaapiFrameStore::Ptr& newFrameStore,
         newFrameStore->m_outputNeeded++;
     }
 
-    return true;
+    return bumpReorderedDPB();
+}
+
+void VaapiDPBManager::setMaxNumReorderFrames(uint32_t num)
+{
+    m_maxNumReorderFrames = num;
+}
+
+/*
+    a first field does not count until its second field is added,
+    the frame is output when both fields are decoded.
+*/
+bool VaapiDPBManager::bumpReorderedDPB()
+{
+    uint32_t i, waiting;
+
+    while (true) {
+        waiting = 0;
+        for (i = 0; i < DPBLayer->DPBCount; i++) {
+            const VaapiFrameStore::Ptr& frameStore = DPBLayer->DPB[i];
+            if (frameStore->m_outputNeeded && frameStore->hasFrame())
+                waiting++;
+        }
+        if (waiting <= m_maxNumReorderFrames)
+            return true;
+        if (!bumpDPB())
+            return false;
+    }
 }
 
 void VaapiDPBManager::resetDPB(H264SPS * sps)
@@ -0,0 +1,280 @@
+/*
+ *  vaapidecoder_h264_dpb_unittest.cpp - host side tests of the h264 DPB output order
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/common_def.h"
+#include "common/unittest.h"
+#include "vaapidecoder_h264.h"
+#include <string.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+/**
+ * feeds a DPB with synthetic pictures, they have a POC and reference marking but no
+ * surface or context. the decoder is only there to record what the DPB outputs.
+ */
+class VaapiDPBManagerTest : public VaapiDecoderH264
+{
+public:
+    VaapiDPBManagerTest(uint32_t DPBSize, uint32_t maxNumReorderFrames)
+        : m_dpb(this, DPBSize)
+    {
+        m_dpb.setMaxNumReorderFrames(maxNumReorderFrames);
+    }
+
+    void decodeFrame(int32_t poc, bool isReference, bool isIdr = false)
+    {
+        PicturePtr picture = newPicture(poc, VAAPI_PICTURE_STRUCTURE_FRAME, isReference, isIdr);
+        //as VaapiDecoderH264 does before an IDR
+        if (isIdr)
+            m_dpb.flushDPB();
+        VaapiFrameStore::Ptr frameStore(new VaapiFrameStore(picture));
+        EXPECT_TRUE(m_dpb.addDPB(frameStore, picture));
+        m_outputCounts.push_back(m_output.size());
+    }
+
+    // a top field of @poc, then a bottom field of @poc + 1
+    void decodeFields(int32_t poc, bool isReference)
+    {
+        PicturePtr top = newPicture(poc, VAAPI_PICTURE_STRUCTURE_TOP_FIELD, isReference, false);
+        VaapiFrameStore::Ptr frameStore(new VaapiFrameStore(top));
+        EXPECT_TRUE(m_dpb.addDPB(frameStore, top));
+        m_outputCounts.push_back(m_output.size());
+
+        PicturePtr bottom = newPicture(poc + 1, VAAPI_PICTURE_STRUCTURE_BOTTOM_FIELD, isReference, false);
+        EXPECT_TRUE(frameStore->addPicture(bottom));
+        EXPECT_TRUE(m_dpb.bumpReorderedDPB());
+        m_outputCounts.push_back(m_output.size());
+    }
+
+    // sliding window marking, done by the decoder after a picture
+    void unmarkReference(int32_t poc)
+    {
+        for (uint32_t i = 0; i < m_dpb.DPBLayer->DPBCount; i++) {
+            const VaapiFrameStore::Ptr& frameStore = m_dpb.DPBLayer->DPB[i];
+            for (uint32_t j = 0; j < frameStore->m_numBuffers; j++) {
+                if (frameStore->m_buffers[j]->m_POC == poc)
+                    VAAPI_PICTURE_FLAG_UNSET(frameStore->m_buffers[j], VAAPI_PICTURE_FLAG_REFERENCE);
+            }
+        }
+    }
+
+    void drain()
+    {
+        m_dpb.drainDPB();
+    }
+
+    virtual Decode_Status outputPicture(PicturePtr& picture)
+    {
+        m_output.push_back(picture->m_POC);
+        return DECODE_SUCCESS;
+    }
+
+    //POCs in output order
+    std::vector<int32_t> m_output;
+    //size of m_output after each picture or field was added
+    std::vector<size_t> m_outputCounts;
+
+private:
+    PicturePtr newPicture(int32_t poc, uint32_t structure, bool isReference, bool isIdr)
+    {
+        PicturePtr picture(new VaapiDecPictureH264(ContextPtr(), SurfacePtr(), poc));
+        picture->m_POC = poc;
+        picture->m_structure = structure;
+        picture->m_picStructure = structure;
+        picture->m_outputFlag = true;
+        if (structure != VAAPI_PICTURE_STRUCTURE_BOTTOM_FIELD)
+            picture->m_fieldPoc[0] = poc;
+        if (structure != VAAPI_PICTURE_STRUCTURE_TOP_FIELD)
+            picture->m_fieldPoc[1] = poc;
+        if (structure != VAAPI_PICTURE_STRUCTURE_FRAME)
+            VAAPI_PICTURE_FLAG_SET(picture, VAAPI_PICTURE_FLAG_INTERLACED);
+        if (isReference)
+            VAAPI_PICTURE_FLAG_SET(picture, VAAPI_PICTURE_FLAG_SHORT_TERM_REFERENCE);
+        if (isIdr)
+            VAAPI_PICTURE_FLAG_SET(picture, VAAPI_PICTURE_FLAG_IDR);
+        return picture;
+    }
+
+    VaapiDPBManager m_dpb;
+};
+
+}
+
+using namespace YamiMediaCodec;
+
+// one picture of a trace in decoding order
+struct TracePicture {
+    int32_t poc;
+    bool isReference;
+};
+
+// I P B B P B B, the B frames are not referenced
+static const TracePicture ipbbTrace[] = {
+    { 0, true }, { 6, true }, { 2, false }, { 4, false },
+    { 12, true }, { 8, false }, { 10, false },
+};
+
+static void decodeTrace(VaapiDPBManagerTest& test, const TracePicture* trace, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        test.decodeFrame(trace[i].poc, trace[i].isReference, !i);
+}
+
+template <class T>
+static void expectVector(const T* expected, size_t count, const std::vector<T>& actual)
+{
+    EXPECT_EQ(count, actual.size());
+    for (size_t i = 0; i < count && i < actual.size(); i++)
+        EXPECT_EQ(expected[i], actual[i]);
+}
+
+static void testNoReorder()
+{
+    VaapiDPBManagerTest test(4, 0);
+    const TracePicture trace[] = { { 0, true }, { 2, true }, { 4, true }, { 6, true } };
+    decodeTrace(test, trace, N_ELEMENTS(trace));
+    //each picture is output once it is added
+    const int32_t output[] = { 0, 2, 4, 6 };
+    const size_t counts[] = { 1, 2, 3, 4 };
+    expectVector(output, N_ELEMENTS(output), test.m_output);
+    expectVector(counts, N_ELEMENTS(counts), test.m_outputCounts);
+}
+
+static void testReorder()
+{
+    VaapiDPBManagerTest test(4, 2);
+    decodeTrace(test, ipbbTrace, N_ELEMENTS(ipbbTrace));
+    //a picture is output when a third one waits
+    const size_t counts[] = { 0, 0, 1, 2, 3, 4, 5 };
+    expectVector(counts, N_ELEMENTS(counts), test.m_outputCounts);
+    test.drain();
+    const int32_t output[] = { 0, 2, 4, 6, 8, 10, 12 };
+    expectVector(output, N_ELEMENTS(output), test.m_output);
+}
+
+static void testLowDelay()
+{
+    //WANT_LOW_DELAY, a reordering stream is output in decoding order
+    VaapiDPBManagerTest test(4, 0);
+    decodeTrace(test, ipbbTrace, N_ELEMENTS(ipbbTrace));
+    const int32_t output[] = { 0, 6, 2, 4, 12, 8, 10 };
+    const size_t counts[] = { 1, 2, 3, 4, 5, 6, 7 };
+    expectVector(output, N_ELEMENTS(output), test.m_output);
+    expectVector(counts, N_ELEMENTS(counts), test.m_outputCounts);
+}
+
+static void testFullDPB()
+{
+    //no bitstream restriction, pictures wait until the DPB is full
+    VaapiDPBManagerTest test(3, 3);
+    decodeTrace(test, ipbbTrace, 4);
+    //the referenced 0 keeps its place after it is output, 2 is bumped too
+    const size_t counts[] = { 0, 0, 0, 2 };
+    expectVector(counts, N_ELEMENTS(counts), test.m_outputCounts);
+    test.drain();
+    const int32_t output[] = { 0, 2, 4, 6 };
+    expectVector(output, N_ELEMENTS(output), test.m_output);
+}
+
+static void testSlidingWindow()
+{
+    VaapiDPBManagerTest test(2, 2);
+    test.decodeFrame(0, true, true);
+    test.decodeFrame(2, true);
+    test.unmarkReference(0);
+    //0 is neither referenced nor waiting for output after it is bumped, so 4 gets its place
+    test.decodeFrame(4, true);
+    test.unmarkReference(2);
+    test.decodeFrame(6, true);
+    test.drain();
+    const int32_t output[] = { 0, 2, 4, 6 };
+    const size_t counts[] = { 0, 0, 1, 2 };
+    expectVector(output, N_ELEMENTS(output), test.m_output);
+    expectVector(counts, N_ELEMENTS(counts), test.m_outputCounts);
+}
+
+static void testFields()
+{
+    VaapiDPBManagerTest test(4, 0);
+    test.decodeFields(0, true);
+    test.decodeFields(2, true);
+    //a frame is output once its second field is added
+    const int32_t output[] = { 0, 2 };
+    const size_t counts[] = { 0, 1, 1, 2 };
+    expectVector(output, N_ELEMENTS(output), test.m_output);
+    expectVector(counts, N_ELEMENTS(counts), test.m_outputCounts);
+}
+
+static void testIdr()
+{
+    VaapiDPBManagerTest test(4, 2);
+    test.decodeFrame(0, true, true);
+    test.decodeFrame(4, true);
+    test.decodeFrame(2, false);
+    //the IDR outputs everything before it, the POC restarts
+    test.decodeFrame(0, true, true);
+    test.decodeFrame(2, true);
+    test.drain();
+    const int32_t output[] = { 0, 2, 4, 0, 2 };
+    const size_t counts[] = { 0, 0, 1, 3, 3 };
+    expectVector(output, N_ELEMENTS(output), test.m_output);
+    expectVector(counts, N_ELEMENTS(counts), test.m_outputCounts);
+}
+
+static void testMaxNumReorderFrames()
+{
+    H264SPS sps;
+    memset(&sps, 0, sizeof(sps));
+    //1920x1088 at level 4, 4 frames fit in the DPB
+    sps.profile_idc = 100;
+    sps.level_idc = 40;
+    sps.pic_width_in_mbs_minus1 = 119;
+    sps.pic_height_in_map_units_minus1 = 67;
+    sps.frame_mbs_only_flag = 1;
+    sps.num_ref_frames = 1;
+    EXPECT_EQ(4u, getMaxNumReorderFrames(&sps, false));
+    EXPECT_EQ(0u, getMaxNumReorderFrames(&sps, true));
+
+    sps.vui_parameters_present_flag = 1;
+    sps.vui_parameters.bitstream_restriction_flag = 1;
+    sps.vui_parameters.max_dec_frame_buffering = 3;
+    sps.vui_parameters.num_reorder_frames = 2;
+    EXPECT_EQ(2u, getMaxNumReorderFrames(&sps, false));
+    sps.vui_parameters.num_reorder_frames = 5;
+    EXPECT_EQ(3u, getMaxNumReorderFrames(&sps, false));
+
+    sps.pic_order_cnt_type = 2;
+    EXPECT_EQ(0u, getMaxNumReorderFrames(&sps, false));
+}
+
+int main()
+{
+    RUN_TEST(testNoReorder);
+    RUN_TEST(testReorder);
+    RUN_TEST(testLowDelay);
+    RUN_TEST(testFullDPB);
+    RUN_TEST(testSlidingWindow);
+    RUN_TEST(testFields);
+    RUN_TEST(testIdr);
+    RUN_TEST(testMaxNumReorderFrames);
+    return UNITTEST_RESULT();
+}
@@ -85,6 +85,7 @@ VaapiDecoderJpeg::VaapiDecoderJpeg()
 
 VaapiDecoderJpeg::~VaapiDecoderJpeg()
 {
+    stop();
 }
 
 Decode_Status
@@ -365,7 +366,7 @@ Decode_Status VaapiDecoderJpeg::decodePictureEnd()
 
     m_picture->m_timeStamp = m_currentPTS;
 
-    if (!m_picture->decode())
+    if (submitPicture(m_picture) != DECODE_SUCCESS)
         status = DECODE_FAIL;
     else if (!outputPicture(m_picture))
         status = DECODE_FAIL;
@@ -373,7 +374,7 @@ Decode_Status VaapiDecoderJpeg::decodePictureEnd()
     return status;
 }
 
-Decode_Status VaapiDecoderJpeg::decode(VideoDecodeBuffer * buffer)
+Decode_Status VaapiDecoderJpeg::doDecode(VideoDecodeBuffer * buffer)
 {
     Decode_Status status = DECODE_SUCCESS;
     JpegMarkerSegment seg;
@@ -546,6 +547,7 @@ Decode_Status VaapiDecoderJpeg::start(VideoConfigBuffer * buffer)
 Decode_Status VaapiDecoderJpeg::reset(VideoConfigBuffer * buffer)
 {
     DEBUG("Jpeg: reset()");
+    drainPipeline(true);
 
     if (m_picture) {
         m_picture.reset();
@@ -38,7 +38,9 @@ class VaapiDecoderJpeg:public VaapiDecoderBase {
     virtual Decode_Status reset(VideoConfigBuffer * buffer);
     virtual void stop(void);
     virtual void flush(void);
-    virtual Decode_Status decode(VideoDecodeBuffer * buf);
+
+  protected:
+    virtual Decode_Status doDecode(VideoDecodeBuffer * buf);
 
   private:
     Decode_Status parseFrameHeader(uint8_t * buf, uint32_t bufSize);
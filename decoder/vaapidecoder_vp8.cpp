@@ -334,6 +334,16 @@ bool VaapiDecoderVP8::ensureProbabilityTable(const PicturePtr&  pic)
     return true;
 }
 
+bool VaapiDecoderVP8::isReferenceFrame()
+{
+    return m_frameHdr.key_frame
+        || m_frameHdr.refresh_last
+        || m_frameHdr.refresh_golden_frame
+        || m_frameHdr.refresh_alternate_frame
+        || m_frameHdr.copy_buffer_to_golden
+        || m_frameHdr.copy_buffer_to_alternate;
+}
+
 void VaapiDecoderVP8::updateReferencePictures()
 {
     const PicturePtr& picture = m_currentPicture;
@@ -456,7 +466,7 @@ Decode_Status VaapiDecoderVP8::decodePicture()
 
     if (!fillSliceParam(sliceParam))
         return DECODE_FAIL;
-    if (!m_currentPicture->decode())
+    if (submitPicture(m_currentPicture) != DECODE_SUCCESS)
         return DECODE_FAIL;
 
     DEBUG("VaapiDecoderVP8::decodePicture success");
@@ -494,7 +504,8 @@ Decode_Status VaapiDecoderVP8::start(VideoConfigBuffer * buffer)
     }
 
     buffer->profile = VAProfileVP8Version0_3;
-    buffer->surfaceNumber = 3 + VP8_EXTRA_SURFACE_NUMBER;
+    //the surface pool adds the ones of the client
+    buffer->surfaceNumber = VP8_MAX_PICTURE_COUNT;
 
 
     DEBUG("disable native graphics buffer");
@@ -530,6 +541,7 @@ void VaapiDecoderVP8::flush(void)
 {
     DEBUG("VP8: flush()");
     /*FIXME: should output all surfaces in drain mode*/
+    drainPipeline(true);
     m_currentPicture.reset();
     m_lastPicture.reset();
     m_goldenRefPicture.reset();
@@ -538,7 +550,7 @@ void VaapiDecoderVP8::flush(void)
     VaapiDecoderBase::flush();
 }
 
-Decode_Status VaapiDecoderVP8::decode(VideoDecodeBuffer * buffer)
+Decode_Status VaapiDecoderVP8::doDecode(VideoDecodeBuffer * buffer)
 {
     Decode_Status status;
     Vp8ParserResult result;
@@ -570,6 +582,12 @@ Decode_Status VaapiDecoderVP8::decode(VideoDecodeBuffer * buffer)
             if (status != DECODE_SUCCESS)
                 return status;
         }
+
+        //the parser keeps the probabilities of a skipped frame
+        if (skipPicture(m_frameHdr.key_frame, isReferenceFrame(), m_currentPTS)) {
+            DEBUG("VP8: skip frame, timestamp=%ld", m_currentPTS);
+            break;
+        }
 #if __PSB_CACHE_DRAIN_FOR_FIRST_FRAME__
         int ii = 0;
         int decodeCount = 1;
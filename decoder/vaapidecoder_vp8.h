@@ -38,7 +38,6 @@
 
 namespace YamiMediaCodec{
 enum {
-    VP8_EXTRA_SURFACE_NUMBER = 5,
     VP8_MAX_PICTURE_COUNT = 5,  // gold_ref, alt_ref, last_ref, previous (m_currentPicture, optional), and the newly allocated one
 };
 
@@ -51,7 +50,9 @@ class VaapiDecoderVP8:public VaapiDecoderBase {
     virtual Decode_Status reset(VideoConfigBuffer * buffer);
     virtual void stop(void);
     virtual void flush(void);
-    virtual Decode_Status decode(VideoDecodeBuffer * buffer);
+
+  protected:
+    virtual Decode_Status doDecode(VideoDecodeBuffer * buffer);
 
   private:
     bool allocNewPicture();
@@ -64,6 +65,7 @@ class VaapiDecoderVP8:public VaapiDecoderBase {
     Decode_Status ensureContext();
     /* decoding functions */
     Decode_Status decodePicture();
+    bool isReferenceFrame();
     void updateReferencePictures();
   private:
     PicturePtr m_currentPicture;
@@ -52,8 +52,8 @@ Decode_Status VaapiDecoderVP9::start(VideoConfigBuffer * buffer)
           buffer->height);
 
     buffer->profile = VAProfileVP9Profile0;
-    //8 reference frame + extra number
-    buffer->surfaceNumber = 8 + VP9_EXTRA_SURFACE_NUMBER;
+    //reference frames and the one in decoding, the surface pool adds the ones of the client
+    buffer->surfaceNumber = VP9_REF_FRAMES + 1;
 
 
     DEBUG("disable native graphics buffer");
@@ -80,6 +80,7 @@ void VaapiDecoderVP9::stop(void)
 
 void VaapiDecoderVP9::flush(void)
 {
+    drainPipeline(true);
     m_parser.reset(vp9_parser_new(), vp9_parser_free);
     m_reference.clear();
     m_reference.resize(VP9_REF_FRAMES);
@@ -89,19 +90,17 @@ void VaapiDecoderVP9::flush(void)
 
 Decode_Status VaapiDecoderVP9::ensureContext(const Vp9FrameHdr* hdr)
 {
-    // only reset va context when there is a larger frame
+    // only reset va context when there is a larger frame,
+    // resetVA() keeps it if the surfaces were allocated larger before
     if (m_configBuffer.width < hdr->width
         || m_configBuffer.height <  hdr->height) {
         INFO("frame size changed, reconfig codec. orig size %d x %d, new size: %d x %d",
                 m_configBuffer.width, m_configBuffer.height, hdr->width, hdr->height);
-        Decode_Status status = VaapiDecoderBase::terminateVA();
-        if (status != DECODE_SUCCESS)
-            return status;
         m_configBuffer.width = hdr->width;
         m_configBuffer.height = hdr->height;
         m_configBuffer.surfaceWidth = ALIGN8(hdr->width);
         m_configBuffer.surfaceHeight = ALIGN32(hdr->height);
-        status = VaapiDecoderBase::start(&m_configBuffer);
+        Decode_Status status = VaapiDecoderBase::resetVA(&m_configBuffer);
         if (status != DECODE_SUCCESS)
             return status;
         return DECODE_FORMAT_CHANGE;
@@ -249,6 +248,20 @@ Decode_Status VaapiDecoderVP9::decode(const Vp9FrameHdr* hdr, const uint8_t* dat
     if (ret != DECODE_SUCCESS)
         return ret;
 
+    //showing an existing frame costs nothing, it is only skipped in the key frame modes
+    bool isKey = hdr->frame_type == VP9_KEY_FRAME && !hdr->show_existing_frame;
+    bool isReference = isKey || hdr->show_existing_frame || hdr->refresh_frame_flags;
+    //the driver keeps the probability contexts, a frame which saves or resets them
+    //changes how the later frames decode even when it refreshes no reference slot
+    if (hdr->refresh_frame_context && !hdr->error_resilient_mode)
+        isReference = true;
+    if (hdr->error_resilient_mode || (hdr->intra_only && hdr->reset_frame_context >= 2))
+        isReference = true;
+    if (skipPicture(isKey, isReference, timeStamp)) {
+        DEBUG("VP9: skip frame, timestamp=%ld", timeStamp);
+        return DECODE_SUCCESS;
+    }
+
     PicturePtr picture = createPicture(timeStamp);
     if (!picture)
         return DECODE_MEMORY_FAIL;
@@ -272,7 +285,7 @@ Decode_Status VaapiDecoderVP9::decode(const Vp9FrameHdr* hdr, const uint8_t* dat
         return DECODE_FAIL;
     if (!ensureSlice(picture, data, size))
         return DECODE_FAIL;
-    ret = picture->decode();
+    ret = submitPicture(picture);
     if (ret != DECODE_SUCCESS)
         return ret;
     updateReference(picture, hdr);
@@ -310,7 +323,7 @@ static bool parse_super_frame(std::vector<uint32_t>& frameSize, const uint8_t* d
     return true;
 }
 
-Decode_Status VaapiDecoderVP9::decode(VideoDecodeBuffer * buffer)
+Decode_Status VaapiDecoderVP9::doDecode(VideoDecodeBuffer * buffer)
 {
     Decode_Status status;
     if (!buffer)
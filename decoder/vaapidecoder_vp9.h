@@ -30,9 +30,6 @@
 #include <vector>
 
 namespace YamiMediaCodec{
-enum {
-    VP9_EXTRA_SURFACE_NUMBER = 5,
-};
 
 class VaapiDecoderVP9:public VaapiDecoderBase {
   public:
@@ -43,7 +40,9 @@ class VaapiDecoderVP9:public VaapiDecoderBase {
     virtual Decode_Status reset(VideoConfigBuffer * );
     virtual void stop(void);
     virtual void flush(void);
-    virtual Decode_Status decode(VideoDecodeBuffer *);
+
+  protected:
+    virtual Decode_Status doDecode(VideoDecodeBuffer *);
 
   private:
     Decode_Status ensureContext(const Vp9FrameHdr* );
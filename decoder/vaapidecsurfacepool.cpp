@@ -29,17 +29,21 @@
 #include "vaapi/vaapidisplay.h"
 #include "vaapi/vaapisurface.h"
 #include "vaapi/vaapiimagepool.h"
+#include <algorithm>
 #include <string.h>
 #include <assert.h>
 
 namespace YamiMediaCodec{
 const uint32_t IMAGE_POOL_SIZE = 8;
+//output surfaces the client holds, if it does not tell. the pool never grows, so leave
+//room for sinks which keep a few frames queued
+const uint32_t DEFAULT_RENDER_DEPTH = 5;
 
 DecSurfacePoolPtr VaapiDecSurfacePool::create(const DisplayPtr& display, VideoConfigBuffer* config)
 {
     DecSurfacePoolPtr pool;
     std::vector<SurfacePtr> surfaces;
-    size_t size = config->surfaceNumber;
+    size_t size = surfaceCount(config);
     surfaces.reserve(size);
     assert(!(config->flag & WANT_SURFACE_PROTECTION));
     assert(!(config->flag & USE_NATIVE_GRAPHIC_BUFFER));
@@ -52,29 +56,72 @@ DecSurfacePoolPtr VaapiDecSurfacePool::create(const DisplayPtr& display, VideoCo
         s->resize(config->width, config->height);
         surfaces.push_back(s);
     }
-    pool.reset(new VaapiDecSurfacePool(display, surfaces));
+    pool.reset(new VaapiDecSurfacePool(display, config, surfaces));
+    DEBUG("surface pool has %d surfaces", (int)size);
     return pool;
 }
 
-VaapiDecSurfacePool::VaapiDecSurfacePool(const DisplayPtr& display, std::vector<SurfacePtr> surfaces):
+uint32_t VaapiDecSurfacePool::surfaceCount(const VideoConfigBuffer* config)
+{
+    uint32_t renderDepth = config->renderDepth ? config->renderDepth : DEFAULT_RENDER_DEPTH;
+    return config->surfaceNumber + renderDepth;
+}
+
+bool VaapiDecSurfacePool::reuse(VideoConfigBuffer* config)
+{
+    if ((uint32_t)config->surfaceWidth > m_surfaceWidth
+        || (uint32_t)config->surfaceHeight > m_surfaceHeight
+        || surfaceCount(config) > m_surfaces.size())
+        return false;
+
+    m_width = config->width;
+    m_height = config->height;
+    //the surfaces of the old stream come back later, do not wait for them
+    setWaitable(true);
+    DEBUG("surface pool is reused for %d x %d", m_width, m_height);
+    return true;
+}
+
+VaapiDecSurfacePool::VaapiDecSurfacePool(const DisplayPtr& display, VideoConfigBuffer* config,
+                                         std::vector<SurfacePtr>& surfaces):
     m_display(display),
+    m_surfaceWidth(config->surfaceWidth),
+    m_surfaceHeight(config->surfaceHeight),
+    m_width(config->width),
+    m_height(config->height),
+    m_allocated(0),
+    m_freed(surfaces.size()),
+    m_output(surfaces.size()),
     m_cond(m_lock),
+    m_waiters(0),
     m_flushing(false)
 {
     size_t size = surfaces.size();
     m_surfaces.swap(surfaces);
     m_renderBuffers.resize(size);
+    m_states.resize(size, SURFACE_FREE);
+    m_slots.reserve(size);
     for (size_t i = 0; i < size; ++i) {
-        const SurfacePtr& s = m_surfaces[i];
         VASurfaceID id = m_surfaces[i]->getID();
         m_renderBuffers[i].display = display->getID();
         m_renderBuffers[i].surface = id;
         m_renderBuffers[i].timeStamp = 0;
 
-        m_renderMap[id] = &m_renderBuffers[i];
-        m_surfaceMap[id] = s.get();
-        m_freed.push_back(id);
+        m_slots.push_back(std::make_pair(id, (uint32_t)i));
+        m_freed.push(i);
     }
+    std::sort(m_slots.begin(), m_slots.end());
+}
+
+bool VaapiDecSurfacePool::slotOf(VASurfaceID id, uint32_t& slot) const
+{
+    //no need hold lock, it never changed from start
+    SlotMap::const_iterator it = std::lower_bound(m_slots.begin(), m_slots.end(),
+                                                  std::make_pair(id, (uint32_t)0));
+    if (it == m_slots.end() || it->first != id)
+        return false;
+    slot = it->second;
+    return true;
 }
 
 void VaapiDecSurfacePool::getSurfaceIDs(std::vector<VASurfaceID>& ids)
@@ -90,66 +137,75 @@ void VaapiDecSurfacePool::getSurfaceIDs(std::vector<VASurfaceID>& ids)
 
 struct VaapiDecSurfacePool::SurfaceRecycler
 {
-    SurfaceRecycler(const DecSurfacePoolPtr& pool): m_pool(pool) {}
-    void operator()(VaapiSurface* surface) { m_pool->recycle(surface->getID(), SURFACE_DECODING);}
+    SurfaceRecycler(const DecSurfacePoolPtr& pool, uint32_t slot): m_pool(pool), m_slot(slot) {}
+    void operator()(VaapiSurface* surface) { m_pool->recycle(m_slot, SURFACE_DECODING);}
 private:
     DecSurfacePoolPtr m_pool;
+    uint32_t m_slot;
 };
 
 SurfacePtr VaapiDecSurfacePool::acquireWithWait()
 {
     SurfacePtr surface;
-    AutoLock lock(m_lock);
-    while (m_freed.empty() && !m_flushing) {
-        DEBUG("wait because there is no available surface from pool");
-        m_cond.wait();
+    uint32_t slot;
+    bool got = !isFlushing() && m_freed.pop(slot);
+
+    if (!got && !isFlushing()) {
+        AutoLock lock(m_lock);
+        //recycle() checks m_waiters after it pushed the slot, so either it sees us
+        //or we see the slot
+        __atomic_add_fetch(&m_waiters, 1, __ATOMIC_SEQ_CST);
+        while (!isFlushing() && !(got = m_freed.pop(slot))) {
+            DEBUG("wait because there is no available surface from pool");
+            m_cond.wait();
+        }
+        __atomic_sub_fetch(&m_waiters, 1, __ATOMIC_SEQ_CST);
     }
 
-    if (m_flushing) {
+    if (!got) {
         DEBUG("input flushing, return nil surface");
         return surface;
     }
 
-    assert(!m_freed.empty());
-    VASurfaceID id = m_freed.front();
-    m_freed.pop_front();
-    m_allocated[id] = SURFACE_DECODING;
-    VaapiSurface* s = m_surfaceMap[id];
-    surface.reset(s, SurfaceRecycler(shared_from_this()));
+    __atomic_store_n(&m_states[slot], SURFACE_DECODING, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&m_allocated, 1, __ATOMIC_SEQ_CST);
+    const SurfacePtr& s = m_surfaces[slot];
+    if (s->getWidth() != m_width || s->getHeight() != m_height)
+        s->resize(m_width, m_height);
+    surface.reset(m_surfaces[slot].get(), SurfaceRecycler(shared_from_this(), slot));
     return surface;
 }
 
 bool VaapiDecSurfacePool::output(const SurfacePtr& surface, int64_t timeStamp)
 {
-    VASurfaceID id = surface->getID();
+    uint32_t slot;
 
-    AutoLock lock(m_lock);
-    const Allocated::iterator it = m_allocated.find(id);
-    if (it == m_allocated.end())
+    if (!slotOf(surface->getID(), slot))
+        return false;
+    //only the decoder, which holds the surface, outputs it
+    if (__atomic_load_n(&m_states[slot], __ATOMIC_ACQUIRE) == SURFACE_FREE)
         return false;
-    assert(it->second == SURFACE_DECODING);
-    it->second |= SURFACE_TO_RENDER;
-    VideoRenderBuffer* buffer = m_renderMap[id];
-    buffer->timeStamp = timeStamp;
+    uint32_t state = __atomic_fetch_or(&m_states[slot], SURFACE_TO_RENDER, __ATOMIC_ACQ_REL);
+    assert(state == SURFACE_DECODING);
+    m_renderBuffers[slot].timeStamp = timeStamp;
     DEBUG("surface=0x%x is output-able with timeStamp=%ld", surface->getID(), timeStamp);
-    m_output.push_back(buffer);
+    if (!m_output.push(slot))
+        assert(0 && "output queue can hold all surfaces");
     return true;
 }
 
 VideoRenderBuffer* VaapiDecSurfacePool::getOutput()
 {
-    AutoLock lock(m_lock);
-    if (m_output.empty())
+    uint32_t slot;
+
+    if (!m_output.pop(slot))
         return NULL;
-    VideoRenderBuffer* buffer = m_output.front();
-    m_output.pop_front();
-    const Allocated::iterator it = m_allocated.find(buffer->surface);
-    assert(it != m_allocated.end());
-    assert(it->second & SURFACE_TO_RENDER);
-    assert(!(it->second & SURFACE_RENDERING));
     //clear SURFACE_TO_RENDER and set SURFACE_RENDERING
-    it->second ^= SURFACE_RENDERING | SURFACE_TO_RENDER;
-    return buffer;
+    uint32_t state = __atomic_fetch_xor(&m_states[slot],
+        SURFACE_RENDERING | SURFACE_TO_RENDER, __ATOMIC_ACQ_REL);
+    assert(state & SURFACE_TO_RENDER);
+    assert(!(state & SURFACE_RENDERING));
+    return &m_renderBuffers[slot];
 }
 
 struct VaapiDecSurfacePool::SurfaceRecyclerRender
@@ -167,8 +223,8 @@ bool VaapiDecSurfacePool::ensureImagePool(VideoFrameRawData &frame)
         return true;
 
     if (!frame.width || !frame.height) {
-        frame.width = m_surfaces[0]->getWidth();
-        frame.height = m_surfaces[0]->getHeight();
+        frame.width = m_width;
+        frame.height = m_height;
     }
 
     DEBUG("create image pool with fourcc:%.4s, size=%dx%d", (char*)(&frame.fourcc), frame.width, frame.height);
@@ -221,7 +277,7 @@ bool VaapiDecSurfacePool::getOutput(VideoFrameRawData* frame)
         return false;
 
     SurfacePtr surface;
-    VaapiSurface *srf = m_surfaceMap[buffer->surface];
+    VaapiSurface *srf = m_surfaces[buffer - &m_renderBuffers[0]].get();
     ASSERT(srf);
     surface.reset(srf, SurfaceRecyclerRender(shared_from_this(), buffer));
 
@@ -271,7 +327,7 @@ bool VaapiDecSurfacePool::populateOutputHandles(VideoFrameRawData *frames, uint3
         if (frames[0].fourcc && frames[0].fourcc != VA_FOURCC_NV12)
             frameCount = IMAGE_POOL_SIZE;
         else //  export the video frame as its internal format
-            frameCount = m_renderBuffers.size();
+            frameCount = m_surfaces.size();
         return true;
     }
 
@@ -300,10 +356,11 @@ bool VaapiDecSurfacePool::populateOutputHandles(VideoFrameRawData *frames, uint3
 
 void VaapiDecSurfacePool::setWaitable(bool waitable)
 {
-    m_flushing = !waitable;
-
-    if (!waitable) {
-        m_cond.signal();
+    {
+        AutoLock lock(m_lock);
+        __atomic_store_n(&m_flushing, !waitable, __ATOMIC_RELEASE);
+        if (!waitable)
+            m_cond.broadcast();
     }
     if (m_imagePool)
         m_imagePool->setWaitable(waitable);
@@ -311,38 +368,49 @@ void VaapiDecSurfacePool::setWaitable(bool waitable)
 
 void VaapiDecSurfacePool::flush()
 {
+    uint32_t slot;
+
+    while (m_output.pop(slot))
+        recycle(slot, SURFACE_TO_RENDER);
+
     AutoLock lock(m_lock);
-    for (OutputQueue::iterator it = m_output.begin();
-        it != m_output.end(); ++it) {
-        recycleLocked((*it)->surface, SURFACE_TO_RENDER);
-    }
-    m_output.clear();
-    //still have unreleased surface
-    if (!m_allocated.empty())
-        m_flushing = true;
+    //still have unreleased surface, the last recycle() clears m_flushing
+    if (__atomic_load_n(&m_allocated, __ATOMIC_SEQ_CST))
+        __atomic_store_n(&m_flushing, true, __ATOMIC_RELEASE);
 }
 
-void VaapiDecSurfacePool::recycleLocked(VASurfaceID id, SurfaceState flag)
+bool VaapiDecSurfacePool::isFlushing() const
 {
-    const Allocated::iterator it = m_allocated.find(id);
-    if (it == m_allocated.end()) {
-        ERROR("try to recycle %u from state %d, it's not an allocated buffer", id, flag);
-        return;
-    }
-    it->second &= ~flag;
-    if (it->second == SURFACE_FREE) {
-        m_allocated.erase(it);
-        m_freed.push_back(id);
-        if (m_flushing && m_allocated.size() == 0)
-            m_flushing = false;
-        m_cond.signal();
-    }
+    return __atomic_load_n(&m_flushing, __ATOMIC_ACQUIRE);
 }
 
-void VaapiDecSurfacePool::recycle(VASurfaceID id, SurfaceState flag)
+void VaapiDecSurfacePool::wakeWaiter()
 {
     AutoLock lock(m_lock);
-    recycleLocked(id,flag);
+    m_cond.signal();
+}
+
+void VaapiDecSurfacePool::recycle(uint32_t slot, SurfaceState flag)
+{
+    uint32_t state = __atomic_fetch_and(&m_states[slot], ~flag, __ATOMIC_ACQ_REL);
+    if (!(state & flag)) {
+        ERROR("try to recycle %u from state %d, it's not an allocated buffer",
+            m_renderBuffers[slot].surface, flag);
+        return;
+    }
+    if (state != (uint32_t)flag)
+        return;
+
+    //the last flag is cleared, back to free queue
+    if (!m_freed.push(slot))
+        assert(0 && "free queue can hold all surfaces");
+    if (!__atomic_sub_fetch(&m_allocated, 1, __ATOMIC_SEQ_CST)) {
+        AutoLock lock(m_lock);
+        if (isFlushing() && !__atomic_load_n(&m_allocated, __ATOMIC_SEQ_CST))
+            __atomic_store_n(&m_flushing, false, __ATOMIC_RELEASE);
+    }
+    if (__atomic_load_n(&m_waiters, __ATOMIC_SEQ_CST))
+        wakeWaiter();
 }
 
 void VaapiDecSurfacePool::recycle(const VideoRenderBuffer * renderBuf)
@@ -352,7 +420,7 @@ void VaapiDecSurfacePool::recycle(const VideoRenderBuffer * renderBuf)
         ERROR("recycle invalid render buffer");
         return;
     }
-    recycle(renderBuf->surface, SURFACE_RENDERING);
+    recycle(renderBuf - &m_renderBuffers[0], SURFACE_RENDERING);
 }
 
 void VaapiDecSurfacePool::recycle(VideoFrameRawData* frame)
@@ -27,10 +27,10 @@
 #include "common/condition.h"
 #include "common/common_def.h"
 #include "common/lock.h"
+#include "common/lockfreequeue.h"
 #include "vaapi/vaapiptrs.h"
 #include "vaapi/vaapitypes.h"
 #include "interface/VideoDecoderDefs.h"
-#include <deque>
 #include <map>
 #include <vector>
 #include <va/va.h>
@@ -53,6 +53,12 @@ namespace YamiMediaCodec{
  * 3. most functions in this class do not support multithread except recycle.
  * 4. flush need called in decoder thread and it will make all following acuireWithWait return null surface.
  *    until all surface recycled.
+ * 5. surfaces are addressed by slot, their index in m_surfaces. the state flags are atomic and
+ *    the free and output queues are lock-free, m_lock is only taken to wait for a free surface
+ *    and to wake up the waiter.
+ * 6. it has config->surfaceNumber surfaces for the decoder plus config->renderDepth for the client.
+ *    they are the render targets of the decoder's VA context, so the pool never grows or shrinks,
+ *    and reuse fails for a stream which needs more of them.
  *</pre>
 */
 
@@ -61,6 +67,12 @@ class VaapiDecSurfacePool : public std::tr1::enable_shared_from_this<VaapiDecSur
 {
 public:
     static DecSurfacePoolPtr create(const DisplayPtr&, VideoConfigBuffer* config);
+    /// keeps the surfaces for a new stream of @config, false if they are too small or too few.
+    /// a surface is resized when it is acquired again
+    bool reuse(VideoConfigBuffer* config);
+    /// the size the surfaces were allocated with, a reused pool keeps it for smaller streams
+    uint32_t surfaceWidth() const { return m_surfaceWidth; }
+    uint32_t surfaceHeight() const { return m_surfaceHeight; }
     void getSurfaceIDs(std::vector<VASurfaceID>& ids);
     /// get a free surface,
     /// it always return null buffer if it's flushed.
@@ -95,31 +107,42 @@ private:
         SURFACE_RENDERING = 0x00000004
     };
 
-    VaapiDecSurfacePool(const DisplayPtr&, std::vector<SurfacePtr>);
+    VaapiDecSurfacePool(const DisplayPtr&, VideoConfigBuffer* config, std::vector<SurfacePtr>& surfaces);
 
-    void recycleLocked(VASurfaceID, SurfaceState);
-    void recycle(VASurfaceID, SurfaceState);
+    static uint32_t surfaceCount(const VideoConfigBuffer* config);
+    bool slotOf(VASurfaceID, uint32_t& slot) const;
+    void recycle(uint32_t slot, SurfaceState);
+    bool isFlushing() const;
+    void wakeWaiter();
 
     //following member only change in constructor.
     DisplayPtr m_display;
+    uint32_t m_surfaceWidth;
+    uint32_t m_surfaceHeight;
     std::vector<VideoRenderBuffer> m_renderBuffers;
     std::vector<SurfacePtr> m_surfaces;
-    typedef std::map<VASurfaceID, VideoRenderBuffer*> RenderMap;
-    RenderMap m_renderMap;
-    typedef std::map<VASurfaceID, VaapiSurface*> SurfaceMap;
-    SurfaceMap m_surfaceMap;
+    //(surface id, slot), sorted by surface id
+    typedef std::vector<std::pair<VASurfaceID, uint32_t> > SlotMap;
+    SlotMap m_slots;
 
-    //free and allocted.
-    std::deque<VASurfaceID> m_freed;
-    typedef std::map<VASurfaceID, uint32_t> Allocated;
-    Allocated m_allocated;
+    //following members only change in reuse()
+    uint32_t m_width;
+    uint32_t m_height;
 
+    //SurfaceState of each slot
+    std::vector<uint32_t> m_states;
+    //slots not in SURFACE_FREE
+    uint32_t m_allocated;
+
+    LockFreeQueue m_freed;
     /* output queue*/
-    typedef std::deque<VideoRenderBuffer*> OutputQueue;
-    OutputQueue m_output;
+    LockFreeQueue m_output;
 
+    //for waiting on m_freed only
     Lock m_lock;
     Condition m_cond;
+    uint32_t m_waiters;
+    //written under m_lock, acquireWithWait() also reads it without
     bool m_flushing;
 
     struct SurfaceRecycler;
@@ -39,9 +39,26 @@ CodedBufferPtr VaapiCodedBuffer::create(const ContextPtr& context, uint32_t bufS
 
 bool VaapiCodedBuffer::map()
 {
+    if (m_segments)
+        return true;
+    m_segments = static_cast<VACodedBufferSegment*>(m_buf->map());
     if (!m_segments)
-        m_segments = static_cast<VACodedBufferSegment*>(m_buf->map());
-    return m_segments != NULL;
+        return false;
+    //the driver could not keep a slice within the max slice size
+    VACodedBufferSegment* segment = m_segments;
+    while (segment != NULL) {
+        if (segment->status & VA_CODED_BUF_STATUS_SLICE_OVERFLOW_MASK)
+            m_flags |= ENCODE_BUFFERFLAG_SLICEOVERFOLOW;
+        segment = static_cast<VACodedBufferSegment*>(segment->next);
+    }
+    return true;
+}
+
+void VaapiCodedBuffer::reset()
+{
+    m_buf->unmap();
+    m_segments = NULL;
+    m_flags = 0;
 }
 
 uint32_t VaapiCodedBuffer::size()
@@ -72,4 +89,59 @@ bool VaapiCodedBuffer::copyInto(void* data)
     }
     return true;
 }
+
+bool VaapiCodedBuffer::getSegments(std::vector<VideoCodedSegment>& segments)
+{
+    if (!map())
+        return false;
+    VACodedBufferSegment* segment = m_segments;
+    while (segment != NULL) {
+        if (segment->size) {
+            VideoCodedSegment s;
+            s.data = static_cast<uint8_t*>(segment->buf);
+            s.size = segment->size;
+            segments.push_back(s);
+        }
+        segment = static_cast<VACodedBufferSegment*>(segment->next);
+    }
+    return true;
+}
+
+VaapiCodedFrame::VaapiCodedFrame()
+{
+    segments = NULL;
+    numSegments = 0;
+    dataSize = 0;
+    flag = 0;
+    timeStamp = 0;
+}
+
+void VaapiCodedFrame::addSegment(const uint8_t* data, uint32_t size, const SharedPtr<void>& owner)
+{
+    VideoCodedSegment segment;
+    segment.data = data;
+    segment.size = size;
+    m_segments.push_back(segment);
+    m_owners.push_back(owner);
+    update();
+}
+
+bool VaapiCodedFrame::addCodedBuffer(const CodedBufferPtr& buffer)
+{
+    if (!buffer || !buffer->getSegments(m_segments))
+        return false;
+    m_owners.push_back(buffer);
+    flag |= buffer->getFlags();
+    update();
+    return true;
+}
+
+void VaapiCodedFrame::update()
+{
+    segments = m_segments.empty() ? NULL : &m_segments[0];
+    numSegments = m_segments.size();
+    dataSize = 0;
+    for (size_t i = 0; i < m_segments.size(); i++)
+        dataSize += m_segments[i].size;
+}
 }
@@ -22,10 +22,12 @@
 #ifndef vaapicodedbuffer_h
 #define vaapicodedbuffer_h
 
+#include "interface/VideoEncoderDefs.h"
 #include "vaapi/vaapibuffer.h"
 #include "vaapi/vaapiptrs.h"
 #include "vaapi/vaapitypes.h"
 #include <stdlib.h>
+#include <vector>
 
 namespace YamiMediaCodec{
 class VaapiCodedBuffer
@@ -38,9 +40,13 @@ public:
         return m_buf->getID();
     }
     bool copyInto(void* data);
+    /// append the mapped segments, they are valid until the buffer is reset or released
+    bool getSegments(std::vector<VideoCodedSegment>& segments);
     bool setFlag(uint32_t flag) { m_flags |= flag; return true; }
     bool clearFlag(uint32_t flag) { m_flags &= !flag; return true; }
     uint32_t getFlags() { return m_flags; }
+    /// unmap and clear flags, so the buffer can be used for another frame
+    void reset();
 
 private:
     VaapiCodedBuffer(const BufObjectPtr& buf):m_buf(buf), m_segments(NULL), m_flags(0) {}
@@ -49,5 +55,23 @@ private:
     VACodedBufferSegment* m_segments;
     uint32_t m_flags;
 };
+
+/**
+ * VideoCodedFrame for the zero copy getOutput,
+ * it holds whatever its segments point to: the mapped coded buffer, stream headers...
+ */
+class VaapiCodedFrame : public VideoCodedFrame
+{
+public:
+    VaapiCodedFrame();
+    void addSegment(const uint8_t* data, uint32_t size, const SharedPtr<void>& owner);
+    bool addCodedBuffer(const CodedBufferPtr&);
+
+private:
+    void update();
+    std::vector<VideoCodedSegment> m_segments;
+    std::vector<SharedPtr<void> > m_owners;
+    DISALLOW_COPY_AND_ASSIGN(VaapiCodedFrame);
+};
 }
 #endif //vaapicodedbuffer_h
@@ -0,0 +1,74 @@
+/*
+ *  vaapicodedbufferpool.cpp - coded buffer pool used for encoding
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "vaapicodedbufferpool.h"
+
+#include "vaapicodedbuffer.h"
+
+namespace YamiMediaCodec{
+
+CodedBufferPoolPtr VaapiCodedBufferPool::create(const ContextPtr& context, uint32_t bufSize, uint32_t size)
+{
+    CodedBufferPoolPtr pool;
+    if (!context || !bufSize || !size)
+        return pool;
+    pool.reset(new VaapiCodedBufferPool(context, bufSize, size));
+    return pool;
+}
+
+VaapiCodedBufferPool::VaapiCodedBufferPool(const ContextPtr& context, uint32_t bufSize, uint32_t size)
+    : VaapiEncPool<VaapiCodedBuffer, CodedBufferPtr>(size)
+    , m_context(context)
+    , m_bufSize(bufSize)
+{
+}
+
+CodedBufferPtr VaapiCodedBufferPool::acquire()
+{
+    CodedBufferPtr entry;
+    return acquireEntry(entry);
+}
+
+bool VaapiCodedBufferPool::createEntry(CodedBufferPtr& entry)
+{
+    entry = VaapiCodedBuffer::create(m_context, m_bufSize);
+    return bool(entry);
+}
+
+CodedBufferPtr VaapiCodedBufferPool::getObject(const CodedBufferPtr& entry) const
+{
+    return entry;
+}
+
+void VaapiCodedBufferPool::resetEntry(CodedBufferPtr& entry)
+{
+    entry->reset();
+}
+
+bool VaapiCodedBufferPool::isCompatible(const ContextPtr& context, uint32_t bufSize) const
+{
+    return m_context == context && m_bufSize >= bufSize;
+}
+
+} //namespace YamiMediaCodec
@@ -0,0 +1,66 @@
+/*
+ *  vaapicodedbufferpool.h - coded buffer pool used for encoding
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapicodedbufferpool_h
+#define vaapicodedbufferpool_h
+
+#include "common/common_def.h"
+#include "vaapi/vaapiptrs.h"
+#include "vaapi/vaapitypes.h"
+#include "vaapiencpool.h"
+
+namespace YamiMediaCodec{
+
+/**
+ * \class VaapiCodedBufferPool
+ * \brief recycles coded buffers, they are big (a few MB for 4K) and needed for every frame.
+ * <pre>
+ * 1. buffers are created on demand, up to the pool size, and go back to the pool
+ *    when the picture holding them is dropped from the output queue.
+ * 2. a recycled buffer is unmapped and its flags are cleared.
+ * 3. when all pooled buffers are in flight, acquire() creates a temporary buffer.
+ *</pre>
+*/
+class VaapiCodedBufferPool : public VaapiEncPool<VaapiCodedBuffer, CodedBufferPtr>
+{
+public:
+    static CodedBufferPoolPtr create(const ContextPtr&, uint32_t bufSize, uint32_t size);
+
+    CodedBufferPtr acquire();
+
+    /// the pooled buffers belong to the context and are at least bufSize
+    bool isCompatible(const ContextPtr&, uint32_t bufSize) const;
+
+private:
+    VaapiCodedBufferPool(const ContextPtr&, uint32_t bufSize, uint32_t size);
+    virtual bool createEntry(CodedBufferPtr&);
+    virtual CodedBufferPtr getObject(const CodedBufferPtr&) const;
+    virtual void resetEntry(CodedBufferPtr&);
+
+    ContextPtr m_context;
+    uint32_t m_bufSize;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiCodedBufferPool);
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapicodedbufferpool_h
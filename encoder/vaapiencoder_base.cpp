@@ -27,20 +27,42 @@
 #include "vaapiencoder_base.h"
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
 #include "common/common_def.h"
 #include "common/utils.h"
 #include "scopedlogger.h"
 #include "vaapicodedbuffer.h"
+#include "vaapicodedbufferpool.h"
+#include "vaapiencsurfacepool.h"
+#include "vaapiratecontrol.h"
 #include "vaapi/vaapidisplay.h"
 #include "vaapi/vaapicontext.h"
 #include "vaapi/vaapiutils.h"
 
 const uint32_t MaxOutputBuffer=5;
 namespace YamiMediaCodec{
+
+// the planar 4:2:0 formats, luma is the first plane
+static bool isPlanar420(uint32_t fourcc)
+{
+    return fourcc == VA_FOURCC_NV12 || fourcc == VA_FOURCC_I420 || fourcc == VA_FOURCC_YV12;
+}
+
 VaapiEncoderBase::VaapiEncoderBase():
     m_entrypoint(VAEntrypointEncSlice),
     m_maxOutputBuffer(MaxOutputBuffer),
-    m_maxCodedbufSize(0)
+    m_maxCodedbufSize(0),
+    m_outputCond(m_lock),
+    m_flushCount(0),
+    m_endOfStream(false),
+    m_totalEncodeTime(0),
+    m_configRatesChanged(false),
+    m_configResolutionChanged(false),
+    m_idrRequested(false),
+    m_ratesChanged(false),
+    m_contextWidth(0),
+    m_contextHeight(0),
+    m_maxRoiRegions(0)
 {
     FUNC_ENTER();
     m_externalDisplay.handle = 0,
@@ -63,6 +85,14 @@ VaapiEncoderBase::VaapiEncoderBase():
     m_videoParamCommon.refreshType = VIDEO_ENC_NONIR;
     m_videoParamCommon.airParams.airAuto = 1;
     m_videoParamCommon.leastInputCount = 0;
+    m_videoParamLookahead.size = sizeof(m_videoParamLookahead);
+    m_videoParamLookahead.lookaheadDepth = 0;
+    m_videoParamPipeline.size = sizeof(m_videoParamPipeline);
+    m_videoParamPipeline.pipelineDepth = 0;
+    m_videoParamStaticQp.size = sizeof(m_videoParamStaticQp);
+    m_videoParamStaticQp.staticQpDelta = 0;
+    memset(&m_statistics, 0, sizeof(m_statistics));
+    m_config = m_videoParamCommon;
 
     updateMaxOutputBufferCount();
 }
@@ -84,25 +114,53 @@ void VaapiEncoderBase::setNativeDisplay(NativeDisplay * nativeDisplay)
 Encode_Status VaapiEncoderBase::start(void)
 {
     FUNC_ENTER();
+    updateMaxOutputBufferCount();
     if (!initVA())
         return ENCODE_FAIL;
 
+    AutoLock l(m_rateControlLock);
+    m_rateControl = VaapiRateControl::create(m_videoParamCommon,
+        m_statsFile.empty() ? NULL : m_statsFile.c_str());
+    if (isHostRateControl() && !m_rateControl)
+        return ENCODE_INVALID_PARAMS;
     return ENCODE_SUCCESS;
 }
 
 void VaapiEncoderBase::flush(void)
 {
-    AutoLock l(m_lock);
-    m_output.clear();
+    {
+        AutoLock l(m_lock);
+        m_output.clear();
+    }
+    wakeOutput();
+    AutoLock l(m_rateControlLock);
+    if (m_rateControl)
+        m_rateControl->flush();
 }
 
 Encode_Status VaapiEncoderBase::stop(void)
 {
     FUNC_ENTER();
+    wakeOutput();
     cleanupVA();
+    //a first pass completes its statistics file here
+    AutoLock l(m_rateControlLock);
+    m_rateControl.reset();
     return ENCODE_SUCCESS;
 }
 
+bool VaapiEncoderBase::updateMaxOutputBufferCount()
+{
+    if (m_videoParamPipeline.pipelineDepth) {
+        m_maxOutputBuffer = m_videoParamPipeline.pipelineDepth;
+        return true;
+    }
+    m_maxOutputBuffer = MaxOutputBuffer;
+    if (m_maxOutputBuffer < m_videoParamCommon.leastInputCount + 3)
+        m_maxOutputBuffer = m_videoParamCommon.leastInputCount + 3;
+    return true;
+}
+
 bool VaapiEncoderBase::isBusy()
 {
     AutoLock l(m_lock);
@@ -117,10 +175,14 @@ Encode_Status VaapiEncoderBase::encode(VideoEncRawBuffer *inBuffer)
     if (!inBuffer)
         return ENCODE_SUCCESS;
     if (!inBuffer->data && !inBuffer->size) {
-        // XXX handle EOS when there is B frames
+        // EOS, encode the frames held back for reordering
         inBuffer->bufAvailable = true;
-        return ENCODE_SUCCESS;
+        return endOfStream();
     }
+    //the frame may be at the new resolution
+    Encode_Status ret = applyConfig();
+    if (ret != ENCODE_SUCCESS)
+        return ret;
     VideoFrameRawData frame;
     if (!fillFrameRawData(&frame, inBuffer->fourcc, width(), height(), inBuffer->data))
         return ENCODE_INVALID_PARAMS;
@@ -138,24 +200,109 @@ Encode_Status VaapiEncoderBase::encode(VideoFrameRawData* frame)
 
     FUNC_ENTER();
 
+    Encode_Status ret = applyConfig();
+    if (ret != ENCODE_SUCCESS)
+        return ret;
     if (isBusy())
         return ENCODE_IS_BUSY;
     SurfacePtr surface = createSurface(frame);
     if (!surface)
         return ENCODE_NO_MEMORY;
-    return doEncode(surface, frame->timeStamp, frame->flags & VIDEO_FRAME_FLAGS_KEY);
+    if (lookaheadDepth())
+        m_inputLuma = analyseLuma(frame);
+    int32_t staticQpDelta = m_videoParamStaticQp.staticQpDelta;
+    if (staticQpDelta && m_maxRoiRegions && isPlanar420(frame->fourcc)) {
+        const uint8_t* luma = reinterpret_cast<const uint8_t*>(frame->handle) + frame->offset[0];
+        AutoLock l(m_configLock);
+        m_staticDetector.detect(luma, frame->pitch[0], frame->width, frame->height, staticQpDelta, *nextRoi());
+    }
+    ret = submit(surface, frame->timeStamp, frame->flags & VIDEO_FRAME_FLAGS_KEY);
+    m_inputLuma.reset();
+    return ret;
 }
 
 Encode_Status VaapiEncoderBase::encode(const SharedPtr<VideoFrame>& frame)
 {
-    if (!frame || !frame->surface)
+    if (!frame)
+        return endOfStream();
+    if (!frame->surface)
         return ENCODE_INVALID_PARAMS;
+    Encode_Status ret = applyConfig();
+    if (ret != ENCODE_SUCCESS)
+        return ret;
     if (isBusy())
         return ENCODE_IS_BUSY;
     SurfacePtr surface = createSurface(frame);
     if (!surface)
         return ENCODE_INVALID_PARAMS;
-    return doEncode(surface, frame->timeStamp, frame->flags & VIDEO_FRAME_FLAGS_KEY);
+    return submit(surface, frame->timeStamp, frame->flags & VIDEO_FRAME_FLAGS_KEY);
+}
+
+// doEncode() with the time it takes recorded for getStatistics()
+Encode_Status VaapiEncoderBase::submit(const SurfacePtr& surface, uint64_t timeStamp, bool forceKeyFrame)
+{
+    uint64_t start = getSystemTime();
+    {
+        AutoLock l(m_configLock);
+        if (m_idrRequested) {
+            forceKeyFrame = true;
+            m_idrRequested = false;
+        }
+        m_inputRoi.swap(m_nextRoi);
+        m_nextRoi.reset();
+    }
+    if (m_inputRoi && m_inputRoi->isEmpty())
+        m_inputRoi.reset();
+    Encode_Status ret = doEncode(surface, timeStamp, forceKeyFrame);
+    m_inputRoi.reset();
+    uint32_t elapsed = getSystemTime() - start;
+
+    AutoLock l(m_lock);
+    m_endOfStream = false;
+    VideoStatistics& stat = m_statistics;
+    if (ret != ENCODE_SUCCESS) {
+        stat.skipped_frames++;
+        return ret;
+    }
+    if (!stat.total_frames || elapsed > stat.max_encode_time) {
+        stat.max_encode_time = elapsed;
+        stat.max_encode_frame = stat.total_frames;
+    }
+    if (!stat.total_frames || elapsed < stat.min_encode_time) {
+        stat.min_encode_time = elapsed;
+        stat.min_encode_frame = stat.total_frames;
+    }
+    stat.total_frames++;
+    m_totalEncodeTime += elapsed;
+    stat.average_encode_time = m_totalEncodeTime / stat.total_frames;
+    return ret;
+}
+
+// encode the held back frames, getOutput() stops waiting once they are all out
+Encode_Status VaapiEncoderBase::endOfStream()
+{
+    Encode_Status ret = drain();
+    AutoLock l(m_lock);
+    m_endOfStream = true;
+    m_outputCond.broadcast();
+    return ret;
+}
+
+// a getOutput() waiting for a picture returns ENCODE_BUFFER_NO_MORE
+void VaapiEncoderBase::wakeOutput()
+{
+    AutoLock l(m_lock);
+    m_flushCount++;
+    m_outputCond.broadcast();
+}
+
+Encode_Status VaapiEncoderBase::getStatistics(VideoStatistics* videoStat)
+{
+    if (!videoStat)
+        return ENCODE_INVALID_PARAMS;
+    AutoLock l(m_lock);
+    *videoStat = m_statistics;
+    return ENCODE_SUCCESS;
 }
 
 Encode_Status VaapiEncoderBase::getParameters(VideoParamConfigType type, Yami_PTR videoEncParams)
@@ -175,6 +322,38 @@ Encode_Status VaapiEncoderBase::getParameters(VideoParamConfigType type, Yami_PT
         }
         break;
     }
+    case VideoParamsTypeStatsFile: {
+        VideoParamsStatsFile* stats = (VideoParamsStatsFile*)videoEncParams;
+        if (stats->size == sizeof(VideoParamsStatsFile)) {
+            stats->path = m_statsFile.empty() ? NULL : m_statsFile.c_str();
+            ret = ENCODE_SUCCESS;
+        }
+        break;
+    }
+    case VideoParamsTypeLookahead: {
+        VideoParamsLookahead* lookahead = (VideoParamsLookahead*)videoEncParams;
+        if (lookahead->size == sizeof(VideoParamsLookahead)) {
+            PARAMETER_ASSIGN(*lookahead, m_videoParamLookahead);
+            ret = ENCODE_SUCCESS;
+        }
+        break;
+    }
+    case VideoParamsTypePipeline: {
+        VideoParamsPipeline* pipeline = (VideoParamsPipeline*)videoEncParams;
+        if (pipeline->size == sizeof(VideoParamsPipeline)) {
+            PARAMETER_ASSIGN(*pipeline, m_videoParamPipeline);
+            ret = ENCODE_SUCCESS;
+        }
+        break;
+    }
+    case VideoParamsTypeStaticQp: {
+        VideoParamsStaticQp* staticQp = (VideoParamsStaticQp*)videoEncParams;
+        if (staticQp->size == sizeof(VideoParamsStaticQp)) {
+            PARAMETER_ASSIGN(*staticQp, m_videoParamStaticQp);
+            ret = ENCODE_SUCCESS;
+        }
+        break;
+    }
     default:
         ret = ENCODE_SUCCESS;
         break;
@@ -195,16 +374,50 @@ Encode_Status VaapiEncoderBase::setParameters(VideoParamConfigType type, Yami_PT
         VideoParamsCommon* common = (VideoParamsCommon*)videoEncParams;
         if (common->size == sizeof(VideoParamsCommon)) {
             PARAMETER_ASSIGN(m_videoParamCommon, *common);
-            if(m_videoParamCommon.rcParams.bitRate > 0)
-	         m_videoParamCommon.rcMode = RATE_CONTROL_CBR;			
-	     // Only support CQP and CBR mode now
-            if (m_videoParamCommon.rcMode != RATE_CONTROL_CBR)
-                m_videoParamCommon.rcMode = RATE_CONTROL_CQP;
+            if (!isHostRateControl()) {
+                if(m_videoParamCommon.rcParams.bitRate > 0)
+                    m_videoParamCommon.rcMode = RATE_CONTROL_CBR;
+                // the driver only does CQP and CBR for us, others modes are done on host
+                if (m_videoParamCommon.rcMode != RATE_CONTROL_CBR)
+                    m_videoParamCommon.rcMode = RATE_CONTROL_CQP;
+            }
         } else
             ret = ENCODE_INVALID_PARAMS;
         m_maxCodedbufSize = 0; // resolution may change, recalculate max codec buffer size when it is requested
         break;
     }
+    case VideoParamsTypeStatsFile: {
+        VideoParamsStatsFile* stats = (VideoParamsStatsFile*)videoEncParams;
+        if (stats->size == sizeof(VideoParamsStatsFile))
+            m_statsFile = stats->path ? stats->path : "";
+        else
+            ret = ENCODE_INVALID_PARAMS;
+        break;
+    }
+    case VideoParamsTypeLookahead: {
+        VideoParamsLookahead* lookahead = (VideoParamsLookahead*)videoEncParams;
+        if (lookahead->size == sizeof(VideoParamsLookahead))
+            PARAMETER_ASSIGN(m_videoParamLookahead, *lookahead);
+        else
+            ret = ENCODE_INVALID_PARAMS;
+        break;
+    }
+    case VideoParamsTypePipeline: {
+        VideoParamsPipeline* pipeline = (VideoParamsPipeline*)videoEncParams;
+        if (pipeline->size == sizeof(VideoParamsPipeline))
+            PARAMETER_ASSIGN(m_videoParamPipeline, *pipeline);
+        else
+            ret = ENCODE_INVALID_PARAMS;
+        break;
+    }
+    case VideoParamsTypeStaticQp: {
+        VideoParamsStaticQp* staticQp = (VideoParamsStaticQp*)videoEncParams;
+        if (staticQp->size == sizeof(VideoParamsStaticQp))
+            PARAMETER_ASSIGN(m_videoParamStaticQp, *staticQp);
+        else
+            ret = ENCODE_INVALID_PARAMS;
+        break;
+    }
     case VideoConfigTypeFrameRate: {
         VideoConfigFrameRate* frameRateConfig = (VideoConfigFrameRate*)videoEncParams;
         if (frameRateConfig->size == sizeof(VideoConfigFrameRate)) {
@@ -226,6 +439,8 @@ Encode_Status VaapiEncoderBase::setParameters(VideoParamConfigType type, Yami_PT
         break;
     }
     INFO("bitrate: %d", bitRate());
+    AutoLock l(m_configLock);
+    m_config = m_videoParamCommon;
     return ret;
 }
 
@@ -233,12 +448,181 @@ Encode_Status VaapiEncoderBase::setConfig(VideoParamConfigType type, Yami_PTR vi
 {
     FUNC_ENTER();
     DEBUG("type = %d", type);
+    switch (type) {
+    case VideoConfigTypeBitRate: {
+        VideoConfigBitRate* rcParamsConfig = (VideoConfigBitRate*)videoEncConfig;
+        if (!rcParamsConfig || rcParamsConfig->size != sizeof(VideoConfigBitRate))
+            return ENCODE_INVALID_PARAMS;
+        AutoLock l(m_configLock);
+        VideoParamsCommon config = m_config;
+        config.rcParams = rcParamsConfig->rcParams;
+        return updateRates(config);
+    }
+    case VideoConfigTypeFrameRate: {
+        VideoConfigFrameRate* frameRateConfig = (VideoConfigFrameRate*)videoEncConfig;
+        if (!frameRateConfig || frameRateConfig->size != sizeof(VideoConfigFrameRate)
+            || !frameRateConfig->frameRate.frameRateNum || !frameRateConfig->frameRate.frameRateDenom)
+            return ENCODE_INVALID_PARAMS;
+        AutoLock l(m_configLock);
+        VideoParamsCommon config = m_config;
+        config.frameRate = frameRateConfig->frameRate;
+        return updateRates(config);
+    }
+    case VideoConfigTypeIDRRequest: {
+        AutoLock l(m_configLock);
+        m_idrRequested = true;
+        return ENCODE_SUCCESS;
+    }
+    case VideoConfigTypeResolution: {
+        VideoConfigResoltuion* resolutionConfig = (VideoConfigResoltuion*)videoEncConfig;
+        if (!resolutionConfig || resolutionConfig->size != sizeof(VideoConfigResoltuion)
+            || !resolutionConfig->resolution.width || !resolutionConfig->resolution.height)
+            return ENCODE_INVALID_PARAMS;
+        AutoLock l(m_configLock);
+        m_config.resolution = resolutionConfig->resolution;
+        m_configResolutionChanged = true;
+        return ENCODE_SUCCESS;
+    }
+    case VideoConfigTypeROI:
+        return setRoi((VideoConfigROI*)videoEncConfig);
+    default:
+        break;
+    }
     return ENCODE_SUCCESS;
 }
 
 Encode_Status VaapiEncoderBase::getConfig(VideoParamConfigType type, Yami_PTR videoEncConfig)
 {
     FUNC_ENTER();
+    if (!videoEncConfig)
+        return ENCODE_INVALID_PARAMS;
+    AutoLock l(m_configLock);
+    switch (type) {
+    case VideoConfigTypeBitRate: {
+        VideoConfigBitRate* rcParamsConfig = (VideoConfigBitRate*)videoEncConfig;
+        if (rcParamsConfig->size != sizeof(VideoConfigBitRate))
+            return ENCODE_INVALID_PARAMS;
+        rcParamsConfig->rcParams = m_config.rcParams;
+        break;
+    }
+    case VideoConfigTypeFrameRate: {
+        VideoConfigFrameRate* frameRateConfig = (VideoConfigFrameRate*)videoEncConfig;
+        if (frameRateConfig->size != sizeof(VideoConfigFrameRate))
+            return ENCODE_INVALID_PARAMS;
+        frameRateConfig->frameRate = m_config.frameRate;
+        break;
+    }
+    case VideoConfigTypeResolution: {
+        VideoConfigResoltuion* resolutionConfig = (VideoConfigResoltuion*)videoEncConfig;
+        if (resolutionConfig->size != sizeof(VideoConfigResoltuion))
+            return ENCODE_INVALID_PARAMS;
+        resolutionConfig->resolution = m_config.resolution;
+        break;
+    }
+    default:
+        break;
+    }
+    return ENCODE_SUCCESS;
+}
+
+// new rates in @config, the host rate control follows them at once, the rest at the next frame.
+// called with m_configLock held
+Encode_Status VaapiEncoderBase::updateRates(const VideoParamsCommon& config)
+{
+    AutoLock l(m_rateControlLock);
+    if (m_rateControl && !m_rateControl->reconfigure(config)) {
+        WARNING("rate control mode %d can't change rates on the fly", config.rcMode);
+        return ENCODE_NOT_SUPPORTED;
+    }
+    m_config.rcParams = config.rcParams;
+    m_config.frameRate = config.frameRate;
+    m_configRatesChanged = true;
+    return ENCODE_SUCCESS;
+}
+
+// take what setConfig() changed since the last frame, on the encode thread
+Encode_Status VaapiEncoderBase::applyConfig()
+{
+    bool resolutionChanged;
+    VideoResolution resolution;
+    {
+        AutoLock l(m_configLock);
+        if (m_configRatesChanged) {
+            m_videoParamCommon.rcParams = m_config.rcParams;
+            m_videoParamCommon.frameRate = m_config.frameRate;
+            m_configRatesChanged = false;
+            //the driver rate control is reset by the next picture
+            m_ratesChanged = true;
+        }
+        resolutionChanged = m_configResolutionChanged;
+        resolution = m_config.resolution;
+        m_configResolutionChanged = false;
+    }
+    if (!resolutionChanged)
+        return ENCODE_SUCCESS;
+    return changeResolution(resolution);
+}
+
+// frames held back for reordering are encoded at the old resolution, then an IDR starts the new one.
+// pooled surfaces and the context are kept when the new resolution fits in them.
+// it runs on the encode thread, drain() is done by the encode() call which takes the first new frame
+Encode_Status VaapiEncoderBase::changeResolution(const VideoResolution& resolution)
+{
+    if (resolution.width == width() && resolution.height == height())
+        return ENCODE_SUCCESS;
+    if (!m_context) {
+        AutoLock l(m_configLock);
+        m_videoParamCommon.resolution = resolution;
+        m_maxCodedbufSize = 0;
+        //the QP deltas are for the old size
+        m_nextRoi.reset();
+        m_staticDetector.reset();
+        return ENCODE_SUCCESS;
+    }
+    Encode_Status ret = drain();
+    if (ret != ENCODE_SUCCESS)
+        return ret;
+    INFO("resolution changes from %dx%d to %dx%d", width(), height(), resolution.width, resolution.height);
+    {
+        AutoLock l(m_configLock);
+        m_videoParamCommon.resolution = resolution;
+        m_maxCodedbufSize = 0;
+        m_idrRequested = true;
+        m_nextRoi.reset();
+        m_staticDetector.reset();
+    }
+    if (resolution.width <= m_contextWidth && resolution.height <= m_contextHeight)
+        return ENCODE_SUCCESS;
+    //pictures in flight keep the old context and their surfaces until they are output
+    releasePools();
+    m_context.reset();
+    if (!createContext())
+        return ENCODE_FAIL;
+    return ENCODE_SUCCESS;
+}
+
+// the map of the next frame, created on first use
+RoiMapPtr& VaapiEncoderBase::nextRoi()
+{
+    if (!m_nextRoi)
+        m_nextRoi.reset(new VaapiRoiMap((width() + 15) / 16, (height() + 15) / 16));
+    return m_nextRoi;
+}
+
+Encode_Status VaapiEncoderBase::setRoi(const VideoConfigROI* roi)
+{
+    if (!roi || roi->size != sizeof(VideoConfigROI) || roi->numRegions > MAX_ROI_REGIONS)
+        return ENCODE_INVALID_PARAMS;
+    if (!m_maxRoiRegions)
+        return ENCODE_NOT_SUPPORTED;
+    AutoLock l(m_configLock);
+    //replaces what was set for the same frame
+    m_nextRoi.reset();
+    RoiMapPtr& map = nextRoi();
+    if (roi->qpDeltaMap)
+        map->setMap(roi->qpDeltaMap, roi->qpDeltaMapPitch ? roi->qpDeltaMapPitch : map->getMbWidth());
+    for (uint32_t i = 0; i < roi->numRegions; i++)
+        map->setRect(roi->regions[i].rect, roi->regions[i].qpDelta);
     return ENCODE_SUCCESS;
 }
 
@@ -260,57 +644,98 @@ Encode_Status VaapiEncoderBase::getMVBufferSize(uint32_t *Size)
 
 SurfacePtr VaapiEncoderBase::createSurface(uint32_t fourcc)
 {
-    VASurfaceAttrib attrib;
-    VaapiChromaType chroma;
-
-    attrib.flags = VA_SURFACE_ATTRIB_SETTABLE;
-    attrib.type = VASurfaceAttribPixelFormat;
-    attrib.value.type = VAGenericValueTypeInteger;
-    attrib.value.value.i = fourcc;
-
-    switch(fourcc) {
-    case VA_FOURCC_NV12:
-    case VA_FOURCC_I420:
-        chroma = VAAPI_CHROMA_TYPE_YUV420;
-    break;
-    case VA_FOURCC_YUY2:
-        chroma = VAAPI_CHROMA_TYPE_YUV422;
-    break;
-    default:
-        ASSERT(0);
-        break;
+    return VaapiEncSurfacePool::createSurface(m_display, fourcc,
+                                m_videoParamCommon.resolution.width, m_videoParamCommon.resolution.height);
+}
+
+template <class Pool>
+static void logPool(const char* name, const SharedPtr<Pool>& pool)
+{
+    if (pool)
+        INFO("%s pool: size %d, hits %d, misses %d", name, pool->getSize(), pool->getHits(), pool->getMisses());
+}
+
+bool VaapiEncoderBase::ensureInputPool(uint32_t fourcc)
+{
+    if (m_inputPool && m_inputPool->isCompatible(fourcc, width(), height()))
+        return true;
+    logPool("input surface", m_inputPool);
+    // every frame in the output queue or waiting for reorder holds an input surface
+    m_inputPool = VaapiEncSurfacePool::create(m_display, fourcc, width(), height(),
+                                              m_maxOutputBuffer + getReorderDepth(), true);
+    return bool(m_inputPool);
+}
+
+void VaapiEncoderBase::releasePools()
+{
+    logPool("input surface", m_inputPool);
+    logPool("reconstructed surface", m_reconPool);
+    logPool("coded buffer", m_codedBufferPool);
+    m_inputPool.reset();
+    m_reconPool.reset();
+    m_codedBufferPool.reset();
+}
+
+SurfacePtr VaapiEncoderBase::acquireReconSurface()
+{
+    if (!m_reconPool || !m_reconPool->isCompatible(VA_FOURCC_NV12, width(), height())) {
+        logPool("reconstructed surface", m_reconPool);
+        // the references, and the surface for the frame being encoded
+        m_reconPool = VaapiEncSurfacePool::create(m_display, VA_FOURCC_NV12, width(), height(),
+                                                  getMaxReferenceCount() + 1, false);
+        if (!m_reconPool)
+            return SurfacePtr();
     }
-    return VaapiSurface::create(m_display, chroma,
-                                m_videoParamCommon.resolution.width, m_videoParamCommon.resolution.height, &attrib, 1);
+    return m_reconPool->acquire();
+}
 
+CodedBufferPtr VaapiEncoderBase::acquireCodedBuffer(uint32_t bufSize)
+{
+    if (!m_codedBufferPool || !m_codedBufferPool->isCompatible(m_context, bufSize)) {
+        logPool("coded buffer", m_codedBufferPool);
+        // the output queue, a released mini GOP may overflow it by the reorder depth
+        m_codedBufferPool = VaapiCodedBufferPool::create(m_context, bufSize,
+                                                         m_maxOutputBuffer + getReorderDepth() + 1);
+        if (!m_codedBufferPool)
+            return CodedBufferPtr();
+    }
+    return m_codedBufferPool->acquire();
 }
 
 SurfacePtr VaapiEncoderBase::createSurface(VideoFrameRawData* frame)
 {
-    SurfacePtr surface = createSurface(frame->fourcc);
     SurfacePtr nil;
-    if (!surface)
+    if (!ensureInputPool(frame->fourcc))
         return nil;
 
-    ImagePtr image = VaapiImage::derive(surface);
-    if (!image) {
-        ERROR("VaapiImage::derive() failed");
+    ImageRawPtr raw;
+    SurfacePtr surface = m_inputPool->acquire(&raw);
+    if (!surface || !raw)
         return nil;
-    }
-    ImageRawPtr raw = mapVaapiImage(image);
-    if (!raw) {
-        ERROR("image->map() failed");
-        return nil;
-    }
 
+    //the pooled surface may be bigger than the frame after a resolution change
     uint8_t* src = reinterpret_cast<uint8_t*>(frame->handle);
-    if (!raw->copyFrom(src, frame->offset, frame->pitch)) {
+    if (!raw->copyFrom(src, frame->offset, frame->pitch, frame->width, frame->height)) {
         ERROR("copyfrom in buffer failed");
         return nil;
     }
     return surface;
 }
 
+LumaFramePtr VaapiEncoderBase::analyseLuma(const VideoFrameRawData* frame) const
+{
+    LumaFramePtr nil;
+    if (!isPlanar420(frame->fourcc))
+        return nil;
+    const uint8_t* luma = reinterpret_cast<const uint8_t*>(frame->handle) + frame->offset[0];
+    return VaapiLumaFrame::create(luma, frame->pitch[0], frame->width, frame->height);
+}
+
+uint32_t VaapiEncoderBase::lookaheadDepth() const
+{
+    return MIN(m_videoParamLookahead.lookaheadDepth, MAX_LOOKAHEAD_DEPTH);
+}
+
 struct SurfaceRecycler
 {
     SurfaceRecycler(const SharedPtr<VideoFrame>& frame): m_frame(frame){}
@@ -338,7 +763,9 @@ void VaapiEncoderBase::fill(VAEncMiscParameterRateControl* rateControl) const
     rateControl->bits_per_second = m_videoParamCommon.rcParams.bitRate;
     rateControl->initial_qp =  m_videoParamCommon.rcParams.initQP;
     rateControl->min_qp =  m_videoParamCommon.rcParams.minQP;
-    /*FIXME: where to find max_qp */
+#if VA_CHECK_VERSION(0,40,0)
+    rateControl->max_qp =  m_videoParamCommon.rcParams.maxQP;
+#endif
     rateControl->window_size = m_videoParamCommon.rcParams.windowSize;
     rateControl->target_percentage = m_videoParamCommon.rcParams.targetPercentage;
     rateControl->rc_flags.bits.disable_frame_skip = m_videoParamCommon.rcParams.disableFrameSkip;
@@ -350,6 +777,14 @@ void VaapiEncoderBase::fill(VAEncMiscParameterFrameRate* frameRate) const
     frameRate->framerate = fps();
 }
 
+void VaapiEncoderBase::fill(VAEncMiscParameterAIR* air) const
+{
+    const AirParams& params = m_videoParamCommon.airParams;
+    air->air_num_mbs = params.airMBs;
+    air->air_threshold = params.airThreshold;
+    air->air_auto = params.airAuto;
+}
+
 /* Generates additional control parameters */
 bool VaapiEncoderBase::ensureMiscParams (VaapiEncPicture* picture)
 {
@@ -364,12 +799,75 @@ bool VaapiEncoderBase::ensureMiscParams (VaapiEncPicture* picture)
         if (!picture->newMisc(VAEncMiscParameterTypeRateControl, rateControl))
             return false;
         fill(rateControl);
+        //setConfig() changed the rates
+        rateControl->rc_flags.bits.reset = m_ratesChanged;
 
         VAEncMiscParameterFrameRate* frameRate;
         if (!picture->newMisc(VAEncMiscParameterTypeFrameRate, frameRate))
             return false;
         fill(frameRate);
     }
+    m_ratesChanged = false;
+
+    VideoIntraRefreshType refreshType = m_videoParamCommon.refreshType;
+    if (refreshType == VIDEO_ENC_AIR || refreshType == VIDEO_ENC_BOTH) {
+        VAEncMiscParameterAIR* air;
+        if (!picture->newMisc(VAEncMiscParameterTypeAIR, air))
+            return false;
+        fill(air);
+    }
+    return ensureRoi(picture);
+}
+
+// rectangles of picture->m_roi, coarsened to what the driver takes
+bool VaapiEncoderBase::ensureRoi(VaapiEncPicture* picture)
+{
+    if (!picture->m_roi)
+        return true;
+#if VA_CHECK_VERSION(0,39,1)
+    std::vector<VaapiRoiMap::Region> regions;
+    picture->m_roi->getRegions(regions, m_maxRoiRegions);
+    if (regions.empty())
+        return true;
+    std::vector<VAEncROI>& rois = picture->m_roiRegions;
+    rois.resize(regions.size());
+    int8_t minDelta = 0, maxDelta = 0;
+    for (size_t i = 0; i < regions.size(); i++) {
+        const VaapiRoiMap::Region& r = regions[i];
+        uint32_t x = r.x * 16, y = r.y * 16;
+        rois[i].roi_rectangle.x = x;
+        rois[i].roi_rectangle.y = y;
+        rois[i].roi_rectangle.width = MIN(r.width * 16, width() - x);
+        rois[i].roi_rectangle.height = MIN(r.height * 16, height() - y);
+        rois[i].roi_value = r.qpDelta;
+        if (r.qpDelta < minDelta)
+            minDelta = r.qpDelta;
+        if (r.qpDelta > maxDelta)
+            maxDelta = r.qpDelta;
+    }
+    VAEncMiscParameterBufferROI* roi;
+    if (!picture->newMisc(VAEncMiscParameterTypeROI, roi))
+        return false;
+    roi->num_roi = rois.size();
+    roi->roi = &rois[0];
+    roi->min_delta_qp = minDelta;
+    roi->max_delta_qp = maxDelta;
+    roi->roi_flags.bits.roi_value_is_qp_delta = 1;
+#endif
+    return true;
+}
+
+bool VaapiEncoderBase::isHostRateControl() const
+{
+    return VaapiRateControl::isHostMode(m_videoParamCommon.rcMode);
+}
+
+bool VaapiEncoderBase::getHostQP(VaapiPictureType type, uint32_t& qp)
+{
+    AutoLock l(m_rateControlLock);
+    if (!m_rateControl)
+        return false;
+    qp = m_rateControl->getQP(type);
     return true;
 }
 
@@ -398,14 +896,15 @@ VaapiProfile VaapiEncoderBase::profile() const
 
 void VaapiEncoderBase::cleanupVA()
 {
+    releasePools();
     m_context.reset();
+    m_contextWidth = 0;
+    m_contextHeight = 0;
     m_display.reset();
 }
 
 bool VaapiEncoderBase::initVA()
 {
-    VAConfigAttrib attrib, *pAttrib = NULL;
-    int32_t attribCount = 0;
     FUNC_ENTER();
 
     m_display = VaapiDisplay::create(m_externalDisplay);
@@ -413,13 +912,27 @@ bool VaapiEncoderBase::initVA()
         ERROR("failed to create display");
         return false;
     }
+    return createContext();
+}
+
+bool VaapiEncoderBase::createContext()
+{
+    VAConfigAttrib attribs[2], *pAttrib = NULL;
+    int32_t attribCount = 0;
 
     if (RATE_CONTROL_NONE != m_videoParamCommon.rcMode) {
-        attrib.type = VAConfigAttribRateControl;
-        attrib.value = m_videoParamCommon.rcMode;
-        pAttrib = &attrib;
-        attribCount = 1;
+        attribs[attribCount].type = VAConfigAttribRateControl;
+        attribs[attribCount].value = isHostRateControl() ? RATE_CONTROL_CQP : m_videoParamCommon.rcMode;
+        attribCount++;
     }
+    uint32_t packedHeaders = getPackedHeaders();
+    if (packedHeaders) {
+        attribs[attribCount].type = VAConfigAttribEncPackedHeaders;
+        attribs[attribCount].value = packedHeaders;
+        attribCount++;
+    }
+    if (attribCount)
+        pAttrib = attribs;
     ConfigPtr config = VaapiConfig::create(m_display, m_videoParamCommon.profile, m_entrypoint, pAttrib, attribCount);
     if (!config) {
         ERROR("failed to create config");
@@ -434,57 +947,96 @@ bool VaapiEncoderBase::initVA()
         ERROR("failed to create context");
         return false;
     }
+    m_contextWidth = m_videoParamCommon.resolution.width;
+    m_contextHeight = m_videoParamCommon.resolution.height;
+
+    m_maxRoiRegions = 0;
+#if VA_CHECK_VERSION(0,39,1)
+    VAConfigAttrib roi;
+    roi.type = VAConfigAttribEncROI;
+    VAStatus status = vaGetConfigAttributes(m_display->getID(), m_videoParamCommon.profile, m_entrypoint, &roi, 1);
+    //num_roi_regions is in the low 8 bits
+    if (status == VA_STATUS_SUCCESS && roi.value != VA_ATTRIB_NOT_SUPPORTED)
+        m_maxRoiRegions = roi.value & 0xff;
+#endif
+    if (m_videoParamStaticQp.staticQpDelta && !m_maxRoiRegions)
+        WARNING("the driver has no ROI, staticQpDelta is ignored");
     return true;
 }
 
-Encode_Status VaapiEncoderBase::checkEmpty(VideoEncOutputBuffer *outBuffer, bool *outEmpty)
+// the oldest picture in the output queue, once the hardware is done with it.
+// without @withWait, a busy hardware gives ENCODE_BUFFER_NO_MORE, it is polled by vaQuerySurfaceStatus.
+Encode_Status VaapiEncoderBase::getPicture(PicturePtr &outPicture, bool withWait)
 {
-    bool isEmpty;
-    FUNC_ENTER();
-    if (!outBuffer)
-        return ENCODE_INVALID_PARAMS;
-
-    AutoLock l(m_lock);
-    isEmpty = m_output.empty();
-    INFO("output queue size: %ld\n", m_output.size());
-
-    *outEmpty = isEmpty;
-
-    if (isEmpty) {
-        if (outBuffer->format == OUTPUT_CODEC_DATA)
-           return getCodecConfig(outBuffer);
-        return ENCODE_BUFFER_NO_MORE;
+    {
+        AutoLock l(m_lock);
+        uint32_t flushCount = m_flushCount;
+        while (m_output.empty()) {
+            if (!withWait || m_endOfStream || flushCount != m_flushCount)
+                return ENCODE_BUFFER_NO_MORE;
+            m_outputCond.wait();
+        }
+        INFO("output queue size: %ld\n", m_output.size());
+        outPicture = m_output.front();
     }
+    if (!withWait && !outPicture->isReady())
+        return ENCODE_BUFFER_NO_MORE;
+    if (!outPicture->sync())
+        return ENCODE_DRIVER_FAIL;
     return ENCODE_SUCCESS;
 }
 
-void VaapiEncoderBase::getPicture(PicturePtr &outPicture)
+// codec data comes from the stream headers when no picture is ready, it never waits
+Encode_Status VaapiEncoderBase::getOutputPicture(VideoEncOutputBuffer* outBuffer, PicturePtr& picture, bool withWait)
 {
-    outPicture = m_output.front();
-    outPicture->sync();
+    if (!outBuffer)
+        return ENCODE_INVALID_PARAMS;
+    bool codecData = outBuffer->format == OUTPUT_CODEC_DATA;
+    Encode_Status ret = getPicture(picture, withWait && !codecData);
+    if (ret == ENCODE_BUFFER_NO_MORE && codecData)
+        return getCodecConfig(outBuffer);
+    return ret;
 }
 
 Encode_Status VaapiEncoderBase::checkCodecData(VideoEncOutputBuffer * outBuffer)
 {
-    if (outBuffer->format != OUTPUT_CODEC_DATA) {
+    //a frame output one NAL at a time stays in the queue until its last NAL
+    if (outBuffer->format != OUTPUT_CODEC_DATA
+        && !(outBuffer->flag & ENCODE_BUFFERFLAG_PARTIALFRAME))
+        popOutput();
+    return ENCODE_SUCCESS;
+}
+
+// the picture is done, feed its coded size back to the host rate control
+void VaapiEncoderBase::popOutput()
+{
+    PicturePtr picture;
+    {
         AutoLock l(m_lock);
+        //flushed while the picture was read
+        if (m_output.empty())
+            return;
+        picture = m_output.front();
         m_output.pop_front();
     }
-    return ENCODE_SUCCESS;
+    if (!picture->m_isRateControlled)
+        return;
+    uint32_t size = picture->m_codedBuffer->size();
+    AutoLock l(m_rateControlLock);
+    if (m_rateControl)
+        m_rateControl->update(picture->m_type, picture->m_qp, size * 8);
 }
 
 #ifndef __BUILD_GET_MV__
 Encode_Status VaapiEncoderBase::getOutput(VideoEncOutputBuffer * outBuffer, bool withWait)
 {
-    bool isEmpty;
     PicturePtr picture;
     Encode_Status ret;
     FUNC_ENTER();
-    ret = checkEmpty(outBuffer, &isEmpty);
-    if (isEmpty)
+    ret = getOutputPicture(outBuffer, picture, withWait);
+    if (ret != ENCODE_SUCCESS)
         return ret;
 
-    getPicture(picture);
     ret = picture->getOutput(outBuffer);
     if (ret != ENCODE_SUCCESS)
         return ret;
@@ -499,15 +1051,13 @@ Encode_Status VaapiEncoderBase::getOutput(VideoEncOutputBuffer * outBuffer, Vide
 {
     void *data = NULL;
     uint32_t mappedSize;
-    bool isEmpty;
     PicturePtr picture;
     Encode_Status ret;
     FUNC_ENTER();
 
-    ret = checkEmpty(outBuffer, &isEmpty);
-    if (isEmpty)
+    ret = getOutputPicture(outBuffer, picture, withWait);
+    if (ret != ENCODE_SUCCESS)
         return ret;
-    getPicture(picture);
 
     ret = picture->getOutput(outBuffer);
     if (ret != ENCODE_SUCCESS)
@@ -522,6 +1072,23 @@ Encode_Status VaapiEncoderBase::getOutput(VideoEncOutputBuffer * outBuffer, Vide
 
 #endif
 
+Encode_Status VaapiEncoderBase::getOutput(SharedPtr<VideoCodedFrame>& frame, bool withWait)
+{
+    PicturePtr picture;
+    Encode_Status ret;
+    FUNC_ENTER();
+    ret = getPicture(picture, withWait);
+    if (ret != ENCODE_SUCCESS)
+        return ret;
+
+    ret = picture->getOutput(frame);
+    if (ret != ENCODE_SUCCESS)
+        return ret;
+
+    popOutput();
+    return ENCODE_SUCCESS;
+}
+
 Encode_Status VaapiEncoderBase::getCodecConfig(VideoEncOutputBuffer * outBuffer)
 {
     ASSERT(outBuffer && (outBuffer->format == OUTPUT_CODEC_DATA));
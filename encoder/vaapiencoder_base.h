@@ -26,14 +26,18 @@
 
 #include "interface/VideoEncoderDefs.h"
 #include "interface/VideoEncoderInterface.h"
+#include "common/condition.h"
 #include "common/lock.h"
 #include "common/log.h"
 #include "vaapiencpicture.h"
+#include "vaapilookahead.h"
+#include "vaapiroi.h"
 #include "vaapi/vaapibuffer.h"
 #include "vaapi/vaapiptrs.h"
 #include "vaapi/vaapisurface.h"
 
 #include <deque>
+#include <string>
 #include <utility>
 
 #define MIN(a, b)  (((a) < (b)) ? (a) : (b))
@@ -71,6 +75,7 @@ public:
 #else
     virtual Encode_Status getOutput(VideoEncOutputBuffer * outBuffer, VideoEncMVBuffer* MVBuffer, bool withWait = false);
 #endif
+    virtual Encode_Status getOutput(SharedPtr<VideoCodedFrame>& frame, bool withWait = false);
     virtual Encode_Status getParameters(VideoParamConfigType type, Yami_PTR);
     virtual Encode_Status setParameters(VideoParamConfigType type, Yami_PTR);
     virtual Encode_Status setConfig(VideoParamConfigType type, Yami_PTR);
@@ -82,18 +87,19 @@ public:
     /// get MV buffer size.
     virtual Encode_Status getMVBufferSize(uint32_t * Size);
 #endif
-    virtual void getPicture(PicturePtr &outPicture);
+    virtual Encode_Status getPicture(PicturePtr &outPicture, bool withWait);
     virtual Encode_Status checkCodecData(VideoEncOutputBuffer * outBuffer);
-    virtual Encode_Status checkEmpty(VideoEncOutputBuffer * outBuffer, bool *outEmpty);
-    virtual Encode_Status getStatistics(VideoStatistics *videoStat) {
-        return ENCODE_SUCCESS;
-    };
+    /// frames submitted by encode() and the time in ms the submissions took
+    virtual Encode_Status getStatistics(VideoStatistics *videoStat);
 
 protected:
     //utils functions for derived class
     SurfacePtr createSurface(uint32_t fourcc = VA_FOURCC_NV12);
     SurfacePtr createSurface(VideoFrameRawData* frame);
     SurfacePtr createSurface(const SharedPtr<VideoFrame>& frame);
+    /// surfaces and coded buffers from the encoder pools, they go back to the pool when released
+    SurfacePtr acquireReconSurface();
+    CodedBufferPtr acquireCodedBuffer(uint32_t bufSize);
 
     template <class Pic>
     bool output(const SharedPtr<Pic>&);
@@ -101,12 +107,30 @@ protected:
 
     //virtual functions
     virtual Encode_Status doEncode(const SurfacePtr& , uint64_t timeStamp, bool forceKeyFrame = false) = 0;
+    /// max count of input frames held back for reordering
+    virtual uint32_t getReorderDepth() const { return 0; }
+    /// max count of reconstructed frames kept as references
+    virtual uint32_t getMaxReferenceCount() const { return 0; }
+    /// encode the frames held back for reordering, at end of stream
+    virtual Encode_Status drain() { return ENCODE_SUCCESS; }
+    /// VA_ENC_PACKED_HEADER_* the encoder sends to the driver, asked for when the context is created
+    virtual uint32_t getPackedHeaders() const { return 0; }
 
     //rate control related things
     void fill(VAEncMiscParameterHRD*) const ;
     void fill(VAEncMiscParameterRateControl*) const ;
     void fill(VAEncMiscParameterFrameRate*) const;	
+    void fill(VAEncMiscParameterAIR*) const;
     bool ensureMiscParams (VaapiEncPicture*);
+    bool ensureRoi(VaapiEncPicture*);
+    /// QP of next picture in coding order, false if the rate is not controlled on host.
+    /// the picture must reach getOutput(), its coded size is fed back to the rate control
+    bool getHostQP(VaapiPictureType type, uint32_t& qp);
+    bool isHostRateControl() const;
+
+    //lookahead
+    uint32_t lookaheadDepth() const;
+    LumaFramePtr analyseLuma(const VideoFrameRawData* frame) const;
 
     //properties
     VaapiProfile profile() const;
@@ -162,23 +186,81 @@ protected:
     ContextPtr m_context;
     VAEntrypoint m_entrypoint;
     VideoParamsCommon m_videoParamCommon;
+    VideoParamsLookahead m_videoParamLookahead;
+    VideoParamsPipeline m_videoParamPipeline;
+    VideoParamsStaticQp m_videoParamStaticQp;
     uint32_t m_maxOutputBuffer; // max count of frames are encoding in parallel, it hurts performance when m_maxOutputBuffer is too big.
-    uint32_t m_maxCodedbufSize;
+                                // VideoParamsPipeline sets it
+    uint32_t m_maxCodedbufSize;  // 0 when it needs to be calculated again, the resolution may have changed
+    //luma of the frame passed to doEncode(), only for system memory input with lookahead enabled
+    LumaFramePtr m_inputLuma;
+    //QP deltas of the frame passed to doEncode(), subclasses put it in VaapiEncPicture::m_roi
+    RoiMapPtr m_inputRoi;
 
 private:
     bool initVA();
+    bool createContext();
     void cleanupVA();
+    Encode_Status updateRates(const VideoParamsCommon& config);
+    Encode_Status applyConfig();
+    Encode_Status changeResolution(const VideoResolution&);
+    Encode_Status setRoi(const VideoConfigROI*);
+    RoiMapPtr& nextRoi();
+    bool ensureInputPool(uint32_t fourcc);
+    void releasePools();
+    void popOutput();
+    Encode_Status submit(const SurfacePtr&, uint64_t timeStamp, bool forceKeyFrame);
+    Encode_Status endOfStream();
+    void wakeOutput();
+    Encode_Status getOutputPicture(VideoEncOutputBuffer* outBuffer, PicturePtr& picture, bool withWait);
     NativeDisplay m_externalDisplay;
 
     Lock m_lock;
     typedef std::deque<PicturePtr> OutputQueue;
     OutputQueue m_output;
+    //getOutput() with wait sleeps on it, until a picture is queued, the stream ends or a flush
+    Condition m_outputCond;
+    uint32_t m_flushCount;
+    bool m_endOfStream;
+    //protected by m_lock too
+    VideoStatistics m_statistics;
+    uint64_t m_totalEncodeTime;
 
-    bool updateMaxOutputBufferCount() {
-        if (m_maxOutputBuffer < m_videoParamCommon.leastInputCount + 3)
-            m_maxOutputBuffer = m_videoParamCommon.leastInputCount + 3;
-        return true;
-    }
+    //surfaces we copy VideoFrameRawData to
+    EncSurfacePoolPtr m_inputPool;
+    EncSurfacePoolPtr m_reconPool;
+    CodedBufferPoolPtr m_codedBufferPool;
+
+    //getHostQP() is called by encode thread, coded sizes come back from output thread
+    RateControlPtr m_rateControl;
+    Lock m_rateControlLock;
+    //VideoParamsStatsFile path, empty if not set
+    std::string m_statsFile;
+
+    //setConfig() and getConfig() may run on any thread, they only touch what m_configLock guards.
+    //applyConfig() hands it to the encode thread at the next frame, only that thread writes
+    //m_videoParamCommon, but for the resolution which is written under m_configLock too
+    Lock m_configLock;
+    //the latest rates and resolution set
+    VideoParamsCommon m_config;
+    bool m_configRatesChanged;
+    bool m_configResolutionChanged;
+    //the next picture is an IDR
+    bool m_idrRequested;
+    //the rates changed, the next picture resets the driver rate control. encode thread only
+    bool m_ratesChanged;
+    //size m_context is created for, smaller resolutions reuse it
+    uint32_t m_contextWidth;
+    uint32_t m_contextHeight;
+
+    //QP deltas set by setConfig() and the static region detector, taken by the next frame.
+    //guarded by m_configLock
+    RoiMapPtr m_nextRoi;
+    VaapiStaticRegionDetector m_staticDetector;
+    //rectangles of VAEncMiscParameterBufferROI the driver takes, 0 if it has no ROI
+    uint32_t m_maxRoiRegions;
+
+    bool updateMaxOutputBufferCount();
 };
 
 template <class Pic>
@@ -190,6 +272,7 @@ bool VaapiEncoderBase::output(const SharedPtr<Pic>& pic)
     picture = std::tr1::dynamic_pointer_cast<VaapiEncPicture>(pic);
     if (picture) {
         m_output.push_back(picture);
+        m_outputCond.signal();
         ret = true;
     } else {
         ERROR("output need a subclass of VaapiEncPicutre");
@@ -0,0 +1,551 @@
+/*
+ *  vaapiencoder_chunked.cpp - encodes closed GOP chunks of a clip on several encoders in parallel
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "vaapiencoder_chunked.h"
+
+#include "common/log.h"
+#include "common/scopedlogger.h"
+#include "common/utils.h"
+#include "vaapiencoder_factory.h"
+#include "vaapih264stitcher.h"
+#include <string.h>
+
+namespace YamiMediaCodec{
+
+VaapiEncoderChunked::VaapiEncoderChunked()
+    : m_chunkFrames(0)
+    , m_started(false)
+    , m_workCond(m_lock)
+    , m_outputCond(m_lock)
+    , m_quit(false)
+    , m_endOfStream(false)
+    , m_flushCount(0)
+    , m_chunkCount(0)
+    , m_stitcher(new VaapiH264Stitcher)
+{
+}
+
+VaapiEncoderChunked::~VaapiEncoderChunked()
+{
+    stop();
+    for (size_t i = 0; i < m_workers.size(); i++)
+        delete m_workers[i].encoder;
+    delete m_stitcher;
+}
+
+bool VaapiEncoderChunked::init(const char* mimeType, uint32_t instances, uint32_t chunkFrames)
+{
+    if (!mimeType || !instances || !chunkFrames || !m_workers.empty())
+        return false;
+    //the stitcher knows h264 only
+    if (strcasecmp(mimeType, YAMI_MIME_H264) && strcasecmp(mimeType, YAMI_MIME_AVC)) {
+        ERROR("chunked encoding is not supported for %s", mimeType);
+        return false;
+    }
+    m_workers.resize(instances);
+    for (uint32_t i = 0; i < instances; i++) {
+        Worker& worker = m_workers[i];
+        worker.owner = this;
+        worker.running = false;
+        worker.encoder = VaapiEncoderFactory::create(mimeType);
+        if (!worker.encoder) {
+            ERROR("failed to create encoder %d of %s", i, mimeType);
+            return false;
+        }
+    }
+    m_chunkFrames = chunkFrames;
+    m_filling.reset(new Chunk);
+    return true;
+}
+
+void VaapiEncoderChunked::setNativeDisplay(NativeDisplay* display)
+{
+    for (size_t i = 0; i < m_workers.size(); i++)
+        m_workers[i].encoder->setNativeDisplay(display);
+}
+
+Encode_Status VaapiEncoderChunked::start(void)
+{
+    FUNC_ENTER();
+    if (m_workers.empty())
+        return ENCODE_NOT_INIT;
+    if (m_started)
+        return ENCODE_ALREADY_INIT;
+    m_quit = false;
+    m_started = true;
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        Worker& worker = m_workers[i];
+        Encode_Status ret = worker.encoder->start();
+        if (ret != ENCODE_SUCCESS) {
+            ERROR("failed to start encoder %d", (int)i);
+            stop();
+            return ret;
+        }
+        if (pthread_create(&worker.thread, NULL, workerThread, &worker)) {
+            ERROR("failed to create thread for encoder %d", (int)i);
+            stop();
+            return ENCODE_FAIL;
+        }
+        worker.running = true;
+    }
+    return ENCODE_SUCCESS;
+}
+
+void VaapiEncoderChunked::stopWorkers()
+{
+    {
+        AutoLock l(m_lock);
+        m_quit = true;
+        m_workCond.broadcast();
+        m_outputCond.broadcast();
+    }
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        Worker& worker = m_workers[i];
+        if (worker.running) {
+            pthread_join(worker.thread, NULL);
+            worker.running = false;
+        }
+    }
+}
+
+Encode_Status VaapiEncoderChunked::stop(void)
+{
+    FUNC_ENTER();
+    if (!m_started)
+        return ENCODE_SUCCESS;
+    stopWorkers();
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        m_workers[i].queue.clear();
+        m_workers[i].encoder->stop();
+    }
+    m_chunks.clear();
+    m_filling.reset(new Chunk);
+    m_endOfStream = false;
+    m_stitcher->reset();
+    m_started = false;
+    return ENCODE_SUCCESS;
+}
+
+void* VaapiEncoderChunked::workerThread(void* arg)
+{
+    Worker* worker = static_cast<Worker*>(arg);
+    worker->owner->work(*worker);
+    return NULL;
+}
+
+void VaapiEncoderChunked::work(Worker& worker)
+{
+    bool first = true;
+    while (true) {
+        ChunkPtr chunk;
+        {
+            AutoLock l(m_lock);
+            while (worker.queue.empty() && !m_quit)
+                m_workCond.wait();
+            if (m_quit)
+                return;
+            chunk = worker.queue.front();
+            worker.queue.pop_front();
+        }
+        bool ok = encodeChunk(worker.encoder, chunk, first);
+        first = false;
+        //the frames are not needed any more
+        chunk->input.clear();
+
+        AutoLock l(m_lock);
+        chunk->done = true;
+        chunk->failed = !ok;
+        m_outputCond.broadcast();
+    }
+}
+
+// one coded frame of @encoder to @chunk, waits for it
+Encode_Status VaapiEncoderChunked::collect(IVideoEncoder* encoder, const ChunkPtr& chunk)
+{
+    SharedPtr<VideoCodedFrame> frame;
+    Encode_Status ret = encoder->getOutput(frame, true);
+    if (ret != ENCODE_SUCCESS)
+        return ret;
+    CodedFramePtr coded(new CodedFrame);
+    coded->data.reserve(frame->dataSize);
+    for (uint32_t i = 0; i < frame->numSegments; i++) {
+        const VideoCodedSegment& segment = frame->segments[i];
+        coded->data.insert(coded->data.end(), segment.data, segment.data + segment.size);
+    }
+    coded->flag = frame->flag;
+    coded->timeStamp = frame->timeStamp;
+    coded->chunkStart = chunk->output.empty();
+    coded->stitched = false;
+    chunk->output.push_back(coded);
+    return ENCODE_SUCCESS;
+}
+
+bool VaapiEncoderChunked::encodeChunk(IVideoEncoder* encoder, const ChunkPtr& chunk, bool first)
+{
+    //a new encoder starts with an IDR
+    if (!first && encoder->setConfig(VideoConfigTypeIDRRequest, NULL) != ENCODE_SUCCESS)
+        return false;
+    for (size_t i = 0; i < chunk->input.size(); i++) {
+        const InputFramePtr& input = chunk->input[i];
+        while (true) {
+            Encode_Status ret;
+            if (input->frame)
+                ret = encoder->encode(input->frame);
+            else
+                ret = encoder->encode(&input->raw);
+            if (ret == ENCODE_SUCCESS)
+                break;
+            if (ret != ENCODE_IS_BUSY || collect(encoder, chunk) != ENCODE_SUCCESS) {
+                ERROR("failed to encode frame %d of a chunk, ret = %d", (int)i, ret);
+                return false;
+            }
+        }
+    }
+    //the frames held back for B frames, the chunk is closed
+    VideoEncRawBuffer eos;
+    if (encoder->encode(&eos) != ENCODE_SUCCESS)
+        return false;
+    Encode_Status ret;
+    while ((ret = collect(encoder, chunk)) == ENCODE_SUCCESS)
+        ;
+    return ret == ENCODE_BUFFER_NO_MORE;
+}
+
+// the filled chunk goes to the next worker in turn, called with m_lock held
+void VaapiEncoderChunked::dispatch()
+{
+    if (m_filling->input.empty())
+        return;
+    m_chunks.push_back(m_filling);
+    m_workers[m_chunkCount % m_workers.size()].queue.push_back(m_filling);
+    m_chunkCount++;
+    m_workCond.broadcast();
+    m_filling.reset(new Chunk);
+}
+
+Encode_Status VaapiEncoderChunked::submit(const InputFramePtr& frame)
+{
+    if (!m_started)
+        return ENCODE_NOT_INIT;
+    //flush() may replace m_filling from another thread
+    AutoLock l(m_lock);
+    if (m_filling->input.empty()) {
+        if (m_chunks.size() >= m_workers.size() * 2)
+            return ENCODE_IS_BUSY;
+        m_endOfStream = false;
+    }
+    m_filling->input.push_back(frame);
+    if (m_filling->input.size() >= m_chunkFrames)
+        dispatch();
+    return ENCODE_SUCCESS;
+}
+
+Encode_Status VaapiEncoderChunked::endOfStream()
+{
+    AutoLock l(m_lock);
+    dispatch();
+    m_endOfStream = true;
+    m_outputCond.broadcast();
+    return ENCODE_SUCCESS;
+}
+
+Encode_Status VaapiEncoderChunked::encode(VideoEncRawBuffer* inBuffer)
+{
+    FUNC_ENTER();
+    if (!inBuffer)
+        return ENCODE_SUCCESS;
+    if (!inBuffer->data && !inBuffer->size) {
+        inBuffer->bufAvailable = true;
+        return endOfStream();
+    }
+    VideoParamsCommon common;
+    common.size = sizeof(common);
+    Encode_Status ret = getParameters(VideoParamsTypeCommon, &common);
+    if (ret != ENCODE_SUCCESS)
+        return ret;
+    VideoFrameRawData frame;
+    if (!fillFrameRawData(&frame, inBuffer->fourcc, common.resolution.width, common.resolution.height, inBuffer->data))
+        return ENCODE_INVALID_PARAMS;
+    if (inBuffer->forceKeyFrame)
+        frame.flags |= VIDEO_FRAME_FLAGS_KEY;
+    frame.timeStamp = inBuffer->timeStamp;
+    ret = encode(&frame);
+    //the data is copied
+    if (ret == ENCODE_SUCCESS)
+        inBuffer->bufAvailable = true;
+    return ret;
+}
+
+Encode_Status VaapiEncoderChunked::encode(VideoFrameRawData* frame)
+{
+    FUNC_ENTER();
+    if (!frame || !frame->width || !frame->height || !frame->fourcc)
+        return ENCODE_INVALID_PARAMS;
+    if (frame->memoryType != VIDEO_DATA_MEMORY_TYPE_RAW_POINTER
+        && frame->memoryType != VIDEO_DATA_MEMORY_TYPE_RAW_COPY)
+        return ENCODE_NOT_SUPPORTED;
+    uint32_t byteWidth[3], byteHeight[3], planes;
+    if (!getPlaneResolution(frame->fourcc, frame->width, frame->height, byteWidth, byteHeight, planes))
+        return ENCODE_INVALID_PARAMS;
+
+    //the caller reuses the frame once we return, copy it
+    InputFramePtr input(new InputFrame);
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < planes; i++)
+        size += byteWidth[i] * byteHeight[i];
+    input->data.resize(size);
+    input->raw = *frame;
+    input->raw.memoryType = VIDEO_DATA_MEMORY_TYPE_RAW_POINTER;
+    input->raw.handle = reinterpret_cast<intptr_t>(&input->data[0]);
+    input->raw.size = size;
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(frame->handle);
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < planes; i++) {
+        for (uint32_t y = 0; y < byteHeight[i]; y++)
+            memcpy(&input->data[offset + y * byteWidth[i]], src + frame->offset[i] + y * frame->pitch[i], byteWidth[i]);
+        input->raw.offset[i] = offset;
+        input->raw.pitch[i] = byteWidth[i];
+        offset += byteWidth[i] * byteHeight[i];
+    }
+    return submit(input);
+}
+
+Encode_Status VaapiEncoderChunked::encode(const SharedPtr<VideoFrame>& frame)
+{
+    FUNC_ENTER();
+    if (!frame)
+        return endOfStream();
+    if (!frame->surface)
+        return ENCODE_INVALID_PARAMS;
+    InputFramePtr input(new InputFrame);
+    input->frame = frame;
+    return submit(input);
+}
+
+// the oldest coded frame, it stays in the queue until popOutput()
+Encode_Status VaapiEncoderChunked::peekOutput(CodedFramePtr& coded, bool withWait)
+{
+    AutoLock l(m_lock);
+    uint32_t flushCount = m_flushCount;
+    while (true) {
+        if (!m_chunks.empty() && m_chunks.front()->done) {
+            ChunkPtr chunk = m_chunks.front();
+            if (chunk->failed) {
+                //the rest of the chunk is lost, the next one starts with an IDR
+                m_chunks.pop_front();
+                return ENCODE_FAIL;
+            }
+            if (!chunk->output.empty()) {
+                coded = chunk->output.front();
+                return ENCODE_SUCCESS;
+            }
+            m_chunks.pop_front();
+            continue;
+        }
+        bool drained = m_chunks.empty() && m_endOfStream;
+        if (!withWait || drained || m_quit || flushCount != m_flushCount)
+            return ENCODE_BUFFER_NO_MORE;
+        m_outputCond.wait();
+    }
+}
+
+void VaapiEncoderChunked::popOutput()
+{
+    AutoLock l(m_lock);
+    if (m_chunks.empty())
+        return;
+    ChunkPtr chunk = m_chunks.front();
+    if (!chunk->output.empty())
+        chunk->output.pop_front();
+    if (chunk->output.empty())
+        m_chunks.pop_front();
+}
+
+#ifndef __BUILD_GET_MV__
+Encode_Status VaapiEncoderChunked::getOutput(VideoEncOutputBuffer* outBuffer, bool withWait)
+#else
+Encode_Status VaapiEncoderChunked::getOutput(VideoEncOutputBuffer* outBuffer, VideoEncMVBuffer*, bool withWait)
+#endif
+{
+    FUNC_ENTER();
+    if (!outBuffer)
+        return ENCODE_INVALID_PARAMS;
+    if (outBuffer->format != OUTPUT_EVERYTHING && outBuffer->format != OUTPUT_FRAME_DATA)
+        return ENCODE_NOT_SUPPORTED;
+    CodedFramePtr coded;
+    Encode_Status ret = peekOutput(coded, withWait);
+    if (ret != ENCODE_SUCCESS)
+        return ret;
+    if (!coded->stitched) {
+        std::vector<uint8_t> stitched;
+        if (!m_stitcher->stitch(&coded->data[0], coded->data.size(), coded->chunkStart, stitched)) {
+            popOutput();
+            return ENCODE_FAIL;
+        }
+        coded->data.swap(stitched);
+        coded->stitched = true;
+    }
+    if (outBuffer->bufferSize < coded->data.size())
+        return ENCODE_BUFFER_TOO_SMALL;
+    memcpy(outBuffer->data, &coded->data[0], coded->data.size());
+    outBuffer->dataSize = coded->data.size();
+    outBuffer->remainingSize = 0;
+    outBuffer->flag = coded->flag;
+    outBuffer->timeStamp = coded->timeStamp;
+    popOutput();
+    return ENCODE_SUCCESS;
+}
+
+struct CodedFrameHolder {
+    SharedPtr<std::vector<uint8_t> > data;
+    VideoCodedSegment segment;
+    VideoCodedFrame frame;
+};
+
+// keeps the holder until the VideoCodedFrame is released
+struct CodedFrameReleaser {
+    CodedFrameReleaser(const SharedPtr<CodedFrameHolder>& holder): m_holder(holder) {}
+    void operator()(VideoCodedFrame*) {}
+private:
+    SharedPtr<CodedFrameHolder> m_holder;
+};
+
+Encode_Status VaapiEncoderChunked::getOutput(SharedPtr<VideoCodedFrame>& frame, bool withWait)
+{
+    FUNC_ENTER();
+    CodedFramePtr coded;
+    Encode_Status ret = peekOutput(coded, withWait);
+    if (ret != ENCODE_SUCCESS)
+        return ret;
+    SharedPtr<CodedFrameHolder> holder(new CodedFrameHolder);
+    holder->data.reset(new std::vector<uint8_t>);
+    if (coded->stitched) {
+        holder->data->swap(coded->data);
+    } else if (!m_stitcher->stitch(&coded->data[0], coded->data.size(), coded->chunkStart, *holder->data)) {
+        popOutput();
+        return ENCODE_FAIL;
+    }
+    popOutput();
+    holder->segment.data = &(*holder->data)[0];
+    holder->segment.size = holder->data->size();
+    holder->frame.segments = &holder->segment;
+    holder->frame.numSegments = 1;
+    holder->frame.dataSize = holder->segment.size;
+    holder->frame.flag = coded->flag;
+    holder->frame.timeStamp = coded->timeStamp;
+    frame.reset(&holder->frame, CodedFrameReleaser(holder));
+    return ENCODE_SUCCESS;
+}
+
+Encode_Status VaapiEncoderChunked::getParameters(VideoParamConfigType type, Yami_PTR videoEncParams)
+{
+    if (m_workers.empty())
+        return ENCODE_NOT_INIT;
+    return m_workers[0].encoder->getParameters(type, videoEncParams);
+}
+
+Encode_Status VaapiEncoderChunked::setParameters(VideoParamConfigType type, Yami_PTR videoEncParams)
+{
+    if (m_workers.empty())
+        return ENCODE_NOT_INIT;
+    if (m_started)
+        return ENCODE_ALREADY_INIT;
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        Encode_Status ret = m_workers[i].encoder->setParameters(type, videoEncParams);
+        if (ret != ENCODE_SUCCESS)
+            return ret;
+    }
+    return ENCODE_SUCCESS;
+}
+
+Encode_Status VaapiEncoderChunked::getMaxOutSize(uint32_t* maxSize)
+{
+    if (m_workers.empty())
+        return ENCODE_NOT_INIT;
+    return m_workers[0].encoder->getMaxOutSize(maxSize);
+}
+
+#ifdef __BUILD_GET_MV__
+Encode_Status VaapiEncoderChunked::getMVBufferSize(uint32_t* Size)
+{
+    return ENCODE_NOT_SUPPORTED;
+}
+#endif
+
+// statistics of all instances, the frame indexes are the ones of the instance
+Encode_Status VaapiEncoderChunked::getStatistics(VideoStatistics* videoStat)
+{
+    if (!videoStat)
+        return ENCODE_NULL_PTR;
+    memset(videoStat, 0, sizeof(*videoStat));
+    uint64_t totalTime = 0;
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        VideoStatistics stat;
+        Encode_Status ret = m_workers[i].encoder->getStatistics(&stat);
+        if (ret != ENCODE_SUCCESS)
+            return ret;
+        if (!stat.total_frames)
+            continue;
+        if (!videoStat->total_frames || stat.max_encode_time > videoStat->max_encode_time) {
+            videoStat->max_encode_time = stat.max_encode_time;
+            videoStat->max_encode_frame = stat.max_encode_frame;
+        }
+        if (!videoStat->total_frames || stat.min_encode_time < videoStat->min_encode_time) {
+            videoStat->min_encode_time = stat.min_encode_time;
+            videoStat->min_encode_frame = stat.min_encode_frame;
+        }
+        videoStat->total_frames += stat.total_frames;
+        videoStat->skipped_frames += stat.skipped_frames;
+        totalTime += (uint64_t)stat.average_encode_time * stat.total_frames;
+    }
+    if (videoStat->total_frames)
+        videoStat->average_encode_time = totalTime / videoStat->total_frames;
+    return ENCODE_SUCCESS;
+}
+
+// drops the frames not encoded yet and the output not taken, chunks being encoded finish unseen
+void VaapiEncoderChunked::flush(void)
+{
+    FUNC_ENTER();
+    AutoLock l(m_lock);
+    for (size_t i = 0; i < m_workers.size(); i++)
+        m_workers[i].queue.clear();
+    m_chunks.clear();
+    m_filling.reset(new Chunk);
+    m_endOfStream = false;
+    m_flushCount++;
+    m_outputCond.broadcast();
+}
+
+Encode_Status VaapiEncoderChunked::getConfig(VideoParamConfigType type, Yami_PTR videoEncConfig)
+{
+    return ENCODE_NOT_SUPPORTED;
+}
+
+Encode_Status VaapiEncoderChunked::setConfig(VideoParamConfigType type, Yami_PTR videoEncConfig)
+{
+    return ENCODE_NOT_SUPPORTED;
+}
+
+} //namespace YamiMediaCodec
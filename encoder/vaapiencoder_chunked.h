@@ -0,0 +1,159 @@
+/*
+ *  vaapiencoder_chunked.h - encodes closed GOP chunks of a clip on several encoders in parallel
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapiencoder_chunked_h
+#define vaapiencoder_chunked_h
+
+#include "interface/VideoEncoderInterface.h"
+#include "common/condition.h"
+#include "common/lock.h"
+
+#include <deque>
+#include <pthread.h>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+class VaapiH264Stitcher;
+
+/**
+ * \class VaapiEncoderChunked
+ * \brief h264 encoder for offline encoding, it splits the input in chunks of closed GOPs,
+ * and encodes them on several encoder instances, each one in its own thread.
+ * <pre>
+ * 1. the instances are created with the same NativeDisplay, so they share one VaapiDisplay
+ *    from the display cache, each one has its own context. the hardware runs the contexts
+ *    in parallel as far as it has engines.
+ * 2. chunk n goes to instance n % instances. each chunk starts with an IDR and ends with an
+ *    end of stream, so no reference crosses chunks.
+ * 3. the output is in input order, VaapiH264Stitcher joins the chunks.
+ * 4. frames in system memory are copied, VideoFrame surfaces are held until their chunk is done.
+ *    at most 2 * instances chunks are in flight, encode() returns ENCODE_IS_BUSY beyond it.
+ * 5. setParameters() goes to every instance, setConfig() is not supported, the output formats
+ *    are OUTPUT_EVERYTHING and OUTPUT_FRAME_DATA.
+ *</pre>
+ */
+class VaapiEncoderChunked : public IVideoEncoder
+{
+public:
+    VaapiEncoderChunked();
+    virtual ~VaapiEncoderChunked();
+    /// @instances encoders of @mimeType, chunks of @chunkFrames frames
+    bool init(const char* mimeType, uint32_t instances, uint32_t chunkFrames);
+
+    virtual void setNativeDisplay(NativeDisplay* display = NULL);
+    virtual Encode_Status start(void);
+    virtual Encode_Status stop(void);
+    virtual Encode_Status encode(VideoEncRawBuffer* inBuffer);
+    virtual Encode_Status encode(VideoFrameRawData* frame);
+    virtual Encode_Status encode(const SharedPtr<VideoFrame>& frame);
+#ifndef __BUILD_GET_MV__
+    virtual Encode_Status getOutput(VideoEncOutputBuffer* outBuffer, bool withWait = false);
+#else
+    virtual Encode_Status getOutput(VideoEncOutputBuffer* outBuffer, VideoEncMVBuffer* MVBuffer, bool withWait = false);
+#endif
+    virtual Encode_Status getOutput(SharedPtr<VideoCodedFrame>& frame, bool withWait = false);
+    virtual Encode_Status getParameters(VideoParamConfigType type, Yami_PTR videoEncParams);
+    virtual Encode_Status setParameters(VideoParamConfigType type, Yami_PTR videoEncParams);
+    virtual Encode_Status getMaxOutSize(uint32_t* maxSize);
+#ifdef __BUILD_GET_MV__
+    virtual Encode_Status getMVBufferSize(uint32_t* Size);
+#endif
+    virtual Encode_Status getStatistics(VideoStatistics* videoStat);
+    virtual void flush(void);
+    virtual Encode_Status getConfig(VideoParamConfigType type, Yami_PTR videoEncConfig);
+    virtual Encode_Status setConfig(VideoParamConfigType type, Yami_PTR videoEncConfig);
+
+private:
+    struct InputFrame {
+        //copy of a frame in system memory, raw points to it
+        std::vector<uint8_t> data;
+        VideoFrameRawData raw;
+        SharedPtr<VideoFrame> frame;
+    };
+    typedef SharedPtr<InputFrame> InputFramePtr;
+
+    struct CodedFrame {
+        std::vector<uint8_t> data;
+        uint32_t flag;
+        uint64_t timeStamp;
+        //first frame of its chunk, and if the stitcher has seen it
+        bool chunkStart;
+        bool stitched;
+    };
+    typedef SharedPtr<CodedFrame> CodedFramePtr;
+
+    struct Chunk {
+        std::vector<InputFramePtr> input;
+        //written by the worker, read by getOutput() once done is set
+        std::deque<CodedFramePtr> output;
+        bool done;
+        bool failed;
+        Chunk() : done(false), failed(false) {}
+    };
+    typedef SharedPtr<Chunk> ChunkPtr;
+
+    struct Worker {
+        VaapiEncoderChunked* owner;
+        IVideoEncoder* encoder;
+        pthread_t thread;
+        bool running;
+        std::deque<ChunkPtr> queue;
+    };
+
+    static void* workerThread(void* arg);
+    void work(Worker& worker);
+    bool encodeChunk(IVideoEncoder* encoder, const ChunkPtr& chunk, bool first);
+    Encode_Status collect(IVideoEncoder* encoder, const ChunkPtr& chunk);
+    void dispatch();
+    Encode_Status endOfStream();
+    Encode_Status submit(const InputFramePtr& frame);
+    Encode_Status peekOutput(CodedFramePtr& coded, bool withWait);
+    void popOutput();
+    void stopWorkers();
+
+    uint32_t m_chunkFrames;
+    std::vector<Worker> m_workers;
+    bool m_started;
+
+    Lock m_lock;
+    //workers sleep on it for chunks
+    Condition m_workCond;
+    //getOutput() sleeps on it for a done chunk
+    Condition m_outputCond;
+    bool m_quit;
+    bool m_endOfStream;
+    uint32_t m_flushCount;
+    //chunks in input order, until all their output is taken
+    std::deque<ChunkPtr> m_chunks;
+    //filled by encode() under m_lock, not dispatched yet
+    ChunkPtr m_filling;
+    uint32_t m_chunkCount;
+
+    //used by the getOutput() thread only
+    VaapiH264Stitcher* m_stitcher;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiEncoderChunked);
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapiencoder_chunked_h
@@ -26,6 +26,7 @@
 #include "vaapiencoder_h264.h"
 #include <assert.h>
 #include "bitwriter.h"
+#include "nalscanner.h"
 #include "scopedlogger.h"
 #include "vaapi/vaapicontext.h"
 #include "vaapi/vaapidisplay.h"
@@ -33,6 +34,8 @@
 #include "vaapiencpicture.h"
 #include "vaapiencoder_factory.h"
 #include <algorithm>
+#include <limits>
+#include <string.h>
 #include <tr1/functional>
 namespace YamiMediaCodec{
 //shortcuts
@@ -46,6 +49,15 @@ using std::vector;
 /* Define the maximum IDR period */
 #define MAX_IDR_PERIOD 512
 
+/* keeps the reference frames of pyramid B frames within 16 */
+#define MAX_B_FRAMES 15
+
+/* idr_pic_id is in the range of 0 to 65535 */
+#define MAX_IDR_PIC_ID 65536
+
+/* a slice header with a few MMCOs is far below it */
+#define H264_MAX_PACKED_SLICE_HEADER_SIZE 256
+
 
 #define VAAPI_ENCODER_H264_NAL_REF_IDC_NONE        0
 #define VAAPI_ENCODER_H264_NAL_REF_IDC_LOW         1
@@ -200,12 +212,12 @@ static BOOL
 bit_writer_write_sps(
     BitWriter *bitwriter,
     const VAEncSequenceParameterBufferH264* const seq,
-    VaapiProfile profile
+    VaapiProfile profile,
+    uint32_t gaps_in_frame_num_value_allowed_flag
 )
 {
     uint32_t constraint_set0_flag, constraint_set1_flag;
     uint32_t constraint_set2_flag, constraint_set3_flag;
-    uint32_t gaps_in_frame_num_value_allowed_flag = 0; // ??
     BOOL nal_hrd_parameters_present_flag;
 
     uint32_t b_qpprime_y_zero_transform_bypass = 0;
@@ -475,16 +487,33 @@ bit_writer_write_pps(
     return TRUE;
 }
 
+static void appendHeaderWithEmulation(std::vector<uint8_t>& dest, const std::vector<uint8_t>& h)
+{
+    std::vector<uint8_t>::const_iterator s = h.begin();
+    std::vector<uint8_t>::const_iterator e;
+    uint8_t zeros[] = {0, 0};
+    uint8_t emulation[] = {0, 0, 3};
+    do {
+        e = std::search(s, h.end(), zeros, zeros + N_ELEMENTS(zeros));
+        dest.insert(dest.end(), s, e);
+        if (e == h.end())
+            break;
+        dest.insert(dest.end(), emulation, emulation + N_ELEMENTS(emulation));
+        s = e + N_ELEMENTS(zeros);
+     } while (1);
+}
+
 class VaapiEncStreamHeaderH264
 {
     typedef std::vector<uint8_t> Header;
 public:
-    void setSPS(const VAEncSequenceParameterBufferH264* const sequence, VaapiProfile profile)
+    /// @gapsAllowed when reference pictures may be dropped from the stream
+    void setSPS(const VAEncSequenceParameterBufferH264* const sequence, VaapiProfile profile, bool gapsAllowed)
     {
         ASSERT(m_sps.empty());
         BitWriter bs;
         bit_writer_init (&bs, 128 * 8);
-        bit_writer_write_sps (&bs, sequence, profile);
+        bit_writer_write_sps (&bs, sequence, profile, gapsAllowed);
         bsToHeader(m_sps, bs);
         bit_writer_clear (&bs, TRUE);
     }
@@ -506,6 +535,9 @@ public:
             generateCodecConfigAVCc();
         else
             generateCodecConfigAnnexB();
+        m_parameterSets.resize(2);
+        appendHeaderWithEmulation(m_parameterSets[0], m_sps);
+        appendHeaderWithEmulation(m_parameterSets[1], m_pps);
     }
 
     Encode_Status getCodecConfig(VideoEncOutputBuffer *outBuffer)
@@ -520,6 +552,17 @@ public:
         outBuffer->flag |= ENCODE_BUFFERFLAG_CODECCONFIG;
         return ENCODE_SUCCESS;
     }
+
+    const std::vector<uint8_t>& getHeaders() const
+    {
+        return m_headers;
+    }
+
+    /// sps and pps NAL units, without start code
+    const std::vector<Header>& getParameterSets() const
+    {
+        return m_parameterSets;
+    }
 private:
     static void bsToHeader(Header& param, BitWriter& bs)
     {
@@ -527,22 +570,6 @@ private:
         param.insert(param.end(), BIT_WRITER_DATA (&bs),  BIT_WRITER_DATA (&bs) + BIT_WRITER_BIT_SIZE (&bs)/8);
     }
 
-    void appendHeaderWithEmulation(Header& h)
-    {
-        Header::iterator s = h.begin();
-        Header::iterator e;
-        uint8_t zeros[] = {0, 0};
-        uint8_t emulation[] = {0, 0, 3};
-        do {
-            e = std::search(s, h.end(), zeros, zeros + N_ELEMENTS(zeros));
-            m_headers.insert(m_headers.end(), s, e);
-            if (e == h.end())
-                break;
-            m_headers.insert(m_headers.end(), emulation, emulation + N_ELEMENTS(emulation));
-            s = e + N_ELEMENTS(zeros);
-         } while (1);
-    }
-
     void generateCodecConfigAnnexB()
     {
         std::vector<Header*> headers;
@@ -551,7 +578,7 @@ private:
         uint8_t sync[] = {0, 0, 0, 1};
         for (int i = 0; i < headers.size(); i++) {
             m_headers.insert(m_headers.end(), sync, sync + N_ELEMENTS(sync));
-            appendHeaderWithEmulation(*headers[i]);
+            appendHeaderWithEmulation(m_headers, *headers[i]);
         }
     }
 
@@ -595,6 +622,7 @@ private:
     Header m_sps;
     Header m_pps;
     Header m_headers;
+    std::vector<Header> m_parameterSets;
 };
 
 class VaapiEncPictureH264:public VaapiEncPicture
@@ -610,6 +638,11 @@ public:
     {
         ASSERT(outBuffer);
         VideoOutputFormat format = outBuffer->format;
+        if (format == OUTPUT_ONE_NAL || format == OUTPUT_ONE_NAL_WITHOUT_STARTCODE)
+            return getOneNal(outBuffer, format == OUTPUT_ONE_NAL);
+        if (format == OUTPUT_LENGTH_PREFIXED)
+            return getLengthPrefixed(outBuffer);
+
         //make a local copy of out Buffer;
         VideoEncOutputBuffer out = *outBuffer;
         out.flag = 0;
@@ -617,6 +650,8 @@ public:
         std::vector<Function> functions;
         if (format == OUTPUT_CODEC_DATA || ((format == OUTPUT_EVERYTHING) && isIdr()))
             functions.push_back(std::tr1::bind(&VaapiEncStreamHeaderH264::getCodecConfig, m_headers,&out));
+        if ((format == OUTPUT_EVERYTHING || format == OUTPUT_FRAME_DATA) && m_sei)
+            functions.push_back(std::tr1::bind(&VaapiEncPictureH264::getSei, this, &out));
         if (format == OUTPUT_EVERYTHING || format == OUTPUT_FRAME_DATA)
             functions.push_back(std::tr1::bind(getOutputHelper, this, &out));
         Encode_Status ret = getOutput(&out, functions);
@@ -627,16 +662,43 @@ public:
         return ret;
     }
 
+protected:
+    virtual Encode_Status getCodedFrame(VaapiCodedFrame& frame)
+    {
+        if (isIdr()) {
+            const std::vector<uint8_t>& headers = m_headers->getHeaders();
+            if (headers.empty())
+                return ENCODE_NO_REQUEST_DATA;
+            frame.addSegment(&headers[0], headers.size(), m_headers);
+            frame.flag |= ENCODE_BUFFERFLAG_CODECCONFIG;
+        }
+        if (m_sei)
+            frame.addSegment(&(*m_sei)[0], m_sei->size(), m_sei);
+        return VaapiEncPicture::getCodedFrame(frame);
+    }
+
 private:
     VaapiEncPictureH264(const ContextPtr& context, const SurfacePtr& surface, int64_t timeStamp):
         VaapiEncPicture(context, surface, timeStamp),
         m_frameNum(0),
-        m_poc(0)
+        m_poc(0),
+        m_isIdr(false),
+        m_isReference(false),
+        m_qpOffset(0),
+        m_headerNals(0),
+        m_nextNal(0)
     {
+        m_refresh.location = 0;
+        m_refresh.size = 0;
+        m_refresh.recoveryPoint = false;
+        m_refDecision.temporalId = 0;
+        m_refDecision.isReference = false;
+        m_refDecision.isLongTerm = false;
+        m_refDecision.frameNum = 0;
     }
 
     bool isIdr() const {
-        return m_type == VAAPI_PICTURE_TYPE_I && !m_frameNum;
+        return m_isIdr;
     }
 
     //getOutput is a virutal function, we need this to help bind
@@ -645,6 +707,15 @@ private:
         return p->VaapiEncPicture::getOutput(out);
     }
 
+    Encode_Status getSei(VideoEncOutputBuffer* outBuffer)
+    {
+        if (outBuffer->bufferSize < m_sei->size())
+            return ENCODE_BUFFER_TOO_SMALL;
+        std::copy(m_sei->begin(), m_sei->end(), outBuffer->data);
+        outBuffer->dataSize = m_sei->size();
+        return ENCODE_SUCCESS;
+    }
+
     Encode_Status getOutput(VideoEncOutputBuffer * outBuffer, std::vector<Function>& functions)
     {
         ASSERT(outBuffer);
@@ -662,9 +733,140 @@ private:
         return ENCODE_SUCCESS;
     }
 
+    void addNal(const uint8_t* data, uint32_t size)
+    {
+        //the zero_byte of a 4 bytes start code, or trailing_zero_8bits
+        while (size && !data[size - 1])
+            size--;
+        if (!size)
+            return;
+        VideoCodedSegment nal;
+        nal.data = data;
+        nal.size = size;
+        m_nals.push_back(nal);
+    }
+
+    // split the picture to NAL units while we walk the coded segments.
+    // the driver does not split a NAL unit across segments.
+    bool collectNals()
+    {
+        if (!m_nals.empty())
+            return true;
+        if (isIdr()) {
+            const std::vector<std::vector<uint8_t> >& sets = m_headers->getParameterSets();
+            for (size_t i = 0; i < sets.size(); i++)
+                addNal(&sets[i][0], sets[i].size());
+            m_headerNals = m_nals.size();
+        }
+        if (m_sei) {
+            const uint32_t startCodeSize = 4;
+            addNal(&(*m_sei)[startCodeSize], m_sei->size() - startCodeSize);
+        }
+
+        std::vector<VideoCodedSegment> segments;
+        if (!m_codedBuffer->getSegments(segments))
+            return false;
+        uint32_t positions[64];
+        for (size_t i = 0; i < segments.size(); i++) {
+            const uint8_t* data = segments[i].data;
+            uint32_t size = segments[i].size;
+            uint32_t offset = 0;
+            int32_t start = -1;
+            uint32_t count;
+            do {
+                count = nal_scanner_scan(data, size, offset, positions, N_ELEMENTS(positions));
+                for (uint32_t j = 0; j < count; j++) {
+                    if (start >= 0)
+                        addNal(data + start, positions[j] - start);
+                    start = positions[j] + 3;
+                }
+                if (count)
+                    offset = positions[count - 1] + 3;
+            } while (count == N_ELEMENTS(positions));
+            if (start >= 0)
+                addNal(data + start, size - start);
+        }
+        return m_nals.size() > m_headerNals;
+    }
+
+    Encode_Status getOneNal(VideoEncOutputBuffer* outBuffer, bool withStartCode)
+    {
+        static const uint8_t startCode[] = {0, 0, 0, 1};
+        if (!collectNals())
+            return ENCODE_FAIL;
+        ASSERT(m_nextNal < m_nals.size());
+        const VideoCodedSegment& nal = m_nals[m_nextNal];
+        uint32_t prefix = withStartCode ? N_ELEMENTS(startCode) : 0;
+        if (prefix + nal.size > outBuffer->bufferSize) {
+            outBuffer->dataSize = 0;
+            return ENCODE_BUFFER_TOO_SMALL;
+        }
+        memcpy(outBuffer->data, startCode, prefix);
+        memcpy(outBuffer->data + prefix, nal.data, nal.size);
+        outBuffer->dataSize = prefix + nal.size;
+
+        uint32_t flags = m_codedBuffer->getFlags();
+        if (m_nextNal < m_headerNals)
+            flags |= ENCODE_BUFFERFLAG_CODECCONFIG;
+        m_nextNal++;
+        outBuffer->remainingSize = 0;
+        for (size_t i = m_nextNal; i < m_nals.size(); i++)
+            outBuffer->remainingSize += prefix + m_nals[i].size;
+        if (m_nextNal < m_nals.size()) {
+            flags &= ~ENCODE_BUFFERFLAG_ENDOFFRAME;
+            flags |= ENCODE_BUFFERFLAG_PARTIALFRAME;
+        }
+        outBuffer->flag = flags;
+        return ENCODE_SUCCESS;
+    }
+
+    // the length prefixed frame matches avcC codec data, so the parameter sets are not repeated here
+    Encode_Status getLengthPrefixed(VideoEncOutputBuffer* outBuffer)
+    {
+        const uint32_t nalLengthSize = 4;
+        if (!collectNals())
+            return ENCODE_FAIL;
+        uint32_t size = 0;
+        for (size_t i = m_headerNals; i < m_nals.size(); i++)
+            size += nalLengthSize + m_nals[i].size;
+        if (size > outBuffer->bufferSize) {
+            outBuffer->dataSize = 0;
+            return ENCODE_BUFFER_TOO_SMALL;
+        }
+        uint8_t* dest = outBuffer->data;
+        for (size_t i = m_headerNals; i < m_nals.size(); i++) {
+            uint32_t nalSize = m_nals[i].size;
+            dest[0] = nalSize >> 24;
+            dest[1] = nalSize >> 16;
+            dest[2] = nalSize >> 8;
+            dest[3] = nalSize;
+            memcpy(dest + nalLengthSize, m_nals[i].data, nalSize);
+            dest += nalLengthSize + nalSize;
+        }
+        outBuffer->dataSize = size;
+        outBuffer->remainingSize = 0;
+        outBuffer->flag = m_codedBuffer->getFlags();
+        return ENCODE_SUCCESS;
+    }
+
     uint32_t m_frameNum;
     uint32_t m_poc;
+    bool m_isIdr;
+    bool m_isReference;
+    //from the lookahead, added to the QP of the rate control
+    int32_t m_qpOffset;
     StreamHeaderPtr m_headers;
+    //macroblocks coded as intra by the intra refresh
+    VaapiIntraRefresh::Region m_refresh;
+    //recovery point SEI, with start code
+    SharedPtr<std::vector<uint8_t> > m_sei;
+    //layer, reference and marking when VaapiEncoderH264::m_layeredRefs is enabled
+    VaapiEncoderH264::LayeredRefs::Decision m_refDecision;
+
+    // NAL units for OUTPUT_ONE_NAL and OUTPUT_LENGTH_PREFIXED, parameter sets first
+    std::vector<VideoCodedSegment> m_nals;
+    uint32_t m_headerNals;
+    uint32_t m_nextNal;
 };
 
 class VaapiEncoderH264Ref
@@ -673,18 +875,22 @@ public:
     VaapiEncoderH264Ref(const PicturePtr& picture, const SurfacePtr& surface):
         m_frameNum(picture->m_frameNum),
         m_poc(picture->m_poc),
+        m_temporalId(picture->m_refDecision.temporalId),
+        m_isLongTerm(picture->m_refDecision.isLongTerm),
         m_pic(surface)
     {
     }
     uint32_t m_frameNum;
     uint32_t m_poc;
+    uint32_t m_temporalId;
+    bool m_isLongTerm;
     SurfacePtr m_pic;
 };
 
 VaapiEncoderH264::VaapiEncoderH264():
     m_useCabac(true),
     m_useDct8x8(false),
-    m_reorderState(VAAPI_ENC_REORD_WAIT_FRAMES),
+    m_useIntraRefresh(false),
     m_streamFormat(AVC_STREAM_FORMAT_ANNEXB)
 {
     m_videoParamCommon.profile = VAProfileH264Main;
@@ -693,6 +899,18 @@ VaapiEncoderH264::VaapiEncoderH264():
     m_videoParamCommon.rcParams.minQP = 1;
 
     m_videoParamAVC.idrInterval = 30;
+    m_videoParamAVC.maxSliceSize = 0;
+
+    m_videoParamBFrames.size = sizeof(m_videoParamBFrames);
+    m_videoParamBFrames.ipPeriod = 1;
+    m_videoParamBFrames.enableBPyramid = false;
+
+    m_videoParamIntraRefresh.size = sizeof(m_videoParamIntraRefresh);
+    m_videoParamIntraRefresh.refreshByRow = false;
+
+    m_videoParamLayers.size = sizeof(m_videoParamLayers);
+    m_videoParamLayers.temporalLayers = 1;
+    m_videoParamLayers.ltrPeriod = 0;
 }
 
 VaapiEncoderH264::~VaapiEncoderH264()
@@ -703,7 +921,6 @@ VaapiEncoderH264::~VaapiEncoderH264()
 bool VaapiEncoderH264::ensureCodedBufferSize()
 {
     AutoLock locker(m_paramLock);
-    uint32_t mbSize;
 
     FUNC_ENTER();
 
@@ -716,12 +933,14 @@ bool VaapiEncoderH264::ensureCodedBufferSize()
 
     m_mbWidth = (width() + 15) / 16;
     m_mbHeight = (height() + 15)/ 16;
-    //FIXME:
-    m_numSlices = 1;
-    mbSize = m_mbWidth * m_mbHeight;
-    if (m_numSlices > (mbSize + 1) / 2)
-        m_numSlices = (mbSize + 1) / 2;
-    ASSERT (m_numSlices);
+    m_numSlices = std::max(m_videoParamAVC.sliceNum.iSliceNum, m_videoParamAVC.sliceNum.pSliceNum);
+    //the driver may cut a slice on any macroblock row when it limits the slice size
+    if (m_videoParamAVC.maxSliceSize > 0)
+        m_numSlices = m_mbHeight;
+    if (m_numSlices > m_mbHeight)
+        m_numSlices = m_mbHeight;
+    if (!m_numSlices)
+        m_numSlices = 1;
 
     /* Maximum sizes for common headers (in bits) */
     enum
@@ -763,8 +982,9 @@ void VaapiEncoderH264::resetParams ()
     DEBUG("resetParams, ensureCodedBufferSize");
     ensureCodedBufferSize();
 
-    //FIXME:
-    m_numBFrames = 0;
+    m_numBFrames = m_videoParamBFrames.ipPeriod ? m_videoParamBFrames.ipPeriod - 1 : 0;
+    if (m_numBFrames > MAX_B_FRAMES)
+        m_numBFrames = MAX_B_FRAMES;
 
     if (keyFramePeriod() < intraPeriod())
         keyFramePeriod() = intraPeriod();
@@ -778,6 +998,15 @@ void VaapiEncoderH264::resetParams ()
     if (m_numBFrames > (intraPeriod() + 1) / 2)
         m_numBFrames = (intraPeriod() + 1) / 2;
 
+    resetIntraRefresh();
+    //the refresh takes the place of periodic I frames, and it is for low latency
+    uint32_t gopIntraPeriod = intraPeriod();
+    uint32_t gopIdrPeriod = keyFramePeriod();
+    if (m_useIntraRefresh) {
+        m_numBFrames = 0;
+        gopIntraPeriod = gopIdrPeriod = std::numeric_limits<uint32_t>::max();
+    }
+
     /* init m_maxFrameNum, max_poc */
     m_log2MaxFrameNum =
         h264_get_log2_max_frame_num (keyFramePeriod());
@@ -785,16 +1014,22 @@ void VaapiEncoderH264::resetParams ()
     m_maxFrameNum = (1 << m_log2MaxFrameNum);
     m_log2MaxPicOrderCnt = m_log2MaxFrameNum + 1;
     m_maxPicOrderCnt = (1 << m_log2MaxPicOrderCnt);
+    m_sliceHeaderTemplates.clear();
+
+    //each picture has one reference, picked by the layer pattern
+    m_layeredRefs.init(m_videoParamLayers.temporalLayers, m_videoParamLayers.ltrPeriod, m_maxFrameNum);
+    if (m_layeredRefs.isEnabled())
+        m_numBFrames = 0;
 
     m_maxRefList0Count = 1;
     m_maxRefList1Count = m_numBFrames > 0;
-    m_maxRefFrames =
-        m_maxRefList0Count + m_maxRefList1Count;
-
-    INFO("m_maxRefFrames: %d", m_maxRefFrames);
-
+    m_gop.init(m_numBFrames, m_videoParamBFrames.enableBPyramid, gopIntraPeriod, gopIdrPeriod,
+               m_maxFrameNum, m_maxPicOrderCnt);
+    m_maxRefFrames = m_layeredRefs.isEnabled() ? m_layeredRefs.maxRefFrames() : m_gop.maxRefFrames();
+    m_lookahead.init(lookaheadDepth());
+    m_idrNum = 0;
 
-    resetGopStart();
+    INFO("m_numBFrames: %d, m_maxRefFrames: %d", m_numBFrames, m_maxRefFrames);
 }
 
 Encode_Status VaapiEncoderH264::getMaxOutSize(uint32_t *maxSize)
@@ -829,8 +1064,10 @@ Encode_Status VaapiEncoderH264::start()
 void VaapiEncoderH264::flush()
 {
     FUNC_ENTER();
-    resetGopStart();
-    m_reorderFrameList.clear();
+    m_lookahead.reset();
+    m_gop.reset();
+    m_intraRefresh.reset();
+    m_layeredRefs.reset();
     m_refList.clear();
 
     VaapiEncoderBase::flush();
@@ -854,7 +1091,32 @@ Encode_Status VaapiEncoderH264::setParameters(VideoParamConfigType type, Yami_PT
     case VideoParamsTypeAVC: {
             VideoParamsAVC* avc = (VideoParamsAVC*)videoEncParams;
             if (avc->size == sizeof(VideoParamsAVC)) {
-                PARAMETER_ASSIGN(*avc, m_videoParamAVC);
+                PARAMETER_ASSIGN(m_videoParamAVC, *avc);
+                m_maxCodedbufSize = 0; // slice count may change
+                status = ENCODE_SUCCESS;
+            }
+        }
+        break;
+    case VideoParamsTypeBFrames: {
+            VideoParamsBFrames* bFrames = (VideoParamsBFrames*)videoEncParams;
+            if (bFrames->size == sizeof(VideoParamsBFrames)) {
+                PARAMETER_ASSIGN(m_videoParamBFrames, *bFrames);
+                status = ENCODE_SUCCESS;
+            }
+        }
+        break;
+    case VideoParamsTypeIntraRefresh: {
+            VideoParamsIntraRefresh* refresh = (VideoParamsIntraRefresh*)videoEncParams;
+            if (refresh->size == sizeof(VideoParamsIntraRefresh)) {
+                PARAMETER_ASSIGN(m_videoParamIntraRefresh, *refresh);
+                status = ENCODE_SUCCESS;
+            }
+        }
+        break;
+    case VideoParamsTypeTemporalLayers: {
+            VideoParamsTemporalLayers* layers = (VideoParamsTemporalLayers*)videoEncParams;
+            if (layers->size == sizeof(VideoParamsTemporalLayers)) {
+                PARAMETER_ASSIGN(m_videoParamLayers, *layers);
                 status = ENCODE_SUCCESS;
             }
         }
@@ -876,6 +1138,24 @@ Encode_Status VaapiEncoderH264::setParameters(VideoParamConfigType type, Yami_PT
             }
         }
         break;
+    case VideoConfigTypeSliceNum: {
+            VideoConfigSliceNum* sliceNum = (VideoConfigSliceNum*)videoEncParams;
+            if (sliceNum->size == sizeof(VideoConfigSliceNum)) {
+                m_videoParamAVC.sliceNum = sliceNum->sliceNum;
+                m_maxCodedbufSize = 0; // slice header count changed
+                status = ENCODE_SUCCESS;
+            }
+        }
+        break;
+    case VideoConfigTypeNALSize: {
+            VideoConfigNALSize* nalSize = (VideoConfigNALSize*)videoEncParams;
+            if (nalSize->size == sizeof(VideoConfigNALSize)) {
+                m_videoParamAVC.maxSliceSize = nalSize->maxSliceSize;
+                m_maxCodedbufSize = 0;
+                status = ENCODE_SUCCESS;
+            }
+        }
+        break;
     default:
         status = VaapiEncoderBase::setParameters(type, videoEncParams);
         break;
@@ -883,6 +1163,17 @@ Encode_Status VaapiEncoderH264::setParameters(VideoParamConfigType type, Yami_PT
     return status;
 }
 
+Encode_Status VaapiEncoderH264::setConfig(VideoParamConfigType type, Yami_PTR videoEncConfig)
+{
+    FUNC_ENTER();
+    if (type != VideoConfigTypeLTRRecovery)
+        return VaapiEncoderBase::setConfig(type, videoEncConfig);
+    if (!m_videoParamLayers.ltrPeriod)
+        return ENCODE_NOT_SUPPORTED;
+    m_layeredRefs.requestRecovery();
+    return ENCODE_SUCCESS;
+}
+
 Encode_Status VaapiEncoderH264::getParameters(VideoParamConfigType type, Yami_PTR videoEncParams)
 {
     Encode_Status status = ENCODE_INVALID_PARAMS;
@@ -900,6 +1191,30 @@ Encode_Status VaapiEncoderH264::getParameters(VideoParamConfigType type, Yami_PT
             }
         }
         break;
+    case VideoParamsTypeBFrames: {
+            VideoParamsBFrames* bFrames = (VideoParamsBFrames*)videoEncParams;
+            if (bFrames->size == sizeof(VideoParamsBFrames)) {
+                PARAMETER_ASSIGN(*bFrames, m_videoParamBFrames);
+                status = ENCODE_SUCCESS;
+            }
+        }
+        break;
+    case VideoParamsTypeIntraRefresh: {
+            VideoParamsIntraRefresh* refresh = (VideoParamsIntraRefresh*)videoEncParams;
+            if (refresh->size == sizeof(VideoParamsIntraRefresh)) {
+                PARAMETER_ASSIGN(*refresh, m_videoParamIntraRefresh);
+                status = ENCODE_SUCCESS;
+            }
+        }
+        break;
+    case VideoParamsTypeTemporalLayers: {
+            VideoParamsTemporalLayers* layers = (VideoParamsTemporalLayers*)videoEncParams;
+            if (layers->size == sizeof(VideoParamsTemporalLayers)) {
+                PARAMETER_ASSIGN(*layers, m_videoParamLayers);
+                status = ENCODE_SUCCESS;
+            }
+        }
+        break;
     case VideoConfigTypeAVCStreamFormat: {
             VideoConfigAVCStreamFormat* format = (VideoConfigAVCStreamFormat*)videoEncParams;
             if (format->size == sizeof(VideoConfigAVCStreamFormat)) {
@@ -908,6 +1223,22 @@ Encode_Status VaapiEncoderH264::getParameters(VideoParamConfigType type, Yami_PT
             }
         }
         break;
+    case VideoConfigTypeSliceNum: {
+            VideoConfigSliceNum* sliceNum = (VideoConfigSliceNum*)videoEncParams;
+            if (sliceNum->size == sizeof(VideoConfigSliceNum)) {
+                sliceNum->sliceNum = m_videoParamAVC.sliceNum;
+                status = ENCODE_SUCCESS;
+            }
+        }
+        break;
+    case VideoConfigTypeNALSize: {
+            VideoConfigNALSize* nalSize = (VideoConfigNALSize*)videoEncParams;
+            if (nalSize->size == sizeof(VideoConfigNALSize)) {
+                nalSize->maxSliceSize = m_videoParamAVC.maxSliceSize;
+                status = ENCODE_SUCCESS;
+            }
+        }
+        break;
     default:
         status = VaapiEncoderBase::getParameters(type, videoEncParams);
         break;
@@ -924,63 +1255,77 @@ Encode_Status VaapiEncoderH264::reorder(const SurfacePtr& surface, uint64_t time
     if (!surface)
         return ENCODE_INVALID_PARAMS;
 
-    ++m_curPresentIndex;
     PicturePtr picture(new VaapiEncPictureH264(m_context, surface, timeStamp));
-    picture->m_poc = ((m_curPresentIndex * 2) % m_maxPicOrderCnt);
-
-    bool isIdr = (m_frameIndex == 0 ||m_frameIndex >= keyFramePeriod() || forceKeyFrame);
-
-    /* check key frames */
-    if (isIdr || (m_frameIndex % intraPeriod() == 0)) {
-        ++m_curFrameNum;
-        ++m_frameIndex;
-        /* b frame enabled,  check queue of reorder_frame_list */
-        if (m_numBFrames
-                && (m_reorderFrameList.size() > 0)) {
-            assert(0);
-
-        }
-        setIntraFrame (picture, isIdr);
-        m_reorderFrameList.push_back(picture);
-        m_reorderState = VAAPI_ENC_REORD_DUMP_FRAMES;
-        return ENCODE_SUCCESS;
-    }
-    /* new p/b frames coming */
-    ++m_frameIndex;
-    if (m_reorderFrameList.size() < m_numBFrames) {
-        assert(0);
-        m_reorderFrameList.push_back(picture);
+    picture->m_roi = m_inputRoi;
+    if (!m_lookahead.getDepth()) {
+        m_gop.push(picture, forceKeyFrame);
         return ENCODE_SUCCESS;
     }
-    ++m_curFrameNum;
-    setPFrame (picture);
-    m_reorderFrameList.push_front(picture);
-    m_reorderState = VAAPI_ENC_REORD_DUMP_FRAMES;
+    m_lookahead.push(picture, forceKeyFrame, m_inputLuma);
+    releaseLookahead();
     return ENCODE_SUCCESS;
 }
 
-// calls immediately after reorder,
-// it makes sure I frame are encoded immediately, so P frames can be pushed to the front of the m_reorderFrameList.
-// it also makes sure input thread and output thread runs in parallel
-Encode_Status VaapiEncoderH264::doEncode(const SurfacePtr& surface, uint64_t timeStamp, bool forceKeyFrame)
+// move the decided frames from m_lookahead to m_gop
+void VaapiEncoderH264::releaseLookahead()
+{
+    Lookahead::Frame frame;
+    while (m_lookahead.pop(frame)) {
+        if (frame.sceneCut)
+            DEBUG("lookahead found a scene cut, coded as IDR");
+        frame.data->m_qpOffset = frame.qpOffset;
+        m_gop.push(frame.data, frame.forceKeyFrame || frame.sceneCut, frame.forceAnchor);
+    }
+}
+
+uint32_t VaapiEncoderH264::applyQpOffset(const PicturePtr& picture) const
+{
+    uint32_t qp = picture->m_qp;
+    if (!picture->m_qpOffset)
+        return qp;
+    //the driver does CQP at initQP, so the offset goes to the slice QP
+    int32_t adjusted = (int32_t)(picture->m_isRateControlled ? qp : initQP()) + picture->m_qpOffset;
+    if (adjusted < (int32_t)minQP())
+        adjusted = minQP();
+    if (adjusted > (int32_t)maxQP())
+        adjusted = maxQP();
+    return adjusted;
+}
+
+// encodes the pictures released by m_gop, in coding order.
+// the anchor of a mini GOP is released with its B frames, so input thread and output thread still run in parallel
+Encode_Status VaapiEncoderH264::encodeReadyPictures()
 {
-    FUNC_ENTER();
     Encode_Status ret;
-    ret = reorder(surface, timeStamp, forceKeyFrame);
-    if (ret != ENCODE_SUCCESS)
-        return ret;
-    if (m_reorderState == VAAPI_ENC_REORD_DUMP_FRAMES) {
-        if (!m_maxCodedbufSize)
+    Gop::Frame frame;
+    while (m_gop.pop(frame)) {
+        if (!m_maxCodedbufSize) {
             ensureCodedBufferSize();
-        CodedBufferPtr codedBuffer = VaapiCodedBuffer::create(m_context, m_maxCodedbufSize);
+            //the macroblock count may have changed
+            resetIntraRefresh();
+        }
+        CodedBufferPtr codedBuffer = acquireCodedBuffer(m_maxCodedbufSize);
         if (!codedBuffer)
             return ENCODE_NO_MEMORY;
-        PicturePtr picture = m_reorderFrameList.front();
-        m_reorderFrameList.pop_front();
+        PicturePtr picture = frame.data;
+        picture->m_type = frame.type;
+        picture->m_isIdr = frame.isIdr;
+        picture->m_isReference = frame.isReference;
+        picture->m_frameNum = frame.frameNum;
+        picture->m_poc = frame.poc;
+        m_intraRefresh.next(picture->m_isIdr, picture->m_refresh);
+        if (m_layeredRefs.isEnabled()) {
+            LayeredRefs::Decision& decision = picture->m_refDecision;
+            m_layeredRefs.decide(picture->m_isIdr, m_refList, decision);
+            picture->m_isReference = decision.isReference;
+            picture->m_frameNum = decision.frameNum;
+            codedBuffer->setFlag(decision.temporalId << ENCODE_BUFFERFLAG_TEMPORALID_SHIFT);
+            if (decision.isLongTerm)
+                codedBuffer->setFlag(ENCODE_BUFFERFLAG_LONGTERMREF);
+        }
         picture->m_codedBuffer = codedBuffer;
-
-        if (m_reorderFrameList.empty())
-            m_reorderState = VAAPI_ENC_REORD_WAIT_FRAMES;
+        picture->m_isRateControlled = getHostQP(picture->m_type, picture->m_qp);
+        picture->m_qp = applyQpOffset(picture);
 
         ret =  encodePicture(picture);
         if (ret != ENCODE_SUCCESS) {
@@ -990,85 +1335,60 @@ Encode_Status VaapiEncoderH264::doEncode(const SurfacePtr& surface, uint64_t tim
         INFO("picture->m_type: 0x%x\n", picture->m_type);
         if (picture->isIdr()) {
             codedBuffer->setFlag(ENCODE_BUFFERFLAG_SYNCFRAME);
+            //two successive IDR pictures must have different idr_pic_id
+            m_idrNum = (m_idrNum + 1) % MAX_IDR_PIC_ID;
         }
 
         if (!output(picture))
             return ENCODE_INVALID_PARAMS;
     }
-
-    INFO();
     return ENCODE_SUCCESS;
 }
 
-Encode_Status VaapiEncoderH264::getCodecConfig(VideoEncOutputBuffer * outBuffer)
-{
-    ASSERT((outBuffer && outBuffer->flag == OUTPUT_CODEC_DATA) || outBuffer->flag == OUTPUT_EVERYTHING);
-    AutoLock locker(m_paramLock);
-    if (!m_headers)
-        return ENCODE_NO_REQUEST_DATA;
-    return m_headers->getCodecConfig(outBuffer);
-}
-
-/* Handle new GOP starts */
-void VaapiEncoderH264::resetGopStart ()
-{
-    m_idrNum = 0;
-    m_frameIndex = 0;
-    m_curFrameNum = 0;
-    m_curPresentIndex = 0;
-}
-
-/* Marks the supplied picture as a B-frame */
-void VaapiEncoderH264::setBFrame (const PicturePtr& pic)
-{
-    pic->m_type = VAAPI_PICTURE_TYPE_B;
-    pic->m_frameNum = (m_curFrameNum % m_maxFrameNum);
-}
-
-/* Marks the supplied picture as a P-frame */
-void VaapiEncoderH264::setPFrame (const PicturePtr& pic)
-{
-    pic->m_type = VAAPI_PICTURE_TYPE_P;
-    pic->m_frameNum = (m_curFrameNum % m_maxFrameNum);
-}
-
-/* Marks the supplied picture as an I-frame */
-void VaapiEncoderH264::setIFrame (const PicturePtr& pic)
+Encode_Status VaapiEncoderH264::doEncode(const SurfacePtr& surface, uint64_t timeStamp, bool forceKeyFrame)
 {
-    pic->m_type = VAAPI_PICTURE_TYPE_I;
-    pic->m_frameNum = (m_curFrameNum % m_maxFrameNum);
+    FUNC_ENTER();
+    Encode_Status ret;
+    ret = reorder(surface, timeStamp, forceKeyFrame);
+    if (ret != ENCODE_SUCCESS)
+        return ret;
+    return encodeReadyPictures();
 }
 
-/* Marks the supplied picture as an IDR frame */
-void VaapiEncoderH264::setIdrFrame (const PicturePtr& pic)
+Encode_Status VaapiEncoderH264::drain()
 {
-    pic->m_type = VAAPI_PICTURE_TYPE_I;
-    pic->m_frameNum = 0;
-    pic->m_poc = 0;
+    FUNC_ENTER();
+    m_lookahead.drain();
+    releaseLookahead();
+    m_gop.drain();
+    return encodeReadyPictures();
 }
 
-/* Marks the supplied picture a a key-frame */
-void VaapiEncoderH264::setIntraFrame (const PicturePtr& picture,bool idIdr)
+Encode_Status VaapiEncoderH264::getCodecConfig(VideoEncOutputBuffer * outBuffer)
 {
-    if (idIdr) {
-        resetGopStart();
-        setIdrFrame(picture);
-        //+1 for next frame
-        m_frameIndex++;
-    } else
-        setIFrame(picture);
+    ASSERT((outBuffer && outBuffer->flag == OUTPUT_CODEC_DATA) || outBuffer->flag == OUTPUT_EVERYTHING);
+    AutoLock locker(m_paramLock);
+    if (!m_headers)
+        return ENCODE_NO_REQUEST_DATA;
+    return m_headers->getCodecConfig(outBuffer);
 }
 
 bool VaapiEncoderH264::
 referenceListUpdate (const PicturePtr& picture, const SurfacePtr& surface)
 {
-    if (VAAPI_PICTURE_TYPE_B == picture->m_type) {
+    if (!picture->m_isReference) {
+        return true;
+    }
+    if (m_layeredRefs.isEnabled()) {
+        ReferencePtr ref(new VaapiEncoderH264Ref(picture, surface));
+        m_layeredRefs.update(picture->m_refDecision, m_refList, ref);
+        assert (m_refList.size() <= m_maxRefFrames);
         return true;
     }
     if (picture->isIdr()) {
         referenceListFree();
     } else if (m_refList.size() >= m_maxRefFrames) {
-        m_refList.pop_front();
+        m_refList.pop_back(); // sliding window, drop the oldest
     }
     ReferencePtr ref(new VaapiEncoderH264Ref(picture, surface));
     m_refList.push_front(ref); // recent first
@@ -1081,11 +1401,15 @@ bool  VaapiEncoderH264::referenceListInit (
     vector<ReferencePtr>& refList0,
     vector<ReferencePtr>& refList1) const
 {
-    assert(picture->m_type == VAAPI_PICTURE_TYPE_P);
-    refList0.reserve(m_refList.size());
-    refList0.insert(refList0.end(), m_refList.begin(), m_refList.end());
+    assert(picture->m_type == VAAPI_PICTURE_TYPE_P || picture->m_type == VAAPI_PICTURE_TYPE_B);
+    if (m_layeredRefs.isEnabled()) {
+        //the packed slice header moves it to the front of the list
+        if (picture->m_refDecision.ref)
+            refList0.push_back(picture->m_refDecision.ref);
+        return true;
+    }
+    Gop::buildRefLists(picture->m_type, picture->m_poc, m_refList, refList0, refList1);
 
-    assert (refList0.size() + refList1.size() <= m_maxRefFrames);
     if (refList0.size() > m_maxRefList0Count)
         refList0.resize(m_maxRefList0Count);
     if (refList1.size() > m_maxRefList1Count)
@@ -1176,7 +1500,16 @@ bool VaapiEncoderH264::fill(VAEncPictureParameterBufferH264* picParam, const Pic
         list<ReferencePtr>::const_iterator it;
         for (it = m_refList.begin(); it != m_refList.end(); ++it) {
             assert(*it && (*it)->m_pic && ((*it)->m_pic->getID() != VA_INVALID_ID));
-            picParam->ReferenceFrames[i].picture_id = (*it)->m_pic->getID();
+            VAPictureH264& ref = picParam->ReferenceFrames[i];
+            ref.picture_id = (*it)->m_pic->getID();
+            ref.TopFieldOrderCnt = (*it)->m_poc;
+            if ((*it)->m_isLongTerm) {
+                ref.flags = VA_PICTURE_H264_LONG_TERM_REFERENCE;
+                ref.frame_idx = 0;
+            } else {
+                ref.flags = VA_PICTURE_H264_SHORT_TERM_REFERENCE;
+                ref.frame_idx = (*it)->m_frameNum;
+            }
             ++i;
         }
     }
@@ -1199,7 +1532,7 @@ bool VaapiEncoderH264::fill(VAEncPictureParameterBufferH264* picParam, const Pic
 
     /* set picture fields */
     picParam->pic_fields.bits.idr_pic_flag = picture->isIdr();
-    picParam->pic_fields.bits.reference_pic_flag = (picture->m_type != VAAPI_PICTURE_TYPE_B);
+    picParam->pic_fields.bits.reference_pic_flag = picture->m_isReference;
     picParam->pic_fields.bits.entropy_coding_mode_flag = m_useCabac;
     picParam->pic_fields.bits.transform_8x8_mode_flag = m_useDct8x8;
     /* enable debloking */
@@ -1211,7 +1544,7 @@ bool VaapiEncoderH264::fill(VAEncPictureParameterBufferH264* picParam, const Pic
 bool VaapiEncoderH264::ensureSequenceHeader(const PicturePtr& picture,const VAEncSequenceParameterBufferH264* const sequence)
 {
     m_headers.reset(new VaapiEncStreamHeaderH264());
-    m_headers->setSPS(sequence, profile());
+    m_headers->setSPS(sequence, profile(), m_videoParamLayers.temporalLayers > 1);
     return true;
 }
 
@@ -1242,13 +1575,23 @@ static void fillReferenceList(VAEncSliceParameterBufferH264* slice, const vector
         picList[i].picture_id = VA_INVALID_SURFACE;
 }
 
+/* slices are cut on macroblock rows, I and P/B pictures may use a different count */
+uint32_t VaapiEncoderH264::sliceCount(const PicturePtr& picture) const
+{
+    const SliceNum& sliceNum = m_videoParamAVC.sliceNum;
+    uint32_t count = picture->m_type == VAAPI_PICTURE_TYPE_I ? sliceNum.iSliceNum : sliceNum.pSliceNum;
+    if (count > m_mbHeight)
+        count = m_mbHeight;
+    return count ? count : 1;
+}
+
 /* Adds slice headers to picture */
 bool VaapiEncoderH264::addSliceHeaders (const PicturePtr& picture,
                                         const vector<ReferencePtr>& refList0,
                                         const vector<ReferencePtr>& refList1) const
 {
     VAEncSliceParameterBufferH264 *sliceParam;
-    uint32_t sliceOfMbs, sliceModMbs, curSliceMbs;
+    uint32_t numSlices, sliceOfRows, sliceModRows, curSliceMbs;
     uint32_t mbSize;
     uint32_t lastMbIndex;
 
@@ -1265,15 +1608,15 @@ bool VaapiEncoderH264::addSliceHeaders (const PicturePtr& picture,
 
     mbSize = m_mbWidth * m_mbHeight;
 
-    assert (m_numSlices && m_numSlices < mbSize);
-    sliceOfMbs = mbSize / m_numSlices;
-    sliceModMbs = mbSize % m_numSlices;
+    numSlices = sliceCount(picture);
+    sliceOfRows = m_mbHeight / numSlices;
+    sliceModRows = m_mbHeight % numSlices;
     lastMbIndex = 0;
-    for (int i = 0; i < m_numSlices; ++i) {
-        curSliceMbs = sliceOfMbs;
-        if (sliceModMbs) {
-            ++curSliceMbs;
-            --sliceModMbs;
+    for (uint32_t i = 0; i < numSlices; ++i) {
+        curSliceMbs = sliceOfRows * m_mbWidth;
+        if (sliceModRows) {
+            curSliceMbs += m_mbWidth;
+            --sliceModRows;
         }
         if (!picture->newSlice(sliceParam))
             return false;
@@ -1295,12 +1638,21 @@ bool VaapiEncoderH264::addSliceHeaders (const PicturePtr& picture,
         fillReferenceList(sliceParam, refList1, 1);
 
 
-        sliceParam->slice_qp_delta = initQP() - minQP();
-        if (sliceParam->slice_qp_delta > 4)
-            sliceParam->slice_qp_delta = 4;
+        if (picture->m_isRateControlled || picture->m_qpOffset) {
+            //pic_init_qp is in the PPS we sent with the IDR, the host QP goes here
+            sliceParam->slice_qp_delta = (int32_t)picture->m_qp - (int32_t)initQP();
+        } else {
+            sliceParam->slice_qp_delta = initQP() - minQP();
+            if (sliceParam->slice_qp_delta > 4)
+                sliceParam->slice_qp_delta = 4;
+        }
         sliceParam->slice_alpha_c0_offset_div2 = 2;
         sliceParam->slice_beta_offset_div2 = 2;
 
+        //the driver's slice header can't carry the reference list modification and MMCOs
+        if (m_layeredRefs.isEnabled() && !addPackedSliceHeader(picture, sliceParam))
+            return false;
+
         /* set calculation for next slice */
         lastMbIndex += curSliceMbs;
     }
@@ -1308,6 +1660,157 @@ bool VaapiEncoderH264::addSliceHeaders (const PicturePtr& picture,
     return true;
 }
 
+/* the fields of a slice header which don't change from picture to picture, for the template cache */
+static uint64_t sliceHeaderShape(uint32_t nalRefIdc, bool isIdr, bool useCabac,
+                                 const VAEncSliceParameterBufferH264* const slice)
+{
+    uint64_t key = nalRefIdc & 3;
+    key = (key << 1) | isIdr;
+    key = (key << 1) | useCabac;
+    key = (key << 4) | (slice->slice_type & 0xf);
+    key = (key << 20) | (slice->macroblock_address & 0xfffff);
+    key = (key << 8) | slice->pic_parameter_set_id;
+    key = (key << 5) | (slice->num_ref_idx_l0_active_minus1 & 0x1f);
+    key = (key << 5) | (slice->num_ref_idx_l1_active_minus1 & 0x1f);
+    key = (key << 1) | (slice->direct_spatial_mv_pred_flag & 1);
+    key = (key << 2) | (slice->cabac_init_idc & 3);
+    key = (key << 2) | (slice->disable_deblocking_filter_idc & 3);
+    key = (key << 4) | (slice->slice_alpha_c0_offset_div2 & 0xf);
+    key = (key << 4) | (slice->slice_beta_offset_div2 & 0xf);
+    return key;
+}
+
+/* the template of a slice shape, built on first use */
+const H264SliceHeaderTemplate& VaapiEncoderH264::sliceHeaderTemplate(uint32_t pictureType,
+    uint32_t nalRefIdc, bool isIdr, const VAEncSliceParameterBufferH264* const slice) const
+{
+    uint64_t key = sliceHeaderShape(nalRefIdc, isIdr, m_useCabac, slice);
+    SliceHeaderTemplates::iterator it = m_sliceHeaderTemplates.find(key);
+    if (it != m_sliceHeaderTemplates.end())
+        return it->second;
+
+    H264SliceHeaderShape shape;
+    shape.nalRefIdc = nalRefIdc;
+    shape.isIdr = isIdr;
+    shape.firstMbInSlice = slice->macroblock_address;
+    shape.sliceType = slice->slice_type;
+    shape.picParameterSetId = slice->pic_parameter_set_id;
+    shape.log2MaxFrameNum = m_log2MaxFrameNum;
+    shape.log2MaxPicOrderCntLsb = m_log2MaxPicOrderCnt;
+    shape.directSpatialMvPredFlag = slice->direct_spatial_mv_pred_flag;
+    /* num_ref_idx_active_override_flag, against the defaults in the PPS */
+    uint32_t l0 = m_maxRefList0Count ? m_maxRefList0Count - 1 : 0;
+    uint32_t l1 = m_maxRefList1Count ? m_maxRefList1Count - 1 : 0;
+    shape.numRefIdxActiveOverride = slice->num_ref_idx_l0_active_minus1 != l0
+        || (pictureType == VAAPI_PICTURE_TYPE_B && slice->num_ref_idx_l1_active_minus1 != l1);
+    shape.numRefIdxL0ActiveMinus1 = slice->num_ref_idx_l0_active_minus1;
+    shape.numRefIdxL1ActiveMinus1 = slice->num_ref_idx_l1_active_minus1;
+    shape.cabac = m_useCabac;
+    shape.cabacInitIdc = slice->cabac_init_idc;
+    shape.disableDeblockingFilterIdc = slice->disable_deblocking_filter_idc;
+    shape.sliceAlphaC0OffsetDiv2 = slice->slice_alpha_c0_offset_div2;
+    shape.sliceBetaOffsetDiv2 = slice->slice_beta_offset_div2;
+
+    H264SliceHeaderTemplate& header = m_sliceHeaderTemplates[key];
+    header.build(shape);
+    return header;
+}
+
+/* slice_header() of a slice, the template of its shape patched with the layered reference decisions of the picture */
+bool VaapiEncoderH264::addPackedSliceHeader(const PicturePtr& picture,
+                                            const VAEncSliceParameterBufferH264* const slice) const
+{
+    const LayeredRefs::Decision& decision = picture->m_refDecision;
+    uint32_t nalRefIdc = VAAPI_ENCODER_H264_NAL_REF_IDC_NONE;
+    if (picture->m_isReference)
+        nalRefIdc = picture->m_type == VAAPI_PICTURE_TYPE_I ? VAAPI_ENCODER_H264_NAL_REF_IDC_HIGH : VAAPI_ENCODER_H264_NAL_REF_IDC_MEDIUM;
+    const H264SliceHeaderTemplate& header = sliceHeaderTemplate(picture->m_type, nalRefIdc, picture->isIdr(), slice);
+
+    H264SliceHeaderFields fields;
+    fields.frameNum = picture->m_frameNum;
+    fields.idrPicId = slice->idr_pic_id;
+    fields.picOrderCntLsb = slice->pic_order_cnt_lsb;
+    fields.sliceQpDelta = slice->slice_qp_delta;
+    /* the reference first in list 0 */
+    const ReferencePtr& ref = decision.ref;
+    fields.modifyRefList0 = bool(ref);
+    fields.modifiedRefIsLongTerm = ref && ref->m_isLongTerm;
+    fields.absDiffPicNumMinus1 = 0;
+    if (ref && !ref->m_isLongTerm)
+        fields.absDiffPicNumMinus1 = (picture->m_frameNum + m_maxFrameNum - ref->m_frameNum) % m_maxFrameNum - 1;
+    fields.longTermReferenceFlag = decision.isLongTerm;
+    fields.mmcos = decision.mmcos.empty() ? NULL : &decision.mmcos[0];
+    fields.mmcoCount = decision.mmcos.size();
+
+    uint8_t data[H264_MAX_PACKED_SLICE_HEADER_SIZE];
+    uint32_t bitSize = header.write(fields, data, sizeof(data));
+    if (!bitSize) {
+        ERROR("slice header is larger than %d bytes", H264_MAX_PACKED_SLICE_HEADER_SIZE);
+        return false;
+    }
+    return picture->addPackedSliceHeader(data, bitSize);
+}
+
+uint32_t VaapiEncoderH264::getPackedHeaders() const
+{
+    return m_layeredRefs.isEnabled() ? VA_ENC_PACKED_HEADER_SLICE : 0;
+}
+
+bool VaapiEncoderH264::ensureMaxSliceSize(const PicturePtr& picture)
+{
+    if (m_videoParamAVC.maxSliceSize <= 0)
+        return true;
+    VAEncMiscParameterMaxSliceSize* maxSliceSize;
+    if (!picture->newMisc(VAEncMiscParameterTypeMaxSliceSize, maxSliceSize))
+        return false;
+    //in bits
+    maxSliceSize->max_slice_size = m_videoParamAVC.maxSliceSize * 8;
+    return true;
+}
+
+// cyclic intra refresh (VIDEO_ENC_CIR, VIDEO_ENC_BOTH) needs the rolling intra refresh of the driver
+void VaapiEncoderH264::resetIntraRefresh()
+{
+    VideoIntraRefreshType type = m_videoParamCommon.refreshType;
+    m_useIntraRefresh = type == VIDEO_ENC_CIR || type == VIDEO_ENC_BOTH;
+#if !VA_CHECK_VERSION(0,39,0)
+    if (m_useIntraRefresh) {
+        WARNING("libva has no rolling intra refresh, periodic I frames are used");
+        m_useIntraRefresh = false;
+    }
+#endif
+    if (m_useIntraRefresh)
+        m_intraRefresh.init(m_videoParamIntraRefresh.refreshByRow, m_mbWidth, m_mbHeight,
+                            m_videoParamCommon.cyclicFrameInterval);
+    else
+        m_intraRefresh.init(false, 0, 0, 0);
+}
+
+// the columns (or rows) picked by m_intraRefresh are forced to intra, with a recovery point SEI on a new cycle
+bool VaapiEncoderH264::ensureIntraRefresh(const PicturePtr& picture)
+{
+    const VaapiIntraRefresh::Region& region = picture->m_refresh;
+    if (!region.size)
+        return true;
+#if VA_CHECK_VERSION(0,39,0)
+    VAEncMiscParameterRIR* rir;
+    if (!picture->newMisc(VAEncMiscParameterTypeRIR, rir))
+        return false;
+    if (m_intraRefresh.isByRow())
+        rir->rir_flags.bits.enable_rir_row = 1;
+    else
+        rir->rir_flags.bits.enable_rir_column = 1;
+    rir->intra_insertion_location = region.location;
+    rir->intra_insert_size = region.size;
+    rir->qp_delta_for_inserted_intra = 0;
+#endif
+    if (region.recoveryPoint) {
+        picture->m_sei.reset(new std::vector<uint8_t>);
+        m_intraRefresh.writeRecoveryPointSei(*picture->m_sei);
+    }
+    return true;
+}
+
 bool VaapiEncoderH264::ensureSequence(const PicturePtr& picture)
 {
     if (picture->m_type != VAAPI_PICTURE_TYPE_I) {
@@ -1365,7 +1868,7 @@ Encode_Status VaapiEncoderH264::encodePicture(const PicturePtr& picture)
 {
     Encode_Status ret = ENCODE_FAIL;
 
-    SurfacePtr reconstruct = createSurface();
+    SurfacePtr reconstruct = acquireReconSurface();
     if (!reconstruct)
         return ret;
     {
@@ -1382,6 +1885,10 @@ Encode_Status VaapiEncoderH264::encodePicture(const PicturePtr& picture)
             return ret;
         if (!ensureMiscParams (picture.get()))
             return ret;
+        if (!ensureMaxSliceSize(picture))
+            return ret;
+        if (!ensureIntraRefresh(picture))
+            return ret;
         if (!ensurePicture(picture, reconstruct))
             return ret;
         if (!ensureSlices (picture))
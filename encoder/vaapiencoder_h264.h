@@ -28,7 +28,12 @@
 #include "vaapiencoder_base.h"
 #include "vaapi/vaapiptrs.h"
 #include "common/lock.h"
+#include "vaapiencoder_h264_gop.h"
+#include "vaapiencoder_h264_refs.h"
+#include "vaapiencoder_h264_slice.h"
+#include "vaapiintrarefresh.h"
 #include <list>
+#include <map>
 #include <queue>
 #include <pthread.h>
 #include <va/va_enc_h264.h>
@@ -45,6 +50,7 @@ public:
     typedef SharedPtr<VaapiEncPictureH264> PicturePtr;
     typedef SharedPtr<VaapiEncoderH264Ref> ReferencePtr;
     typedef SharedPtr <VaapiEncStreamHeaderH264> StreamHeaderPtr;
+    typedef H264LayeredRefs<ReferencePtr> LayeredRefs;
 
     VaapiEncoderH264();
     ~VaapiEncoderH264();
@@ -54,6 +60,7 @@ public:
 
     virtual Encode_Status getParameters(VideoParamConfigType type, Yami_PTR);
     virtual Encode_Status setParameters(VideoParamConfigType type, Yami_PTR);
+    virtual Encode_Status setConfig(VideoParamConfigType type, Yami_PTR);
     virtual Encode_Status getMaxOutSize(uint32_t *maxSize);
 #ifdef __BUILD_GET_MV__
     // get MV buffer size.
@@ -63,6 +70,10 @@ public:
 protected:
     virtual Encode_Status doEncode(const SurfacePtr&, uint64_t timeStamp, bool forceKeyFrame);
     virtual Encode_Status getCodecConfig(VideoEncOutputBuffer *outBuffer);
+    virtual uint32_t getReorderDepth() const { return m_numBFrames + m_lookahead.getDepth(); }
+    virtual uint32_t getMaxReferenceCount() const { return m_maxRefFrames; }
+    virtual Encode_Status drain();
+    virtual uint32_t getPackedHeaders() const;
 
 private:
     //following code is a template for other encoder implementation
@@ -74,13 +85,23 @@ private:
     bool addSliceHeaders (const PicturePtr&,
                           const std::vector<ReferencePtr>& refList0,
                           const std::vector<ReferencePtr>& refList1) const;
+    bool addPackedSliceHeader(const PicturePtr&, const VAEncSliceParameterBufferH264* const) const;
+    const H264SliceHeaderTemplate& sliceHeaderTemplate(uint32_t pictureType, uint32_t nalRefIdc, bool isIdr,
+        const VAEncSliceParameterBufferH264* const) const;
     bool ensureSequence(const PicturePtr&);
     bool ensurePicture (const PicturePtr&, const SurfacePtr&);
     bool ensureSlices(const PicturePtr&);
+    bool ensureMaxSliceSize(const PicturePtr&);
+    bool ensureIntraRefresh(const PicturePtr&);
+    void resetIntraRefresh();
+    uint32_t sliceCount(const PicturePtr&) const;
     bool ensureCodedBufferSize();
 
     //reference list related
     Encode_Status reorder(const SurfacePtr& surface, uint64_t timeStamp, bool forceKeyFrame);
+    Encode_Status encodeReadyPictures();
+    void releaseLookahead();
+    uint32_t applyQpOffset(const PicturePtr&) const;
     bool referenceListUpdate (const PicturePtr&, const SurfacePtr&);
     bool referenceListInit (
         const PicturePtr& ,
@@ -93,16 +114,12 @@ private:
     uint32_t& keyFramePeriod() {
         return m_videoParamAVC.idrInterval;
     }
-    void resetGopStart();
-    void setBFrame(const PicturePtr&);
-    void setPFrame(const PicturePtr&);
-    void setIFrame(const PicturePtr&);
-    void setIdrFrame(const PicturePtr&);
-    void setIntraFrame(const PicturePtr&, bool idIdr);
-
     void resetParams();
 
     VideoParamsAVC m_videoParamAVC;
+    VideoParamsBFrames m_videoParamBFrames;
+    VideoParamsIntraRefresh m_videoParamIntraRefresh;
+    VideoParamsTemporalLayers m_videoParamLayers;
 
     uint8_t m_levelIdc;
     uint32_t m_numSlices;
@@ -111,14 +128,17 @@ private:
     uint32_t m_mbHeight;
     bool  m_useCabac;
     bool  m_useDct8x8;
+    bool  m_useIntraRefresh;
 
     /* re-ordering */
-    std::list<PicturePtr> m_reorderFrameList;
-    VaapiEncReorderState m_reorderState;
+    typedef H264Gop<PicturePtr> Gop;
+    Gop m_gop;
+    typedef VaapiLookahead<PicturePtr> Lookahead;
+    Lookahead m_lookahead;
+    //temporal layers and long term reference, m_refList is managed by it when enabled
+    LayeredRefs m_layeredRefs;
+    VaapiIntraRefresh m_intraRefresh;
     AVCStreamFormat m_streamFormat;
-    uint32_t m_frameIndex;
-    uint32_t m_curFrameNum;
-    uint32_t m_curPresentIndex;
     /* reference list */
     std::list<ReferencePtr> m_refList;
     uint32_t m_maxRefFrames;
@@ -132,6 +152,9 @@ private:
     uint32_t m_maxPicOrderCnt;
     uint32_t m_log2MaxPicOrderCnt;
     uint32_t m_idrNum;
+    //packed slice headers by shape, built on first use
+    typedef std::map<uint64_t, H264SliceHeaderTemplate> SliceHeaderTemplates;
+    mutable SliceHeaderTemplates m_sliceHeaderTemplates;
 
     StreamHeaderPtr m_headers;
     Lock m_paramLock; // locker for parameters update, for example: m_sps/m_pps/m_maxCodedbufSize (width/height etc)
@@ -0,0 +1,270 @@
+/*
+ *  vaapiencoder_h264_gop.h - picture type, order and reference decisions for h264 encoder
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapiencoder_h264_gop_h
+#define vaapiencoder_h264_gop_h
+
+#include "vaapi/vaapipicturetypes.h"
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include <list>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+/**
+ * \class H264Gop
+ * \brief decides type, coding order, frame_num and POC of the pictures of a h264 stream.
+ * <pre>
+ * it does not touch VA, so it works the same with or without a GPU and the host side
+ * unit tests cover it. T is whatever the caller wants to get back with each decision.
+ * 1. pictures are pushed in display order, up to numBFrames of them are held back,
+ *    then the mini GOP is released in coding order: the anchor (P or I) first, then the B frames.
+ * 2. with pyramid, the middle B frame of a mini GOP is coded first and used as reference by
+ *    the B frames on each side, recursively. without it, B frames are never referenced.
+ * 3. an IDR or drain() closes the pending mini GOP by turning its last picture into a P frame,
+ *    since B frames can't reference across an IDR or past the end of stream.
+ *    a forced anchor releases the pending B frames early, the mini GOP is just shorter.
+ * 4. frame_num counts reference pictures since the IDR, POC is twice the display index since the IDR.
+ *</pre>
+ */
+template <class T>
+class H264Gop
+{
+public:
+    struct Frame {
+        T data;
+        VaapiPictureType type;
+        bool isIdr;
+        bool isReference;
+        uint32_t frameNum;
+        uint32_t poc;
+    };
+
+    H264Gop()
+        : m_numBFrames(0), m_pyramid(false), m_intraPeriod(1), m_idrPeriod(1)
+        , m_maxFrameNum(16), m_maxPicOrderCnt(32)
+    {
+        reset();
+    }
+
+    void init(uint32_t numBFrames, bool pyramid, uint32_t intraPeriod, uint32_t idrPeriod,
+              uint32_t maxFrameNum, uint32_t maxPicOrderCnt)
+    {
+        m_numBFrames = numBFrames;
+        m_pyramid = pyramid;
+        m_intraPeriod = intraPeriod ? intraPeriod : 1;
+        m_idrPeriod = idrPeriod ? idrPeriod : 1;
+        m_maxFrameNum = maxFrameNum;
+        m_maxPicOrderCnt = maxPicOrderCnt;
+        reset();
+    }
+
+    /// drop everything, next picture will be an IDR
+    void reset()
+    {
+        m_pending.clear();
+        m_ready.clear();
+        m_frameIndex = 0;
+        m_nextFrameNum = 0;
+    }
+
+    /// add a picture in display order, @forceAnchor makes it a P frame even if a B frame is due
+    void push(const T& data, bool forceIdr, bool forceAnchor = false)
+    {
+        Frame frame;
+        frame.data = data;
+        frame.isIdr = false;
+        frame.isReference = false;
+        frame.frameNum = 0;
+
+        if (!m_frameIndex || m_frameIndex >= m_idrPeriod || forceIdr) {
+            closeMiniGop();
+            m_frameIndex = 0;
+            m_nextFrameNum = 0;
+            frame.type = VAAPI_PICTURE_TYPE_I;
+            frame.isIdr = true;
+            frame.poc = 0;
+            m_frameIndex++;
+            release(frame);
+            return;
+        }
+        frame.poc = (m_frameIndex * 2) % m_maxPicOrderCnt;
+        bool isIntra = !(m_frameIndex % m_intraPeriod);
+        m_frameIndex++;
+        if (isIntra || forceAnchor || m_pending.size() >= m_numBFrames) {
+            frame.type = isIntra ? VAAPI_PICTURE_TYPE_I : VAAPI_PICTURE_TYPE_P;
+            release(frame);
+        } else {
+            frame.type = VAAPI_PICTURE_TYPE_B;
+            m_pending.push_back(frame);
+        }
+    }
+
+    /// release the held back pictures, for end of stream
+    void drain()
+    {
+        closeMiniGop();
+    }
+
+    /// get next picture in coding order
+    bool pop(Frame& frame)
+    {
+        if (m_ready.empty())
+            return false;
+        frame = m_ready.front();
+        m_ready.pop_front();
+        return true;
+    }
+
+    /// count of pictures pushed but not popped yet
+    size_t size() const
+    {
+        return m_pending.size() + m_ready.size();
+    }
+
+    /// max count of reference frames the decisions need
+    uint32_t maxRefFrames() const
+    {
+        if (!m_numBFrames)
+            return 1;
+        if (!m_pyramid)
+            return 2;
+        // the referenced B frames of two mini GOPs and their two anchors
+        return 2 + 2 * referencedBFrames(m_numBFrames);
+    }
+
+    /**
+     * build the reference lists of a picture from @param[in] refs, most recent first,
+     * in the same order the decoder initializes them (8.2.4.2), so no list modification is needed.
+     * R needs a m_poc member.
+     */
+    template <class R>
+    static void buildRefLists(VaapiPictureType type, uint32_t poc, const std::list<R>& refs,
+                              std::vector<R>& refList0, std::vector<R>& refList1)
+    {
+        typename std::list<R>::const_iterator it;
+        if (type == VAAPI_PICTURE_TYPE_P) {
+            // descending PicNum, the decoding order
+            refList0.assign(refs.begin(), refs.end());
+            return;
+        }
+        if (type != VAAPI_PICTURE_TYPE_B)
+            return;
+        std::vector<R> before, after;
+        for (it = refs.begin(); it != refs.end(); ++it) {
+            if ((*it)->m_poc < poc)
+                before.push_back(*it);
+            else
+                after.push_back(*it);
+        }
+        std::sort(before.begin(), before.end(), pocGreater<R>);
+        std::sort(after.begin(), after.end(), pocLess<R>);
+        refList0 = before;
+        refList0.insert(refList0.end(), after.begin(), after.end());
+        refList1 = after;
+        refList1.insert(refList1.end(), before.begin(), before.end());
+    }
+
+private:
+    template <class R>
+    static bool pocGreater(const R& a, const R& b)
+    {
+        return a->m_poc > b->m_poc;
+    }
+
+    template <class R>
+    static bool pocLess(const R& a, const R& b)
+    {
+        return a->m_poc < b->m_poc;
+    }
+
+    static uint32_t referencedBFrames(uint32_t count)
+    {
+        if (count < 3)
+            return 0;
+        uint32_t left = (count - 1) / 2;
+        return 1 + referencedBFrames(left) + referencedBFrames(count - 1 - left);
+    }
+
+    // assign frame_num and queue in coding order
+    void release(Frame& frame)
+    {
+        if (frame.type != VAAPI_PICTURE_TYPE_B)
+            frame.isReference = true;
+        frame.frameNum = m_nextFrameNum;
+        if (frame.isReference)
+            m_nextFrameNum = (m_nextFrameNum + 1) % m_maxFrameNum;
+        m_ready.push_back(frame);
+        if (frame.type != VAAPI_PICTURE_TYPE_B) {
+            releaseBFrames(0, m_pending.size());
+            m_pending.clear();
+        }
+    }
+
+    // release m_pending[begin, end)
+    void releaseBFrames(size_t begin, size_t end)
+    {
+        if (begin >= end)
+            return;
+        if (!m_pyramid) {
+            for (size_t i = begin; i < end; i++)
+                release(m_pending[i]);
+            return;
+        }
+        size_t middle = begin + (end - begin - 1) / 2;
+        Frame& frame = m_pending[middle];
+        frame.isReference = end - begin >= 3;
+        release(frame);
+        releaseBFrames(begin, middle);
+        releaseBFrames(middle + 1, end);
+    }
+
+    void closeMiniGop()
+    {
+        if (m_pending.empty())
+            return;
+        Frame frame = m_pending.back();
+        m_pending.pop_back();
+        frame.type = VAAPI_PICTURE_TYPE_P;
+        release(frame);
+    }
+
+    uint32_t m_numBFrames;
+    bool m_pyramid;
+    uint32_t m_intraPeriod;
+    uint32_t m_idrPeriod;
+    uint32_t m_maxFrameNum;
+    uint32_t m_maxPicOrderCnt;
+
+    // display index since last IDR
+    uint32_t m_frameIndex;
+    uint32_t m_nextFrameNum;
+    // B frames waiting for their anchor, display order
+    std::deque<Frame> m_pending;
+    // coding order
+    std::deque<Frame> m_ready;
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapiencoder_h264_gop_h
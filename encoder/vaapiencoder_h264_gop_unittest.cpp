@@ -0,0 +1,241 @@
+/*
+ *  vaapiencoder_h264_gop_unittest.cpp - host side tests of the h264 encoder GOP decisions
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/common_def.h"
+#include "common/unittest.h"
+#include "vaapiencoder_h264_gop.h"
+
+using namespace YamiMediaCodec;
+
+typedef H264Gop<uint32_t> Gop;
+
+// one expected decision, data is the display index pushed
+struct Expected {
+    uint32_t display;
+    VaapiPictureType type;
+    bool isIdr;
+    bool isReference;
+    uint32_t frameNum;
+    uint32_t poc;
+};
+
+static void popAll(Gop& gop, std::vector<Gop::Frame>& frames)
+{
+    Gop::Frame frame;
+    while (gop.pop(frame))
+        frames.push_back(frame);
+}
+
+static void pushFrames(Gop& gop, uint32_t count, std::vector<Gop::Frame>& frames)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        gop.push(i, false);
+        popAll(gop, frames);
+    }
+    gop.drain();
+    popAll(gop, frames);
+}
+
+static void expectFrames(const std::vector<Gop::Frame>& frames, const Expected* expected, size_t count)
+{
+    EXPECT_EQ(count, frames.size());
+    for (size_t i = 0; i < count && i < frames.size(); i++) {
+        EXPECT_EQ(expected[i].display, frames[i].data);
+        EXPECT_EQ(expected[i].type, frames[i].type);
+        EXPECT_EQ(expected[i].isIdr, frames[i].isIdr);
+        EXPECT_EQ(expected[i].isReference, frames[i].isReference);
+        EXPECT_EQ(expected[i].frameNum, frames[i].frameNum);
+        EXPECT_EQ(expected[i].poc, frames[i].poc);
+    }
+}
+
+static void testNoBFrames()
+{
+    Gop gop;
+    gop.init(0, false, 30, 30, 16, 64);
+    std::vector<Gop::Frame> frames;
+    pushFrames(gop, 4, frames);
+    const Expected expected[] = {
+        { 0, VAAPI_PICTURE_TYPE_I, true, true, 0, 0 },
+        { 1, VAAPI_PICTURE_TYPE_P, false, true, 1, 2 },
+        { 2, VAAPI_PICTURE_TYPE_P, false, true, 2, 4 },
+        { 3, VAAPI_PICTURE_TYPE_P, false, true, 3, 6 },
+    };
+    expectFrames(frames, expected, N_ELEMENTS(expected));
+    EXPECT_EQ(1u, gop.maxRefFrames());
+}
+
+static void testBFrames()
+{
+    Gop gop;
+    gop.init(2, false, 30, 30, 16, 64);
+    std::vector<Gop::Frame> frames;
+    pushFrames(gop, 7, frames);
+    // the anchor is coded before the B frames it closes, B frames are not referenced
+    const Expected expected[] = {
+        { 0, VAAPI_PICTURE_TYPE_I, true, true, 0, 0 },
+        { 3, VAAPI_PICTURE_TYPE_P, false, true, 1, 6 },
+        { 1, VAAPI_PICTURE_TYPE_B, false, false, 2, 2 },
+        { 2, VAAPI_PICTURE_TYPE_B, false, false, 2, 4 },
+        { 6, VAAPI_PICTURE_TYPE_P, false, true, 2, 12 },
+        { 4, VAAPI_PICTURE_TYPE_B, false, false, 3, 8 },
+        { 5, VAAPI_PICTURE_TYPE_B, false, false, 3, 10 },
+    };
+    expectFrames(frames, expected, N_ELEMENTS(expected));
+    EXPECT_EQ(2u, gop.maxRefFrames());
+}
+
+static void testPyramid()
+{
+    Gop gop;
+    gop.init(3, true, 30, 30, 16, 64);
+    std::vector<Gop::Frame> frames;
+    pushFrames(gop, 5, frames);
+    // the middle B frame is coded first and referenced by its neighbours
+    const Expected expected[] = {
+        { 0, VAAPI_PICTURE_TYPE_I, true, true, 0, 0 },
+        { 4, VAAPI_PICTURE_TYPE_P, false, true, 1, 8 },
+        { 2, VAAPI_PICTURE_TYPE_B, false, true, 2, 4 },
+        { 1, VAAPI_PICTURE_TYPE_B, false, false, 3, 2 },
+        { 3, VAAPI_PICTURE_TYPE_B, false, false, 3, 6 },
+    };
+    expectFrames(frames, expected, N_ELEMENTS(expected));
+    EXPECT_EQ(4u, gop.maxRefFrames());
+}
+
+static void testDrainClosesMiniGop()
+{
+    Gop gop;
+    gop.init(3, false, 30, 30, 16, 64);
+    std::vector<Gop::Frame> frames;
+    pushFrames(gop, 3, frames);
+    // no anchor came, the last held back picture becomes one
+    const Expected expected[] = {
+        { 0, VAAPI_PICTURE_TYPE_I, true, true, 0, 0 },
+        { 2, VAAPI_PICTURE_TYPE_P, false, true, 1, 4 },
+        { 1, VAAPI_PICTURE_TYPE_B, false, false, 2, 2 },
+    };
+    expectFrames(frames, expected, N_ELEMENTS(expected));
+    EXPECT_EQ(0u, gop.size());
+}
+
+static void testForcedIdr()
+{
+    Gop gop;
+    gop.init(2, false, 30, 30, 16, 64);
+    std::vector<Gop::Frame> frames;
+    gop.push(0, false);
+    gop.push(1, false);
+    // the IDR waits in coding order, the B frame for its anchor
+    EXPECT_EQ(2u, gop.size());
+    popAll(gop, frames);
+    gop.push(2, true);
+    popAll(gop, frames);
+    // the pending B frame is closed as P before the IDR restarts frame_num and POC
+    const Expected expected[] = {
+        { 0, VAAPI_PICTURE_TYPE_I, true, true, 0, 0 },
+        { 1, VAAPI_PICTURE_TYPE_P, false, true, 1, 2 },
+        { 2, VAAPI_PICTURE_TYPE_I, true, true, 0, 0 },
+    };
+    expectFrames(frames, expected, N_ELEMENTS(expected));
+}
+
+static void testForcedAnchor()
+{
+    Gop gop;
+    gop.init(3, false, 30, 30, 16, 64);
+    std::vector<Gop::Frame> frames;
+    gop.push(0, false);
+    gop.push(1, false);
+    gop.push(2, false, true);
+    popAll(gop, frames);
+    const Expected expected[] = {
+        { 0, VAAPI_PICTURE_TYPE_I, true, true, 0, 0 },
+        { 2, VAAPI_PICTURE_TYPE_P, false, true, 1, 4 },
+        { 1, VAAPI_PICTURE_TYPE_B, false, false, 2, 2 },
+    };
+    expectFrames(frames, expected, N_ELEMENTS(expected));
+}
+
+static void testPeriods()
+{
+    Gop gop;
+    gop.init(1, false, 3, 6, 4, 16);
+    std::vector<Gop::Frame> frames;
+    pushFrames(gop, 9, frames);
+    // an I frame every 3 pictures, an IDR every 6, frame_num wraps at 4 and POC at 16
+    const Expected expected[] = {
+        { 0, VAAPI_PICTURE_TYPE_I, true, true, 0, 0 },
+        { 2, VAAPI_PICTURE_TYPE_P, false, true, 1, 4 },
+        { 1, VAAPI_PICTURE_TYPE_B, false, false, 2, 2 },
+        { 3, VAAPI_PICTURE_TYPE_I, false, true, 2, 6 },
+        { 5, VAAPI_PICTURE_TYPE_P, false, true, 3, 10 },
+        { 4, VAAPI_PICTURE_TYPE_B, false, false, 0, 8 },
+        { 6, VAAPI_PICTURE_TYPE_I, true, true, 0, 0 },
+        { 8, VAAPI_PICTURE_TYPE_P, false, true, 1, 4 },
+        { 7, VAAPI_PICTURE_TYPE_B, false, false, 2, 2 },
+    };
+    expectFrames(frames, expected, N_ELEMENTS(expected));
+}
+
+struct Ref {
+    uint32_t m_poc;
+};
+
+static void testRefLists()
+{
+    Ref refs[] = { { 8 }, { 0 }, { 2 }, { 12 } };
+    std::list<const Ref*> refList;
+    for (size_t i = 0; i < N_ELEMENTS(refs); i++)
+        refList.push_back(&refs[i]);
+
+    std::vector<const Ref*> list0, list1;
+    Gop::buildRefLists(VAAPI_PICTURE_TYPE_P, 14, refList, list0, list1);
+    EXPECT_EQ(4u, list0.size());
+    EXPECT_TRUE(list1.empty());
+    for (size_t i = 0; i < list0.size(); i++)
+        EXPECT_EQ(&refs[i], list0[i]);
+
+    // 8.2.4.2.3, list0 is past pictures closest first then future ones, list1 the reverse
+    list0.clear();
+    Gop::buildRefLists(VAAPI_PICTURE_TYPE_B, 6, refList, list0, list1);
+    const uint32_t pocs0[] = { 2, 0, 8, 12 };
+    const uint32_t pocs1[] = { 8, 12, 2, 0 };
+    EXPECT_EQ(4u, list0.size());
+    EXPECT_EQ(4u, list1.size());
+    for (size_t i = 0; i < 4 && i < list0.size() && i < list1.size(); i++) {
+        EXPECT_EQ(pocs0[i], list0[i]->m_poc);
+        EXPECT_EQ(pocs1[i], list1[i]->m_poc);
+    }
+}
+
+int main()
+{
+    RUN_TEST(testNoBFrames);
+    RUN_TEST(testBFrames);
+    RUN_TEST(testPyramid);
+    RUN_TEST(testDrainClosesMiniGop);
+    RUN_TEST(testForcedIdr);
+    RUN_TEST(testForcedAnchor);
+    RUN_TEST(testPeriods);
+    RUN_TEST(testRefLists);
+    return UNITTEST_RESULT();
+}
@@ -0,0 +1,251 @@
+/*
+ *  vaapiencoder_h264_refs.h - temporal layers and long term references for h264 encoder
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapiencoder_h264_refs_h
+#define vaapiencoder_h264_refs_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <list>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+#define H264_MAX_TEMPORAL_LAYERS 3
+
+/// a memory_management_control_operation of dec_ref_pic_marking()
+struct H264Mmco {
+    uint32_t op;
+    //difference_of_pic_nums_minus1 for op 1, long_term_frame_idx for op 6
+    uint32_t value;
+};
+
+/**
+ * \class H264LayeredRefs
+ * \brief decides temporal layer, reference and memory management of P pictures,
+ * in place of the sliding window.
+ * <pre>
+ * R is the reference the caller keeps, it needs m_frameNum, m_temporalId and m_isLongTerm
+ * members.
+ * 1. with n layers, the layer pattern repeats every 2^(n-1) pictures, like 0 2 1 2 for 3 layers.
+ *    a picture of layer t > 0 only references the last picture of a layer below t,
+ *    a picture of layer 0 the last picture of layer 0. the top layer is not referenced,
+ *    so any top layers can be dropped from the stream.
+ * 2. one short term reference is kept per referenced layer, the previous one of the same layer
+ *    is removed by MMCO 1 when a new one comes.
+ * 3. with a long term period, the IDR and then a layer 0 picture every period pictures is kept
+ *    as long term reference (MMCO 6, index 0), replacing the previous one.
+ * 4. after a recovery request, the next picture is a layer 0 picture which references the
+ *    long term reference only, all short term references are removed.
+ *</pre>
+ */
+template <class R>
+class H264LayeredRefs
+{
+public:
+    enum {
+        MMCO_SHORT_TERM_UNUSED = 1,
+        MMCO_CURRENT_LONG_TERM = 6,
+    };
+    typedef H264Mmco Mmco;
+    struct Decision {
+        uint32_t temporalId;
+        bool isReference;
+        //kept as long term reference, by long_term_reference_flag for an IDR
+        bool isLongTerm;
+        uint32_t frameNum;
+        //reference of a P picture
+        R ref;
+        std::vector<Mmco> mmcos;
+        std::vector<R> removed;
+    };
+
+    H264LayeredRefs()
+        : m_layers(1), m_ltrPeriod(0), m_maxFrameNum(16)
+    {
+        reset();
+    }
+
+    void init(uint32_t layers, uint32_t ltrPeriod, uint32_t maxFrameNum)
+    {
+        if (!layers)
+            layers = 1;
+        if (layers > H264_MAX_TEMPORAL_LAYERS)
+            layers = H264_MAX_TEMPORAL_LAYERS;
+        m_layers = layers;
+        m_ltrPeriod = ltrPeriod;
+        m_maxFrameNum = maxFrameNum;
+        reset();
+    }
+
+    /// false for a single layer without long term reference, the sliding window does it
+    bool isEnabled() const
+    {
+        return m_layers > 1 || m_ltrPeriod;
+    }
+
+    void reset()
+    {
+        m_index = 0;
+        m_nextFrameNum = 0;
+        m_sinceLongTerm = 0;
+        m_recovery = false;
+    }
+
+    uint32_t maxRefFrames() const
+    {
+        uint32_t count = m_layers > 1 ? m_layers - 1 : 1;
+        return count + (m_ltrPeriod ? 1 : 0);
+    }
+
+    /// next picture references the long term reference only
+    void requestRecovery()
+    {
+        m_recovery = true;
+    }
+
+    /// decide for next picture in coding order, @refs is the current references, most recent first
+    void decide(bool isIdr, const std::list<R>& refs, Decision& decision)
+    {
+        decision.ref = R();
+        decision.mmcos.clear();
+        decision.removed.clear();
+        decision.isLongTerm = false;
+        if (isIdr) {
+            reset();
+            decision.temporalId = 0;
+            decision.isReference = true;
+            decision.isLongTerm = m_ltrPeriod > 0;
+            decision.frameNum = 0;
+            m_nextFrameNum = 1;
+            m_index = 1;
+            return;
+        }
+
+        typename std::list<R>::const_iterator it;
+        bool recovery = m_recovery && findLongTerm(refs);
+        m_recovery = false;
+        if (recovery) {
+            m_index = 0;
+            decision.ref = findLongTerm(refs);
+        }
+        uint32_t tid = temporalId(m_index);
+        decision.temporalId = tid;
+        decision.isReference = m_layers == 1 || tid < m_layers - 1;
+        decision.frameNum = m_nextFrameNum;
+        if (!recovery) {
+            for (it = refs.begin(); it != refs.end(); ++it) {
+                if (tid ? (*it)->m_temporalId < tid : !(*it)->m_temporalId) {
+                    decision.ref = *it;
+                    break;
+                }
+            }
+        }
+        if (!decision.ref && !refs.empty())
+            decision.ref = refs.front();
+
+        m_index++;
+        m_sinceLongTerm++;
+        if (!decision.isReference)
+            return;
+        for (it = refs.begin(); it != refs.end(); ++it) {
+            const R& r = *it;
+            if (r->m_isLongTerm || (!recovery && r->m_temporalId != tid))
+                continue;
+            Mmco mmco;
+            mmco.op = MMCO_SHORT_TERM_UNUSED;
+            mmco.value = picNumDiff(decision.frameNum, r->m_frameNum) - 1;
+            decision.mmcos.push_back(mmco);
+            decision.removed.push_back(r);
+        }
+        if (m_ltrPeriod && !tid && m_sinceLongTerm >= m_ltrPeriod) {
+            Mmco mmco;
+            mmco.op = MMCO_CURRENT_LONG_TERM;
+            mmco.value = 0;
+            decision.mmcos.push_back(mmco);
+            decision.isLongTerm = true;
+            m_sinceLongTerm = 0;
+        }
+        m_nextFrameNum = (m_nextFrameNum + 1) % m_maxFrameNum;
+    }
+
+    /// the picture of @decision is encoded, @current is its reference
+    void update(const Decision& decision, std::list<R>& refs, const R& current)
+    {
+        if (!decision.isReference)
+            return;
+        for (size_t i = 0; i < decision.removed.size(); i++)
+            refs.remove(decision.removed[i]);
+        if (decision.isLongTerm) {
+            typename std::list<R>::iterator it = refs.begin();
+            while (it != refs.end()) {
+                if ((*it)->m_isLongTerm)
+                    it = refs.erase(it);
+                else
+                    ++it;
+            }
+        }
+        refs.push_front(current);
+    }
+
+private:
+    uint32_t temporalId(uint32_t index) const
+    {
+        uint32_t period = 1 << (m_layers - 1);
+        uint32_t pos = index % period;
+        uint32_t tid = m_layers - 1;
+        //the lowest set bit of the position in the pattern picks the layer
+        while (pos && !(pos & 1)) {
+            pos >>= 1;
+            tid--;
+        }
+        return pos ? tid : 0;
+    }
+
+    static R findLongTerm(const std::list<R>& refs)
+    {
+        typename std::list<R>::const_iterator it;
+        for (it = refs.begin(); it != refs.end(); ++it) {
+            if ((*it)->m_isLongTerm)
+                return *it;
+        }
+        return R();
+    }
+
+    uint32_t picNumDiff(uint32_t current, uint32_t frameNum) const
+    {
+        return (current + m_maxFrameNum - frameNum) % m_maxFrameNum;
+    }
+
+    uint32_t m_layers;
+    uint32_t m_ltrPeriod;
+    uint32_t m_maxFrameNum;
+
+    //picture index in the layer pattern
+    uint32_t m_index;
+    uint32_t m_nextFrameNum;
+    uint32_t m_sinceLongTerm;
+    bool m_recovery;
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapiencoder_h264_refs_h
@@ -0,0 +1,346 @@
+/*
+ *  vaapiencoder_h264_slice.h - slice header templates for the h264 encoder
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapiencoder_h264_slice_h
+#define vaapiencoder_h264_slice_h
+
+#include "vaapiencoder_h264_refs.h"
+#include <stdint.h>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+/**
+ * \class H264SliceBitWriter
+ * \brief writes bits to a fixed buffer of the caller through a 64 bit accumulator,
+ * 32 bits are stored at a time. nothing is allocated, a slice header fits on the stack.
+ */
+class H264SliceBitWriter
+{
+public:
+    H264SliceBitWriter(uint8_t* data, uint32_t size)
+        : m_acc(0), m_accBits(0), m_data(data), m_size(size), m_pos(0), m_overflow(false)
+    {
+    }
+
+    /// @bits up to 32
+    void put(uint32_t value, uint32_t bits)
+    {
+        if (!bits)
+            return;
+        //less than 32 bits are pending, so they fit with 32 more
+        m_acc = (m_acc << bits) | (value & (0xffffffffU >> (32 - bits)));
+        m_accBits += bits;
+        if (m_accBits >= 32) {
+            m_accBits -= 32;
+            store((uint32_t)(m_acc >> m_accBits), 4);
+        }
+    }
+
+    void putUe(uint32_t value)
+    {
+        uint64_t code = (uint64_t)value + 1;
+        uint32_t bits = 64 - __builtin_clzll(code);
+        if (bits > 32) {
+            put(0, bits - 33);
+            put(0, 32);
+            put((uint32_t)(code >> 32), 1);
+            put((uint32_t)code, 32);
+            return;
+        }
+        if (bits > 16) {
+            put(0, bits - 1);
+            put((uint32_t)code, bits);
+        } else {
+            //one put for the whole code
+            put((uint32_t)code, bits * 2 - 1);
+        }
+    }
+
+    void putSe(int32_t value)
+    {
+        putUe(value > 0 ? ((uint32_t)value << 1) - 1 : -((int64_t)value << 1));
+    }
+
+    /// bits put so far
+    uint32_t getBitSize() const { return m_pos * 8 + m_accBits; }
+
+    /// pads the last byte with 0 and stores it, bit size of the data or 0 on overflow
+    uint32_t finish()
+    {
+        uint32_t bits = m_pos * 8 + m_accBits;
+        uint32_t bytes = (m_accBits + 7) / 8;
+        if (bytes)
+            store((uint32_t)(m_acc << (bytes * 8 - m_accBits)), bytes);
+        m_accBits = 0;
+        return m_overflow ? 0 : bits;
+    }
+
+private:
+    void store(uint32_t value, uint32_t bytes)
+    {
+        if (m_pos + bytes > m_size) {
+            m_overflow = true;
+            return;
+        }
+        for (uint32_t i = bytes; i > 0; i--)
+            m_data[m_pos++] = value >> ((i - 1) * 8);
+    }
+
+    uint64_t m_acc;
+    uint32_t m_accBits;
+    uint8_t* m_data;
+    uint32_t m_size;
+    uint32_t m_pos;
+    bool m_overflow;
+};
+
+/// the slice_header() elements which are the same for every picture of a slice shape
+struct H264SliceHeaderShape {
+    uint32_t nalRefIdc;
+    bool isIdr;
+    uint32_t firstMbInSlice;
+    //7.4.3, 0 to 9, P B and I are 0 1 and 2 modulo 5
+    uint32_t sliceType;
+    uint32_t picParameterSetId;
+    uint32_t log2MaxFrameNum;
+    uint32_t log2MaxPicOrderCntLsb;
+    uint32_t directSpatialMvPredFlag;
+    //num_ref_idx_active_override_flag, the counts are sent when it is set
+    bool numRefIdxActiveOverride;
+    uint32_t numRefIdxL0ActiveMinus1;
+    uint32_t numRefIdxL1ActiveMinus1;
+    bool cabac;
+    uint32_t cabacInitIdc;
+    uint32_t disableDeblockingFilterIdc;
+    int32_t sliceAlphaC0OffsetDiv2;
+    int32_t sliceBetaOffsetDiv2;
+};
+
+/// the slice_header() elements which change from picture to picture
+struct H264SliceHeaderFields {
+    uint32_t frameNum;
+    uint32_t idrPicId;
+    uint32_t picOrderCntLsb;
+    int32_t sliceQpDelta;
+    //ref_pic_list_modification() of list 0, one reference moved to the front
+    bool modifyRefList0;
+    //the long term reference with long_term_pic_num 0, else a short term one
+    bool modifiedRefIsLongTerm;
+    uint32_t absDiffPicNumMinus1;
+    //dec_ref_pic_marking() of an IDR
+    bool longTermReferenceFlag;
+    //dec_ref_pic_marking() of other pictures, sliding window if there is none
+    const H264Mmco* mmcos;
+    uint32_t mmcoCount;
+};
+
+/**
+ * \class H264SliceHeaderTemplate
+ * \brief a packed slice header with its per picture fields left as holes.
+ * <pre>
+ * the encoder builds one template for each H264SliceHeaderShape, and the constant bits
+ * between the holes are merged into 32 bit words. a header is then written by copying
+ * the words and patching the H264SliceHeaderFields, instead of coding every syntax
+ * element again. the encoder fills the shape and the fields.
+ *</pre>
+ */
+class H264SliceHeaderTemplate
+{
+public:
+    /// slice_header() (7.3.3) after a start code and the nal header
+    void build(const H264SliceHeaderShape& shape)
+    {
+        m_items.clear();
+        /* start code */
+        put(1, 32);
+        /* nal header, forbidden_zero_bit, nal_ref_idc and nal_unit_type */
+        put(0, 1);
+        put(shape.nalRefIdc, 2);
+        put(shape.isIdr ? NAL_IDR : NAL_NON_IDR, 5);
+        putUe(shape.firstMbInSlice);
+        putUe(shape.sliceType);
+        putUe(shape.picParameterSetId);
+        hole(FIELD_FRAME_NUM, shape.log2MaxFrameNum);
+        if (shape.isIdr)
+            hole(FIELD_IDR_PIC_ID);
+        hole(FIELD_POC_LSB, shape.log2MaxPicOrderCntLsb);
+        bool isB = shape.sliceType % 5 == SLICE_B;
+        bool isI = shape.sliceType % 5 == SLICE_I;
+        if (isB)
+            put(shape.directSpatialMvPredFlag, 1);
+        if (!isI) {
+            put(shape.numRefIdxActiveOverride, 1);
+            if (shape.numRefIdxActiveOverride) {
+                putUe(shape.numRefIdxL0ActiveMinus1);
+                if (isB)
+                    putUe(shape.numRefIdxL1ActiveMinus1);
+            }
+            hole(FIELD_REF_LIST_MODIFICATION);
+            /* ref_pic_list_modification_flag_l1 */
+            if (isB)
+                put(0, 1);
+        }
+        if (shape.nalRefIdc) {
+            if (shape.isIdr) {
+                /* no_output_of_prior_pics_flag */
+                put(0, 1);
+                hole(FIELD_LONG_TERM_REFERENCE, 1);
+            } else {
+                hole(FIELD_ADAPTIVE_MARKING);
+            }
+        }
+        if (shape.cabac && !isI)
+            putUe(shape.cabacInitIdc);
+        hole(FIELD_QP_DELTA);
+        /* deblocking_filter_control_present_flag is set in the PPS */
+        putUe(shape.disableDeblockingFilterIdc);
+        if (shape.disableDeblockingFilterIdc != 1) {
+            putSe(shape.sliceAlphaC0OffsetDiv2);
+            putSe(shape.sliceBetaOffsetDiv2);
+        }
+    }
+
+    /// the header with @fields to @data, its bit size, or 0 if it does not fit in @size bytes
+    uint32_t write(const H264SliceHeaderFields& fields, uint8_t* data, uint32_t size) const
+    {
+        H264SliceBitWriter bs(data, size);
+        for (size_t i = 0; i < m_items.size(); i++) {
+            const Item& item = m_items[i];
+            switch (item.field) {
+            case FIELD_CONSTANT:
+                bs.put(item.value, item.bits);
+                break;
+            case FIELD_FRAME_NUM:
+                bs.put(fields.frameNum, item.bits);
+                break;
+            case FIELD_IDR_PIC_ID:
+                bs.putUe(fields.idrPicId);
+                break;
+            case FIELD_POC_LSB:
+                bs.put(fields.picOrderCntLsb, item.bits);
+                break;
+            case FIELD_REF_LIST_MODIFICATION:
+                bs.put(fields.modifyRefList0, 1);
+                if (fields.modifyRefList0) {
+                    if (fields.modifiedRefIsLongTerm) {
+                        /* long_term_pic_num */
+                        bs.putUe(2);
+                        bs.putUe(0);
+                    } else {
+                        /* abs_diff_pic_num_minus1, subtracted from the current frame_num */
+                        bs.putUe(0);
+                        bs.putUe(fields.absDiffPicNumMinus1);
+                    }
+                    bs.putUe(3);
+                }
+                break;
+            case FIELD_LONG_TERM_REFERENCE:
+                bs.put(fields.longTermReferenceFlag, 1);
+                break;
+            case FIELD_ADAPTIVE_MARKING:
+                /* adaptive_ref_pic_marking_mode_flag */
+                bs.put(fields.mmcoCount != 0, 1);
+                if (fields.mmcoCount) {
+                    for (uint32_t j = 0; j < fields.mmcoCount; j++) {
+                        bs.putUe(fields.mmcos[j].op);
+                        bs.putUe(fields.mmcos[j].value);
+                    }
+                    bs.putUe(0);
+                }
+                break;
+            case FIELD_QP_DELTA:
+                bs.putSe(fields.sliceQpDelta);
+                break;
+            }
+        }
+        return bs.finish();
+    }
+
+private:
+    enum {
+        NAL_NON_IDR = 1,
+        NAL_IDR = 5,
+        SLICE_B = 1,
+        SLICE_I = 2,
+    };
+    enum Field {
+        FIELD_CONSTANT,
+        FIELD_FRAME_NUM,
+        FIELD_IDR_PIC_ID,
+        FIELD_POC_LSB,
+        //ref_pic_list_modification() of list 0
+        FIELD_REF_LIST_MODIFICATION,
+        //long_term_reference_flag of an IDR
+        FIELD_LONG_TERM_REFERENCE,
+        //adaptive_ref_pic_marking_mode_flag and the MMCOs
+        FIELD_ADAPTIVE_MARKING,
+        FIELD_QP_DELTA,
+    };
+    struct Item {
+        uint32_t value;
+        //width of a constant or a fixed length field
+        uint8_t bits;
+        uint8_t field;
+    };
+
+    void put(uint32_t value, uint32_t bits)
+    {
+        if (!bits)
+            return;
+        if (!m_items.empty()) {
+            Item& last = m_items.back();
+            if (last.field == FIELD_CONSTANT && last.bits + bits <= 32) {
+                last.value = (last.value << bits) | (value & (0xffffffffU >> (32 - bits)));
+                last.bits += bits;
+                return;
+            }
+        }
+        Item item = { value & (0xffffffffU >> (32 - bits)), (uint8_t)bits, FIELD_CONSTANT };
+        m_items.push_back(item);
+    }
+
+    void putUe(uint32_t value)
+    {
+        uint32_t code = value + 1;
+        uint32_t bits = 32 - __builtin_clz(code);
+        put(0, bits - 1);
+        put(code, bits);
+    }
+
+    void putSe(int32_t value)
+    {
+        putUe(value > 0 ? ((uint32_t)value << 1) - 1 : -((int64_t)value << 1));
+    }
+
+    /// a hole, @bits for fixed length fields
+    void hole(Field field, uint32_t bits = 0)
+    {
+        Item item = { 0, (uint8_t)bits, (uint8_t)field };
+        m_items.push_back(item);
+    }
+
+    std::vector<Item> m_items;
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapiencoder_h264_slice_h
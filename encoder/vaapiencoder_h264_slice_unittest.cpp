@@ -0,0 +1,339 @@
+/*
+ *  vaapiencoder_h264_slice_unittest.cpp - host side tests and benchmark of the h264 slice header templates
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "codecparsers/bitwriter.h"
+#include "common/unittest.h"
+#include "vaapiencoder_h264_slice.h"
+#include <string.h>
+#include <sys/time.h>
+
+using namespace YamiMediaCodec;
+
+#define MAX_HEADER_SIZE 256
+
+static void putUe(BitWriter* bw, uint32_t value)
+{
+    uint64_t code = (uint64_t)value + 1;
+    uint32_t bits = 0;
+    while (code >> bits)
+        bits++;
+    if (bits > 1)
+        bit_writer_put_bits_uint32(bw, 0, bits - 1);
+    bit_writer_put_bits_uint64(bw, code, bits);
+}
+
+static void putSe(BitWriter* bw, int32_t value)
+{
+    putUe(bw, value > 0 ? ((uint32_t)value << 1) - 1 : -((int64_t)value << 1));
+}
+
+/* the slice header coded element by element with BitWriter, as the encoder did before the templates */
+static void referenceHeader(const H264SliceHeaderShape& shape, const H264SliceHeaderFields& fields, BitWriter* bw)
+{
+    bit_writer_put_bits_uint32(bw, 1, 32);
+    bit_writer_put_bits_uint32(bw, 0, 1);
+    bit_writer_put_bits_uint32(bw, shape.nalRefIdc, 2);
+    bit_writer_put_bits_uint32(bw, shape.isIdr ? 5 : 1, 5);
+    putUe(bw, shape.firstMbInSlice);
+    putUe(bw, shape.sliceType);
+    putUe(bw, shape.picParameterSetId);
+    bit_writer_put_bits_uint32(bw, fields.frameNum, shape.log2MaxFrameNum);
+    if (shape.isIdr)
+        putUe(bw, fields.idrPicId);
+    bit_writer_put_bits_uint32(bw, fields.picOrderCntLsb, shape.log2MaxPicOrderCntLsb);
+    bool isB = shape.sliceType % 5 == 1;
+    bool isI = shape.sliceType % 5 == 2;
+    if (isB)
+        bit_writer_put_bits_uint32(bw, shape.directSpatialMvPredFlag, 1);
+    if (!isI) {
+        bit_writer_put_bits_uint32(bw, shape.numRefIdxActiveOverride, 1);
+        if (shape.numRefIdxActiveOverride) {
+            putUe(bw, shape.numRefIdxL0ActiveMinus1);
+            if (isB)
+                putUe(bw, shape.numRefIdxL1ActiveMinus1);
+        }
+        bit_writer_put_bits_uint32(bw, fields.modifyRefList0, 1);
+        if (fields.modifyRefList0) {
+            if (fields.modifiedRefIsLongTerm) {
+                putUe(bw, 2);
+                putUe(bw, 0);
+            } else {
+                putUe(bw, 0);
+                putUe(bw, fields.absDiffPicNumMinus1);
+            }
+            putUe(bw, 3);
+        }
+        if (isB)
+            bit_writer_put_bits_uint32(bw, 0, 1);
+    }
+    if (shape.nalRefIdc) {
+        if (shape.isIdr) {
+            bit_writer_put_bits_uint32(bw, 0, 1);
+            bit_writer_put_bits_uint32(bw, fields.longTermReferenceFlag, 1);
+        } else {
+            bit_writer_put_bits_uint32(bw, fields.mmcoCount != 0, 1);
+            if (fields.mmcoCount) {
+                for (uint32_t i = 0; i < fields.mmcoCount; i++) {
+                    putUe(bw, fields.mmcos[i].op);
+                    putUe(bw, fields.mmcos[i].value);
+                }
+                putUe(bw, 0);
+            }
+        }
+    }
+    if (shape.cabac && !isI)
+        putUe(bw, shape.cabacInitIdc);
+    putSe(bw, fields.sliceQpDelta);
+    putUe(bw, shape.disableDeblockingFilterIdc);
+    if (shape.disableDeblockingFilterIdc != 1) {
+        putSe(bw, shape.sliceAlphaC0OffsetDiv2);
+        putSe(bw, shape.sliceBetaOffsetDiv2);
+    }
+}
+
+static uint32_t seed = 1;
+
+/* deterministic, so a failure can be reproduced */
+static uint32_t randomNumber(uint32_t range)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % range;
+}
+
+/* mostly small values as in a stream, sometimes long codes */
+static uint32_t randomUe()
+{
+    uint32_t r = randomNumber(10);
+    if (r < 6)
+        return randomNumber(8);
+    if (r < 9)
+        return randomNumber(1000);
+    return randomNumber(1U << 24) << randomNumber(8);
+}
+
+static void randomShape(H264SliceHeaderShape& shape)
+{
+    shape.nalRefIdc = randomNumber(4);
+    shape.isIdr = !randomNumber(4);
+    shape.firstMbInSlice = randomNumber(2) ? 0 : randomNumber(8160);
+    shape.sliceType = randomNumber(3) + (randomNumber(2) ? 5 : 0);
+    if (shape.isIdr)
+        shape.sliceType = 2;
+    shape.picParameterSetId = randomNumber(3);
+    shape.log2MaxFrameNum = 4 + randomNumber(13);
+    shape.log2MaxPicOrderCntLsb = 4 + randomNumber(13);
+    shape.directSpatialMvPredFlag = randomNumber(2);
+    shape.numRefIdxActiveOverride = randomNumber(2);
+    shape.numRefIdxL0ActiveMinus1 = randomNumber(32);
+    shape.numRefIdxL1ActiveMinus1 = randomNumber(32);
+    shape.cabac = randomNumber(2);
+    shape.cabacInitIdc = randomNumber(3);
+    shape.disableDeblockingFilterIdc = randomNumber(3);
+    shape.sliceAlphaC0OffsetDiv2 = (int32_t)randomNumber(13) - 6;
+    shape.sliceBetaOffsetDiv2 = (int32_t)randomNumber(13) - 6;
+}
+
+static void randomFields(const H264SliceHeaderShape& shape, H264SliceHeaderFields& fields, H264Mmco* mmcos)
+{
+    fields.frameNum = randomNumber(1U << shape.log2MaxFrameNum);
+    fields.idrPicId = randomNumber(65536);
+    fields.picOrderCntLsb = randomNumber(1U << shape.log2MaxPicOrderCntLsb);
+    fields.sliceQpDelta = (int32_t)randomNumber(103) - 51;
+    fields.modifyRefList0 = randomNumber(2);
+    fields.modifiedRefIsLongTerm = randomNumber(2);
+    fields.absDiffPicNumMinus1 = randomUe();
+    fields.longTermReferenceFlag = randomNumber(2);
+    fields.mmcoCount = randomNumber(4);
+    for (uint32_t i = 0; i < fields.mmcoCount; i++) {
+        mmcos[i].op = 1 + randomNumber(6);
+        mmcos[i].value = randomUe();
+    }
+    fields.mmcos = mmcos;
+}
+
+static bool sameHeader(const H264SliceHeaderTemplate& header, const H264SliceHeaderShape& shape,
+                       const H264SliceHeaderFields& fields)
+{
+    uint8_t data[MAX_HEADER_SIZE];
+    uint32_t bits = header.write(fields, data, sizeof(data));
+
+    BitWriter bw;
+    bit_writer_init(&bw, MAX_HEADER_SIZE * 8);
+    referenceHeader(shape, fields, &bw);
+    uint32_t referenceBits = BIT_WRITER_BIT_SIZE(&bw);
+    //the reference leaves the bits after the last one as they were
+    bit_writer_align_bytes(&bw, 0);
+    bool same = bits == referenceBits && !memcmp(data, BIT_WRITER_DATA(&bw), (bits + 7) / 8);
+    bit_writer_clear(&bw, true);
+    return same;
+}
+
+static void testBitWriter()
+{
+    for (uint32_t i = 0; i < 20000; i++) {
+        uint8_t data[2 * MAX_HEADER_SIZE];
+        H264SliceBitWriter writer(data, sizeof(data));
+        BitWriter bw;
+        bit_writer_init(&bw, sizeof(data) * 8);
+        uint32_t count = randomNumber(40);
+        for (uint32_t j = 0; j < count; j++) {
+            uint32_t bits = randomNumber(33);
+            uint32_t value = randomNumber(1U << 24) << 8 | randomNumber(256);
+            int32_t se = (int32_t)(randomUe() >> 1) * (randomNumber(2) ? 1 : -1);
+            switch (randomNumber(4)) {
+            case 0:
+                writer.put(value, bits);
+                bit_writer_put_bits_uint32(&bw, bits < 32 ? value & ((1U << bits) - 1) : value, bits);
+                break;
+            case 1:
+                value = randomUe();
+                writer.putUe(value);
+                putUe(&bw, value);
+                break;
+            case 2:
+                //codes of 33 to 65 bits, 65 only for the largest value
+                value = randomNumber(4) ? 0xffffffff - randomNumber(1U << 24) : 0xffffffff;
+                writer.putUe(value);
+                putUe(&bw, value);
+                break;
+            default:
+                writer.putSe(se);
+                putSe(&bw, se);
+                break;
+            }
+        }
+        uint32_t bitSize = writer.finish();
+        EXPECT_EQ(BIT_WRITER_BIT_SIZE(&bw), bitSize);
+        bit_writer_align_bytes(&bw, 0);
+        EXPECT_TRUE(!memcmp(data, BIT_WRITER_DATA(&bw), (bitSize + 7) / 8));
+        bit_writer_clear(&bw, true);
+    }
+}
+
+static void testRandomHeaders()
+{
+    H264SliceHeaderShape shape;
+    H264SliceHeaderFields fields;
+    H264Mmco mmcos[4];
+    H264SliceHeaderTemplate header;
+    for (uint32_t i = 0; i < 200000; i++) {
+        //a new shape now and then, the template is reused for the pictures in between
+        if (!(i % 8)) {
+            randomShape(shape);
+            header.build(shape);
+        }
+        randomFields(shape, fields, mmcos);
+        if (!sameHeader(header, shape, fields)) {
+            EXPECT_TRUE(!"template and reference differ");
+            fprintf(stderr, "header %u\n", i);
+            return;
+        }
+    }
+}
+
+static void testOverflow()
+{
+    H264SliceHeaderShape shape;
+    H264SliceHeaderFields fields;
+    H264Mmco mmcos[4];
+    randomShape(shape);
+    randomFields(shape, fields, mmcos);
+    H264SliceHeaderTemplate header;
+    header.build(shape);
+
+    uint8_t data[MAX_HEADER_SIZE];
+    uint32_t bits = header.write(fields, data, sizeof(data));
+    EXPECT_TRUE(bits > 0);
+    uint32_t bytes = (bits + 7) / 8;
+    EXPECT_EQ(bits, header.write(fields, data, bytes));
+    //one byte short, nothing is written past it
+    memset(data, 0xa5, sizeof(data));
+    EXPECT_EQ(0u, header.write(fields, data, bytes - 1));
+    EXPECT_EQ(0xa5, data[bytes - 1]);
+}
+
+static uint64_t microseconds()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* ns per P slice header, the template against BitWriter as the encoder used it */
+static void benchmark()
+{
+    const uint32_t count = 2000000;
+    H264SliceHeaderShape shape;
+    memset(&shape, 0, sizeof(shape));
+    shape.nalRefIdc = 2;
+    shape.log2MaxFrameNum = 8;
+    shape.log2MaxPicOrderCntLsb = 9;
+    shape.cabac = true;
+    shape.sliceAlphaC0OffsetDiv2 = 2;
+    shape.sliceBetaOffsetDiv2 = 2;
+    H264SliceHeaderFields fields;
+    memset(&fields, 0, sizeof(fields));
+    fields.modifyRefList0 = true;
+    H264Mmco mmco = { 1, 3 };
+    fields.mmcos = &mmco;
+    fields.mmcoCount = 1;
+
+    uint32_t sum = 0;
+    uint64_t start = microseconds();
+    H264SliceHeaderTemplate header;
+    header.build(shape);
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t data[MAX_HEADER_SIZE];
+        fields.frameNum = i & 0xff;
+        fields.picOrderCntLsb = (i * 2) & 0x1ff;
+        fields.sliceQpDelta = i % 7;
+        sum += header.write(fields, data, sizeof(data)) + data[8];
+    }
+    uint64_t templateTime = microseconds() - start;
+
+    start = microseconds();
+    for (uint32_t i = 0; i < count; i++) {
+        BitWriter bw;
+        bit_writer_init(&bw, 128 * 8);
+        fields.frameNum = i & 0xff;
+        fields.picOrderCntLsb = (i * 2) & 0x1ff;
+        fields.sliceQpDelta = i % 7;
+        referenceHeader(shape, fields, &bw);
+        sum += BIT_WRITER_BIT_SIZE(&bw) + BIT_WRITER_DATA(&bw)[8];
+        bit_writer_clear(&bw, true);
+    }
+    uint64_t referenceTime = microseconds() - start;
+
+    printf("P slice header, template: %.1f ns, BitWriter: %.1f ns (%u)\n",
+        templateTime * 1000.0 / count, referenceTime * 1000.0 / count, sum & 1);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+        benchmark();
+        return 0;
+    }
+    RUN_TEST(testBitWriter);
+    RUN_TEST(testRandomHeaders);
+    RUN_TEST(testOverflow);
+    return UNITTEST_RESULT();
+}
@@ -22,6 +22,7 @@
 
 #include "common/log.h"
 #include "interface/VideoEncoderHost.h"
+#include "vaapiencoder_chunked.h"
 #include "vaapiencoder_factory.h"
 
 using namespace YamiMediaCodec;
@@ -46,6 +47,24 @@ IVideoEncoder* createVideoEncoder(const char* mimeType) {
     return enc;
 }
 
+IVideoEncoder* createChunkedVideoEncoder(const char* mimeType, uint32_t instances, uint32_t chunkFrames) {
+    yamiTraceInit();
+
+    if (!mimeType) {
+        ERROR("NULL mime type.");
+        return NULL;
+    }
+
+    VaapiEncoderChunked* enc = new VaapiEncoderChunked;
+    if (!enc->init(mimeType, instances, chunkFrames)) {
+        ERROR("Failed to create chunked encoder for mimeType: '%s'", mimeType);
+        delete enc;
+        return NULL;
+    }
+    INFO("Created chunked encoder for mimeType: '%s', %d instances", mimeType, instances);
+    return enc;
+}
+
 void releaseVideoEncoder(IVideoEncoder* p) {
     delete p;
 }
@@ -30,6 +30,7 @@
 #include "vaapicodedbuffer.h"
 #include "vaapiencpicture.h"
 #include "vaapiencoder_factory.h"
+#include "vaapiratecontrol.h"
 #include "log.h"
 #include "bitwriter.h"
 #include <stdio.h>
@@ -274,6 +275,16 @@ Encode_Status VaapiEncoderJpeg::setParameters(VideoParamConfigType type, Yami_PT
         return ENCODE_INVALID_PARAMS;
 
     switch (type) {
+    case VideoParamsTypeCommon: {
+        //the host rate control QP is only applied by the h264 encoder
+        VideoParamsCommon* common = (VideoParamsCommon*)videoEncParams;
+        if (common->size == sizeof(VideoParamsCommon) && VaapiRateControl::isHostMode(common->rcMode)) {
+            ERROR("jpeg encoder does not support rate control mode 0x%x", common->rcMode);
+            return ENCODE_NOT_SUPPORTED;
+        }
+        status = VaapiEncoderBase::setParameters(type, videoEncParams);
+        break;
+    }
     default:
         status = VaapiEncoderBase::setParameters(type, videoEncParams);
         break;
@@ -294,7 +305,11 @@ Encode_Status VaapiEncoderJpeg::doEncode(const SurfacePtr& surface, uint64_t tim
 {
     FUNC_ENTER();
     Encode_Status ret;
-    CodedBufferPtr codedBuffer = VaapiCodedBuffer::create(m_context, m_maxCodedbufSize);
+    if (!m_maxCodedbufSize)
+        resetParams();
+    CodedBufferPtr codedBuffer = acquireCodedBuffer(m_maxCodedbufSize);
+    if (!codedBuffer)
+        return ENCODE_NO_MEMORY;
     PicturePtr picture(new VaapiEncPictureJPEG(m_context, surface, timeStamp));
     picture->m_codedBuffer = codedBuffer;
     ret = encodePicture(picture);
@@ -468,7 +483,7 @@ bool VaapiEncoderJpeg::addSliceHeaders (const PicturePtr& picture) const
 Encode_Status VaapiEncoderJpeg::encodePicture(const PicturePtr &picture)
 {
     Encode_Status ret = ENCODE_FAIL;
-    SurfacePtr reconstruct = createSurface();
+    SurfacePtr reconstruct = acquireReconSurface();
     if (!reconstruct)
         return ret;
 
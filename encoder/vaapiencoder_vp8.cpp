@@ -29,6 +29,7 @@
 #include "vaapicodedbuffer.h"
 #include "vaapiencpicture.h"
 #include "vaapiencoder_factory.h"
+#include "vaapiratecontrol.h"
 #include <algorithm>
 
 namespace YamiMediaCodec{
@@ -102,6 +103,16 @@ Encode_Status VaapiEncoderVP8::setParameters(VideoParamConfigType type, Yami_PTR
         return ENCODE_INVALID_PARAMS;
 
     switch (type) {
+    case VideoParamsTypeCommon: {
+        //the host rate control QP is only applied by the h264 encoder
+        VideoParamsCommon* common = (VideoParamsCommon*)videoEncParams;
+        if (common->size == sizeof(VideoParamsCommon) && VaapiRateControl::isHostMode(common->rcMode)) {
+            ERROR("vp8 encoder does not support rate control mode 0x%x", common->rcMode);
+            return ENCODE_NOT_SUPPORTED;
+        }
+        status = VaapiEncoderBase::setParameters(type, videoEncParams);
+        break;
+    }
     default:
         status = VaapiEncoderBase::setParameters(type, videoEncParams);
         break;
@@ -119,6 +130,11 @@ Encode_Status VaapiEncoderVP8::getParameters(VideoParamConfigType type, Yami_PTR
     return VaapiEncoderBase::getParameters(type, videoEncParams);
 }
 
+uint32_t VaapiEncoderVP8::getMaxReferenceCount() const
+{
+    return MAX_REFERECNE_FRAME;
+}
+
 Encode_Status VaapiEncoderVP8::doEncode(const SurfacePtr& surface, uint64_t timeStamp, bool forceKeyFrame)
 {
     Encode_Status ret;
@@ -126,14 +142,19 @@ Encode_Status VaapiEncoderVP8::doEncode(const SurfacePtr& surface, uint64_t time
         return ENCODE_INVALID_PARAMS;
 
     PicturePtr picture(new VaapiEncPicture(m_context, surface, timeStamp));
+    picture->m_roi = m_inputRoi;
 
+    if (forceKeyFrame)
+        m_frameCount = 0;
     m_frameCount %= keyFramePeriod();
     picture->m_type = (m_frameCount ? VAAPI_PICTURE_TYPE_P : VAAPI_PICTURE_TYPE_I);
     m_frameCount++;
 
     m_qIndex = (initQP() > minQP() && initQP() < maxQP()) ? initQP() : VP8_DEFAULT_QP;
 
-    CodedBufferPtr codedBuffer = VaapiCodedBuffer::create(m_context, m_maxCodedbufSize);
+    if (!m_maxCodedbufSize)
+        resetParams();
+    CodedBufferPtr codedBuffer = acquireCodedBuffer(m_maxCodedbufSize);
     if (!codedBuffer)
         return ENCODE_NO_MEMORY;
     picture->m_codedBuffer = codedBuffer;
@@ -268,7 +289,7 @@ bool VaapiEncoderVP8::referenceListUpdate (const PicturePtr& pic, const SurfaceP
 Encode_Status VaapiEncoderVP8::encodePicture(const PicturePtr& picture)
 {
     Encode_Status ret = ENCODE_FAIL;
-    SurfacePtr reconstruct = createSurface();
+    SurfacePtr reconstruct = acquireReconSurface();
     if (!reconstruct)
         return ret;
 
@@ -51,6 +51,7 @@ public:
 
 protected:
     virtual Encode_Status doEncode(const SurfacePtr&, uint64_t timeStamp, bool forceKeyFrame = false);
+    virtual uint32_t getMaxReferenceCount() const;
 
 private:
     Encode_Status encodePicture(const PicturePtr&);
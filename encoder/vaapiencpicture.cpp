@@ -35,6 +35,8 @@ VaapiEncPicture::VaapiEncPicture(const ContextPtr& context,
                                  const SurfacePtr & surface,
                                  int64_t timeStamp)
 :VaapiPicture(context, surface, timeStamp)
+, m_qp(0)
+, m_isRateControlled(false)
 {
 }
 
@@ -51,7 +53,20 @@ bool VaapiEncPicture::doRender()
     RENDER_OBJECT(m_picture);
     RENDER_OBJECT(m_qMatrix);
     RENDER_OBJECT(m_huffTable);
-    RENDER_OBJECT(m_slices);
+    if (m_packedSliceHeaders.empty()) {
+        RENDER_OBJECT(m_slices);
+    } else {
+        if (m_packedSliceHeaders.size() != m_slices.size()) {
+            ERROR("%d packed slice headers for %d slices", (int)m_packedSliceHeaders.size(), (int)m_slices.size());
+            return false;
+        }
+        for (size_t i = 0; i < m_slices.size(); i++) {
+            RENDER_OBJECT(m_packedSliceHeaders[i]);
+            RENDER_OBJECT(m_slices[i]);
+        }
+        m_packedSliceHeaders.clear();
+        m_slices.clear();
+    }
 #ifdef __BUILD_GET_MV__
     RENDER_OBJECT(m_FEIBuffer);
 #endif
@@ -78,6 +93,24 @@ addPackedHeader(VAEncPackedHeaderType packedHeaderType, const void *header,
     return ret;
 }
 
+bool VaapiEncPicture::addPackedSliceHeader(const void *header, uint32_t headerBitSize)
+{
+    VAEncPackedHeaderParameterBuffer *packedHeader;
+    BufObjectPtr param =
+        createBufferObject(VAEncPackedHeaderParameterBufferType,
+                           packedHeader);
+    BufObjectPtr data =
+        createBufferObject(VAEncPackedHeaderDataBufferType,
+                           (headerBitSize + 7) / 8, header, NULL);
+    bool ret = addObject(m_packedSliceHeaders, param, data);
+    if (ret) {
+        packedHeader->type = VAEncPackedHeaderSlice;
+        packedHeader->bit_length = headerBitSize;
+        packedHeader->has_emulation_bytes = 0;
+    }
+    return ret;
+}
+
 Encode_Status VaapiEncPicture::getOutput(VideoEncOutputBuffer * outBuffer)
 {
     ASSERT(outBuffer);
@@ -94,6 +127,24 @@ Encode_Status VaapiEncPicture::getOutput(VideoEncOutputBuffer * outBuffer)
     return ENCODE_SUCCESS;
 }
 
+Encode_Status VaapiEncPicture::getOutput(SharedPtr<VideoCodedFrame>& frame)
+{
+    SharedPtr<VaapiCodedFrame> coded(new VaapiCodedFrame);
+    Encode_Status ret = getCodedFrame(*coded);
+    if (ret != ENCODE_SUCCESS)
+        return ret;
+    frame = coded;
+    return ENCODE_SUCCESS;
+}
+
+Encode_Status VaapiEncPicture::getCodedFrame(VaapiCodedFrame& frame)
+{
+    if (!frame.addCodedBuffer(m_codedBuffer))
+        return ENCODE_FAIL;
+    frame.timeStamp = m_timeStamp;
+    return ENCODE_SUCCESS;
+}
+
 #ifdef __BUILD_GET_MV__
 bool VaapiEncPicture::editMVBuffer(void*& buffer, uint32_t *size)
 {
@@ -26,9 +26,12 @@
 #include "interface/VideoEncoderDefs.h"
 
 #include "vaapi/vaapipicture.h"
+#include "vaapiroi.h"
 
 
 namespace YamiMediaCodec{
+class VaapiCodedFrame;
+
 class VaapiEncPicture:public VaapiPicture {
   public:
     VaapiEncPicture(const ContextPtr& context,
@@ -56,6 +59,8 @@ class VaapiEncPicture:public VaapiPicture {
 
     bool addPackedHeader(VAEncPackedHeaderType, const void *header,
                          uint32_t headerBitSize);
+    /// packed header of the slice added by the next newSlice(), all slices have one or none has
+    bool addPackedSliceHeader(const void *header, uint32_t headerBitSize);
 
     bool encode();
 
@@ -63,12 +68,28 @@ class VaapiEncPicture:public VaapiPicture {
     // vp8 hybrid driver may need entropy code the coded buffer
     // h264 encoder may need convert annexb to avcC
     virtual Encode_Status getOutput(VideoEncOutputBuffer * outBuffer);
+    /// zero copy version, @frame holds the coded buffer until it is released
+    Encode_Status getOutput(SharedPtr<VideoCodedFrame>& frame);
 
 #ifdef __BUILD_GET_MV__
     virtual bool editMVBuffer(void*& buffer, uint32_t *size);
 #endif
 
     CodedBufferPtr m_codedBuffer;
+    /// QP picked on host, 0 if the driver picks it
+    uint32_t m_qp;
+    /// m_qp came from the host rate control, the coded size goes back to it
+    bool m_isRateControlled;
+    /// QP deltas of the picture, NULL for none
+    RoiMapPtr m_roi;
+#if VA_CHECK_VERSION(0,39,1)
+    /// VAEncMiscParameterBufferROI points here, it stays until the picture is rendered
+    std::vector<VAEncROI> m_roiRegions;
+#endif
+
+  protected:
+    // add the coded data to @frame, subclass can put headers before it
+    virtual Encode_Status getCodedFrame(VaapiCodedFrame& frame);
 
   private:
     bool doRender();
@@ -87,6 +108,8 @@ class VaapiEncPicture:public VaapiPicture {
     std::vector < BufObjectPtr > m_miscParams;
     std::vector < BufObjectPtr > m_slices;
     std::vector < std::pair<BufObjectPtr,BufObjectPtr > >m_packedHeaders;
+    //the driver matches a packed slice header to the slice parameter rendered after it
+    std::vector < std::pair<BufObjectPtr,BufObjectPtr > >m_packedSliceHeaders;
 };
 
 template < class T > bool VaapiEncPicture::editSequence(T * &seqParam)
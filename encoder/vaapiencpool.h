@@ -0,0 +1,149 @@
+/*
+ *  vaapiencpool.h - recycling pool shared by the encoder surface and coded buffer pools
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapiencpool_h
+#define vaapiencpool_h
+
+#include "common/common_def.h"
+#include "common/lock.h"
+#include "common/log.h"
+#include "interface/VideoCommonDefs.h"
+#include <deque>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+/**
+ * \class VaapiEncPool
+ * \brief hands out pooled objects through a recycling deleter
+ * <pre>
+ * 1. entries are created on demand, up to the pool size. a returned entry goes back to
+ *    a first-in-first-out free queue.
+ * 2. when all pooled entries are in flight, acquireEntry() creates a temporary one,
+ *    it is not pooled and dies with its last reference.
+ * 3. the entries and the free queue are only touched under m_lock, acquireEntry() may be
+ *    called from one thread while entries are released from any other.
+ * 4. a derived pool says how an Entry is created, which T it hands out and how the
+ *    entry is cleaned when it comes back.
+ *</pre>
+*/
+template <class T, class Entry>
+class VaapiEncPool : public std::tr1::enable_shared_from_this<VaapiEncPool<T, Entry> >
+{
+public:
+    virtual ~VaapiEncPool() {}
+
+    uint32_t getSize() const { return m_size; }
+    /// acquireEntry() served by a recycled entry
+    uint32_t getHits() const { return m_hits; }
+    /// acquireEntry() which had to create an entry
+    uint32_t getMisses() const { return m_misses; }
+
+protected:
+    VaapiEncPool(uint32_t size)
+        : m_size(size)
+        , m_hits(0)
+        , m_misses(0)
+    {
+        m_entries.reserve(size);
+    }
+
+    /// a free entry, copied to acquired as well. null if a new entry failed to create
+    SharedPtr<T> acquireEntry(Entry& acquired);
+
+    virtual bool createEntry(Entry&) = 0;
+    virtual SharedPtr<T> getObject(const Entry&) const = 0;
+    /// called under m_lock when the entry comes back to the pool
+    virtual void resetEntry(Entry&) {}
+
+private:
+    void recycle(uint32_t index);
+
+    uint32_t m_size;
+    std::vector<Entry> m_entries;
+    std::deque<uint32_t> m_freeIndex;
+    Lock m_lock;
+
+    uint32_t m_hits;
+    uint32_t m_misses;
+
+    struct Recycler;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiEncPool);
+};
+
+template <class T, class Entry>
+struct VaapiEncPool<T, Entry>::Recycler
+{
+    Recycler(const SharedPtr<VaapiEncPool>& pool, uint32_t index)
+        : m_pool(pool), m_index(index) {}
+    void operator()(T*)
+    {
+        m_pool->recycle(m_index);
+    }
+private:
+    SharedPtr<VaapiEncPool> m_pool;
+    uint32_t m_index;
+};
+
+template <class T, class Entry>
+SharedPtr<T> VaapiEncPool<T, Entry>::acquireEntry(Entry& acquired)
+{
+    SharedPtr<T> object;
+    uint32_t index;
+
+    AutoLock lock(m_lock);
+    if (!m_freeIndex.empty()) {
+        index = m_freeIndex.front();
+        m_freeIndex.pop_front();
+        m_hits++;
+    } else {
+        m_misses++;
+        Entry entry;
+        if (!createEntry(entry))
+            return object;
+        if (m_entries.size() >= m_size) {
+            //every pooled entry is in flight, this one lives only for a frame
+            DEBUG("encoder pool exhausted, %d entries in flight", m_size);
+            acquired = entry;
+            return getObject(entry);
+        }
+        index = m_entries.size();
+        m_entries.push_back(entry);
+    }
+
+    acquired = m_entries[index];
+    object.reset(getObject(acquired).get(), Recycler(this->shared_from_this(), index));
+    return object;
+}
+
+template <class T, class Entry>
+void VaapiEncPool<T, Entry>::recycle(uint32_t index)
+{
+    AutoLock lock(m_lock);
+    ASSERT(index < m_entries.size());
+    resetEntry(m_entries[index]);
+    m_freeIndex.push_back(index);
+}
+
+} //namespace YamiMediaCodec
+
+#endif //vaapiencpool_h
@@ -0,0 +1,215 @@
+/*
+ *  vaapiencpool_unittest.cpp - host side tests of the encoder recycling pool
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/unittest.h"
+#include "vaapiencpool.h"
+#include <pthread.h>
+#include <sched.h>
+
+using namespace YamiMediaCodec;
+
+// an object of the pool, it knows if it is handed out twice
+struct Object {
+    uint32_t id;
+    uint32_t inUse;
+    uint32_t resets;
+};
+typedef SharedPtr<Object> ObjectPtr;
+
+class TestPool : public VaapiEncPool<Object, ObjectPtr>
+{
+public:
+    static SharedPtr<TestPool> create(uint32_t size)
+    {
+        return SharedPtr<TestPool>(new TestPool(size));
+    }
+
+    ObjectPtr acquire()
+    {
+        ObjectPtr entry;
+        return acquireEntry(entry);
+    }
+
+    uint32_t m_created;
+    bool m_failCreate;
+
+private:
+    TestPool(uint32_t size)
+        : VaapiEncPool<Object, ObjectPtr>(size)
+        , m_created(0)
+        , m_failCreate(false)
+    {
+    }
+
+    virtual bool createEntry(ObjectPtr& entry)
+    {
+        if (m_failCreate)
+            return false;
+        entry.reset(new Object);
+        entry->id = m_created++;
+        entry->inUse = 0;
+        entry->resets = 0;
+        return true;
+    }
+
+    virtual ObjectPtr getObject(const ObjectPtr& entry) const
+    {
+        return entry;
+    }
+
+    virtual void resetEntry(ObjectPtr& entry)
+    {
+        entry->resets++;
+    }
+};
+
+static void testRecycle()
+{
+    SharedPtr<TestPool> pool = TestPool::create(2);
+    ObjectPtr a = pool->acquire();
+    ObjectPtr b = pool->acquire();
+    EXPECT_TRUE(a && b);
+    EXPECT_EQ(0u, a->id);
+    EXPECT_EQ(1u, b->id);
+    EXPECT_EQ(2u, pool->getMisses());
+
+    //the free queue is first in first out
+    Object* first = a.get();
+    a.reset();
+    b.reset();
+    EXPECT_EQ(1u, first->resets);
+    a = pool->acquire();
+    EXPECT_EQ(0u, a->id);
+    b = pool->acquire();
+    EXPECT_EQ(1u, b->id);
+    EXPECT_EQ(2u, pool->getHits());
+    EXPECT_EQ(2u, pool->m_created);
+}
+
+static void testExhausted()
+{
+    SharedPtr<TestPool> pool = TestPool::create(1);
+    ObjectPtr pooled = pool->acquire();
+    //a temporary object, it is not recycled
+    ObjectPtr temporary = pool->acquire();
+    EXPECT_TRUE(bool(temporary));
+    EXPECT_EQ(1u, temporary->id);
+    temporary.reset();
+    pooled.reset();
+    ObjectPtr again = pool->acquire();
+    EXPECT_EQ(0u, again->id);
+    EXPECT_EQ(2u, pool->m_created);
+
+    pool->m_failCreate = true;
+    EXPECT_TRUE(!pool->acquire());
+}
+
+static void testPoolOutlivesOwner()
+{
+    SharedPtr<TestPool> pool = TestPool::create(1);
+    ObjectPtr object = pool->acquire();
+    //the encoder may drop the pool while a coded buffer is still in the output queue
+    pool.reset();
+    EXPECT_EQ(0u, object->resets);
+    object.reset();
+}
+
+#define THREADS 3
+#define ROUNDS 20000
+#define POOL_SIZE 4
+
+// the main thread hands each object to a releaser through a slot
+struct Handoff {
+    Object* object;
+    ObjectPtr held;
+};
+
+static uint32_t handoffDone;
+static Handoff handoffs[THREADS];
+static uint32_t handoffErrors;
+
+static void* releaseSlot(void* arg)
+{
+    Handoff* handoff = static_cast<Handoff*>(arg);
+    while (1) {
+        if (!__atomic_load_n(&handoff->object, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&handoffDone, __ATOMIC_ACQUIRE))
+                break;
+            sched_yield();
+            continue;
+        }
+        ObjectPtr object = handoff->held;
+        handoff->held.reset();
+        if (__atomic_exchange_n(&object->inUse, 0, __ATOMIC_SEQ_CST) != 1)
+            __atomic_add_fetch(&handoffErrors, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&handoff->object, (Object*)NULL, __ATOMIC_RELEASE);
+        //the last reference goes here, the object is recycled on this thread
+        object.reset();
+    }
+    return NULL;
+}
+
+static void testConcurrentRelease()
+{
+    SharedPtr<TestPool> pool = TestPool::create(POOL_SIZE);
+    pthread_t threads[THREADS];
+    handoffDone = 0;
+    handoffErrors = 0;
+    for (uint32_t i = 0; i < THREADS; i++) {
+        handoffs[i].object = NULL;
+        EXPECT_EQ(0, pthread_create(&threads[i], NULL, releaseSlot, &handoffs[i]));
+    }
+
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        Handoff& handoff = handoffs[i % THREADS];
+        while (__atomic_load_n(&handoff.object, __ATOMIC_ACQUIRE))
+            sched_yield();
+        ObjectPtr object = pool->acquire();
+        if (!object) {
+            __atomic_add_fetch(&handoffErrors, 1, __ATOMIC_SEQ_CST);
+            break;
+        }
+        //an object is never handed out while it is in use
+        if (__atomic_exchange_n(&object->inUse, 1, __ATOMIC_SEQ_CST))
+            __atomic_add_fetch(&handoffErrors, 1, __ATOMIC_SEQ_CST);
+        handoff.held = object;
+        object.reset();
+        __atomic_store_n(&handoff.object, handoff.held.get(), __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&handoffDone, 1, __ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    EXPECT_EQ(0u, handoffErrors);
+    EXPECT_EQ((uint32_t)ROUNDS, pool->getHits() + pool->getMisses());
+    //one object per releaser and the one being acquired, the pool never runs out
+    EXPECT_TRUE(pool->m_created <= POOL_SIZE);
+    EXPECT_EQ(0u, pool->getMisses() - pool->m_created);
+}
+
+int main()
+{
+    RUN_TEST(testRecycle);
+    RUN_TEST(testExhausted);
+    RUN_TEST(testPoolOutlivesOwner);
+    RUN_TEST(testConcurrentRelease);
+    return UNITTEST_RESULT();
+}
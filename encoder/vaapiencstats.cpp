@@ -0,0 +1,155 @@
+/*
+ *  vaapiencstats.cpp - statistics file shared by the passes of a two pass encode
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "vaapiencstats.h"
+
+#include "common/log.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace YamiMediaCodec{
+
+EncStatsWriterPtr VaapiEncStatsWriter::create(const char* path, uint32_t width, uint32_t height,
+                                              uint32_t frameRateNum, uint32_t frameRateDenom)
+{
+    EncStatsWriterPtr writer;
+    if (!path)
+        return writer;
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        ERROR("can't open statistics file %s", path);
+        return writer;
+    }
+    writer.reset(new VaapiEncStatsWriter);
+    writer->m_file = file;
+    EncStatsHeader& header = writer->m_header;
+    memcpy(header.magic, ENC_STATS_MAGIC, sizeof(header.magic));
+    header.recordSize = sizeof(EncStatsRecord);
+    header.width = width;
+    header.height = height;
+    header.frameRateNum = frameRateNum;
+    header.frameRateDenom = frameRateDenom;
+    //a header with no count marks an unfinished file
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        ERROR("write statistics file %s failed", path);
+        writer.reset();
+    }
+    return writer;
+}
+
+VaapiEncStatsWriter::VaapiEncStatsWriter()
+    : m_file(NULL)
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+VaapiEncStatsWriter::~VaapiEncStatsWriter()
+{
+    if (!m_file)
+        return;
+    if (m_header.count) {
+        if (fseek(m_file, 0, SEEK_SET) || fwrite(&m_header, sizeof(m_header), 1, m_file) != 1)
+            ERROR("update statistics header failed");
+    }
+    fclose(m_file);
+}
+
+bool VaapiEncStatsWriter::write(const EncStatsRecord& record)
+{
+    if (fwrite(&record, sizeof(record), 1, m_file) != 1) {
+        ERROR("write statistics record failed");
+        return false;
+    }
+    m_header.count++;
+    return true;
+}
+
+EncStatsReaderPtr VaapiEncStatsReader::create(const char* path)
+{
+    EncStatsReaderPtr reader;
+    if (!path)
+        return reader;
+    reader.reset(new VaapiEncStatsReader);
+    if (!reader->init(path))
+        reader.reset();
+    return reader;
+}
+
+VaapiEncStatsReader::VaapiEncStatsReader()
+    : m_data(MAP_FAILED)
+    , m_size(0)
+    , m_header(NULL)
+    , m_records(NULL)
+{
+}
+
+VaapiEncStatsReader::~VaapiEncStatsReader()
+{
+    if (m_data != MAP_FAILED)
+        munmap(m_data, m_size);
+}
+
+bool VaapiEncStatsReader::init(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ERROR("can't open statistics file %s", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(EncStatsHeader)) {
+        ERROR("statistics file %s is too small", path);
+        close(fd);
+        return false;
+    }
+    m_size = st.st_size;
+    m_data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //the mapping stays valid after close
+    close(fd);
+    if (m_data == MAP_FAILED) {
+        ERROR("mmap statistics file %s failed", path);
+        return false;
+    }
+    //the whole file is read in order, once
+    madvise(m_data, m_size, MADV_SEQUENTIAL);
+
+    m_header = static_cast<const EncStatsHeader*>(m_data);
+    if (memcmp(m_header->magic, ENC_STATS_MAGIC, sizeof(m_header->magic))
+        || m_header->recordSize != sizeof(EncStatsRecord)) {
+        ERROR("%s is not a statistics file", path);
+        return false;
+    }
+    if (!m_header->count
+        || m_header->count > (m_size - sizeof(EncStatsHeader)) / sizeof(EncStatsRecord)) {
+        ERROR("statistics file %s is not complete", path);
+        return false;
+    }
+    m_records = reinterpret_cast<const EncStatsRecord*>(m_header + 1);
+    return true;
+}
+
+} //namespace YamiMediaCodec
@@ -0,0 +1,115 @@
+/*
+ *  vaapiencstats.h - statistics file shared by the passes of a two pass encode
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapiencstats_h
+#define vaapiencstats_h
+
+#include "common/common_def.h"
+#include "interface/VideoCommonDefs.h"
+#include <stdint.h>
+#include <stdio.h>
+
+namespace YamiMediaCodec{
+
+/**
+ * layout of the statistics file, host byte order:
+ * one EncStatsHeader, then one EncStatsRecord per picture in coding order.
+ */
+#define ENC_STATS_MAGIC "YST1"
+
+struct EncStatsHeader {
+    char magic[4];
+    uint32_t recordSize;
+    // of the pass which wrote the file
+    uint32_t width;
+    uint32_t height;
+    uint32_t frameRateNum;
+    uint32_t frameRateDenom;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct EncStatsRecord {
+    uint32_t bits;
+    // bits * qscale per pixel, so passes at different resolutions compare
+    float complexity;
+    uint8_t type;
+    uint8_t qp;
+    uint16_t reserved;
+};
+
+class VaapiEncStatsWriter;
+class VaapiEncStatsReader;
+typedef SharedPtr<VaapiEncStatsWriter> EncStatsWriterPtr;
+typedef SharedPtr<VaapiEncStatsReader> EncStatsReaderPtr;
+
+/**
+ * \class VaapiEncStatsWriter
+ * \brief appends records to a statistics file, the header gets the record count when it is destroyed.
+ */
+class VaapiEncStatsWriter
+{
+public:
+    static EncStatsWriterPtr create(const char* path, uint32_t width, uint32_t height,
+                                    uint32_t frameRateNum, uint32_t frameRateDenom);
+    ~VaapiEncStatsWriter();
+
+    bool write(const EncStatsRecord& record);
+
+private:
+    VaapiEncStatsWriter();
+
+    FILE* m_file;
+    EncStatsHeader m_header;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiEncStatsWriter);
+};
+
+/**
+ * \class VaapiEncStatsReader
+ * \brief maps a statistics file written by VaapiEncStatsWriter, read only.
+ */
+class VaapiEncStatsReader
+{
+public:
+    /// NULL if the file can't be mapped or is not a complete statistics file
+    static EncStatsReaderPtr create(const char* path);
+    ~VaapiEncStatsReader();
+
+    const EncStatsHeader& getHeader() const { return *m_header; }
+    uint32_t getCount() const { return m_header->count; }
+    const EncStatsRecord& getRecord(uint32_t index) const { return m_records[index]; }
+
+private:
+    VaapiEncStatsReader();
+    bool init(const char* path);
+
+    void* m_data;
+    size_t m_size;
+    const EncStatsHeader* m_header;
+    const EncStatsRecord* m_records;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiEncStatsReader);
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapiencstats_h
@@ -0,0 +1,126 @@
+/*
+ *  vaapiencstats_unittest.cpp - host side tests of the two pass statistics file
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/unittest.h"
+#include "vaapiencstats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace YamiMediaCodec;
+
+#define RECORDS 1000
+
+static char path[] = "/tmp/vaapiencstats_unittest_XXXXXX";
+
+static EncStatsRecord makeRecord(uint32_t i)
+{
+    EncStatsRecord record;
+    memset(&record, 0, sizeof(record));
+    record.bits = i * 1000 + 7;
+    record.complexity = i * 0.25f;
+    record.type = i % 3 + 1;
+    record.qp = i % 52;
+    return record;
+}
+
+static bool writeRecords(uint32_t count)
+{
+    EncStatsWriterPtr writer = VaapiEncStatsWriter::create(path, 1920, 1080, 30000, 1001);
+    if (!writer)
+        return false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!writer->write(makeRecord(i)))
+            return false;
+    }
+    return true;
+}
+
+static void testRoundTrip()
+{
+    EXPECT_TRUE(writeRecords(RECORDS));
+    EncStatsReaderPtr reader = VaapiEncStatsReader::create(path);
+    EXPECT_TRUE(bool(reader));
+    if (!reader)
+        return;
+    const EncStatsHeader& header = reader->getHeader();
+    EXPECT_TRUE(!memcmp(header.magic, ENC_STATS_MAGIC, sizeof(header.magic)));
+    EXPECT_EQ(1920u, header.width);
+    EXPECT_EQ(1080u, header.height);
+    EXPECT_EQ(30000u, header.frameRateNum);
+    EXPECT_EQ(1001u, header.frameRateDenom);
+    EXPECT_EQ((uint32_t)RECORDS, reader->getCount());
+    for (uint32_t i = 0; i < RECORDS; i++) {
+        EncStatsRecord expected = makeRecord(i);
+        EXPECT_TRUE(!memcmp(&expected, &reader->getRecord(i), sizeof(expected)));
+    }
+}
+
+// the writer is still running, or it wrote no record
+static void testUnfinished()
+{
+    {
+        EncStatsWriterPtr writer = VaapiEncStatsWriter::create(path, 64, 64, 30, 1);
+        EXPECT_TRUE(writer && writer->write(makeRecord(0)));
+        fflush(NULL);
+        EXPECT_TRUE(!VaapiEncStatsReader::create(path));
+    }
+    EXPECT_TRUE(writeRecords(0));
+    EXPECT_TRUE(!VaapiEncStatsReader::create(path));
+}
+
+static void testDamaged()
+{
+    EXPECT_TRUE(writeRecords(RECORDS));
+    //records cut off, the count in the header says more
+    EXPECT_EQ(0, truncate(path, sizeof(EncStatsHeader) + (RECORDS - 1) * sizeof(EncStatsRecord) + 1));
+    EXPECT_TRUE(!VaapiEncStatsReader::create(path));
+    EXPECT_EQ(0, truncate(path, sizeof(EncStatsHeader) - 1));
+    EXPECT_TRUE(!VaapiEncStatsReader::create(path));
+
+    //not a statistics file
+    EXPECT_TRUE(writeRecords(RECORDS));
+    FILE* file = fopen(path, "r+b");
+    EXPECT_TRUE(file && fwrite("XXXX", 4, 1, file) == 1);
+    if (file)
+        fclose(file);
+    EXPECT_TRUE(!VaapiEncStatsReader::create(path));
+
+    EXPECT_TRUE(!VaapiEncStatsReader::create(NULL));
+    EXPECT_TRUE(!VaapiEncStatsReader::create("/nonexistent/statistics"));
+    EXPECT_TRUE(!VaapiEncStatsWriter::create(NULL, 64, 64, 30, 1));
+    EXPECT_TRUE(!VaapiEncStatsWriter::create("/nonexistent/statistics", 64, 64, 30, 1));
+}
+
+int main()
+{
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "can't create %s\n", path);
+        return 1;
+    }
+    close(fd);
+    RUN_TEST(testRoundTrip);
+    RUN_TEST(testUnfinished);
+    RUN_TEST(testDamaged);
+    unlink(path);
+    return UNITTEST_RESULT();
+}
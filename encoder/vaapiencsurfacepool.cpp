@@ -0,0 +1,120 @@
+/*
+ *  vaapiencsurfacepool.cpp - surface pool used for encoding
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "vaapiencsurfacepool.h"
+
+#include "common/log.h"
+#include "vaapi/vaapidisplay.h"
+#include "vaapi/vaapiimage.h"
+#include "vaapi/vaapisurface.h"
+
+namespace YamiMediaCodec{
+
+EncSurfacePoolPtr VaapiEncSurfacePool::create(const DisplayPtr& display, uint32_t fourcc,
+    uint32_t width, uint32_t height, uint32_t size, bool mapped)
+{
+    EncSurfacePoolPtr pool;
+    if (!display || !width || !height || !size)
+        return pool;
+    pool.reset(new VaapiEncSurfacePool(display, fourcc, width, height, size, mapped));
+    return pool;
+}
+
+SurfacePtr VaapiEncSurfacePool::createSurface(const DisplayPtr& display, uint32_t fourcc,
+    uint32_t width, uint32_t height)
+{
+    VASurfaceAttrib attrib;
+    VaapiChromaType chroma;
+
+    attrib.flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attrib.type = VASurfaceAttribPixelFormat;
+    attrib.value.type = VAGenericValueTypeInteger;
+    attrib.value.value.i = fourcc;
+
+    switch(fourcc) {
+    case VA_FOURCC_NV12:
+    case VA_FOURCC_I420:
+        chroma = VAAPI_CHROMA_TYPE_YUV420;
+    break;
+    case VA_FOURCC_YUY2:
+        chroma = VAAPI_CHROMA_TYPE_YUV422;
+    break;
+    default:
+        ASSERT(0);
+        return SurfacePtr();
+    }
+    return VaapiSurface::create(display, chroma, width, height, &attrib, 1);
+}
+
+VaapiEncSurfacePool::VaapiEncSurfacePool(const DisplayPtr& display, uint32_t fourcc,
+    uint32_t width, uint32_t height, uint32_t size, bool mapped)
+    : VaapiEncPool<VaapiSurface, VaapiEncSurfaceEntry>(size)
+    , m_display(display)
+    , m_fourcc(fourcc)
+    , m_width(width)
+    , m_height(height)
+    , m_mapped(mapped)
+{
+}
+
+bool VaapiEncSurfacePool::createEntry(Entry& entry)
+{
+    entry.surface = createSurface(m_display, m_fourcc, m_width, m_height);
+    if (!entry.surface)
+        return false;
+    if (!m_mapped)
+        return true;
+    entry.image = VaapiImage::derive(entry.surface);
+    if (!entry.image) {
+        ERROR("VaapiImage::derive() failed");
+        return false;
+    }
+    entry.raw = mapVaapiImage(entry.image);
+    if (!entry.raw) {
+        ERROR("image->map() failed");
+        return false;
+    }
+    return true;
+}
+
+SurfacePtr VaapiEncSurfacePool::getObject(const Entry& entry) const
+{
+    return entry.surface;
+}
+
+SurfacePtr VaapiEncSurfacePool::acquire(ImageRawPtr* raw)
+{
+    Entry entry;
+    SurfacePtr surface = acquireEntry(entry);
+    if (surface && raw)
+        *raw = entry.raw;
+    return surface;
+}
+
+bool VaapiEncSurfacePool::isCompatible(uint32_t fourcc, uint32_t width, uint32_t height) const
+{
+    return m_fourcc == fourcc && m_width >= width && m_height >= height;
+}
+
+} //namespace YamiMediaCodec
@@ -0,0 +1,85 @@
+/*
+ *  vaapiencsurfacepool.h - surface pool used for encoding
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapiencsurfacepool_h
+#define vaapiencsurfacepool_h
+
+#include "common/common_def.h"
+#include "vaapi/vaapiptrs.h"
+#include "vaapi/vaapitypes.h"
+#include "vaapiencpool.h"
+#include <va/va.h>
+
+namespace YamiMediaCodec{
+
+//raw is declared last, so it is unmapped before the image is destroyed
+struct VaapiEncSurfaceEntry {
+    SurfacePtr surface;
+    ImagePtr image;
+    ImageRawPtr raw;
+};
+
+/**
+ * \class VaapiEncSurfacePool
+ * \brief recycles the surfaces an encoder fills for every frame
+ * <pre>
+ * 1. surfaces are created on demand, up to the pool size. a returned surface goes back to
+ *    a first-in-first-out free queue, to be friendly to graphics fence.
+ * 2. if the pool is created mapped, each surface keeps a derived image mapped for its whole
+ *    life time, so uploading a frame is a plain copy.
+ * 3. when all pooled surfaces are in flight, acquire() creates a temporary surface
+ *    which is destroyed when it is released.
+ *</pre>
+*/
+class VaapiEncSurfacePool : public VaapiEncPool<VaapiSurface, VaapiEncSurfaceEntry>
+{
+public:
+    static EncSurfacePoolPtr create(const DisplayPtr&, uint32_t fourcc,
+        uint32_t width, uint32_t height, uint32_t size, bool mapped);
+    static SurfacePtr createSurface(const DisplayPtr&, uint32_t fourcc,
+        uint32_t width, uint32_t height);
+
+    /// get a free surface, raw is set to its mapped image if the pool is mapped
+    SurfacePtr acquire(ImageRawPtr* raw = NULL);
+
+    /// the pooled surfaces can hold a picture of this size, they may be bigger
+    bool isCompatible(uint32_t fourcc, uint32_t width, uint32_t height) const;
+
+private:
+    typedef VaapiEncSurfaceEntry Entry;
+
+    VaapiEncSurfacePool(const DisplayPtr&, uint32_t fourcc,
+        uint32_t width, uint32_t height, uint32_t size, bool mapped);
+    virtual bool createEntry(Entry&);
+    virtual SurfacePtr getObject(const Entry&) const;
+
+    DisplayPtr m_display;
+    uint32_t m_fourcc;
+    uint32_t m_width;
+    uint32_t m_height;
+    bool m_mapped;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiEncSurfacePool);
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapiencsurfacepool_h
@@ -0,0 +1,268 @@
+/*
+ *  vaapih264stitcher.cpp - joins h264 streams encoded in closed GOP chunks
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "vaapih264stitcher.h"
+
+#include "codecparsers/bitreader.h"
+#include "codecparsers/bitwriter.h"
+#include "common/log.h"
+
+namespace YamiMediaCodec{
+
+/* idr_pic_id is in the range of 0 to 65535 */
+#define MAX_IDR_PIC_ID 65536
+
+static const uint8_t s_startCode[] = { 0, 0, 0, 1 };
+
+static bool getUe(BitReader* br, uint32_t& value)
+{
+    uint32_t zeros = 0, bit;
+    while (true) {
+        if (!bit_reader_get_bits_uint32(br, &bit, 1))
+            return false;
+        if (bit)
+            break;
+        if (++zeros > 31)
+            return false;
+    }
+    uint32_t suffix = 0;
+    if (zeros && !bit_reader_get_bits_uint32(br, &suffix, zeros))
+        return false;
+    value = (1U << zeros) - 1 + suffix;
+    return true;
+}
+
+static bool putUe(BitWriter* bw, uint32_t value)
+{
+    uint32_t bits = 0;
+    uint32_t code = value + 1;
+    while (code >> bits)
+        bits++;
+    if (bits > 1 && !bit_writer_put_bits_uint32(bw, 0, bits - 1))
+        return false;
+    return bit_writer_put_bits_uint32(bw, code, bits);
+}
+
+// bits from @begin to @end of @src
+static bool copyBits(BitWriter* bw, const std::vector<uint8_t>& src, uint32_t begin, uint32_t end)
+{
+    BitReader br;
+    bit_reader_init(&br, &src[0], src.size());
+    if (!bit_reader_skip(&br, begin))
+        return false;
+    uint32_t left = end - begin;
+    while (left) {
+        uint32_t bits = left > 32 ? 32 : left;
+        uint32_t value;
+        if (!bit_reader_get_bits_uint32(&br, &value, bits)
+            || !bit_writer_put_bits_uint32(bw, value, bits))
+            return false;
+        left -= bits;
+    }
+    return true;
+}
+
+// drops the emulation prevention bytes
+static void unescape(const uint8_t* data, uint32_t size, std::vector<uint8_t>& rbsp)
+{
+    uint32_t zeros = 0;
+    rbsp.clear();
+    rbsp.reserve(size);
+    for (uint32_t i = 0; i < size; i++) {
+        if (zeros >= 2 && data[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        rbsp.push_back(data[i]);
+        zeros = data[i] ? 0 : zeros + 1;
+    }
+}
+
+static void escape(const uint8_t* rbsp, uint32_t size, std::vector<uint8_t>& out)
+{
+    uint32_t zeros = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        if (zeros >= 2 && rbsp[i] <= 3) {
+            out.push_back(3);
+            zeros = 0;
+        }
+        out.push_back(rbsp[i]);
+        zeros = rbsp[i] ? 0 : zeros + 1;
+    }
+    //an rbsp ending with a cabac_zero_word
+    if (size && !rbsp[size - 1])
+        out.push_back(3);
+}
+
+VaapiH264Stitcher::VaapiH264Stitcher()
+    : m_parser(h264_nal_parser_new())
+    , m_idrPicId(0)
+{
+}
+
+VaapiH264Stitcher::~VaapiH264Stitcher()
+{
+    h264_nal_parser_free(m_parser);
+}
+
+void VaapiH264Stitcher::reset()
+{
+    m_idrPicId = 0;
+}
+
+bool VaapiH264Stitcher::stitch(const uint8_t* data, uint32_t size, bool chunkStart, std::vector<uint8_t>& out)
+{
+    H264NalUnit nalu;
+    H264SliceHdr slice;
+    bool isIdr = false;
+    bool firstSlice = true;
+    uint32_t offset = 0;
+    out.clear();
+    out.reserve(size + 16);
+    while (offset + 4 <= size) {
+        H264ParserResult result = h264_parser_identify_nalu(m_parser, data, offset, size, &nalu);
+        if (result == H264_PARSER_NO_NAL)
+            break;
+        //the last one
+        if (result == H264_PARSER_NO_NAL_END)
+            result = H264_PARSER_OK;
+        if (result != H264_PARSER_OK) {
+            ERROR("broken nal in the access unit");
+            return false;
+        }
+        offset = nalu.offset + nalu.size;
+        if (nalu.type == H264_NAL_SPS || nalu.type == H264_NAL_PPS) {
+            if (h264_parser_parse_nal(m_parser, &nalu) != H264_PARSER_OK) {
+                ERROR("failed to parse parameter set");
+                return false;
+            }
+        }
+        if (nalu.type != H264_NAL_SLICE && nalu.type != H264_NAL_SLICE_IDR) {
+            out.insert(out.end(), s_startCode, s_startCode + sizeof(s_startCode));
+            out.insert(out.end(), nalu.data + nalu.offset, nalu.data + nalu.offset + nalu.size);
+            continue;
+        }
+        if (firstSlice && chunkStart && nalu.type != H264_NAL_SLICE_IDR) {
+            ERROR("chunk does not start with an IDR, frame_num and POC can't be kept");
+            return false;
+        }
+        firstSlice = false;
+        out.insert(out.end(), s_startCode, s_startCode + sizeof(s_startCode));
+        if (nalu.type == H264_NAL_SLICE) {
+            out.insert(out.end(), nalu.data + nalu.offset, nalu.data + nalu.offset + nalu.size);
+            continue;
+        }
+        if (h264_parser_parse_slice_hdr(m_parser, &nalu, &slice, true, true) != H264_PARSER_OK) {
+            ERROR("failed to parse IDR slice header");
+            return false;
+        }
+        if (!rewriteIdrPicId(nalu, slice, out))
+            return false;
+        isIdr = true;
+    }
+    if (isIdr)
+        m_idrPicId = (m_idrPicId + 1) % MAX_IDR_PIC_ID;
+    return true;
+}
+
+// the slice with m_idrPicId, the rest of it moves to the new header length
+bool VaapiH264Stitcher::rewriteIdrPicId(H264NalUnit& nalu, const H264SliceHdr& slice, std::vector<uint8_t>& out) const
+{
+    const uint8_t* header = nalu.data + nalu.offset;
+    std::vector<uint8_t> rbsp;
+    unescape(header + nalu.header_bytes, nalu.size - nalu.header_bytes, rbsp);
+    if (rbsp.empty())
+        return false;
+
+    const H264SPS* sps = slice.pps->sequence;
+    BitReader br;
+    bit_reader_init(&br, &rbsp[0], rbsp.size());
+    uint32_t value;
+    //first_mb_in_slice, slice_type, pic_parameter_set_id
+    for (int i = 0; i < 3; i++) {
+        if (!getUe(&br, value))
+            return false;
+    }
+    if (sps->separate_colour_plane_flag && !bit_reader_skip(&br, 2))
+        return false;
+    if (!bit_reader_skip(&br, sps->log2_max_frame_num_minus4 + 4))
+        return false;
+    if (!sps->frame_mbs_only_flag) {
+        //field_pic_flag and bottom_field_flag
+        if (!bit_reader_get_bits_uint32(&br, &value, 1))
+            return false;
+        if (value && !bit_reader_skip(&br, 1))
+            return false;
+    }
+    uint32_t idrBegin = bit_reader_get_pos(&br);
+    if (!getUe(&br, value))
+        return false;
+    uint32_t idrEnd = bit_reader_get_pos(&br);
+    uint32_t headerEnd = slice.header_size - 8 * slice.n_emulation_prevention_bytes;
+    if (headerEnd < idrEnd || headerEnd > rbsp.size() * 8)
+        return false;
+
+    BitWriter bw;
+    bit_writer_init(&bw, (rbsp.size() + 8) * 8);
+    bool ret = copyBits(&bw, rbsp, 0, idrBegin)
+        && putUe(&bw, m_idrPicId)
+        && copyBits(&bw, rbsp, idrEnd, headerEnd);
+    if (ret && slice.pps->entropy_coding_mode_flag) {
+        //cabac_alignment_one_bit, the slice data starts on a byte
+        while (ret && (BIT_WRITER_BIT_SIZE(&bw) & 7))
+            ret = bit_writer_put_bits_uint32(&bw, 1, 1);
+        uint32_t dataBegin = (headerEnd + 7) / 8;
+        if (ret && dataBegin < rbsp.size())
+            ret = bit_writer_put_bytes(&bw, &rbsp[dataBegin], rbsp.size() - dataBegin);
+    } else if (ret) {
+        //slice data runs to the rbsp_stop_one_bit, the last bit set
+        uint32_t last = rbsp.size();
+        while (last && !rbsp[last - 1])
+            last--;
+        if (!last) {
+            bit_writer_clear(&bw, true);
+            return false;
+        }
+        uint8_t byte = rbsp[last - 1];
+        uint32_t stop = last * 8 - 1;
+        while (!(byte & 1)) {
+            byte >>= 1;
+            stop--;
+        }
+        ret = stop >= headerEnd
+            && copyBits(&bw, rbsp, headerEnd, stop)
+            && bit_writer_put_bits_uint32(&bw, 1, 1)
+            && bit_writer_align_bytes(&bw, 0);
+    }
+    if (ret) {
+        out.insert(out.end(), header, header + nalu.header_bytes);
+        escape(BIT_WRITER_DATA(&bw), BIT_WRITER_BIT_SIZE(&bw) / 8, out);
+    } else {
+        ERROR("failed to rewrite idr_pic_id");
+    }
+    bit_writer_clear(&bw, true);
+    return ret;
+}
+
+} //namespace YamiMediaCodec
@@ -0,0 +1,68 @@
+/*
+ *  vaapih264stitcher.h - joins h264 streams encoded in closed GOP chunks
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapih264stitcher_h
+#define vaapih264stitcher_h
+
+#include "common/common_def.h"
+#include "interface/VideoCommonDefs.h"
+#include "codecparsers/h264parser.h"
+#include <stdint.h>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+/**
+ * \class VaapiH264Stitcher
+ * \brief joins the Annex B access units of closed GOP chunks, encoded by separate encoders,
+ * into one stream.
+ * <pre>
+ * 1. each chunk starts with an IDR, so frame_num and POC restart in each chunk and are kept.
+ *    a chunk which does not start with an IDR can't be stitched.
+ * 2. every encoder numbers its IDRs from 0, so idr_pic_id is rewritten to count the IDRs of the
+ *    joined stream. the rest of the slice is moved to the new header length, the alignment bits
+ *    before CABAC slice data are redone.
+ * 3. it is plain CPU code, it works on any Annex B stream the parser takes.
+ *</pre>
+ */
+class VaapiH264Stitcher
+{
+public:
+    VaapiH264Stitcher();
+    ~VaapiH264Stitcher();
+
+    /// next access unit in decoding order to @out, @chunkStart for the first one of a chunk
+    bool stitch(const uint8_t* data, uint32_t size, bool chunkStart, std::vector<uint8_t>& out);
+    void reset();
+
+private:
+    bool rewriteIdrPicId(H264NalUnit& nalu, const H264SliceHdr& slice, std::vector<uint8_t>& out) const;
+
+    H264NalParser* m_parser;
+    //of the next IDR in the joined stream
+    uint32_t m_idrPicId;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiH264Stitcher);
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapih264stitcher_h
@@ -0,0 +1,336 @@
+/*
+ *  vaapih264stitcher_unittest.cpp - host side tests of the h264 chunk stitcher on synthetic streams
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/unittest.h"
+#include "vaapih264stitcher.h"
+
+using namespace YamiMediaCodec;
+
+// writes the RBSP of a synthetic NAL unit, msb first
+class RbspWriter
+{
+public:
+    RbspWriter()
+        : m_bits(0)
+    {
+    }
+
+    void put(uint32_t value, uint32_t bits)
+    {
+        while (bits--) {
+            if (!(m_bits % 8))
+                m_data.push_back(0);
+            if ((value >> bits) & 1)
+                m_data.back() |= 0x80 >> (m_bits % 8);
+            m_bits++;
+        }
+    }
+
+    void putUe(uint32_t value)
+    {
+        uint32_t bits = 0;
+        while ((value + 1) >> (bits + 1))
+            bits++;
+        put(0, bits);
+        put(value + 1, bits + 1);
+    }
+
+    void putSe(int32_t value)
+    {
+        putUe(value > 0 ? 2 * value - 1 : -2 * value);
+    }
+
+    bool aligned() const { return !(m_bits % 8); }
+
+    void trailingBits()
+    {
+        put(1, 1);
+        while (!aligned())
+            put(0, 1);
+    }
+
+    // a start code, the header byte and the escaped rbsp to @out
+    void appendNal(uint32_t refIdc, uint32_t type, std::vector<uint8_t>& out) const
+    {
+        static const uint8_t startCode[] = { 0, 0, 0, 1 };
+        out.insert(out.end(), startCode, startCode + sizeof(startCode));
+        out.push_back((refIdc << 5) | type);
+        uint32_t zeros = 0;
+        for (size_t i = 0; i < m_data.size(); i++) {
+            if (zeros >= 2 && m_data[i] <= 3) {
+                out.push_back(3);
+                zeros = 0;
+            }
+            out.push_back(m_data[i]);
+            zeros = m_data[i] ? 0 : zeros + 1;
+        }
+        if (!m_data.empty() && !m_data.back())
+            out.push_back(3);
+    }
+
+private:
+    std::vector<uint8_t> m_data;
+    uint32_t m_bits;
+};
+
+struct StreamParams {
+    bool cabac;
+    bool frameMbsOnly;
+    uint32_t log2MaxFrameNum;
+    //slices per picture
+    uint32_t slices;
+    //cabac_zero_words after the slice data
+    uint32_t zeroWords;
+};
+
+static void writeSps(const StreamParams& params, std::vector<uint8_t>& out)
+{
+    RbspWriter w;
+    w.put(params.cabac ? 77 : 66, 8); //profile_idc
+    w.put(0, 8); //constraint flags
+    w.put(40, 8); //level_idc
+    w.putUe(0); //seq_parameter_set_id
+    w.putUe(params.log2MaxFrameNum - 4);
+    w.putUe(2); //pic_order_cnt_type
+    w.putUe(1); //max_num_ref_frames
+    w.put(0, 1); //gaps_in_frame_num_value_allowed_flag
+    w.putUe(119); //pic_width_in_mbs_minus1
+    w.putUe(params.frameMbsOnly ? 67 : 33); //pic_height_in_map_units_minus1
+    w.put(params.frameMbsOnly, 1);
+    if (!params.frameMbsOnly)
+        w.put(0, 1); //mb_adaptive_frame_field_flag
+    w.put(1, 1); //direct_8x8_inference_flag
+    w.put(0, 1); //frame_cropping_flag
+    w.put(0, 1); //vui_parameters_present_flag
+    w.trailingBits();
+    w.appendNal(3, 7, out);
+}
+
+static void writePps(const StreamParams& params, std::vector<uint8_t>& out)
+{
+    RbspWriter w;
+    w.putUe(0); //pic_parameter_set_id
+    w.putUe(0); //seq_parameter_set_id
+    w.put(params.cabac, 1);
+    w.put(0, 1); //bottom_field_pic_order_in_frame_present_flag
+    w.putUe(0); //num_slice_groups_minus1
+    w.putUe(0); //num_ref_idx_l0_default_active_minus1
+    w.putUe(0); //num_ref_idx_l1_default_active_minus1
+    w.put(0, 1); //weighted_pred_flag
+    w.put(0, 2); //weighted_bipred_idc
+    w.putSe(0); //pic_init_qp_minus26
+    w.putSe(0); //pic_init_qs_minus26
+    w.putSe(0); //chroma_qp_index_offset
+    w.put(0, 1); //deblocking_filter_control_present_flag
+    w.put(0, 1); //constrained_intra_pred_flag
+    w.put(0, 1); //redundant_pic_cnt_present_flag
+    w.trailingBits();
+    w.appendNal(3, 8, out);
+}
+
+// slice data of slice @seed, runs of zeros so emulation prevention bytes are needed
+static void writeSliceData(const StreamParams& params, uint32_t seed, RbspWriter& w)
+{
+    if (params.cabac) {
+        while (!w.aligned())
+            w.put(1, 1); //cabac_alignment_one_bit
+    }
+    for (uint32_t i = 0; i < 40 + seed % 7; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = (seed >> 16) & 0xff;
+        w.put(r < 96 ? 0 : r, 8);
+    }
+    w.put(seed & 0x7f, 7);
+    w.trailingBits();
+    for (uint32_t i = 0; i < params.zeroWords; i++)
+        w.put(0, 16);
+}
+
+// one picture, @idrPicId < 0 for a P picture
+static void writePicture(const StreamParams& params, int32_t idrPicId, uint32_t frameNum, bool bottomField,
+                         uint32_t seed, std::vector<uint8_t>& out)
+{
+    bool isIdr = idrPicId >= 0;
+    for (uint32_t s = 0; s < params.slices; s++) {
+        RbspWriter w;
+        w.putUe(s * 40); //first_mb_in_slice
+        w.putUe(isIdr ? 7 : 5); //slice_type, I or P
+        w.putUe(0); //pic_parameter_set_id
+        w.put(frameNum, params.log2MaxFrameNum);
+        if (!params.frameMbsOnly) {
+            w.put(1, 1); //field_pic_flag
+            w.put(bottomField, 1);
+        }
+        if (isIdr) {
+            w.putUe(idrPicId);
+        } else {
+            w.put(0, 1); //num_ref_idx_active_override_flag
+            w.put(0, 1); //ref_pic_list_modification_flag_l0
+        }
+        //dec_ref_pic_marking
+        if (isIdr) {
+            w.put(0, 1); //no_output_of_prior_pics_flag
+            w.put(0, 1); //long_term_reference_flag
+        } else {
+            w.put(0, 1); //adaptive_ref_pic_marking_mode_flag
+        }
+        if (params.cabac && !isIdr)
+            w.putUe(0); //cabac_init_idc
+        w.putSe(s % 2 ? -3 : 2); //slice_qp_delta
+        writeSliceData(params, seed * 16 + s, w);
+        w.appendNal(3, isIdr ? 5 : 1, out);
+    }
+}
+
+// a chunk as an encoder codes it, each encoder numbers its IDRs from 0
+static void writeChunk(const StreamParams& params, uint32_t pictures, uint32_t seed,
+                       std::vector<std::vector<uint8_t> >& units, int32_t firstIdrPicId = 0)
+{
+    for (uint32_t i = 0; i < pictures; i++) {
+        std::vector<uint8_t> unit;
+        if (!i) {
+            writeSps(params, unit);
+            writePps(params, unit);
+        }
+        uint32_t frameNum = i % (1 << params.log2MaxFrameNum);
+        writePicture(params, i ? -1 : firstIdrPicId, frameNum, false, seed + i, unit);
+        units.push_back(unit);
+    }
+}
+
+static bool stitchAndCompare(const StreamParams& params, uint32_t chunks, uint32_t pictures)
+{
+    VaapiH264Stitcher stitcher;
+    bool same = true;
+    for (uint32_t c = 0; c < chunks; c++) {
+        std::vector<std::vector<uint8_t> > coded, expected;
+        writeChunk(params, pictures, c * 100, coded);
+        //what a single encoder would have written
+        writeChunk(params, pictures, c * 100, expected, c);
+        for (uint32_t i = 0; i < pictures; i++) {
+            std::vector<uint8_t> out;
+            if (!stitcher.stitch(&coded[i][0], coded[i].size(), !i, out))
+                return false;
+            same = same && out == expected[i];
+        }
+    }
+    return same;
+}
+
+static void testCavlc()
+{
+    StreamParams params = { false, true, 4, 1, 0 };
+    EXPECT_TRUE(stitchAndCompare(params, 4, 5));
+}
+
+static void testCabac()
+{
+    //idr_pic_id grows from 1 to 3 and 5 bits, the alignment bits before the slice data change
+    StreamParams params = { true, true, 4, 1, 0 };
+    EXPECT_TRUE(stitchAndCompare(params, 8, 3));
+    //the last word of the rbsp is zero, it needs an emulation prevention byte after it
+    params.zeroWords = 2;
+    EXPECT_TRUE(stitchAndCompare(params, 3, 3));
+}
+
+static void testSlicesAndFrameNum()
+{
+    StreamParams params = { false, true, 8, 3, 0 };
+    EXPECT_TRUE(stitchAndCompare(params, 3, 4));
+    params.cabac = true;
+    EXPECT_TRUE(stitchAndCompare(params, 3, 4));
+}
+
+static void testFields()
+{
+    StreamParams params = { true, false, 5, 1, 0 };
+    VaapiH264Stitcher stitcher;
+    for (uint32_t c = 0; c < 3; c++) {
+        //an IDR top field and a bottom field of the same frame, in one access unit each
+        std::vector<uint8_t> top, bottom, expected;
+        writeSps(params, top);
+        writePps(params, top);
+        writePicture(params, 0, 0, false, c, top);
+        writePicture(params, -1, 0, true, c + 1, bottom);
+        writeSps(params, expected);
+        writePps(params, expected);
+        writePicture(params, c, 0, false, c, expected);
+
+        std::vector<uint8_t> out;
+        EXPECT_TRUE(stitcher.stitch(&top[0], top.size(), true, out));
+        EXPECT_TRUE(out == expected);
+        EXPECT_TRUE(stitcher.stitch(&bottom[0], bottom.size(), false, out));
+        EXPECT_TRUE(out == bottom);
+    }
+}
+
+static void testChunkWithoutIdr()
+{
+    StreamParams params = { false, true, 4, 1, 0 };
+    std::vector<uint8_t> unit, out;
+    writeSps(params, unit);
+    writePps(params, unit);
+    writePicture(params, 0, 0, false, 1, unit);
+    VaapiH264Stitcher stitcher;
+    EXPECT_TRUE(stitcher.stitch(&unit[0], unit.size(), true, out));
+
+    std::vector<uint8_t> p;
+    writePicture(params, -1, 1, false, 2, p);
+    EXPECT_TRUE(stitcher.stitch(&p[0], p.size(), false, out));
+    EXPECT_TRUE(out == p);
+    //frame_num and POC would not restart
+    EXPECT_TRUE(!stitcher.stitch(&p[0], p.size(), true, out));
+}
+
+static void testIdrPicIdWraps()
+{
+    StreamParams params = { false, true, 4, 1, 0 };
+    std::vector<uint8_t> unit, out, expected;
+    writeSps(params, unit);
+    writePps(params, unit);
+    writePicture(params, 0, 0, false, 1, unit);
+    VaapiH264Stitcher stitcher;
+    for (uint32_t i = 0; i < 65536; i++)
+        stitcher.stitch(&unit[0], unit.size(), true, out);
+    //idr_pic_id is at most 65535, the 65537th IDR is 0 again
+    EXPECT_TRUE(stitcher.stitch(&unit[0], unit.size(), true, out));
+    EXPECT_TRUE(out == unit);
+
+    stitcher.reset();
+    EXPECT_TRUE(stitcher.stitch(&unit[0], unit.size(), true, out));
+    EXPECT_TRUE(out == unit);
+    writeSps(params, expected);
+    writePps(params, expected);
+    writePicture(params, 1, 0, false, 1, expected);
+    EXPECT_TRUE(stitcher.stitch(&unit[0], unit.size(), true, out));
+    EXPECT_TRUE(out == expected);
+}
+
+int main()
+{
+    RUN_TEST(testCavlc);
+    RUN_TEST(testCabac);
+    RUN_TEST(testSlicesAndFrameNum);
+    RUN_TEST(testFields);
+    RUN_TEST(testChunkWithoutIdr);
+    RUN_TEST(testIdrPicIdWraps);
+    return UNITTEST_RESULT();
+}
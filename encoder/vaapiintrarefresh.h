@@ -0,0 +1,152 @@
+/*
+ *  vaapiintrarefresh.h - schedule of the periodic intra refresh for encoders
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapiintrarefresh_h
+#define vaapiintrarefresh_h
+
+#include "vaapiencoder_h264_slice.h"
+#include <stdint.h>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+/**
+ * \class VaapiIntraRefresh
+ * \brief decides which macroblock columns or rows of each picture are coded as intra,
+ * so a refresh sweeps the picture instead of coding an I frame.
+ * <pre>
+ * the caller turns the decisions to driver parameters.
+ * 1. a cycle refreshes all columns (or rows) in period frames, the same count in each frame,
+ *    the last frame of a cycle may refresh less.
+ * 2. an IDR refreshes everything, the next picture starts a new cycle.
+ * 3. the first picture of a cycle is a recovery point, the picture is fully refreshed
+ *    recoveryFrameCount() frames later. writeRecoveryPointSei() tells it to an H.264 decoder.
+ *</pre>
+ */
+class VaapiIntraRefresh
+{
+public:
+    struct Region {
+        //in macroblocks, size is 0 for no refresh
+        uint32_t location;
+        uint32_t size;
+        bool recoveryPoint;
+    };
+
+    VaapiIntraRefresh()
+        : m_byRow(false), m_lines(0), m_size(0), m_cycleFrames(0), m_position(0)
+    {
+    }
+
+    /// @period is the frame count of a cycle, it is clamped to the column (or row) count
+    void init(bool byRow, uint32_t mbWidth, uint32_t mbHeight, uint32_t period)
+    {
+        m_byRow = byRow;
+        m_lines = byRow ? mbHeight : mbWidth;
+        if (!period)
+            period = 1;
+        m_size = m_lines ? (m_lines + period - 1) / period : 0;
+        m_cycleFrames = m_size ? (m_lines + m_size - 1) / m_size : 0;
+        reset();
+    }
+
+    void reset()
+    {
+        m_position = 0;
+    }
+
+    bool isByRow() const { return m_byRow; }
+
+    /// frames from a recovery point to the fully refreshed picture
+    uint32_t recoveryFrameCount() const
+    {
+        return m_cycleFrames ? m_cycleFrames - 1 : 0;
+    }
+
+    /// recovery point SEI (D.1.7) for the first picture of a cycle, an H.264 NAL unit with start code
+    void writeRecoveryPointSei(std::vector<uint8_t>& nal) const
+    {
+        const uint8_t seiNalHeader = 6;
+        const uint8_t recoveryPointPayloadType = 6;
+        uint8_t payload[8];
+        H264SliceBitWriter bs(payload, sizeof(payload));
+        bs.putUe(recoveryFrameCount());
+        //exact_match_flag is 0, the refreshed area may be predicted from the area not refreshed yet.
+        //broken_link_flag and changing_slice_group_idc are 0 too
+        bs.put(0, 4);
+        //bit_equal_to_one, then zeros till byte aligned
+        if (bs.getBitSize() % 8)
+            bs.put(1, 1);
+        uint32_t payloadSize = (bs.finish() + 7) / 8;
+
+        std::vector<uint8_t> rbsp;
+        rbsp.push_back(seiNalHeader);
+        rbsp.push_back(recoveryPointPayloadType);
+        rbsp.push_back(payloadSize);
+        rbsp.insert(rbsp.end(), payload, payload + payloadSize);
+        //rbsp_trailing_bits
+        rbsp.push_back(0x80);
+
+        const uint8_t sync[] = { 0, 0, 0, 1 };
+        nal.assign(sync, sync + sizeof(sync));
+        uint32_t zeros = 0;
+        for (size_t i = 0; i < rbsp.size(); i++) {
+            if (zeros == 2 && rbsp[i] <= 3) {
+                nal.push_back(3);
+                zeros = 0;
+            }
+            nal.push_back(rbsp[i]);
+            zeros = rbsp[i] ? 0 : zeros + 1;
+        }
+    }
+
+    /// region of the next picture in coding order
+    void next(bool isIdr, Region& region)
+    {
+        region.location = 0;
+        region.size = 0;
+        region.recoveryPoint = false;
+        if (isIdr || !m_size) {
+            reset();
+            return;
+        }
+        region.location = m_position * m_size;
+        region.size = m_size;
+        if (region.location + region.size > m_lines)
+            region.size = m_lines - region.location;
+        region.recoveryPoint = !m_position;
+        m_position = (m_position + 1) % m_cycleFrames;
+    }
+
+private:
+    bool m_byRow;
+    //macroblock columns, or rows
+    uint32_t m_lines;
+    //refreshed in each picture
+    uint32_t m_size;
+    uint32_t m_cycleFrames;
+    //picture index in current cycle
+    uint32_t m_position;
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapiintrarefresh_h
@@ -0,0 +1,215 @@
+/*
+ *  vaapiintrarefresh_unittest.cpp - host side tests of the intra refresh schedule and its SEI
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/unittest.h"
+#include "vaapiintrarefresh.h"
+#include <algorithm>
+#include <vector>
+//the decoder's NAL reader, nalutils.h has no C++ guard of its own
+extern "C" {
+#include "codecparsers/nalutils.h"
+}
+
+using namespace YamiMediaCodec;
+
+typedef VaapiIntraRefresh::Region Region;
+
+/**
+ * runs @cycles cycles after an IDR. each line is refreshed once a cycle, in order,
+ * by regions of the same size but for the last one, the first region is the recovery point.
+ */
+static void checkCycles(VaapiIntraRefresh& refresh, uint32_t lines, uint32_t size, uint32_t cycles)
+{
+    Region region;
+    refresh.next(true, region);
+    EXPECT_EQ(0u, region.size);
+    EXPECT_TRUE(!region.recoveryPoint);
+
+    uint32_t frames = (lines + size - 1) / size;
+    EXPECT_EQ(frames - 1, refresh.recoveryFrameCount());
+    for (uint32_t c = 0; c < cycles; c++) {
+        std::vector<uint32_t> refreshed(lines);
+        for (uint32_t i = 0; i < frames; i++) {
+            refresh.next(false, region);
+            EXPECT_EQ(i * size, region.location);
+            EXPECT_EQ(i + 1 < frames ? size : lines - i * size, region.size);
+            EXPECT_EQ(!i, region.recoveryPoint);
+            for (uint32_t l = region.location; l < region.location + region.size && l < lines; l++)
+                refreshed[l]++;
+        }
+        for (uint32_t l = 0; l < lines; l++)
+            EXPECT_EQ(1u, refreshed[l]);
+    }
+}
+
+static void testColumns()
+{
+    VaapiIntraRefresh refresh;
+    //1280x720, 80 columns in 8 frames
+    refresh.init(false, 80, 45, 8);
+    EXPECT_TRUE(!refresh.isByRow());
+    checkCycles(refresh, 80, 10, 3);
+
+    //columns left over, the last frame of the cycle refreshes less
+    refresh.init(false, 45, 30, 8);
+    checkCycles(refresh, 45, 6, 3);
+}
+
+static void testRows()
+{
+    VaapiIntraRefresh refresh;
+    refresh.init(true, 80, 45, 10);
+    EXPECT_TRUE(refresh.isByRow());
+    checkCycles(refresh, 45, 5, 2);
+}
+
+// a period longer than the lines refreshes one line a frame, a period of 0 or 1 all lines each frame
+static void testPeriodClamped()
+{
+    VaapiIntraRefresh refresh;
+    refresh.init(false, 10, 10, 100);
+    checkCycles(refresh, 10, 1, 2);
+    refresh.init(false, 10, 10, 0);
+    checkCycles(refresh, 10, 10, 3);
+    refresh.init(false, 10, 10, 1);
+    checkCycles(refresh, 10, 10, 3);
+}
+
+// an IDR in the middle of a cycle refreshes everything, the next picture starts a new cycle
+static void testIdrRestarts()
+{
+    VaapiIntraRefresh refresh;
+    refresh.init(false, 40, 30, 4);
+    Region region;
+    refresh.next(true, region);
+    refresh.next(false, region);
+    refresh.next(false, region);
+    EXPECT_EQ(10u, region.location);
+    refresh.next(true, region);
+    EXPECT_EQ(0u, region.size);
+    refresh.next(false, region);
+    EXPECT_EQ(0u, region.location);
+    EXPECT_TRUE(region.recoveryPoint);
+
+    //reset() does the same, for a new stream
+    refresh.next(false, region);
+    refresh.reset();
+    refresh.next(false, region);
+    EXPECT_EQ(0u, region.location);
+    EXPECT_TRUE(region.recoveryPoint);
+}
+
+static void testDisabled()
+{
+    VaapiIntraRefresh refresh;
+    refresh.init(false, 0, 0, 0);
+    EXPECT_EQ(0u, refresh.recoveryFrameCount());
+    Region region;
+    for (uint32_t i = 0; i < 3; i++) {
+        refresh.next(false, region);
+        EXPECT_EQ(0u, region.size);
+        EXPECT_TRUE(!region.recoveryPoint);
+    }
+}
+
+static uint32_t readBits(NalReader* nr, uint32_t bits)
+{
+    uint32_t value = 0xffffffff;
+    EXPECT_TRUE(nal_reader_get_bits_uint32(nr, &value, bits));
+    return value;
+}
+
+/* parses the SEI with the decoder's NAL reader, it drops the emulation prevention bytes */
+static void checkSei(const std::vector<uint8_t>& nal, uint32_t recoveryFrameCount)
+{
+    EXPECT_TRUE(nal.size() > 4);
+    if (nal.size() <= 4)
+        return;
+    EXPECT_TRUE(!nal[0] && !nal[1] && !nal[2] && nal[3] == 1);
+    //no start code and no 0x000003 the decoder would take for an emulation prevention it is not
+    for (size_t i = 6; i < nal.size(); i++)
+        EXPECT_TRUE(nal[i - 2] || nal[i - 1] || nal[i] > 3 || (nal[i] == 3 && i + 1 < nal.size() && nal[i + 1] <= 3));
+
+    NalReader nr;
+    nal_reader_init(&nr, &nal[4], nal.size() - 4);
+    //forbidden_zero_bit, nal_ref_idc, nal_unit_type
+    EXPECT_EQ(0u, readBits(&nr, 1));
+    EXPECT_EQ(0u, readBits(&nr, 2));
+    EXPECT_EQ(6u, readBits(&nr, 5));
+    //payloadType recovery point, payloadSize
+    EXPECT_EQ(6u, readBits(&nr, 8));
+    uint32_t payloadSize = readBits(&nr, 8);
+    uint32_t payloadStart = nal_reader_get_pos(&nr) - 8 * nal_reader_get_epb_count(&nr);
+
+    uint32_t count = 0xffffffff;
+    EXPECT_TRUE(nal_reader_get_ue(&nr, &count));
+    EXPECT_EQ(recoveryFrameCount, count);
+    //exact_match_flag, broken_link_flag, changing_slice_group_idc
+    EXPECT_EQ(0u, readBits(&nr, 4));
+    //payload alignment, a one and zeros
+    uint32_t payloadBits = nal_reader_get_pos(&nr) - 8 * nal_reader_get_epb_count(&nr) - payloadStart;
+    if (payloadBits % 8) {
+        EXPECT_EQ(1u, readBits(&nr, 1));
+        payloadBits++;
+        EXPECT_EQ(0u, readBits(&nr, (8 - payloadBits % 8) % 8));
+    }
+    EXPECT_EQ(payloadSize * 8, nal_reader_get_pos(&nr) - 8 * nal_reader_get_epb_count(&nr) - payloadStart);
+    //rbsp_trailing_bits end the NAL
+    EXPECT_TRUE(!nal_reader_has_more_data(&nr));
+    EXPECT_EQ(0x80u, readBits(&nr, 8));
+    EXPECT_EQ(0u, nal_reader_get_remaining(&nr));
+}
+
+static void testRecoveryPointSei()
+{
+    VaapiIntraRefresh refresh;
+    std::vector<uint8_t> nal;
+    //every count up to a 4096 wide picture refreshed a column a frame, payloads of 1 to 3 bytes
+    for (uint32_t lines = 1; lines <= 256; lines++) {
+        refresh.init(false, lines, 1, lines);
+        refresh.writeRecoveryPointSei(nal);
+        checkSei(nal, lines - 1);
+    }
+    //22 leading zeros of the ue code, the payload starts with 00 00 02 and needs emulation prevention
+    refresh.init(false, 1 << 22, 1, 1 << 22);
+    refresh.writeRecoveryPointSei(nal);
+    checkSei(nal, (1 << 22) - 1);
+    const uint8_t emulated[] = { 0x00, 0x00, 0x03, 0x02 };
+    EXPECT_TRUE(std::search(nal.begin(), nal.end(), emulated, emulated + sizeof(emulated)) != nal.end());
+
+    //a cycle of 8 frames, ue(7) and the flags take 11 bits, the payload is aligned to 2 bytes
+    refresh.init(true, 80, 45, 8);
+    refresh.writeRecoveryPointSei(nal);
+    const uint8_t expected[] = { 0, 0, 0, 1, 0x06, 0x06, 0x02, 0x10, 0x10, 0x80 };
+    EXPECT_EQ(sizeof(expected), nal.size());
+    EXPECT_TRUE(nal == std::vector<uint8_t>(expected, expected + sizeof(expected)));
+}
+
+int main()
+{
+    RUN_TEST(testColumns);
+    RUN_TEST(testRows);
+    RUN_TEST(testPeriodClamped);
+    RUN_TEST(testIdrRestarts);
+    RUN_TEST(testDisabled);
+    RUN_TEST(testRecoveryPointSei);
+    return UNITTEST_RESULT();
+}
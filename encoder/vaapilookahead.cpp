@@ -0,0 +1,283 @@
+/*
+ *  vaapilookahead.cpp - luma analysis and lookahead decisions for encoders
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "vaapilookahead.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// LOOKAHEAD_C_ONLY leaves the SIMD kernels out, the unit test uses it to check the C ones
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(LOOKAHEAD_C_ONLY)
+#define LOOKAHEAD_X86 1
+#include <emmintrin.h>
+#endif
+
+namespace YamiMediaCodec{
+
+// downscale factor in each direction
+#define LUMA_SCALE 4
+#define LUMA_BLOCK 8
+
+// the kernels work on one row, or one row of 8x8 blocks
+struct LumaKernels {
+    // 4 source rows to one row, @width is the destination width
+    void (*downscale)(uint8_t* dest, const uint8_t* src, uint32_t pitch, uint32_t width);
+    uint64_t (*sad)(const uint8_t* a, const uint8_t* b, uint32_t width);
+    // sum of absolute deviations from the mean of each 8x8 block
+    uint64_t (*blockDeviation)(const uint8_t* src, uint32_t pitch, uint32_t blocks);
+};
+
+static inline uint8_t avg(uint8_t a, uint8_t b)
+{
+    return (a + b + 1) >> 1;
+}
+
+// averages the way _mm_avg_epu8 does, so the C and SIMD results match
+static uint32_t downscaleC(uint8_t* dest, const uint8_t* src, uint32_t pitch, uint32_t begin, uint32_t width)
+{
+    const uint8_t* r0 = src;
+    const uint8_t* r1 = r0 + pitch;
+    const uint8_t* r2 = r1 + pitch;
+    const uint8_t* r3 = r2 + pitch;
+    for (uint32_t i = begin; i < width; i++) {
+        uint8_t v[LUMA_SCALE];
+        for (uint32_t j = 0; j < LUMA_SCALE; j++) {
+            uint32_t x = i * LUMA_SCALE + j;
+            v[j] = avg(avg(r0[x], r1[x]), avg(r2[x], r3[x]));
+        }
+        dest[i] = avg(avg(v[0], v[1]), avg(v[2], v[3]));
+    }
+    return width;
+}
+
+static void downscale_c(uint8_t* dest, const uint8_t* src, uint32_t pitch, uint32_t width)
+{
+    downscaleC(dest, src, pitch, 0, width);
+}
+
+static uint64_t sad_c(const uint8_t* a, const uint8_t* b, uint32_t width)
+{
+    uint64_t sad = 0;
+    for (uint32_t i = 0; i < width; i++)
+        sad += abs(a[i] - b[i]);
+    return sad;
+}
+
+static uint32_t blockMean(const uint8_t* src, uint32_t pitch)
+{
+    uint32_t sum = 0;
+    for (uint32_t y = 0; y < LUMA_BLOCK; y++)
+        for (uint32_t x = 0; x < LUMA_BLOCK; x++)
+            sum += src[y * pitch + x];
+    return (sum + 32) >> 6;
+}
+
+static uint64_t blockDeviation_c(const uint8_t* src, uint32_t pitch, uint32_t blocks)
+{
+    uint64_t cost = 0;
+    for (uint32_t b = 0; b < blocks; b++) {
+        const uint8_t* block = src + b * LUMA_BLOCK;
+        int32_t mean = blockMean(block, pitch);
+        for (uint32_t y = 0; y < LUMA_BLOCK; y++)
+            for (uint32_t x = 0; x < LUMA_BLOCK; x++)
+                cost += abs(block[y * pitch + x] - mean);
+    }
+    return cost;
+}
+
+#ifdef LOOKAHEAD_X86
+
+// 16 source bytes to 4 destination bytes, in the low byte of each 32 bits lane
+__attribute__ ((target ("sse2")))
+static inline __m128i downscaleRow4(__m128i v)
+{
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+    const __m128i lowWords = _mm_set1_epi32(0x0000ffff);
+    __m128i pairs = _mm_avg_epu16(_mm_and_si128(v, lowBytes), _mm_srli_epi16(v, 8));
+    return _mm_avg_epu16(_mm_and_si128(pairs, lowWords), _mm_srli_epi32(pairs, 16));
+}
+
+__attribute__ ((target ("sse2")))
+static void downscale_sse2(uint8_t* dest, const uint8_t* src, uint32_t pitch, uint32_t width)
+{
+    uint32_t i = 0;
+    //each loop makes 16 destination bytes from 64 bytes of 4 rows
+    for (; i + 16 <= width; i += 16) {
+        __m128i v[4];
+        for (uint32_t j = 0; j < 4; j++) {
+            const uint8_t* s = src + (i + j * 4) * LUMA_SCALE;
+            __m128i r0 = _mm_loadu_si128((const __m128i*)s);
+            __m128i r1 = _mm_loadu_si128((const __m128i*)(s + pitch));
+            __m128i r2 = _mm_loadu_si128((const __m128i*)(s + pitch * 2));
+            __m128i r3 = _mm_loadu_si128((const __m128i*)(s + pitch * 3));
+            v[j] = downscaleRow4(_mm_avg_epu8(_mm_avg_epu8(r0, r1), _mm_avg_epu8(r2, r3)));
+        }
+        __m128i lo = _mm_packs_epi32(v[0], v[1]);
+        __m128i hi = _mm_packs_epi32(v[2], v[3]);
+        _mm_storeu_si128((__m128i*)(dest + i), _mm_packus_epi16(lo, hi));
+    }
+    downscaleC(dest, src, pitch, i, width);
+}
+
+__attribute__ ((target ("sse2")))
+static uint64_t sad_sse2(const uint8_t* a, const uint8_t* b, uint32_t width)
+{
+    __m128i sum = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 16 <= width; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+    }
+    uint64_t sad = (uint64_t)_mm_cvtsi128_si32(sum) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+    return sad + sad_c(a + i, b + i, width - i);
+}
+
+__attribute__ ((target ("sse2")))
+static uint64_t blockDeviation_sse2(const uint8_t* src, uint32_t pitch, uint32_t blocks)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t cost = 0;
+    for (uint32_t b = 0; b < blocks; b++) {
+        const uint8_t* block = src + b * LUMA_BLOCK;
+        __m128i rows[LUMA_BLOCK / 2];
+        __m128i sum = zero;
+        for (uint32_t y = 0; y < LUMA_BLOCK / 2; y++) {
+            const uint8_t* s = block + y * 2 * pitch;
+            rows[y] = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)s),
+                                         _mm_loadl_epi64((const __m128i*)(s + pitch)));
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(rows[y], zero));
+        }
+        uint32_t total = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+        __m128i mean = _mm_set1_epi8((char)((total + 32) >> 6));
+        __m128i dev = zero;
+        for (uint32_t y = 0; y < LUMA_BLOCK / 2; y++)
+            dev = _mm_add_epi64(dev, _mm_sad_epu8(rows[y], mean));
+        cost += _mm_cvtsi128_si32(dev) + _mm_cvtsi128_si32(_mm_srli_si128(dev, 8));
+    }
+    return cost;
+}
+
+#endif //LOOKAHEAD_X86
+
+static LumaKernels selectKernels()
+{
+    LumaKernels kernels = { downscale_c, sad_c, blockDeviation_c };
+#ifdef LOOKAHEAD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        kernels.downscale = downscale_sse2;
+        kernels.sad = sad_sse2;
+        kernels.blockDeviation = blockDeviation_sse2;
+    }
+#endif
+    return kernels;
+}
+
+// selected once, on first use
+static const LumaKernels& getKernels()
+{
+    static const LumaKernels kernels = selectKernels();
+    return kernels;
+}
+
+LumaFramePtr VaapiLumaFrame::create(const uint8_t* luma, uint32_t pitch, uint32_t width, uint32_t height)
+{
+    LumaFramePtr frame;
+    if (!luma || width < LUMA_SCALE * LUMA_BLOCK || height < LUMA_SCALE * LUMA_BLOCK)
+        return frame;
+    frame.reset(new VaapiLumaFrame);
+    if (!frame->init(luma, pitch, width, height))
+        frame.reset();
+    return frame;
+}
+
+VaapiLumaFrame::VaapiLumaFrame()
+    : m_width(0)
+    , m_height(0)
+    , m_pitch(0)
+    , m_intraCost(0)
+{
+    memset(m_histogram, 0, sizeof(m_histogram));
+}
+
+bool VaapiLumaFrame::init(const uint8_t* luma, uint32_t pitch, uint32_t width, uint32_t height)
+{
+    const LumaKernels& kernels = getKernels();
+    m_width = width / LUMA_SCALE;
+    m_height = height / LUMA_SCALE;
+    m_pitch = (m_width + 15) & ~15;
+    m_plane.assign(m_pitch * m_height, 0);
+
+    for (uint32_t y = 0; y < m_height; y++)
+        kernels.downscale(&m_plane[y * m_pitch], luma + y * LUMA_SCALE * pitch, pitch, m_width);
+
+    //4 histograms, so successive pixels don't wait for each other's increment
+    uint32_t histograms[4][HISTOGRAM_BINS];
+    memset(histograms, 0, sizeof(histograms));
+    for (uint32_t y = 0; y < m_height; y++) {
+        const uint8_t* row = &m_plane[y * m_pitch];
+        uint32_t x = 0;
+        for (; x + 4 <= m_width; x += 4) {
+            histograms[0][row[x] >> 2]++;
+            histograms[1][row[x + 1] >> 2]++;
+            histograms[2][row[x + 2] >> 2]++;
+            histograms[3][row[x + 3] >> 2]++;
+        }
+        for (; x < m_width; x++)
+            histograms[0][row[x] >> 2]++;
+    }
+    for (uint32_t i = 0; i < HISTOGRAM_BINS; i++)
+        m_histogram[i] = histograms[0][i] + histograms[1][i] + histograms[2][i] + histograms[3][i];
+
+    uint32_t blocks = m_width / LUMA_BLOCK;
+    for (uint32_t y = 0; y + LUMA_BLOCK <= m_height; y += LUMA_BLOCK)
+        m_intraCost += kernels.blockDeviation(&m_plane[y * m_pitch], m_pitch, blocks);
+    return true;
+}
+
+uint64_t VaapiLumaFrame::getInterCost(const VaapiLumaFrame& other) const
+{
+    if (m_width != other.m_width || m_height != other.m_height)
+        return 0;
+    const LumaKernels& kernels = getKernels();
+    uint64_t sad = 0;
+    //the zero padding adds nothing, so whole padded rows can be compared
+    for (uint32_t y = 0; y < m_height; y++)
+        sad += kernels.sad(&m_plane[y * m_pitch], &other.m_plane[y * m_pitch], m_pitch);
+    return sad;
+}
+
+double VaapiLumaFrame::getHistogramDiff(const VaapiLumaFrame& other) const
+{
+    uint64_t diff = 0;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_BINS; i++) {
+        diff += abs((int32_t)m_histogram[i] - (int32_t)other.m_histogram[i]);
+        total += m_histogram[i] + other.m_histogram[i];
+    }
+    return total ? (double)diff / total : 0;
+}
+
+} //namespace YamiMediaCodec
@@ -0,0 +1,242 @@
+/*
+ *  vaapilookahead.h - luma analysis and lookahead decisions for encoders
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapilookahead_h
+#define vaapilookahead_h
+
+#include "common/common_def.h"
+#include "interface/VideoCommonDefs.h"
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+#define MAX_LOOKAHEAD_DEPTH 40
+
+class VaapiLumaFrame;
+typedef SharedPtr<VaapiLumaFrame> LumaFramePtr;
+
+/**
+ * \class VaapiLumaFrame
+ * \brief luma of a frame downscaled by 4 in each direction, with the statistics the lookahead needs.
+ * <pre>
+ * 1. it is plain CPU code, SSE2 kernels are used when the CPU has them. the C kernels give the
+ *    same results, bit for bit.
+ * 2. intra cost is the sum of absolute deviations from the mean of each 8x8 block,
+ *    inter cost is the zero motion SAD against another frame. both are in the same unit.
+ *</pre>
+ */
+class VaapiLumaFrame
+{
+public:
+    enum {
+        HISTOGRAM_BINS = 64,
+    };
+    /// analyse the luma plane, NULL if it is too small to analyse
+    static LumaFramePtr create(const uint8_t* luma, uint32_t pitch, uint32_t width, uint32_t height);
+
+    uint32_t getWidth() const { return m_width; }
+    uint32_t getHeight() const { return m_height; }
+    uint64_t getIntraCost() const { return m_intraCost; }
+    /// sum of absolute differences against @other, which has the same size
+    uint64_t getInterCost(const VaapiLumaFrame& other) const;
+    /// difference of the luma histograms, from 0 for same to 1 for disjoint
+    double getHistogramDiff(const VaapiLumaFrame& other) const;
+
+private:
+    VaapiLumaFrame();
+    bool init(const uint8_t* luma, uint32_t pitch, uint32_t width, uint32_t height);
+
+    uint32_t m_width;
+    uint32_t m_height;
+    //multiple of 16, the padding is zero
+    uint32_t m_pitch;
+    std::vector<uint8_t> m_plane;
+    uint32_t m_histogram[HISTOGRAM_BINS];
+    uint64_t m_intraCost;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiLumaFrame);
+};
+
+/**
+ * \class VaapiLookahead
+ * \brief holds the frames in front of the encoder for a few frames, to decide on them with the future in view
+ * <pre>
+ * 1. frames are pushed in display order and popped when depth frames are queued after them.
+ * 2. a scene cut is a frame which differs from the previous one in content and luma histogram.
+ *    it is not a cut if the next frame looks like the previous one again, like a flash.
+ *    the frame after a flash is compared with the one before the flash.
+ * 3. a frame which differs a lot from the previous one is coded as an anchor, B frames
+ *    don't pay off in high motion.
+ * 4. a frame whose following frames are well predicted gets a lower QP, since the bits spent
+ *    on it are reused by them, and the other way around.
+ * 5. frames without luma, like the ones in video memory, get no decision.
+ *</pre>
+ */
+template <class T>
+class VaapiLookahead
+{
+public:
+    struct Frame {
+        T data;
+        bool forceKeyFrame;
+        bool sceneCut;
+        bool forceAnchor;
+        int32_t qpOffset;
+    };
+
+    VaapiLookahead() : m_depth(0), m_draining(false) {}
+
+    void init(uint32_t depth)
+    {
+        m_depth = depth;
+        reset();
+    }
+
+    uint32_t getDepth() const { return m_depth; }
+
+    void reset()
+    {
+        m_queue.clear();
+        m_last.reset();
+        m_beforeFlash.reset();
+        m_draining = false;
+    }
+
+    void push(const T& data, bool forceKeyFrame, const LumaFramePtr& luma)
+    {
+        Item item;
+        item.data = data;
+        item.forceKeyFrame = forceKeyFrame;
+        item.luma = luma;
+        item.interCost = 0;
+        const LumaFramePtr& prev = m_queue.empty() ? m_last : m_queue.back().luma;
+        item.hasPrev = luma && prev && isSameSize(*luma, *prev);
+        if (item.hasPrev)
+            item.interCost = luma->getInterCost(*prev);
+        m_queue.push_back(item);
+        m_draining = false;
+    }
+
+    /// release all frames, for end of stream
+    void drain()
+    {
+        m_draining = true;
+    }
+
+    bool pop(Frame& frame)
+    {
+        if (m_queue.empty() || (!m_draining && m_queue.size() <= m_depth))
+            return false;
+        const Item& item = m_queue.front();
+        frame.data = item.data;
+        frame.forceKeyFrame = item.forceKeyFrame;
+        frame.sceneCut = false;
+        frame.forceAnchor = false;
+        frame.qpOffset = 0;
+        bool flash = false;
+        if (item.hasPrev) {
+            const VaapiLumaFrame& cur = *item.luma;
+            const VaapiLumaFrame& prev = *m_last;
+            frame.sceneCut = isCut(prev, cur, item.interCost);
+            //back from a flash, the frame before the flash is the one to compare with
+            if (frame.sceneCut && m_beforeFlash && isSameSize(*m_beforeFlash, cur))
+                frame.sceneCut = isCut(*m_beforeFlash, cur, cur.getInterCost(*m_beforeFlash));
+            if (frame.sceneCut && m_queue.size() > 1) {
+                const Item& next = m_queue[1];
+                if (next.luma && isSameSize(prev, *next.luma)
+                    && !isCut(prev, *next.luma, next.luma->getInterCost(prev))) {
+                    frame.sceneCut = false;
+                    flash = true;
+                }
+            }
+            frame.forceAnchor = !frame.sceneCut
+                && item.interCost * 2 > cur.getIntraCost();
+        }
+        if (item.luma)
+            frame.qpOffset = getQpOffset();
+        m_beforeFlash = flash ? m_last : LumaFramePtr();
+        m_last = item.luma;
+        m_queue.pop_front();
+        return true;
+    }
+
+    size_t size() const { return m_queue.size(); }
+
+private:
+    struct Item {
+        T data;
+        bool forceKeyFrame;
+        //the previous frame has luma of the same size
+        bool hasPrev;
+        LumaFramePtr luma;
+        //against the previous frame
+        uint64_t interCost;
+    };
+
+    static bool isSameSize(const VaapiLumaFrame& a, const VaapiLumaFrame& b)
+    {
+        return a.getWidth() == b.getWidth() && a.getHeight() == b.getHeight();
+    }
+
+    static bool isCut(const VaapiLumaFrame& prev, const VaapiLumaFrame& cur, uint64_t interCost)
+    {
+        return cur.getHistogramDiff(prev) > 0.25
+            && interCost * 10 > cur.getIntraCost() * 6;
+    }
+
+    // how well the frames after the front one are predicted from their previous frames
+    int32_t getQpOffset() const
+    {
+        uint64_t inter = 0, intra = 0;
+        for (size_t i = 1; i < m_queue.size(); i++) {
+            const Item& item = m_queue[i];
+            if (!item.hasPrev)
+                break;
+            inter += item.interCost;
+            intra += item.luma->getIntraCost();
+        }
+        if (!intra)
+            return 0;
+        double ratio = (double)inter / intra;
+        if (ratio < 0.05)
+            return -2;
+        if (ratio < 0.15)
+            return -1;
+        if (ratio > 0.6)
+            return 1;
+        return 0;
+    }
+
+    uint32_t m_depth;
+    bool m_draining;
+    std::deque<Item> m_queue;
+    //luma of the last popped frame
+    LumaFramePtr m_last;
+    //luma of the frame before m_last, if m_last was a flash
+    LumaFramePtr m_beforeFlash;
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapilookahead_h
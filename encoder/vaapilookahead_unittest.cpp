@@ -0,0 +1,401 @@
+/*
+ *  vaapilookahead_unittest.cpp - host side tests and benchmark of the lookahead analysis
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/unittest.h"
+#include "vaapilookahead.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+
+using namespace YamiMediaCodec;
+
+#define WIDTH 320
+#define HEIGHT 240
+#define DEPTH 4
+
+static uint32_t seed = 1;
+
+/* deterministic, so a failure can be reproduced */
+static uint32_t randomNumber(uint32_t range)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % range;
+}
+
+struct Luma {
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    std::vector<uint8_t> data;
+
+    Luma(uint32_t w, uint32_t h, uint32_t p)
+        : width(w), height(h), pitch(p), data(p * h) {}
+
+    LumaFramePtr analyse() const
+    {
+        return VaapiLumaFrame::create(&data[0], pitch, width, height);
+    }
+};
+
+/* a smooth texture for each scene, moved @shift pixels to the left */
+static void drawScene(Luma& luma, uint32_t scene, uint32_t shift, int32_t brightness = 0)
+{
+    double base = scene ? 170 : 70;
+    double fx = scene ? 0.11 : 0.05;
+    double fy = scene ? 0.07 : 0.03;
+    for (uint32_t y = 0; y < luma.height; y++) {
+        for (uint32_t x = 0; x < luma.width; x++) {
+            double v = base + brightness + 40 * sin((x + shift) * fx) * cos(y * fy);
+            luma.data[y * luma.pitch + x] = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+        }
+    }
+}
+
+static void drawNoise(Luma& luma)
+{
+    for (uint32_t i = 0; i < luma.data.size(); i++)
+        luma.data[i] = randomNumber(256);
+}
+
+/* the analysis written out plainly, the kernels have to match it bit for bit */
+struct Reference {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> plane;
+    uint32_t histogram[VaapiLumaFrame::HISTOGRAM_BINS];
+    uint64_t intraCost;
+};
+
+static uint8_t avg(uint8_t a, uint8_t b)
+{
+    return (a + b + 1) >> 1;
+}
+
+static void analyse(const Luma& luma, Reference& ref)
+{
+    ref.width = luma.width / 4;
+    ref.height = luma.height / 4;
+    ref.plane.resize(ref.width * ref.height);
+    memset(ref.histogram, 0, sizeof(ref.histogram));
+    for (uint32_t y = 0; y < ref.height; y++) {
+        for (uint32_t x = 0; x < ref.width; x++) {
+            uint8_t v[4];
+            for (uint32_t j = 0; j < 4; j++) {
+                const uint8_t* s = &luma.data[y * 4 * luma.pitch + x * 4 + j];
+                v[j] = avg(avg(s[0], s[luma.pitch]), avg(s[luma.pitch * 2], s[luma.pitch * 3]));
+            }
+            uint8_t pixel = avg(avg(v[0], v[1]), avg(v[2], v[3]));
+            ref.plane[y * ref.width + x] = pixel;
+            ref.histogram[pixel >> 2]++;
+        }
+    }
+
+    ref.intraCost = 0;
+    for (uint32_t by = 0; by + 8 <= ref.height; by += 8) {
+        for (uint32_t bx = 0; bx + 8 <= ref.width; bx += 8) {
+            uint32_t sum = 0;
+            for (uint32_t y = 0; y < 8; y++)
+                for (uint32_t x = 0; x < 8; x++)
+                    sum += ref.plane[(by + y) * ref.width + bx + x];
+            int32_t mean = (sum + 32) >> 6;
+            for (uint32_t y = 0; y < 8; y++)
+                for (uint32_t x = 0; x < 8; x++)
+                    ref.intraCost += abs(ref.plane[(by + y) * ref.width + bx + x] - mean);
+        }
+    }
+}
+
+static uint64_t interCost(const Reference& a, const Reference& b)
+{
+    uint64_t sad = 0;
+    for (uint32_t i = 0; i < a.plane.size(); i++)
+        sad += abs(a.plane[i] - b.plane[i]);
+    return sad;
+}
+
+static double histogramDiff(const Reference& a, const Reference& b)
+{
+    uint64_t diff = 0, total = 0;
+    for (uint32_t i = 0; i < VaapiLumaFrame::HISTOGRAM_BINS; i++) {
+        diff += abs((int32_t)a.histogram[i] - (int32_t)b.histogram[i]);
+        total += a.histogram[i] + b.histogram[i];
+    }
+    return total ? (double)diff / total : 0;
+}
+
+// sizes which leave a tail after the 16 wide SIMD loops, with and without a wider pitch
+static void testAnalysis()
+{
+    const uint32_t sizes[][3] = {
+        { 32, 32, 32 },
+        { 64, 32, 80 },
+        { 100, 36, 100 },
+        { 196, 70, 256 },
+        { 320, 240, 320 },
+        { 356, 101, 400 },
+    };
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        Luma a(sizes[i][0], sizes[i][1], sizes[i][2]);
+        Luma b(sizes[i][0], sizes[i][1], sizes[i][2]);
+        drawNoise(a);
+        drawNoise(b);
+        Reference refA, refB;
+        analyse(a, refA);
+        analyse(b, refB);
+
+        LumaFramePtr frameA = a.analyse();
+        LumaFramePtr frameB = b.analyse();
+        EXPECT_TRUE(frameA && frameB);
+        if (!frameA || !frameB)
+            continue;
+        EXPECT_EQ(refA.width, frameA->getWidth());
+        EXPECT_EQ(refA.height, frameA->getHeight());
+        EXPECT_EQ(refA.intraCost, frameA->getIntraCost());
+        EXPECT_EQ(refB.intraCost, frameB->getIntraCost());
+        EXPECT_EQ(interCost(refA, refB), frameA->getInterCost(*frameB));
+        EXPECT_EQ(0u, frameA->getInterCost(*frameA));
+        EXPECT_EQ(histogramDiff(refA, refB), frameA->getHistogramDiff(*frameB));
+    }
+
+    //too small to analyse, or frames of another size
+    Luma small(31, 64, 32);
+    EXPECT_TRUE(!small.analyse());
+    EXPECT_TRUE(!VaapiLumaFrame::create(NULL, 64, 64, 64));
+    Luma a(64, 64, 64), b(128, 64, 128);
+    drawNoise(a);
+    drawNoise(b);
+    EXPECT_EQ(0u, a.analyse()->getInterCost(*b.analyse()));
+}
+
+typedef VaapiLookahead<uint32_t> Lookahead;
+
+struct Decisions {
+    std::vector<uint32_t> order;
+    std::vector<bool> sceneCut;
+    std::vector<bool> forceAnchor;
+    std::vector<int32_t> qpOffset;
+
+    void pop(Lookahead& lookahead)
+    {
+        Lookahead::Frame frame;
+        while (lookahead.pop(frame)) {
+            order.push_back(frame.data);
+            sceneCut.push_back(frame.sceneCut);
+            forceAnchor.push_back(frame.forceAnchor);
+            qpOffset.push_back(frame.qpOffset);
+        }
+    }
+};
+
+static void push(Lookahead& lookahead, Decisions& decisions, uint32_t index, const Luma& luma)
+{
+    lookahead.push(index, false, luma.analyse());
+    decisions.pop(lookahead);
+}
+
+// frames come out in order, DEPTH frames late, all of them on drain
+static void testDepth()
+{
+    Lookahead lookahead;
+    lookahead.init(DEPTH);
+    Decisions decisions;
+    Luma luma(WIDTH, HEIGHT, WIDTH);
+    drawScene(luma, 0, 0);
+    for (uint32_t i = 0; i < 10; i++) {
+        push(lookahead, decisions, i, luma);
+        EXPECT_EQ(i < DEPTH ? 0 : i + 1 - DEPTH, (uint32_t)decisions.order.size());
+    }
+    lookahead.drain();
+    decisions.pop(lookahead);
+    EXPECT_EQ(10u, (uint32_t)decisions.order.size());
+    for (uint32_t i = 0; i < decisions.order.size(); i++)
+        EXPECT_EQ(i, decisions.order[i]);
+    EXPECT_EQ(0u, (uint32_t)lookahead.size());
+}
+
+// a slow pan over one scene, then a cut to another one at frame 20
+static void testSceneCut()
+{
+    Lookahead lookahead;
+    lookahead.init(DEPTH);
+    Decisions decisions;
+    Luma luma(WIDTH, HEIGHT, WIDTH);
+    for (uint32_t i = 0; i < 40; i++) {
+        drawScene(luma, i >= 20, i);
+        push(lookahead, decisions, i, luma);
+    }
+    lookahead.drain();
+    decisions.pop(lookahead);
+    EXPECT_EQ(40u, (uint32_t)decisions.sceneCut.size());
+    for (uint32_t i = 0; i < decisions.sceneCut.size(); i++) {
+        EXPECT_EQ(i == 20, decisions.sceneCut[i]);
+        EXPECT_TRUE(!decisions.forceAnchor[i]);
+    }
+}
+
+// a flash, one bright frame between two of the same scene, is not a cut
+static void testFlash()
+{
+    Lookahead lookahead;
+    lookahead.init(DEPTH);
+    Decisions decisions;
+    Luma luma(WIDTH, HEIGHT, WIDTH);
+    for (uint32_t i = 0; i < 20; i++) {
+        drawScene(luma, 0, i, i == 10 ? 80 : 0);
+        push(lookahead, decisions, i, luma);
+    }
+    //with depth 0 the next frame is not known, the flash is taken for a cut
+    Lookahead noDepth;
+    noDepth.init(0);
+    Decisions noDepthDecisions;
+    for (uint32_t i = 0; i < 20; i++) {
+        drawScene(luma, 0, i, i == 10 ? 80 : 0);
+        push(noDepth, noDepthDecisions, i, luma);
+    }
+    lookahead.drain();
+    decisions.pop(lookahead);
+    for (uint32_t i = 0; i < decisions.sceneCut.size(); i++)
+        EXPECT_TRUE(!decisions.sceneCut[i]);
+    EXPECT_EQ(20u, (uint32_t)noDepthDecisions.sceneCut.size());
+    EXPECT_TRUE(noDepthDecisions.sceneCut[10]);
+}
+
+// new content with the same luma histogram, a mirrored frame, is high motion but no cut
+static void testSameHistogram()
+{
+    Lookahead lookahead;
+    lookahead.init(DEPTH);
+    Decisions decisions;
+    Luma luma(WIDTH, HEIGHT, WIDTH);
+    Luma mirrored(WIDTH, HEIGHT, WIDTH);
+    drawScene(luma, 1, 0);
+    for (uint32_t y = 0; y < HEIGHT; y++)
+        for (uint32_t x = 0; x < WIDTH; x++)
+            mirrored.data[y * WIDTH + x] = luma.data[y * WIDTH + WIDTH - 1 - x];
+    for (uint32_t i = 0; i < 10; i++)
+        push(lookahead, decisions, i, i < 5 ? luma : mirrored);
+    lookahead.drain();
+    decisions.pop(lookahead);
+    EXPECT_EQ(10u, (uint32_t)decisions.sceneCut.size());
+    for (uint32_t i = 0; i < decisions.sceneCut.size(); i++) {
+        EXPECT_TRUE(!decisions.sceneCut[i]);
+        EXPECT_EQ(i == 5, decisions.forceAnchor[i]);
+    }
+}
+
+// a fast pan is high motion, it closes the mini GOP but is no cut
+static void testHighMotion()
+{
+    Lookahead lookahead;
+    lookahead.init(DEPTH);
+    Decisions decisions;
+    Luma luma(WIDTH, HEIGHT, WIDTH);
+    for (uint32_t i = 0; i < 20; i++) {
+        drawScene(luma, 1, i * (i >= 10 ? 12 : 1));
+        push(lookahead, decisions, i, luma);
+    }
+    lookahead.drain();
+    decisions.pop(lookahead);
+    for (uint32_t i = 0; i < decisions.sceneCut.size(); i++) {
+        EXPECT_TRUE(!decisions.sceneCut[i]);
+        EXPECT_EQ(i > 10, decisions.forceAnchor[i]);
+    }
+}
+
+// a still frame is referenced well and gets a lower QP, noise gets a higher one
+static void testQpOffset()
+{
+    Lookahead lookahead;
+    lookahead.init(DEPTH);
+    Decisions decisions;
+    Luma luma(WIDTH, HEIGHT, WIDTH);
+    drawScene(luma, 0, 0);
+    for (uint32_t i = 0; i < 10; i++)
+        push(lookahead, decisions, i, luma);
+    for (uint32_t i = 10; i < 20; i++) {
+        drawNoise(luma);
+        push(lookahead, decisions, i, luma);
+    }
+    lookahead.drain();
+    decisions.pop(lookahead);
+    EXPECT_EQ(20u, (uint32_t)decisions.qpOffset.size());
+    EXPECT_EQ(-2, decisions.qpOffset[0]);
+    EXPECT_EQ(1, decisions.qpOffset[12]);
+    //the last frame has nothing after it
+    EXPECT_EQ(0, decisions.qpOffset[19]);
+
+    //frames without luma get no decision and break the chain
+    Lookahead noLuma;
+    noLuma.init(1);
+    Lookahead::Frame frame;
+    noLuma.push(0, true, LumaFramePtr());
+    noLuma.push(1, false, luma.analyse());
+    EXPECT_TRUE(noLuma.pop(frame));
+    EXPECT_TRUE(frame.forceKeyFrame);
+    EXPECT_TRUE(!frame.sceneCut && !frame.forceAnchor);
+    EXPECT_EQ(0, frame.qpOffset);
+}
+
+static uint64_t microseconds()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* analysis time of a 1080p frame and its comparison with the previous one */
+static void benchmark()
+{
+    const uint32_t frames = 200;
+    Luma luma[2] = { Luma(1920, 1080, 1920), Luma(1920, 1080, 1920) };
+    drawScene(luma[0], 0, 0);
+    drawScene(luma[1], 0, 8);
+
+    uint64_t sum = 0;
+    LumaFramePtr prev = luma[1].analyse();
+    uint64_t start = microseconds();
+    for (uint32_t i = 0; i < frames; i++) {
+        LumaFramePtr cur = luma[i & 1].analyse();
+        sum += cur->getInterCost(*prev) + cur->getIntraCost();
+        sum += cur->getHistogramDiff(*prev) > 0.25;
+        prev = cur;
+    }
+    uint64_t time = microseconds() - start;
+    printf("1080p frame analysis: %.3f ms (%u)\n", time / 1000.0 / frames, (uint32_t)(sum & 1));
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && !strcmp(argv[1], "--benchmark")) {
+        benchmark();
+        return 0;
+    }
+    RUN_TEST(testAnalysis);
+    RUN_TEST(testDepth);
+    RUN_TEST(testSceneCut);
+    RUN_TEST(testFlash);
+    RUN_TEST(testSameHistogram);
+    RUN_TEST(testHighMotion);
+    RUN_TEST(testQpOffset);
+    return UNITTEST_RESULT();
+}
@@ -0,0 +1,505 @@
+/*
+ *  vaapiratecontrol.cpp - rate control done on host for encoders running in CQP mode
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "vaapiratecontrol.h"
+
+#include "vaapiencstats.h"
+#include "common/common_def.h"
+#include "common/log.h"
+#include <algorithm>
+#include <deque>
+#include <math.h>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+#define H264_MAX_QP 51
+
+/* QP of I and B pictures relative to P pictures, about the usual 1.4 and 1.3 qscale ratios */
+static const int32_t s_qpOffset[] = {
+    0,  //VAAPI_PICTURE_TYPE_NONE
+    -3, //VAAPI_PICTURE_TYPE_I
+    0,  //VAAPI_PICTURE_TYPE_P
+    2,  //VAAPI_PICTURE_TYPE_B
+};
+
+static double qpToQscale(double qp)
+{
+    return 0.85 * pow(2.0, (qp - 12.0) / 6.0);
+}
+
+static double qscaleToQp(double qscale)
+{
+    return 12.0 + 6.0 * log(qscale / 0.85) / log(2.0);
+}
+
+static uint32_t typeIndex(VaapiPictureType type)
+{
+    return type < N_ELEMENTS(s_qpOffset) ? type : VAAPI_PICTURE_TYPE_P;
+}
+
+// qscale of a picture type relative to P pictures
+static double typeRatio(uint32_t index)
+{
+    return qpToQscale(12 + s_qpOffset[index]) / qpToQscale(12);
+}
+
+static double getFrameRate(const VideoParamsCommon& params)
+{
+    if (params.frameRate.frameRateNum && params.frameRate.frameRateDenom)
+        return (double)params.frameRate.frameRateNum / params.frameRate.frameRateDenom;
+    return 30;
+}
+
+static void getQPRange(const VideoParamsCommon& params, uint32_t& minQP, uint32_t& maxQP)
+{
+    minQP = params.rcParams.minQP;
+    maxQP = params.rcParams.maxQP;
+    if (maxQP > H264_MAX_QP || !maxQP)
+        maxQP = H264_MAX_QP;
+    if (minQP > maxQP)
+        minQP = maxQP;
+}
+
+static uint32_t clampQP(double qp, uint32_t minQP, uint32_t maxQP)
+{
+    if (qp < minQP)
+        return minQP;
+    if (qp > maxQP)
+        return maxQP;
+    return (uint32_t)(qp + 0.5);
+}
+
+/**
+ * the bits of a picture are modeled as complexity / qscale.
+ * 1. complexity is tracked as a decaying average, normalized to P pictures, so one base qscale
+ *    spreads the target bits over the picture types. each type keeps its own average too, to
+ *    predict the size of the next picture of that type.
+ * 2. the base qscale is scaled by how far the coded bits are from the wanted bits, over
+ *    a window of a few seconds.
+ * 3. capped VBR runs a leaky bucket at the peak rate, a picture which would drain it below
+ *    a safety margin gets a higher qscale.
+ */
+class VaapiHostRateControl : public VaapiRateControl
+{
+public:
+    VaapiHostRateControl(const VideoParamsCommon& params);
+
+    virtual uint32_t getQP(VaapiPictureType type);
+    virtual void update(VaapiPictureType type, uint32_t qp, uint32_t bits);
+    virtual void flush();
+    virtual bool reconfigure(const VideoParamsCommon& params);
+
+private:
+    struct Complexity {
+        double sum;
+        double count;
+        Complexity() : sum(0), count(0) {}
+        void add(double cplx, double decay)
+        {
+            sum = sum * decay + cplx;
+            count = count * decay + 1;
+        }
+        double get() const { return sum / count; }
+    };
+
+    struct InFlight {
+        double bits;
+        double fill;
+    };
+
+    uint32_t clampQP(double qp) const
+    {
+        return YamiMediaCodec::clampQP(qp, m_minQP, m_maxQP);
+    }
+    void setRates(const VideoParamsCommon& params);
+
+    VideoRateControl m_mode;
+    double m_bitsPerFrame;
+    double m_decay;
+    double m_window;
+    uint32_t m_initQP;
+    uint32_t m_minQP;
+    uint32_t m_maxQP;
+
+    Complexity m_complexity;
+    Complexity m_typeComplexity[N_ELEMENTS(s_qpOffset)];
+
+    // coded and predicted bits, against what we want for the pictures so far
+    double m_totalBits;
+    double m_wantedBits;
+
+    // leaky bucket for capped VBR, fullness includes the predictions of pictures in flight
+    double m_vbvSize;
+    double m_vbvFill;
+    double m_vbvFullness;
+    std::deque<InFlight> m_inFlight;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiHostRateControl);
+};
+
+VaapiHostRateControl::VaapiHostRateControl(const VideoParamsCommon& params)
+    : m_mode(params.rcMode)
+    , m_initQP(params.rcParams.initQP)
+    , m_totalBits(0)
+    , m_wantedBits(0)
+    , m_vbvSize(0)
+    , m_vbvFill(0)
+    , m_vbvFullness(0)
+{
+    setRates(params);
+    m_vbvFullness = m_vbvSize * 0.9;
+}
+
+void VaapiHostRateControl::setRates(const VideoParamsCommon& params)
+{
+    double fps = getFrameRate(params);
+    double bitRate = params.rcParams.bitRate;
+    if (m_mode == RATE_CONTROL_HOST_CAPPED_VBR) {
+        uint32_t percentage = params.rcParams.targetPercentage;
+        if (!percentage || percentage > 100)
+            percentage = 100;
+        double ms = params.rcParams.windowSize ? params.rcParams.windowSize : 1000;
+        m_vbvSize = bitRate * ms / 1000;
+        m_vbvFill = bitRate / fps;
+        bitRate = bitRate * percentage / 100;
+    }
+    m_bitsPerFrame = bitRate / fps;
+
+    //abr follows the target closely, vbr lets the complexity drive the QP for longer
+    if (m_mode == RATE_CONTROL_HOST_ABR) {
+        m_decay = 0.8;
+        m_window = bitRate * 2;
+    } else {
+        m_decay = 0.95;
+        m_window = bitRate * 10;
+    }
+    getQPRange(params, m_minQP, m_maxQP);
+}
+
+uint32_t VaapiHostRateControl::getQP(VaapiPictureType type)
+{
+    uint32_t index = typeIndex(type);
+    uint32_t qp;
+    InFlight flight;
+
+    if (!m_complexity.count || m_bitsPerFrame <= 0) {
+        qp = clampQP((double)m_initQP + s_qpOffset[index]);
+        flight.bits = m_bitsPerFrame;
+    } else {
+        double base = m_complexity.get() / m_bitsPerFrame;
+        double overflow = 1 + (m_totalBits - m_wantedBits) / m_window;
+        if (overflow < 0.5)
+            overflow = 0.5;
+        if (overflow > 2)
+            overflow = 2;
+        double ratio = typeRatio(index);
+        double qscale = base * ratio * overflow;
+
+        //first picture of this type, assume it is as complex as the average
+        double cplx = m_typeComplexity[index].count ?
+            m_typeComplexity[index].get() : m_complexity.get() * ratio;
+        if (m_vbvSize) {
+            double maxBits = std::min(m_vbvSize, m_vbvFullness + m_vbvFill) - m_vbvSize * 0.1;
+            if (maxBits < m_bitsPerFrame * 0.1)
+                maxBits = m_bitsPerFrame * 0.1;
+            if (cplx / qscale > maxBits)
+                qscale = cplx / maxBits;
+        }
+        qp = clampQP(qscaleToQp(qscale));
+        flight.bits = cplx / qpToQscale(qp);
+    }
+
+    //account for the prediction until update() brings the real size
+    flight.fill = m_vbvFill;
+    if (m_vbvSize)
+        m_vbvFullness = std::min(m_vbvSize, m_vbvFullness + flight.fill) - flight.bits;
+    m_totalBits += flight.bits;
+    m_wantedBits += m_bitsPerFrame;
+    m_inFlight.push_back(flight);
+    DEBUG("host rate control, type %d, qp %d, predicted bits %d", type, qp, (int)flight.bits);
+    return qp;
+}
+
+void VaapiHostRateControl::update(VaapiPictureType type, uint32_t qp, uint32_t bits)
+{
+    uint32_t index = typeIndex(type);
+    double qscale = qpToQscale(qp);
+    double cplx = bits * qscale;
+    double ratio = typeRatio(index);
+    m_complexity.add(cplx / ratio, m_decay);
+    m_typeComplexity[index].add(cplx, m_decay);
+
+    if (m_inFlight.empty()) {
+        //not predicted by getQP(), the picture was encoded before a flush()
+        return;
+    }
+    double predicted = m_inFlight.front().bits;
+    m_inFlight.pop_front();
+    m_totalBits += bits - predicted;
+    if (m_vbvSize) {
+        m_vbvFullness += predicted - bits;
+        if (m_vbvFullness < 0)
+            WARNING("host rate control, vbv underflow by %d bits", (int)-m_vbvFullness);
+    }
+}
+
+bool VaapiHostRateControl::reconfigure(const VideoParamsCommon& params)
+{
+    m_initQP = params.rcParams.initQP;
+    setRates(params);
+    m_vbvFullness = std::min(m_vbvFullness, m_vbvSize);
+    //the new target starts now, only the pictures in flight count against it
+    m_totalBits = 0;
+    for (size_t i = 0; i < m_inFlight.size(); i++)
+        m_totalBits += m_inFlight[i].bits;
+    m_wantedBits = m_bitsPerFrame * m_inFlight.size();
+    return true;
+}
+
+void VaapiHostRateControl::flush()
+{
+    //take back the predictions, the pictures will never be coded
+    while (!m_inFlight.empty()) {
+        const InFlight& flight = m_inFlight.back();
+        m_totalBits -= flight.bits;
+        m_wantedBits -= m_bitsPerFrame;
+        if (m_vbvSize)
+            m_vbvFullness = std::min(m_vbvSize, m_vbvFullness + flight.bits - flight.fill);
+        m_inFlight.pop_back();
+    }
+}
+
+/**
+ * first pass of a two pass encode, each picture type gets a fixed QP and
+ * the outcome of every picture is written to the statistics file.
+ */
+class VaapiFirstPassRateControl : public VaapiRateControl
+{
+public:
+    VaapiFirstPassRateControl(const VideoParamsCommon& params, const EncStatsWriterPtr& writer);
+
+    virtual uint32_t getQP(VaapiPictureType type);
+    virtual void update(VaapiPictureType type, uint32_t qp, uint32_t bits);
+    virtual void flush() {}
+    //the QP is fixed, a new rate changes nothing
+    virtual bool reconfigure(const VideoParamsCommon&) { return true; }
+
+private:
+    EncStatsWriterPtr m_writer;
+    uint32_t m_initQP;
+    uint32_t m_minQP;
+    uint32_t m_maxQP;
+    double m_pixels;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiFirstPassRateControl);
+};
+
+VaapiFirstPassRateControl::VaapiFirstPassRateControl(const VideoParamsCommon& params, const EncStatsWriterPtr& writer)
+    : m_writer(writer)
+    , m_initQP(params.rcParams.initQP)
+    , m_pixels((double)params.resolution.width * params.resolution.height)
+{
+    getQPRange(params, m_minQP, m_maxQP);
+}
+
+uint32_t VaapiFirstPassRateControl::getQP(VaapiPictureType type)
+{
+    return clampQP((double)m_initQP + s_qpOffset[typeIndex(type)], m_minQP, m_maxQP);
+}
+
+void VaapiFirstPassRateControl::update(VaapiPictureType type, uint32_t qp, uint32_t bits)
+{
+    EncStatsRecord record;
+    record.bits = bits;
+    record.complexity = m_pixels ? bits * qpToQscale(qp) / m_pixels : 0;
+    record.type = type;
+    record.qp = qp;
+    record.reserved = 0;
+    m_writer->write(record);
+}
+
+/**
+ * second pass of a two pass encode.
+ * 1. the bits of the clip are spread before the first picture: qscale follows complexity^(1 - QCOMP),
+ *    so complex pictures get more bits but not in proportion, it is what makes two pass beat ABR.
+ * 2. the first pass may run at a lower resolution, complexity is per pixel and scaled up here.
+ * 3. the plan is corrected by how far the coded bits are from the planned bits, like ABR.
+ * 4. pictures past the end of the statistics get the average plan.
+ */
+class VaapiSecondPassRateControl : public VaapiRateControl
+{
+public:
+    static RateControlPtr create(const VideoParamsCommon& params, const EncStatsReaderPtr& reader);
+
+    virtual uint32_t getQP(VaapiPictureType type);
+    virtual void update(VaapiPictureType type, uint32_t qp, uint32_t bits);
+    virtual void flush();
+
+private:
+    VaapiSecondPassRateControl(const VideoParamsCommon& params);
+    void plan(const VaapiEncStatsReader& reader);
+
+    double m_bitsPerFrame;
+    double m_window;
+    double m_pixels;
+    uint32_t m_minQP;
+    uint32_t m_maxQP;
+
+    // per picture in coding order
+    std::vector<double> m_qscale;
+    std::vector<double> m_plannedBits;
+    double m_averageQscale;
+    uint32_t m_index;
+
+    double m_codedBits;
+    double m_plannedCodedBits;
+    std::deque<double> m_inFlight;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiSecondPassRateControl);
+};
+
+#define QCOMP 0.6
+
+RateControlPtr VaapiSecondPassRateControl::create(const VideoParamsCommon& params, const EncStatsReaderPtr& reader)
+{
+    RateControlPtr rateControl;
+    if (!params.rcParams.bitRate) {
+        ERROR("second pass needs a bitrate");
+        return rateControl;
+    }
+    SharedPtr<VaapiSecondPassRateControl> secondPass(new VaapiSecondPassRateControl(params));
+    secondPass->plan(*reader);
+    rateControl = secondPass;
+    return rateControl;
+}
+
+VaapiSecondPassRateControl::VaapiSecondPassRateControl(const VideoParamsCommon& params)
+    : m_bitsPerFrame(params.rcParams.bitRate / getFrameRate(params))
+    , m_window(params.rcParams.bitRate * 2.0)
+    , m_pixels((double)params.resolution.width * params.resolution.height)
+    , m_averageQscale(0)
+    , m_index(0)
+    , m_codedBits(0)
+    , m_plannedCodedBits(0)
+{
+    getQPRange(params, m_minQP, m_maxQP);
+}
+
+void VaapiSecondPassRateControl::plan(const VaapiEncStatsReader& reader)
+{
+    uint32_t count = reader.getCount();
+    std::vector<double> complexity(count);
+    double sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        complexity[i] = reader.getRecord(i).complexity * m_pixels;
+        sum += complexity[i];
+    }
+    //a skipped picture costs nearly nothing, don't let it have a zero qscale
+    double floor = sum / count * 0.01;
+    double weights = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        complexity[i] = std::max(complexity[i], floor);
+        weights += pow(complexity[i], QCOMP) / typeRatio(typeIndex((VaapiPictureType)reader.getRecord(i).type));
+    }
+
+    //qscale[i] = k * complexity[i]^(1 - QCOMP) * ratio, with k chosen to spend exactly the target
+    double k = weights / (m_bitsPerFrame * count);
+    m_qscale.resize(count);
+    m_plannedBits.resize(count);
+    double qscaleSum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        double ratio = typeRatio(typeIndex((VaapiPictureType)reader.getRecord(i).type));
+        m_qscale[i] = k * pow(complexity[i], 1 - QCOMP) * ratio;
+        m_plannedBits[i] = complexity[i] / m_qscale[i];
+        qscaleSum += m_qscale[i];
+    }
+    m_averageQscale = qscaleSum / count;
+    INFO("second pass, %d pictures, average qp %.1f", count, qscaleToQp(m_averageQscale));
+}
+
+uint32_t VaapiSecondPassRateControl::getQP(VaapiPictureType type)
+{
+    double qscale = m_averageQscale;
+    double planned = m_bitsPerFrame;
+    if (m_index < m_qscale.size()) {
+        qscale = m_qscale[m_index];
+        planned = m_plannedBits[m_index];
+    }
+    m_index++;
+
+    double overflow = 1 + (m_codedBits - m_plannedCodedBits) / m_window;
+    if (overflow < 0.5)
+        overflow = 0.5;
+    if (overflow > 2)
+        overflow = 2;
+    uint32_t qp = clampQP(qscaleToQp(qscale * overflow), m_minQP, m_maxQP);
+    m_inFlight.push_back(planned);
+    DEBUG("second pass, type %d, qp %d, planned bits %d", type, qp, (int)planned);
+    return qp;
+}
+
+void VaapiSecondPassRateControl::update(VaapiPictureType type, uint32_t qp, uint32_t bits)
+{
+    if (m_inFlight.empty())
+        return;
+    m_plannedCodedBits += m_inFlight.front();
+    m_inFlight.pop_front();
+    m_codedBits += bits;
+}
+
+void VaapiSecondPassRateControl::flush()
+{
+    //the dropped pictures used up their plans, whatever comes next takes the following ones
+    m_inFlight.clear();
+}
+
+bool VaapiRateControl::isHostMode(VideoRateControl mode)
+{
+    return mode == RATE_CONTROL_HOST_ABR
+        || mode == RATE_CONTROL_HOST_VBR
+        || mode == RATE_CONTROL_HOST_CAPPED_VBR
+        || mode == RATE_CONTROL_HOST_FIRST_PASS
+        || mode == RATE_CONTROL_HOST_SECOND_PASS;
+}
+
+RateControlPtr VaapiRateControl::create(const VideoParamsCommon& params, const char* statsFile)
+{
+    RateControlPtr rateControl;
+    if (params.rcMode == RATE_CONTROL_HOST_FIRST_PASS) {
+        EncStatsWriterPtr writer = VaapiEncStatsWriter::create(statsFile,
+            params.resolution.width, params.resolution.height,
+            params.frameRate.frameRateNum, params.frameRate.frameRateDenom);
+        if (writer)
+            rateControl.reset(new VaapiFirstPassRateControl(params, writer));
+    } else if (params.rcMode == RATE_CONTROL_HOST_SECOND_PASS) {
+        EncStatsReaderPtr reader = VaapiEncStatsReader::create(statsFile);
+        if (reader)
+            rateControl = VaapiSecondPassRateControl::create(params, reader);
+    } else if (isHostMode(params.rcMode))
+        rateControl.reset(new VaapiHostRateControl(params));
+    return rateControl;
+}
+
+} //namespace YamiMediaCodec
@@ -0,0 +1,63 @@
+/*
+ *  vaapiratecontrol.h - rate control done on host for encoders running in CQP mode
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapiratecontrol_h
+#define vaapiratecontrol_h
+
+#include "interface/VideoEncoderDefs.h"
+#include "vaapi/vaapiptrs.h"
+#include "vaapi/vaapipicturetypes.h"
+
+namespace YamiMediaCodec{
+
+/**
+ * \class VaapiRateControl
+ * \brief picks the QP of each picture, for rate control modes the driver does not do.
+ * <pre>
+ * 1. getQP() is called in coding order before a picture is encoded, update() is called with
+ *    the coded size of the same pictures in the same order, once they are done.
+ *    pictures in between are in flight, their sizes are predicted.
+ * 2. the QPs depend on the calls only, the same input gives the same QPs.
+ * 3. it is not thread safe, the caller serializes the calls.
+ *</pre>
+ */
+class VaapiRateControl
+{
+public:
+    /// create a controller for params.rcMode, NULL if the mode is not a host mode.
+    /// the two pass modes need @statsFile
+    static RateControlPtr create(const VideoParamsCommon& params, const char* statsFile);
+    static bool isHostMode(VideoRateControl mode);
+
+    virtual ~VaapiRateControl() {}
+    /// QP of next picture in coding order, H.264 scale
+    virtual uint32_t getQP(VaapiPictureType type) = 0;
+    /// the oldest picture in flight was coded to @bits bits with @qp
+    virtual void update(VaapiPictureType type, uint32_t qp, uint32_t bits) = 0;
+    /// the pictures in flight are dropped
+    virtual void flush() = 0;
+    /// bitRate or frameRate in @params changed on the fly, false if the mode can't follow
+    virtual bool reconfigure(const VideoParamsCommon& params) { return false; }
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapiratecontrol_h
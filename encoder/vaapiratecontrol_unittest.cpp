@@ -0,0 +1,348 @@
+/*
+ *  vaapiratecontrol_unittest.cpp - host side tests of the host rate control, on a simulated encoder
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/unittest.h"
+#include "vaapiratecontrol.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <deque>
+#include <vector>
+
+using namespace YamiMediaCodec;
+
+#define FPS 30
+#define GOP_SIZE 30
+// pictures the simulated encoder has in flight, their sizes come back this late
+#define PIPELINE_DEPTH 4
+
+/**
+ * the simulated encoder codes a picture to complexity / qscale bits, the model the
+ * controller assumes. complexity depends on the picture type, changes with each scene
+ * and has some noise, so the controller has something to follow.
+ */
+class SimulatedEncoder
+{
+public:
+    SimulatedEncoder(uint32_t bFrames)
+        : m_bFrames(bFrames)
+        , m_index(0)
+        , m_seed(1)
+    {
+    }
+
+    VaapiPictureType nextType()
+    {
+        uint32_t position = m_index % GOP_SIZE;
+        if (!position)
+            return VAAPI_PICTURE_TYPE_I;
+        return (position % (m_bFrames + 1)) ? VAAPI_PICTURE_TYPE_B : VAAPI_PICTURE_TYPE_P;
+    }
+
+    uint32_t encode(VaapiPictureType type, uint32_t qp)
+    {
+        static const double typeComplexity[] = { 0, 600000, 200000, 100000 };
+        //a new scene every 150 pictures, from easy to 3 times harder
+        double scene = 1 + (m_index / 150) % 3;
+        double noise = 0.8 + 0.4 * random();
+        double qscale = 0.85 * pow(2.0, (qp - 12.0) / 6.0);
+        m_index++;
+        return (uint32_t)(typeComplexity[type] * scene * noise / qscale);
+    }
+
+private:
+    // deterministic, in [0, 1)
+    double random()
+    {
+        m_seed = m_seed * 1103515245 + 12345;
+        return ((m_seed >> 16) & 0x7fff) / 32768.0;
+    }
+
+    uint32_t m_bFrames;
+    uint32_t m_index;
+    uint32_t m_seed;
+};
+
+struct Result {
+    std::vector<uint32_t> qps;
+    std::vector<uint32_t> bits;
+
+    double averageBitRate(size_t begin, size_t end) const
+    {
+        double sum = 0;
+        for (size_t i = begin; i < end; i++)
+            sum += bits[i];
+        return sum * FPS / (end - begin);
+    }
+};
+
+static void initParams(VideoParamsCommon& params, VideoRateControl mode, uint32_t bitRate)
+{
+    memset(&params, 0, sizeof(params));
+    params.size = sizeof(params);
+    params.rcMode = mode;
+    params.frameRate.frameRateNum = FPS;
+    params.frameRate.frameRateDenom = 1;
+    params.resolution.width = 1280;
+    params.resolution.height = 720;
+    params.rcParams.bitRate = bitRate;
+    params.rcParams.initQP = 26;
+    params.rcParams.minQP = 1;
+    params.rcParams.maxQP = 51;
+}
+
+// @newParams, if not NULL, is applied by reconfigure() at picture @changeAt
+static void run(const RateControlPtr& rateControl, uint32_t count, uint32_t bFrames, Result& result,
+                const VideoParamsCommon* newParams = NULL, uint32_t changeAt = 0)
+{
+    SimulatedEncoder encoder(bFrames);
+    std::deque<std::pair<VaapiPictureType, uint32_t> > inFlight;
+    for (uint32_t i = 0; i < count; i++) {
+        if (newParams && i == changeAt)
+            EXPECT_TRUE(rateControl->reconfigure(*newParams));
+        VaapiPictureType type = encoder.nextType();
+        uint32_t qp = rateControl->getQP(type);
+        result.qps.push_back(qp);
+        result.bits.push_back(encoder.encode(type, qp));
+        inFlight.push_back(std::make_pair(type, qp));
+        if (inFlight.size() > PIPELINE_DEPTH) {
+            rateControl->update(inFlight.front().first, inFlight.front().second, result.bits[i - PIPELINE_DEPTH]);
+            inFlight.pop_front();
+        }
+    }
+}
+
+static bool near(double expected, double actual, double tolerance)
+{
+    return fabs(actual - expected) <= expected * tolerance;
+}
+
+static void testCreate()
+{
+    VideoParamsCommon params;
+    initParams(params, RATE_CONTROL_CQP, 1000000);
+    EXPECT_TRUE(!VaapiRateControl::create(params, NULL));
+    initParams(params, RATE_CONTROL_CBR, 1000000);
+    EXPECT_TRUE(!VaapiRateControl::create(params, NULL));
+    EXPECT_TRUE(!VaapiRateControl::isHostMode(RATE_CONTROL_CBR));
+
+    initParams(params, RATE_CONTROL_HOST_ABR, 1000000);
+    EXPECT_TRUE(VaapiRateControl::isHostMode(params.rcMode));
+    EXPECT_TRUE(bool(VaapiRateControl::create(params, NULL)));
+}
+
+static void testAbrFollowsTarget()
+{
+    const uint32_t bitRate = 1000000;
+    VideoParamsCommon params;
+    initParams(params, RATE_CONTROL_HOST_ABR, bitRate);
+    RateControlPtr rateControl = VaapiRateControl::create(params, NULL);
+    Result result;
+    run(rateControl, FPS * 30, 0, result);
+
+    //the whole clip, and the last scene once the controller has settled on it
+    EXPECT_TRUE(near(bitRate, result.averageBitRate(0, result.bits.size()), 0.05));
+    EXPECT_TRUE(near(bitRate, result.averageBitRate(FPS * 25, FPS * 30), 0.15));
+    //I pictures get a lower QP than the P pictures around them
+    EXPECT_TRUE(result.qps[GOP_SIZE * 10] < result.qps[GOP_SIZE * 10 + 1]);
+}
+
+static void testAbrWithBFrames()
+{
+    const uint32_t bitRate = 2000000;
+    VideoParamsCommon params;
+    initParams(params, RATE_CONTROL_HOST_ABR, bitRate);
+    RateControlPtr rateControl = VaapiRateControl::create(params, NULL);
+    Result result;
+    run(rateControl, FPS * 30, 2, result);
+
+    EXPECT_TRUE(near(bitRate, result.averageBitRate(0, result.bits.size()), 0.1));
+    //B pictures get a higher QP than the P picture before them
+    EXPECT_TRUE(result.qps[GOP_SIZE * 10 + 3] < result.qps[GOP_SIZE * 10 + 4]);
+}
+
+static void testVbrFollowsTarget()
+{
+    const uint32_t bitRate = 1000000;
+    VideoParamsCommon params;
+    initParams(params, RATE_CONTROL_HOST_VBR, bitRate);
+    RateControlPtr rateControl = VaapiRateControl::create(params, NULL);
+    Result result;
+    run(rateControl, FPS * 60, 0, result);
+
+    //the window is longer than ABR's, the average is looser but still there
+    EXPECT_TRUE(near(bitRate, result.averageBitRate(0, result.bits.size()), 0.2));
+}
+
+static void testCappedVbrKeepsPeak()
+{
+    const uint32_t peak = 2000000;
+    VideoParamsCommon params;
+    initParams(params, RATE_CONTROL_HOST_CAPPED_VBR, peak);
+    params.rcParams.targetPercentage = 50;
+    params.rcParams.windowSize = 1000;
+    RateControlPtr rateControl = VaapiRateControl::create(params, NULL);
+    Result result;
+    run(rateControl, FPS * 30, 0, result);
+
+    EXPECT_TRUE(near(peak / 2, result.averageBitRate(0, result.bits.size()), 0.15));
+
+    //no second of the clip goes over the peak rate by more than the noise of one picture
+    for (size_t i = 0; i + FPS <= result.bits.size(); i += FPS)
+        EXPECT_TRUE(result.averageBitRate(i, i + FPS) < peak * 1.1);
+}
+
+static void testQpRange()
+{
+    VideoParamsCommon params;
+    initParams(params, RATE_CONTROL_HOST_ABR, 10000);
+    params.rcParams.minQP = 20;
+    params.rcParams.maxQP = 40;
+    RateControlPtr rateControl = VaapiRateControl::create(params, NULL);
+    Result result;
+    run(rateControl, FPS * 5, 0, result);
+    for (size_t i = 0; i < result.qps.size(); i++) {
+        EXPECT_TRUE(result.qps[i] >= 20);
+        EXPECT_TRUE(result.qps[i] <= 40);
+    }
+    //far too few bits for the content, it ends up at maxQP
+    EXPECT_EQ(40u, result.qps.back());
+
+    //QP 0 is a valid pick
+    initParams(params, RATE_CONTROL_HOST_ABR, 100000000);
+    params.rcParams.minQP = 0;
+    rateControl = VaapiRateControl::create(params, NULL);
+    Result lossless;
+    run(rateControl, FPS * 5, 0, lossless);
+    EXPECT_EQ(0u, lossless.qps.back());
+}
+
+static void testReconfigure()
+{
+    VideoParamsCommon params;
+    initParams(params, RATE_CONTROL_HOST_ABR, 2000000);
+    RateControlPtr rateControl = VaapiRateControl::create(params, NULL);
+    VideoParamsCommon newParams = params;
+    newParams.rcParams.bitRate = 1000000;
+    Result result;
+    run(rateControl, FPS * 30, 0, result, &newParams, FPS * 15);
+
+    EXPECT_TRUE(near(2000000, result.averageBitRate(0, FPS * 15), 0.15));
+    EXPECT_TRUE(near(1000000, result.averageBitRate(FPS * 20, FPS * 30), 0.15));
+}
+
+static void testDeterministic()
+{
+    VideoParamsCommon params;
+    initParams(params, RATE_CONTROL_HOST_CAPPED_VBR, 1500000);
+    params.rcParams.targetPercentage = 80;
+    Result first, second;
+    run(VaapiRateControl::create(params, NULL), FPS * 10, 2, first);
+    run(VaapiRateControl::create(params, NULL), FPS * 10, 2, second);
+    EXPECT_TRUE(first.qps == second.qps);
+}
+
+static void testFlush()
+{
+    const uint32_t bitRate = 1000000;
+    VideoParamsCommon params;
+    initParams(params, RATE_CONTROL_HOST_ABR, bitRate);
+    RateControlPtr rateControl = VaapiRateControl::create(params, NULL);
+    Result result;
+    run(rateControl, FPS * 10, 0, result);
+    //the pictures in flight are dropped, sizes of pictures coded before the flush may still come
+    rateControl->flush();
+    rateControl->update(VAAPI_PICTURE_TYPE_P, result.qps.back(), result.bits.back());
+
+    Result after;
+    run(rateControl, FPS * 20, 0, after);
+    EXPECT_TRUE(near(bitRate, after.averageBitRate(0, after.bits.size()), 0.1));
+}
+
+// the first pass writes what each picture cost, the second spreads the clip's bits by it
+static void testTwoPass()
+{
+    const uint32_t bitRate = 1000000;
+    char path[] = "/tmp/vaapiratecontrol_unittest_XXXXXX";
+    int fd = mkstemp(path);
+    EXPECT_TRUE(fd >= 0);
+    if (fd < 0)
+        return;
+    close(fd);
+
+    VideoParamsCommon params;
+    initParams(params, RATE_CONTROL_HOST_FIRST_PASS, 0);
+    EXPECT_TRUE(!VaapiRateControl::create(params, NULL));
+    RateControlPtr rateControl = VaapiRateControl::create(params, path);
+    EXPECT_TRUE(bool(rateControl));
+    if (!rateControl) {
+        unlink(path);
+        return;
+    }
+    Result first;
+    run(rateControl, FPS * 30, 0, first);
+    //the statistics header is completed when the controller goes
+    rateControl.reset();
+    //a fixed QP per picture type
+    for (size_t i = 1; i < first.qps.size(); i++)
+        EXPECT_EQ(first.qps[i % GOP_SIZE ? 1 : 0], first.qps[i]);
+    EXPECT_TRUE(first.qps[0] < first.qps[1]);
+
+    initParams(params, RATE_CONTROL_HOST_SECOND_PASS, 0);
+    EXPECT_TRUE(!VaapiRateControl::create(params, path));
+    params.rcParams.bitRate = bitRate;
+    EXPECT_TRUE(!VaapiRateControl::create(params, "/nonexistent/statistics"));
+    rateControl = VaapiRateControl::create(params, path);
+    EXPECT_TRUE(bool(rateControl));
+    if (!rateControl) {
+        unlink(path);
+        return;
+    }
+    Result second;
+    run(rateControl, FPS * 30, 0, second);
+    unlink(path);
+
+    //the plan spends the whole clip's bits, with little left to correct
+    EXPECT_TRUE(near(bitRate, second.averageBitRate(0, second.bits.size()), 0.03));
+    //the hardest scene gets more bits, about (3 / 1)^0.6 times those of the easiest one, ABR would give both the same.
+    //the planned QPs are known from the first picture on, no scene needs to settle first
+    double hard = second.averageBitRate(300, 450);
+    double easy = second.averageBitRate(450, 600);
+    EXPECT_TRUE(hard > easy * 1.6 && hard < easy * 2.3);
+    EXPECT_TRUE(second.qps[300 + 1] > second.qps[450 + 1]);
+    EXPECT_TRUE(near(bitRate, second.averageBitRate(0, 450), 0.1));
+}
+
+int main()
+{
+    RUN_TEST(testCreate);
+    RUN_TEST(testAbrFollowsTarget);
+    RUN_TEST(testAbrWithBFrames);
+    RUN_TEST(testVbrFollowsTarget);
+    RUN_TEST(testCappedVbrKeepsPeak);
+    RUN_TEST(testQpRange);
+    RUN_TEST(testReconfigure);
+    RUN_TEST(testDeterministic);
+    RUN_TEST(testFlush);
+    RUN_TEST(testTwoPass);
+    return UNITTEST_RESULT();
+}
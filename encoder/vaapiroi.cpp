@@ -0,0 +1,284 @@
+/*
+ *  vaapiroi.cpp - per macroblock QP deltas and static region detection for encoders
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "vaapiroi.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// ROI_C_ONLY leaves the SSE2 SAD out, the unit test uses it to check the C one
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(ROI_C_ONLY)
+#define ROI_X86 1
+#include <emmintrin.h>
+#endif
+
+namespace YamiMediaCodec{
+
+#define MB_SIZE 16
+#define MAX_QP_DELTA 51
+// SAD of a static macroblock, 1 per pixel leaves room for capture noise
+#define STATIC_MB_SAD (MB_SIZE * MB_SIZE)
+
+VaapiRoiMap::VaapiRoiMap(uint32_t mbWidth, uint32_t mbHeight)
+    : m_mbWidth(mbWidth)
+    , m_mbHeight(mbHeight)
+    , m_map(mbWidth * mbHeight, 0)
+{
+}
+
+int8_t VaapiRoiMap::clamp(int32_t qpDelta)
+{
+    if (qpDelta > MAX_QP_DELTA)
+        return MAX_QP_DELTA;
+    if (qpDelta < -MAX_QP_DELTA)
+        return -MAX_QP_DELTA;
+    return qpDelta;
+}
+
+void VaapiRoiMap::setRect(const VideoRect& rect, int32_t qpDelta)
+{
+    int32_t left = rect.x > 0 ? rect.x : 0;
+    int32_t top = rect.y > 0 ? rect.y : 0;
+    int64_t right = (int64_t)rect.x + rect.width;
+    int64_t bottom = (int64_t)rect.y + rect.height;
+    if (right <= left || bottom <= top)
+        return;
+    uint32_t x0 = left / MB_SIZE;
+    uint32_t y0 = top / MB_SIZE;
+    uint32_t x1 = (right + MB_SIZE - 1) / MB_SIZE;
+    uint32_t y1 = (bottom + MB_SIZE - 1) / MB_SIZE;
+    if (x1 > m_mbWidth)
+        x1 = m_mbWidth;
+    if (y1 > m_mbHeight)
+        y1 = m_mbHeight;
+    for (uint32_t y = y0; y < y1; y++) {
+        for (uint32_t x = x0; x < x1; x++)
+            set(x, y, qpDelta);
+    }
+}
+
+void VaapiRoiMap::setMap(const int8_t* map, uint32_t pitch)
+{
+    for (uint32_t y = 0; y < m_mbHeight; y++) {
+        for (uint32_t x = 0; x < m_mbWidth; x++)
+            set(x, y, map[y * pitch + x]);
+    }
+}
+
+bool VaapiRoiMap::isEmpty() const
+{
+    for (size_t i = 0; i < m_map.size(); i++) {
+        if (m_map[i])
+            return false;
+    }
+    return true;
+}
+
+// runs of the same delta in each row, merged with the same run of the row above.
+// @scale is the size of a @map entry in macroblocks
+static void mapToRegions(const std::vector<int8_t>& map, uint32_t width, uint32_t height,
+                         uint32_t scale, uint32_t mbWidth, uint32_t mbHeight,
+                         std::vector<VaapiRoiMap::Region>& regions)
+{
+    regions.clear();
+    //regions ending on the row above
+    std::vector<size_t> open, next;
+    for (uint32_t y = 0; y < height; y++) {
+        next.clear();
+        uint32_t x = 0;
+        while (x < width) {
+            int8_t delta = map[y * width + x];
+            uint32_t end = x + 1;
+            while (end < width && map[y * width + end] == delta)
+                end++;
+            if (delta) {
+                VaapiRoiMap::Region r;
+                r.x = x * scale;
+                r.y = y * scale;
+                r.width = (end * scale > mbWidth ? mbWidth : end * scale) - r.x;
+                r.height = ((y + 1) * scale > mbHeight ? mbHeight : (y + 1) * scale) - r.y;
+                r.qpDelta = delta;
+                size_t i;
+                for (i = 0; i < open.size(); i++) {
+                    VaapiRoiMap::Region& above = regions[open[i]];
+                    if (above.x == r.x && above.width == r.width && above.qpDelta == delta)
+                        break;
+                }
+                if (i < open.size()) {
+                    regions[open[i]].height += r.height;
+                    next.push_back(open[i]);
+                } else {
+                    next.push_back(regions.size());
+                    regions.push_back(r);
+                }
+            }
+            x = end;
+        }
+        open.swap(next);
+    }
+}
+
+void VaapiRoiMap::getRegions(std::vector<Region>& regions, uint32_t maxRegions) const
+{
+    std::vector<int8_t> map(m_map);
+    uint32_t width = m_mbWidth;
+    uint32_t height = m_mbHeight;
+    uint32_t scale = 1;
+    while (true) {
+        mapToRegions(map, width, height, scale, m_mbWidth, m_mbHeight, regions);
+        if (regions.size() <= maxRegions)
+            return;
+        if (width == 1 && height == 1) {
+            regions.clear();
+            return;
+        }
+        uint32_t w = (width + 1) / 2;
+        uint32_t h = (height + 1) / 2;
+        std::vector<int8_t> coarse(w * h);
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                int8_t delta = MAX_QP_DELTA;
+                for (uint32_t j = y * 2; j < y * 2 + 2 && j < height; j++) {
+                    for (uint32_t i = x * 2; i < x * 2 + 2 && i < width; i++) {
+                        if (map[j * width + i] < delta)
+                            delta = map[j * width + i];
+                    }
+                }
+                coarse[y * w + x] = delta;
+            }
+        }
+        map.swap(coarse);
+        width = w;
+        height = h;
+        scale *= 2;
+    }
+}
+
+// SAD of a 16 pixels wide macroblock
+static uint32_t mbSad_c(const uint8_t* a, uint32_t pitchA, const uint8_t* b, uint32_t pitchB, uint32_t rows)
+{
+    uint32_t sad = 0;
+    for (uint32_t y = 0; y < rows; y++) {
+        for (uint32_t x = 0; x < MB_SIZE; x++)
+            sad += abs(a[y * pitchA + x] - b[y * pitchB + x]);
+    }
+    return sad;
+}
+
+#ifdef ROI_X86
+__attribute__ ((target ("sse2")))
+static uint32_t mbSad_sse2(const uint8_t* a, uint32_t pitchA, const uint8_t* b, uint32_t pitchB, uint32_t rows)
+{
+    __m128i sum = _mm_setzero_si128();
+    for (uint32_t y = 0; y < rows; y++) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + y * pitchA));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + y * pitchB));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+    }
+    return _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+}
+#endif //ROI_X86
+
+typedef uint32_t (*MbSadFunc)(const uint8_t* a, uint32_t pitchA, const uint8_t* b, uint32_t pitchB, uint32_t rows);
+
+static MbSadFunc selectMbSad()
+{
+#ifdef ROI_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        return mbSad_sse2;
+#endif
+    return mbSad_c;
+}
+
+// selected once, on first use
+static MbSadFunc getMbSad()
+{
+    static const MbSadFunc mbSad = selectMbSad();
+    return mbSad;
+}
+
+// SAD of the partial macroblocks on the right edge
+static uint32_t edgeSad(const uint8_t* a, uint32_t pitchA, const uint8_t* b, uint32_t pitchB,
+                        uint32_t columns, uint32_t rows)
+{
+    uint32_t sad = 0;
+    for (uint32_t y = 0; y < rows; y++) {
+        for (uint32_t x = 0; x < columns; x++)
+            sad += abs(a[y * pitchA + x] - b[y * pitchB + x]);
+    }
+    return sad;
+}
+
+VaapiStaticRegionDetector::VaapiStaticRegionDetector()
+    : m_width(0)
+    , m_height(0)
+{
+}
+
+void VaapiStaticRegionDetector::reset()
+{
+    m_width = 0;
+    m_height = 0;
+    m_prev.clear();
+}
+
+void VaapiStaticRegionDetector::detect(const uint8_t* luma, uint32_t pitch, uint32_t width, uint32_t height,
+                                       int32_t qpDelta, VaapiRoiMap& map)
+{
+    if (!luma)
+        return;
+    if (width != m_width || height != m_height) {
+        m_width = width;
+        m_height = height;
+        m_prev.assign(width * height, 0);
+    } else if (qpDelta) {
+        MbSadFunc mbSad = getMbSad();
+        uint32_t mbWidth = map.getMbWidth();
+        uint32_t mbHeight = map.getMbHeight();
+        for (uint32_t mbY = 0; mbY < mbHeight && mbY * MB_SIZE < height; mbY++) {
+            uint32_t rows = height - mbY * MB_SIZE;
+            if (rows > MB_SIZE)
+                rows = MB_SIZE;
+            for (uint32_t mbX = 0; mbX < mbWidth && mbX * MB_SIZE < width; mbX++) {
+                if (map.get(mbX, mbY))
+                    continue;
+                const uint8_t* cur = luma + mbY * MB_SIZE * pitch + mbX * MB_SIZE;
+                const uint8_t* prev = &m_prev[mbY * MB_SIZE * width + mbX * MB_SIZE];
+                uint32_t columns = width - mbX * MB_SIZE;
+                uint32_t sad;
+                if (columns >= MB_SIZE)
+                    sad = mbSad(cur, pitch, prev, width, rows);
+                else
+                    sad = edgeSad(cur, pitch, prev, width, columns, rows);
+                if (sad <= STATIC_MB_SAD)
+                    map.set(mbX, mbY, qpDelta);
+            }
+        }
+    }
+    for (uint32_t y = 0; y < height; y++)
+        memcpy(&m_prev[y * width], luma + y * pitch, width);
+}
+
+} //namespace YamiMediaCodec
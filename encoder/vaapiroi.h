@@ -0,0 +1,113 @@
+/*
+ *  vaapiroi.h - per macroblock QP deltas and static region detection for encoders
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef vaapiroi_h
+#define vaapiroi_h
+
+#include "common/common_def.h"
+#include "interface/VideoCommonDefs.h"
+#include <stdint.h>
+#include <vector>
+
+namespace YamiMediaCodec{
+
+class VaapiRoiMap;
+typedef SharedPtr<VaapiRoiMap> RoiMapPtr;
+
+/**
+ * \class VaapiRoiMap
+ * \brief QP delta of each macroblock of a picture, turned to the few rectangles a driver takes.
+ * <pre>
+ * 1. the caller turns the regions to VAEncMiscParameterBufferROI.
+ * 2. regions do not overlap. macroblocks with delta 0 are not in any region.
+ * 3. when the map needs more regions than the driver takes, it is coarsened by 2x2 groups,
+ *    each group gets the lowest delta in it, until the regions fit.
+ *    so a macroblock never gets a higher QP than it asked for.
+ *</pre>
+ */
+class VaapiRoiMap
+{
+public:
+    struct Region {
+        //in macroblocks
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+        uint32_t height;
+        int8_t qpDelta;
+    };
+
+    VaapiRoiMap(uint32_t mbWidth, uint32_t mbHeight);
+
+    uint32_t getMbWidth() const { return m_mbWidth; }
+    uint32_t getMbHeight() const { return m_mbHeight; }
+    int8_t get(uint32_t mbX, uint32_t mbY) const { return m_map[mbY * m_mbWidth + mbX]; }
+    void set(uint32_t mbX, uint32_t mbY, int32_t qpDelta) { m_map[mbY * m_mbWidth + mbX] = clamp(qpDelta); }
+
+    /// the macroblocks @rect (in pixels) touches get @qpDelta
+    void setRect(const VideoRect& rect, int32_t qpDelta);
+    /// one delta per macroblock in raster order, @pitch bytes apart for each macroblock row
+    void setMap(const int8_t* map, uint32_t pitch);
+    bool isEmpty() const;
+
+    /// at most @maxRegions regions covering the macroblocks with a delta
+    void getRegions(std::vector<Region>& regions, uint32_t maxRegions) const;
+
+private:
+    static int8_t clamp(int32_t qpDelta);
+
+    uint32_t m_mbWidth;
+    uint32_t m_mbHeight;
+    std::vector<int8_t> m_map;
+};
+
+/**
+ * \class VaapiStaticRegionDetector
+ * \brief finds the macroblocks whose luma did not change since the previous frame,
+ * so screen content and fixed cameras spend bits only where the picture moves.
+ * <pre>
+ * 1. it keeps a copy of the luma of the previous frame, a frame of another size starts over.
+ * 2. a macroblock is static when its SAD against the previous frame is within noise.
+ *    SSE2 is used when the CPU has it, the C code gives the same result.
+ *</pre>
+ */
+class VaapiStaticRegionDetector
+{
+public:
+    VaapiStaticRegionDetector();
+
+    /// static macroblocks of @luma get @qpDelta in @map, unless they have a delta already
+    void detect(const uint8_t* luma, uint32_t pitch, uint32_t width, uint32_t height,
+                int32_t qpDelta, VaapiRoiMap& map);
+    void reset();
+
+private:
+    uint32_t m_width;
+    uint32_t m_height;
+    //luma of the previous frame, pitch is m_width
+    std::vector<uint8_t> m_prev;
+
+    DISALLOW_COPY_AND_ASSIGN(VaapiStaticRegionDetector);
+};
+
+} //namespace YamiMediaCodec
+
+#endif //vaapiroi_h
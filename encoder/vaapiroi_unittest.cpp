@@ -0,0 +1,310 @@
+/*
+ *  vaapiroi_unittest.cpp - host side tests of the ROI map and the static region detector
+ *
+ *  Copyright (C) 2015 Intel Corporation
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "common/unittest.h"
+#include "vaapiroi.h"
+#include <stdlib.h>
+#include <vector>
+
+using namespace YamiMediaCodec;
+
+typedef VaapiRoiMap::Region Region;
+
+static uint32_t seed = 1;
+
+/* deterministic, so a failure can be reproduced */
+static uint32_t randomNumber(uint32_t range)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % range;
+}
+
+static VideoRect makeRect(int32_t x, int32_t y, uint32_t width, uint32_t height)
+{
+    VideoRect rect;
+    rect.x = x;
+    rect.y = y;
+    rect.width = width;
+    rect.height = height;
+    return rect;
+}
+
+static bool isRegion(const Region& r, uint32_t x, uint32_t y, uint32_t width, uint32_t height, int8_t qpDelta)
+{
+    return r.x == x && r.y == y && r.width == width && r.height == height && r.qpDelta == qpDelta;
+}
+
+static void expectMap(const VaapiRoiMap& map, const int8_t* expected)
+{
+    for (uint32_t y = 0; y < map.getMbHeight(); y++) {
+        for (uint32_t x = 0; x < map.getMbWidth(); x++)
+            EXPECT_EQ(expected[y * map.getMbWidth() + x], map.get(x, y));
+    }
+}
+
+/* a rectangle covers every macroblock it touches, and nothing outside the picture */
+static void testRect()
+{
+    VaapiRoiMap map(4, 3);
+    EXPECT_TRUE(map.isEmpty());
+
+    //pixels 17..32 x 15..16 touch macroblocks 1..2 x 0..1
+    map.setRect(makeRect(17, 15, 16, 2), -3);
+    const int8_t rounded[] = {
+        0, -3, -3, 0,
+        0, -3, -3, 0,
+        0, 0, 0, 0,
+    };
+    expectMap(map, rounded);
+
+    //clipped to the picture, and it replaces the delta set before
+    map.setRect(makeRect(-10, -10, 1000, 20), 5);
+    const int8_t clipped[] = {
+        5, 5, 5, 5,
+        0, -3, -3, 0,
+        0, 0, 0, 0,
+    };
+    expectMap(map, clipped);
+
+    //empty or fully outside, nothing changes
+    map.setRect(makeRect(8, 8, 0, 16), 1);
+    map.setRect(makeRect(-100, 0, 50, 16), 1);
+    map.setRect(makeRect(0, -100, 16, 100), 1);
+    expectMap(map, clipped);
+
+    //deltas are clamped to what the QP range allows
+    map.setRect(makeRect(48, 32, 16, 16), 100);
+    map.setRect(makeRect(0, 32, 1, 1), -100);
+    EXPECT_EQ(51, map.get(3, 2));
+    EXPECT_EQ(-51, map.get(0, 2));
+}
+
+/* a map with a pitch, a rectangle over it, then the regions of both */
+static void testMapAndRect()
+{
+    const int8_t deltas[] = {
+        2, 2, 0, 0, 9, 9,
+        2, 2, 0, -1, 9, 9,
+    };
+    VaapiRoiMap map(4, 2);
+    map.setMap(deltas, 6);
+    map.setRect(makeRect(48, 0, 16, 16), -4);
+    EXPECT_TRUE(!map.isEmpty());
+
+    std::vector<Region> regions;
+    map.getRegions(regions, 8);
+    EXPECT_EQ(3u, regions.size());
+    if (regions.size() != 3)
+        return;
+    EXPECT_TRUE(isRegion(regions[0], 0, 0, 2, 2, 2));
+    EXPECT_TRUE(isRegion(regions[1], 3, 0, 1, 1, -4));
+    EXPECT_TRUE(isRegion(regions[2], 3, 1, 1, 1, -1));
+
+    //a map of zeros has no region
+    const int8_t zeros[12] = { 0 };
+    map.setMap(zeros, 6);
+    EXPECT_TRUE(map.isEmpty());
+    map.getRegions(regions, 8);
+    EXPECT_TRUE(regions.empty());
+}
+
+/* too many regions, 2x2 groups get the lowest delta in them until they fit */
+static void testCoarsen()
+{
+    const int8_t deltas[] = {
+        3, 5, 0, 2,
+        4, 6, 1, 1,
+        -2, 0, 9, 9,
+        0, 0, 9, 9,
+    };
+    VaapiRoiMap map(4, 4);
+    map.setMap(deltas, 4);
+
+    std::vector<Region> regions;
+    map.getRegions(regions, 16);
+    EXPECT_EQ(8u, regions.size());
+
+    //the top right group has a 0, so it drops out
+    map.getRegions(regions, 3);
+    EXPECT_EQ(3u, regions.size());
+    if (regions.size() == 3) {
+        EXPECT_TRUE(isRegion(regions[0], 0, 0, 2, 2, 3));
+        EXPECT_TRUE(isRegion(regions[1], 0, 2, 2, 2, -2));
+        EXPECT_TRUE(isRegion(regions[2], 2, 2, 2, 2, 9));
+    }
+
+    map.getRegions(regions, 1);
+    EXPECT_EQ(1u, regions.size());
+    if (regions.size() == 1)
+        EXPECT_TRUE(isRegion(regions[0], 0, 0, 4, 4, -2));
+
+    //nothing fits in no region
+    map.getRegions(regions, 0);
+    EXPECT_TRUE(regions.empty());
+
+    //an odd size, the coarse regions are clipped to the picture
+    const int8_t odd[] = {
+        5, 0, 5,
+        5, 5, 5,
+        5, 5, -1,
+    };
+    VaapiRoiMap oddMap(3, 3);
+    oddMap.setMap(odd, 3);
+    oddMap.getRegions(regions, 3);
+    EXPECT_EQ(3u, regions.size());
+    if (regions.size() == 3) {
+        EXPECT_TRUE(isRegion(regions[0], 2, 0, 1, 2, 5));
+        EXPECT_TRUE(isRegion(regions[1], 0, 2, 2, 1, 5));
+        EXPECT_TRUE(isRegion(regions[2], 2, 2, 1, 1, -1));
+    }
+    oddMap.getRegions(regions, 1);
+    EXPECT_EQ(1u, regions.size());
+    if (regions.size() == 1)
+        EXPECT_TRUE(isRegion(regions[0], 0, 0, 3, 3, -1));
+}
+
+struct Luma {
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    std::vector<uint8_t> data;
+
+    Luma(uint32_t w, uint32_t h, uint32_t p)
+        : width(w), height(h), pitch(p), data(p * h) {}
+
+    uint8_t& at(uint32_t x, uint32_t y) { return data[y * pitch + x]; }
+
+    /* adds @value to the @width x @height pixels at @x, @y */
+    void add(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t value)
+    {
+        for (uint32_t j = y; j < y + h; j++) {
+            for (uint32_t i = x; i < x + w; i++)
+                at(i, j) += value;
+        }
+    }
+};
+
+static void fill(Luma& luma, uint32_t range)
+{
+    for (uint32_t i = 0; i < luma.data.size(); i++)
+        luma.data[i] = randomNumber(range);
+}
+
+/* a 40x40 picture, the right and bottom macroblocks are 8 pixels wide or high */
+static void testEdgeMacroblocks()
+{
+    Luma prev(40, 40, 48);
+    fill(prev, 200);
+    Luma cur(prev);
+    //the padding right of the picture is not looked at
+    for (uint32_t y = 0; y < cur.height; y++) {
+        for (uint32_t x = cur.width; x < cur.pitch; x++)
+            cur.at(x, y) = randomNumber(256);
+    }
+    //a SAD of 256 is static, 257 is not
+    cur.add(0, 0, 16, 16, 1);
+    cur.add(16, 0, 16, 16, 1);
+    cur.at(16, 0)++;
+    cur.add(32, 0, 8, 16, 2);
+    cur.add(32, 16, 8, 16, 2);
+    cur.at(39, 31)++;
+    cur.add(0, 32, 16, 8, 2);
+    cur.at(15, 39)++;
+    cur.add(16, 32, 16, 8, 3);
+    cur.add(32, 32, 8, 8, 4);
+
+    VaapiStaticRegionDetector detector;
+    VaapiRoiMap map(3, 3);
+    //the first frame has nothing to compare with
+    detector.detect(&prev.data[0], prev.pitch, prev.width, prev.height, 4, map);
+    EXPECT_TRUE(map.isEmpty());
+
+    //a static macroblock with a delta keeps it
+    map.set(1, 1, 7);
+    detector.detect(&cur.data[0], cur.pitch, cur.width, cur.height, 4, map);
+    const int8_t expected[] = {
+        4, 0, 4,
+        4, 7, 0,
+        0, 0, 4,
+    };
+    expectMap(map, expected);
+
+    //no delta to set, or a frame of another size, leaves the map alone
+    VaapiRoiMap untouched(3, 3);
+    detector.detect(&cur.data[0], cur.pitch, cur.width, cur.height, 0, untouched);
+    EXPECT_TRUE(untouched.isEmpty());
+    detector.detect(&cur.data[0], cur.pitch, 32, 32, 4, untouched);
+    EXPECT_TRUE(untouched.isEmpty());
+}
+
+/* the SAD written out plainly */
+static uint32_t sad(const Luma& a, const Luma& b, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    uint32_t sum = 0;
+    for (uint32_t j = y; j < y + h; j++) {
+        for (uint32_t i = x; i < x + w; i++)
+            sum += abs(a.data[j * a.pitch + i] - b.data[j * b.pitch + i]);
+    }
+    return sum;
+}
+
+/* random changes around the static threshold, the SAD in use has to agree with the plain one */
+static void testSad()
+{
+    const uint32_t mbWidth = 8;
+    const uint32_t mbHeight = 4;
+    for (uint32_t round = 0; round < 16; round++) {
+        Luma prev(mbWidth * 16, mbHeight * 16, mbWidth * 16 + 16);
+        //big values in the last rounds, so no sum of the kernel may overflow a byte or a word
+        fill(prev, round < 12 ? 240 : 256);
+        Luma cur(prev);
+        for (uint32_t mbY = 0; mbY < mbHeight; mbY++) {
+            for (uint32_t mbX = 0; mbX < mbWidth; mbX++) {
+                uint32_t changes = round < 12 ? 240 + randomNumber(32) : randomNumber(256 * 64);
+                for (uint32_t i = 0; i < changes; i++) {
+                    uint8_t& pixel = cur.at(mbX * 16 + randomNumber(16), mbY * 16 + randomNumber(16));
+                    pixel = round < 12 ? pixel + 1 : randomNumber(256);
+                }
+            }
+        }
+
+        VaapiStaticRegionDetector detector;
+        VaapiRoiMap map(mbWidth, mbHeight);
+        detector.detect(&prev.data[0], prev.pitch, prev.width, prev.height, 1, map);
+        detector.detect(&cur.data[0], cur.pitch, cur.width, cur.height, 1, map);
+        for (uint32_t mbY = 0; mbY < mbHeight; mbY++) {
+            for (uint32_t mbX = 0; mbX < mbWidth; mbX++) {
+                bool still = sad(prev, cur, mbX * 16, mbY * 16, 16, 16) <= 256;
+                EXPECT_EQ(still, map.get(mbX, mbY) == 1);
+            }
+        }
+    }
+}
+
+int main()
+{
+    RUN_TEST(testRect);
+    RUN_TEST(testMapAndRect);
+    RUN_TEST(testCoarsen);
+    RUN_TEST(testEdgeMacroblocks);
+    RUN_TEST(testSad);
+    return UNITTEST_RESULT();
+}
@@ -39,6 +39,7 @@ typedef struct {
 
 typedef enum {
     PACKED_FRAME_TYPE,
+    NAL_UNIT_TABLE_TYPE,
 } VIDEO_EXTENSION_TYPE;
 
 typedef struct {
@@ -46,6 +47,13 @@ typedef struct {
     int32_t offSet;
 }PackedFrameData;
 
+// extData of NAL_UNIT_TABLE_TYPE is an array of NalUnitSpan, one for each nal unit in
+// VideoDecodeBuffer.data. offset is where the nal unit header is, a start code precedes it.
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+}NalUnitSpan;
+
 // flags for VideoDecodeBuffer, VideoConfigBuffer and VideoRenderBuffer
 typedef enum {
     // indicates if sample has discontinuity in time stamp (happen after seeking usually)
@@ -61,6 +69,8 @@ typedef enum {
     HAS_VA_PROFILE = 0x08,
 
     // indicate whether output order will be the same as decoder order
+    // a picture is output as soon as it is decoded. for a stream which reorders, e.g. h264 with
+    // B frames, the pictures are output in decoding order, not in display order.
     WANT_LOW_DELAY = 0x10,      // make display order same as decoding order
 
     // indicates whether error concealment algorithm should be enabled to automatically conceal error.
@@ -99,6 +109,14 @@ typedef enum {
     // the input data is in avcC format (not byte stream)  for h264
     IS_AVCC = IS_NAL_UNIT << 1, // 0x20000
 
+    // the input data is a byte stream for h264 and ext is a NAL_UNIT_TABLE_TYPE locating its nal units
+    HAS_NAL_UNIT_TABLE = IS_AVCC << 1, // 0x40000
+
+    // parse on a decoder thread and submit to the driver on another one. decode() queues a copy of the buffer,
+    // it returns DECODE_NO_SURFACE when the queue is full and errors of earlier buffers.
+    // a nal unit table is copied too, a buffer with any other ext waits for the queue and is decoded in place.
+    WANT_PIPELINED_DECODE = HAS_NAL_UNIT_TABLE << 1, // 0x80000
+
 } VIDEO_BUFFER_FLAG;
 
 typedef struct {
@@ -109,6 +127,23 @@ typedef struct {
     VideoExtensionBuffer *ext;
 }VideoDecodeBuffer;
 
+// pictures the decoder does not decode, see IVideoDecoder::setSkipPolicy()
+typedef enum {
+    // decode every picture
+    SKIP_NONE = 0,
+    // skip the pictures no other picture refers to, usually the non-reference B pictures
+    SKIP_NON_REFERENCE,
+    // decode only the key pictures, IDR and I pictures for h264, key frames for vp8 and vp9
+    SKIP_NON_KEY,
+    // decode only the first key picture of each interval, for thumbnails and trick play
+    SKIP_KEY_INTERVAL,
+} VIDEO_SKIP_MODE;
+
+typedef struct {
+    uint32_t mode;              // VIDEO_SKIP_MODE
+    int64_t interval;           // for SKIP_KEY_INTERVAL, in the unit of VideoDecodeBuffer.timeStamp
+}VideoSkipPolicy;
+
 
 #define MAX_GRAPHIC_BUFFER_NUM  (16 + 1 + 11)   // max DPB + 1 + AVC_EXTRA_NUM
 
@@ -136,6 +171,9 @@ typedef struct {
     uint32_t rotationDegrees;
 
     void *parser_handle;
+    /// output surfaces the client holds at once, 0 for the default of 5. the decoder allocates the
+    /// surfaces the stream needs plus these, and waits for one to come back when all are in use
+    uint32_t renderDepth;
 }VideoConfigBuffer;
 
 typedef struct {
@@ -139,6 +139,14 @@ public:
     virtual Decode_Status  getClientNativeWindowBuffer(void *bufferHeader, void *nativeBufferHandle) = 0;
     /// not interest for now, may be used by Android to accept external video frame memory from gralloc
     virtual Decode_Status flagNativeBuffer(void * pBuffer) = 0;
+
+    /** \brief set which pictures are not decoded, when the client falls behind or only needs key pictures.
+    * skipped pictures are not output. when it goes back from a key picture mode, the other pictures
+    * are decoded again from the next key picture. it can be called between two #decode.
+    * it is the last virtual so the vtable of the older methods is unchanged, and the default decodes
+    * every picture so decoders written against the older interface still build.
+    */
+    virtual void setSkipPolicy(const VideoSkipPolicy* policy) {}
 };
 }
 #endif                          /* VIDEO_DECODER_INTERFACE_H_ */
@@ -61,9 +61,9 @@ typedef enum {
     OUTPUT_EVERYTHING = 0,      //Output whatever driver generates
     OUTPUT_CODEC_DATA = 1,      // codec data for mp4, similar to avcc format
     OUTPUT_FRAME_DATA = 2,      //Equal to OUTPUT_EVERYTHING when no header along with the frame data
-    OUTPUT_ONE_NAL = 4,
-    OUTPUT_ONE_NAL_WITHOUT_STARTCODE = 8,
-    OUTPUT_LENGTH_PREFIXED = 16,
+    OUTPUT_ONE_NAL = 4,         //one NAL unit per getOutput call, ENCODE_BUFFERFLAG_PARTIALFRAME is set until the last one
+    OUTPUT_ONE_NAL_WITHOUT_STARTCODE = 8,   //same as OUTPUT_ONE_NAL, without the start code
+    OUTPUT_LENGTH_PREFIXED = 16,    //frame data with 4 bytes length before each NAL unit, matches avcC codec data
     OUTPUT_BUFFER_LAST
 }VideoOutputFormat;
 
@@ -84,6 +84,12 @@ typedef enum {
     RATE_CONTROL_VBR = VA_RC_VBR,
     RATE_CONTROL_VCM = VA_RC_VCM,
     RATE_CONTROL_CQP = VA_RC_CQP,
+    //QP picked by yami for each frame, the driver runs in CQP mode. H.264 only, VP8 and JPEG reject them
+    RATE_CONTROL_HOST_ABR = 0x10000,    //average bitRate over about 2 seconds
+    RATE_CONTROL_HOST_VBR,              //average bitRate over about 10 seconds, QP follows the frame complexity
+    RATE_CONTROL_HOST_CAPPED_VBR,       //average bitRate * targetPercentage / 100, peak bitRate over windowSize ms
+    RATE_CONTROL_HOST_FIRST_PASS,       //fixed QP per picture type, statistics written to the VideoParamsStatsFile path
+    RATE_CONTROL_HOST_SECOND_PASS,      //average bitRate over the whole clip, spread by the statistics in the VideoParamsStatsFile path
     RATE_CONTROL_LAST
 }VideoRateControl;
 
@@ -139,6 +145,9 @@ typedef enum {
 #define ENCODE_BUFFERFLAG_DATACORRUPT      0x00000010
 #define ENCODE_BUFFERFLAG_DATAINVALID      0x00000020
 #define ENCODE_BUFFERFLAG_SLICEOVERFOLOW   0x00000040
+#define ENCODE_BUFFERFLAG_LONGTERMREF      0x00000080   //the frame is the long term reference, until the next one
+#define ENCODE_BUFFERFLAG_TEMPORALID_MASK  0x00000300   //temporal layer of the frame, 0 for the base layer
+#define ENCODE_BUFFERFLAG_TEMPORALID_SHIFT 8
 
 typedef struct VideoEncOutputBuffer {
     uint8_t *data;
@@ -155,6 +164,23 @@ typedef struct VideoEncOutputBuffer {
 #endif
 }VideoEncOutputBuffer;
 
+typedef struct VideoCodedSegment {
+    const uint8_t *data;
+    uint32_t size;
+}VideoCodedSegment;
+
+/*
+ * one frame of encoded data as a scatter-gather list,
+ * the segments point into the mapped coded buffer and stay valid until the frame is released
+ */
+typedef struct VideoCodedFrame {
+    const VideoCodedSegment *segments;
+    uint32_t numSegments;
+    uint32_t dataSize;          //total size of all segments
+    uint32_t flag;              //Key frame, Codec Data etc
+    uint64_t timeStamp;
+}VideoCodedFrame;
+
 #ifdef __BUILD_GET_MV__
     /*
     * VideoEncMVBuffer is defined to store Motion vector.
@@ -323,6 +349,25 @@ typedef enum {
     //format related
     VideoConfigTypeAVCStreamFormat,
 
+    //next frame references the long term reference only, to recover from a loss. no config struct
+    VideoConfigTypeLTRRecovery,
+    //QP deltas of the next frame passed to encode(), VideoConfigROI
+    VideoConfigTypeROI,
+    //statistics file of the two pass rate control modes, VideoParamsStatsFile, set before start()
+    VideoParamsTypeStatsFile,
+    //B frames of the H.264 encoder, VideoParamsBFrames
+    VideoParamsTypeBFrames,
+    //frames analysed ahead of encoding, VideoParamsLookahead
+    VideoParamsTypeLookahead,
+    //frames in flight in the encoder, VideoParamsPipeline
+    VideoParamsTypePipeline,
+    //direction of the VIDEO_ENC_CIR refresh of the H.264 encoder, VideoParamsIntraRefresh
+    VideoParamsTypeIntraRefresh,
+    //temporal layers and long term references of the H.264 encoder, VideoParamsTemporalLayers
+    VideoParamsTypeTemporalLayers,
+    //QP delta of the macroblocks which did not change, VideoParamsStaticQp
+    VideoParamsTypeStaticQp,
+
     VideoParamsConfigExtension
 }VideoParamConfigType;
 
@@ -352,7 +397,7 @@ typedef struct VideoParamsAVC {
     uint32_t size;
     uint32_t basicUnitSize;     //for rate control
     uint8_t VUIFlag;
-    int32_t maxSliceSize;
+    int32_t maxSliceSize;       //in bytes, 0 for no limit. the driver cuts slices on macroblock rows to honour it
     uint32_t idrInterval;
     SliceNum sliceNum;
     AVCDelimiterType delimiterType;
@@ -395,6 +440,44 @@ typedef struct VideoParamsStoreMetaDataInBuffers {
     bool isEnabled;
 }VideoParamsStoreMetaDataInBuffers;
 
+typedef struct VideoParamsStatsFile {
+    uint32_t size;
+    const char* path;           //copied by setParameters(), the file is opened by start()
+}VideoParamsStatsFile;
+
+typedef struct VideoParamsBFrames {
+    uint32_t size;
+    uint32_t ipPeriod;          //distance between I/P frames, the ipPeriod - 1 frames in between are B frames
+    bool enableBPyramid;        //B frames in the middle of a mini GOP are used as reference
+}VideoParamsBFrames;
+
+typedef struct VideoParamsLookahead {
+    uint32_t size;
+    uint32_t lookaheadDepth;    //frames analysed ahead of encoding for scene cuts, anchors and QP, 0 to disable
+}VideoParamsLookahead;
+
+typedef struct VideoParamsPipeline {
+    uint32_t size;
+    uint32_t pipelineDepth;     //max frames in flight before encode() returns ENCODE_IS_BUSY, 0 for the default
+}VideoParamsPipeline;
+
+typedef struct VideoParamsIntraRefresh {
+    uint32_t size;
+    bool refreshByRow;          //VIDEO_ENC_CIR sweeps macroblock rows instead of columns, in cyclicFrameInterval frames
+}VideoParamsIntraRefresh;
+
+typedef struct VideoParamsTemporalLayers {
+    uint32_t size;
+    uint32_t temporalLayers;    //1 to 3, layers above the base layer can be dropped from the stream, no B frames if more than 1
+    uint32_t ltrPeriod;         //a base layer frame is kept as long term reference every ltrPeriod frames, 0 to disable
+}VideoParamsTemporalLayers;
+
+typedef struct VideoParamsStaticQp {
+    uint32_t size;
+    int32_t staticQpDelta;      //added to the QP of macroblocks which did not change since the previous frame, 0 to disable.
+                                //only for frames in system memory
+}VideoParamsStaticQp;
+
 typedef struct VideoConfigFrameRate {
     uint32_t size;
     VideoFrameRate frameRate;
@@ -446,6 +529,26 @@ typedef struct VideoConfigAVCStreamFormat {
     AVCStreamFormat streamFormat;
 } VideoConfigAVCStreamFormat;
 
+#define MAX_ROI_REGIONS 16
+
+typedef struct VideoROIRegion {
+    VideoRect rect;             //in pixels, rounded out to macroblocks
+    int32_t qpDelta;            //added to the QP of the frame, negative for better quality
+} VideoROIRegion;
+
+/*
+ * only for the next frame, the encoder copies everything.
+ * the driver takes a few rectangles, a map which needs more is coarsened,
+ * the macroblocks keep the lowest delta around them
+ */
+typedef struct VideoConfigROI {
+    uint32_t size;
+    uint32_t numRegions;
+    VideoROIRegion regions[MAX_ROI_REGIONS];    //later regions override earlier ones where they overlap
+    const int8_t* qpDeltaMap;   //one delta per macroblock in raster order, applied before the regions. NULL for none
+    uint32_t qpDeltaMapPitch;   //bytes between 2 macroblock rows of qpDeltaMap
+} VideoConfigROI;
+
 typedef struct {
     uint32_t total_frames;
     uint32_t skipped_frames;
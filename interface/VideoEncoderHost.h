@@ -36,6 +36,12 @@ YamiMediaCodec::IVideoEncoder *createVideoEncoder(const char *mimeType);
  * \brief destroy encoder
 */
 void releaseVideoEncoder(YamiMediaCodec::IVideoEncoder * p);
+/** \fn IVideoEncoder *createChunkedVideoEncoder(const char *mimeType, uint32_t instances, uint32_t chunkFrames)
+ * \brief create encoder for offline encoding, it encodes chunks of @chunkFrames frames
+ * on @instances encoders in parallel, each chunk is a closed GOP. h264 only.
+ * destroy it with releaseVideoEncoder()
+*/
+YamiMediaCodec::IVideoEncoder *createChunkedVideoEncoder(const char *mimeType, uint32_t instances, uint32_t chunkFrames);
 
 typedef YamiMediaCodec::IVideoEncoder *(*YamiCreateVideoEncoderFuncPtr) (const char *mimeType);
 typedef void (*YamiReleaseVideoEncoderFuncPtr)(YamiMediaCodec::IVideoEncoder * p);
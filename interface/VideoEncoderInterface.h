@@ -45,21 +45,26 @@ class IVideoEncoder {
     virtual Encode_Status stop(void) = 0;
 
     /// continue encoding with new data in @param[in] inBuffer
+    /// an inBuffer without data and size marks the end of stream, the frames held back for B frames are encoded
     virtual Encode_Status encode(VideoEncRawBuffer * inBuffer) = 0;
     /// continue encoding with new data in @param[in] frame
     virtual Encode_Status encode(VideoFrameRawData* frame) = 0;
 
     /// continue encoding with new data in @param[in] frame
     /// we will hold a reference of @param[in]frame, until encode is done
+    /// a null frame marks the end of stream
     virtual Encode_Status encode(const SharedPtr<VideoFrame>& frame) = 0;
 
 #ifndef __BUILD_GET_MV__
     /**
      * \brief return one frame encoded data to client;
-     * when withWait is false, ENCODE_BUFFER_NO_MORE will be returned if there is no available frame. \n
-     * when withWait is true, function call is block until there is one frame available. \n
+     * when withWait is false, ENCODE_BUFFER_NO_MORE will be returned if there is no available frame,
+     * or the oldest frame is still being encoded by the hardware; it never blocks. \n
+     * when withWait is true, function call is block until there is one frame available. it returns
+     * ENCODE_BUFFER_NO_MORE when the last frame is out after end of stream, or on flush() and stop(). \n
      * typically, getOutput() is called in a separate thread (than encoding thread), this thread sleeps when
-     * there is no output available when withWait is true. \n
+     * there is no output available when withWait is true. a single thread can drive many encoders
+     * by polling them with withWait false. \n
      *
      * param [in/out] outBuffer a #VideoEncOutputBuffer of one frame encoded data
      * param [in/out] when there is no output data available, wait or not
@@ -68,10 +73,13 @@ class IVideoEncoder {
 #else
     /**
      * \brief return one frame encoded data to client;
-     * when withWait is false, ENCODE_BUFFER_NO_MORE will be returned if there is no available frame. \n
-     * when withWait is true, function call is block until there is one frame available. \n
+     * when withWait is false, ENCODE_BUFFER_NO_MORE will be returned if there is no available frame,
+     * or the oldest frame is still being encoded by the hardware; it never blocks. \n
+     * when withWait is true, function call is block until there is one frame available. it returns
+     * ENCODE_BUFFER_NO_MORE when the last frame is out after end of stream, or on flush() and stop(). \n
      * typically, getOutput() is called in a separate thread (than encoding thread), this thread sleeps when
-     * there is no output available when withWait is true. \n
+     * there is no output available when withWait is true. a single thread can drive many encoders
+     * by polling them with withWait false. \n
      *
      * param [in/out] outBuffer a #VideoEncOutputBuffer of one frame encoded data
      * param [in/out] MVBuffer  a #VideoEncMVBuffer of one frame MV data
@@ -99,11 +107,27 @@ class IVideoEncoder {
 
     ///obsolete, discard cached data (input data or encoded video frames), not sure why an encoder need this
     virtual void flush(void) = 0;
-    ///obsolete, what is the difference between  getParameters and getConfig?
+    /// get the current value of a config set by setConfig()
     virtual Encode_Status getConfig(VideoParamConfigType type, Yami_PTR videoEncConfig) = 0;
-    ///obsolete, what is the difference between  setParameters and setConfig?
+    /// change encoding on the fly, from any thread. it applies from the next frame passed to encode(). \n
+    /// VideoConfigTypeBitRate/VideoConfigTypeFrameRate: rate control is reset, SPS updates at next I frame. \n
+    /// VideoConfigTypeIDRRequest: next frame is an IDR, videoEncConfig is not used. \n
+    /// VideoConfigTypeResolution: held back frames are encoded at old resolution, next frame is an IDR.
+    /// they are encoded by the next encode() call, on its thread, before it takes the new frame.
     virtual Encode_Status setConfig(VideoParamConfigType type, Yami_PTR videoEncConfig) = 0;
 
+    /**
+     * \brief zero copy version of getOutput, return one frame encoded data as OUTPUT_EVERYTHING does,
+     * but without copying it: @param[out] frame is a scatter-gather list of the mapped coded buffer. \n
+     * withWait works as in the getOutput above. \n
+     * the coded buffer is not reused until @param[out] frame is released, so release it soon. \n
+     * it is the last virtual so the vtable of the older methods is unchanged, and the default returns
+     * ENCODE_NOT_SUPPORTED so encoders written against the older interface still build.
+     */
+    virtual Encode_Status getOutput(SharedPtr<VideoCodedFrame>& frame, bool withWait = false)
+    {
+        return ENCODE_NOT_SUPPORTED;
+    }
 };
 }
 #endif                          /* VIDEO_ENCODER_INTERFACE_H_ */
@@ -28,6 +28,9 @@
 #include <stdlib.h>
 #include "decodeinput.h"
 #include "common/log.h"
+#include "codecparsers/nalscanner.h"
+#include "codecparsers/h264ausplitter.h"
+#include <vector>
 
 #ifdef __ENABLE_AVFORMAT__
 #include "decodeinputavformat.h"
@@ -48,6 +51,7 @@ public:
 protected:
     FILE *m_fp;
     uint8_t *m_buffer;
+    uint32_t m_bufferSize; // CacheBufferSize, or more once a unit did not fit in it
     bool m_readToEOS;
     bool m_parseToEOS;
 };
@@ -73,7 +77,8 @@ public:
     ~DecodeInputRaw();
     bool init();
     bool ensureBufferData();
-    int32_t scanForStartCode(const uint8_t * data, uint32_t offset, uint32_t size);
+    bool readMoreData();
+    virtual int32_t scanForStartCode(const uint8_t * data, uint32_t offset, uint32_t size);
     bool getNextDecodeUnit(VideoDecodeBuffer &inputBuffer);
     virtual bool isSyncWord(const uint8_t* buf) = 0;
 
@@ -89,7 +94,13 @@ public:
     DecodeInputH264();
     ~DecodeInputH264();
     const char * getMimeType();
+    int32_t scanForStartCode(const uint8_t * data, uint32_t offset, uint32_t size);
+    bool getNextDecodeUnit(VideoDecodeBuffer &inputBuffer);
     bool isSyncWord(const uint8_t* buf);
+private:
+    H264AuSplitter* m_splitter;
+    std::vector<NalUnitSpan> m_nalTable;
+    VideoExtensionBuffer m_nalTableExt;
 };
 
 class DecodeInputJPEG:public DecodeInputRaw
@@ -149,6 +160,7 @@ DecodeInput* DecodeInput::create(const char* fileName)
 MyDecodeInput::MyDecodeInput()
     : m_fp(NULL)
     , m_buffer(NULL)
+    , m_bufferSize(0)
     , m_readToEOS(false)
     , m_parseToEOS(false)
 {
@@ -172,6 +184,9 @@ bool MyDecodeInput::initInput(const char* fileName)
     }
 
     m_buffer = static_cast<uint8_t*>(malloc(CacheBufferSize));
+    if (!m_buffer)
+        return false;
+    m_bufferSize = CacheBufferSize;
     return init();
 }
 
@@ -280,14 +295,46 @@ bool DecodeInputRaw::ensureBufferData()
         return true;
 
     // move unused data to the begining of m_buffer
-    if (m_availableData + MaxNaluSize >= CacheBufferSize) {
-        memcpy(m_buffer, m_buffer+m_lastReadOffset, m_availableData-m_lastReadOffset);
+    if (m_availableData + MaxNaluSize >= m_bufferSize) {
+        memmove(m_buffer, m_buffer+m_lastReadOffset, m_availableData-m_lastReadOffset);
         m_availableData = m_availableData-m_lastReadOffset;
         m_lastReadOffset = 0;
     }
 
-    readCount = fread(m_buffer + m_availableData, 1, CacheBufferSize-m_availableData, m_fp);
-    if (readCount < CacheBufferSize-m_availableData)
+    readCount = fread(m_buffer + m_availableData, 1, m_bufferSize-m_availableData, m_fp);
+    if (readCount < m_bufferSize-m_availableData)
+        m_readToEOS = true;
+
+    m_availableData += readCount;
+    return true;
+}
+
+// read data beyond MaxNaluSize, for units bigger than that.
+// the cache is doubled when the unit fills it, false means no data can be added
+bool DecodeInputRaw::readMoreData()
+{
+    int readCount = 0;
+
+    if (m_readToEOS)
+        return false;
+
+    if (m_lastReadOffset) {
+        memmove(m_buffer, m_buffer+m_lastReadOffset, m_availableData-m_lastReadOffset);
+        m_availableData = m_availableData-m_lastReadOffset;
+        m_lastReadOffset = 0;
+    }
+    if (m_availableData == m_bufferSize) {
+        uint8_t* buffer = static_cast<uint8_t*>(realloc(m_buffer, m_bufferSize * 2));
+        if (!buffer) {
+            ERROR("fail to grow the input cache to %d bytes", m_bufferSize * 2);
+            return false;
+        }
+        m_buffer = buffer;
+        m_bufferSize *= 2;
+    }
+
+    readCount = fread(m_buffer + m_availableData, 1, m_bufferSize-m_availableData, m_fp);
+    if (readCount < m_bufferSize-m_availableData)
         m_readToEOS = true;
 
     m_availableData += readCount;
@@ -345,11 +392,15 @@ bool DecodeInputRaw::getNextDecodeUnit(VideoDecodeBuffer &inputBuffer)
 DecodeInputH264::DecodeInputH264()
 {
     StartCodeSize = 3;
+    m_splitter = h264_au_splitter_new();
+    m_nalTableExt.extType = NAL_UNIT_TABLE_TYPE;
+    m_nalTableExt.extSize = 0;
+    m_nalTableExt.extData = NULL;
 }
 
 DecodeInputH264::~DecodeInputH264()
 {
-
+    h264_au_splitter_free(m_splitter);
 }
 
 const char *DecodeInputH264::getMimeType()
@@ -357,6 +408,62 @@ const char *DecodeInputH264::getMimeType()
     return YAMI_MIME_H264;
 }
 
+int32_t DecodeInputH264::scanForStartCode(const uint8_t * data,
+                 uint32_t offset, uint32_t size)
+{
+    if (offset + StartCodeSize > size)
+        return -1;
+    return nal_scanner_find_start_code(data + offset, size - offset);
+}
+
+// hands one access unit at a time, with its nal units located
+bool DecodeInputH264::getNextDecodeUnit(VideoDecodeBuffer &inputBuffer)
+{
+    uint32_t auOffset, auSize;
+    bool eos;
+
+    if (!m_splitter)
+        return DecodeInputRaw::getNextDecodeUnit(inputBuffer);
+    if (m_parseToEOS)
+        return false;
+
+    ensureBufferData();
+    eos = m_readToEOS;
+    while (!h264_au_splitter_split(m_splitter, m_buffer + m_lastReadOffset,
+                                   m_availableData - m_lastReadOffset, eos,
+                                   &auOffset, &auSize)) {
+        if (eos) {
+            m_parseToEOS = true;
+            return false;
+        }
+        // the cache grows for an access unit bigger than it, give up rather than cut the unit
+        if (!readMoreData() && !m_readToEOS) {
+            m_parseToEOS = true;
+            return false;
+        }
+        eos = m_readToEOS;
+    }
+
+    m_nalTable.resize(m_splitter->n_nalus);
+    for (uint32_t i = 0; i < m_splitter->n_nalus; i++) {
+        m_nalTable[i].offset = m_splitter->nalus[i].offset;
+        m_nalTable[i].size = m_splitter->nalus[i].size;
+    }
+    m_nalTableExt.extSize = m_nalTable.size() * sizeof(NalUnitSpan);
+    m_nalTableExt.extData = m_nalTable.empty() ? NULL : (uint8_t*)&m_nalTable[0];
+
+    inputBuffer.data = m_buffer + m_lastReadOffset + auOffset;
+    inputBuffer.size = auSize;
+    inputBuffer.flag = HAS_COMPLETE_FRAME | HAS_NAL_UNIT_TABLE;
+    inputBuffer.ext = &m_nalTableExt;
+
+    DEBUG("access unit data=%p, size=%d, %d nal units\n", inputBuffer.data, inputBuffer.size, (int)m_nalTable.size());
+    m_lastReadOffset += auOffset + auSize;
+    if (m_readToEOS && m_lastReadOffset == m_availableData)
+        m_parseToEOS = true;
+    return true;
+}
+
 bool DecodeInputH264::isSyncWord(const uint8_t* buf)
 {
     return buf[0] == 0 && buf[1] == 0 && buf[2] == 1;
@@ -39,6 +39,31 @@
 
 using namespace YamiMediaCodec;
 
+#ifdef __BUILD_GET_MV__
+static VideoEncMVBuffer MVBuffer;
+static FILE* MVFp;
+#endif
+
+// write one coded frame, @withWait waits for the oldest frame in flight instead of returning ENCODE_BUFFER_NO_MORE
+static Encode_Status writeOneOutput(IVideoEncoder* encoder, EncodeOutput* output, VideoEncOutputBuffer* outputBuffer, bool withWait)
+{
+    Encode_Status status;
+#ifndef __BUILD_GET_MV__
+    status = encoder->getOutput(outputBuffer, withWait);
+#else
+    status = encoder->getOutput(outputBuffer, &MVBuffer, withWait);
+#endif
+    if (status == ENCODE_SUCCESS
+        && !output->write(outputBuffer->data, outputBuffer->dataSize))
+        assert(0);
+#ifdef __BUILD_GET_MV__
+    if (status == ENCODE_SUCCESS) {
+        fwrite(MVBuffer.data, MVBuffer.bufferSize, 1, MVFp);
+    }
+#endif
+    return status;
+}
+
 int main(int argc, char** argv)
 {
     IVideoEncoder *encoder = NULL;
@@ -86,6 +111,28 @@ int main(int argc, char** argv)
     encVideoParams.size = sizeof(VideoParamsCommon);
     encoder->setParameters(VideoParamsTypeCommon, &encVideoParams);
 
+    if (ipPeriod > 1) {
+        VideoParamsBFrames bFrames;
+        bFrames.size = sizeof(VideoParamsBFrames);
+        encoder->getParameters(VideoParamsTypeBFrames, &bFrames);
+        bFrames.ipPeriod = ipPeriod;
+        encoder->setParameters(VideoParamsTypeBFrames, &bFrames);
+    }
+
+    if (lookaheadDepth) {
+        VideoParamsLookahead lookahead;
+        lookahead.size = sizeof(VideoParamsLookahead);
+        lookahead.lookaheadDepth = lookaheadDepth;
+        encoder->setParameters(VideoParamsTypeLookahead, &lookahead);
+    }
+
+    if (statsFile) {
+        VideoParamsStatsFile stats;
+        stats.size = sizeof(VideoParamsStatsFile);
+        stats.path = statsFile;
+        encoder->setParameters(VideoParamsTypeStatsFile, &stats);
+    }
+
     VideoConfigAVCStreamFormat streamFormat;
     streamFormat.size = sizeof(VideoConfigAVCStreamFormat);
     streamFormat.streamFormat = AVC_STREAM_FORMAT_ANNEXB;
@@ -99,7 +146,6 @@ int main(int argc, char** argv)
 
 #ifdef __BUILD_GET_MV__
     uint32_t size;
-    VideoEncMVBuffer MVBuffer;
     MVFp = fopen("feimv.bin","wb");
     encoder->getMVBufferSize(&size);
     if (!createMVBuffer(&MVBuffer, size)) {
@@ -117,27 +163,20 @@ int main(int argc, char** argv)
         memset(&inputBuffer, 0, sizeof(inputBuffer));
         if (input->getOneFrameInput(inputBuffer)) {
             status = encoder->encode(&inputBuffer);
+            //all frames in flight, wait for the oldest one to make room
+            while (status == ENCODE_IS_BUSY) {
+                writeOneOutput(encoder, output, &outputBuffer, true);
+                status = encoder->encode(&inputBuffer);
+            }
             ASSERT(status == ENCODE_SUCCESS);
             input->recycleOneFrameInput(inputBuffer);
         }
         else
             break;
 
-        //get the output buffer
+        //get the coded frames which are ready, without waiting
         do {
-#ifndef __BUILD_GET_MV__
-            status = encoder->getOutput(&outputBuffer, false);
-#else
-            status = encoder->getOutput(&outputBuffer, &MVBuffer, false);
-#endif
-            if (status == ENCODE_SUCCESS
-                && !output->write(outputBuffer.data, outputBuffer.dataSize))
-                assert(0);
-#ifdef __BUILD_GET_MV__
-            if (status == ENCODE_SUCCESS) {
-                fwrite(MVBuffer.data, MVBuffer.bufferSize, 1, MVFp);
-            }
-#endif
+            status = writeOneOutput(encoder, output, &outputBuffer, false);
         } while (status != ENCODE_BUFFER_NO_MORE);
 
         encodeFrameCount++;
@@ -146,21 +185,13 @@ int main(int argc, char** argv)
             break;
     }
 
-    // drain the output buffer
+    // send end of stream, so the encoder codes the frames it holds for reordering
+    status = encoder->encode(SharedPtr<VideoFrame>());
+    ASSERT(status == ENCODE_SUCCESS);
+
+    // drain the output buffer, getOutput() stops waiting once the last frame is out
     do {
-#ifndef __BUILD_GET_MV__
-       status = encoder->getOutput(&outputBuffer, true);
-#else
-       status = encoder->getOutput(&outputBuffer, &MVBuffer, true);
-#endif
-       if (status == ENCODE_SUCCESS
-           && !output->write(outputBuffer.data, outputBuffer.dataSize))
-           assert(0);
-#ifdef __BUILD_GET_MV__
-        if (status == ENCODE_SUCCESS) {
-            fwrite(MVBuffer.data, MVBuffer.bufferSize, 1, MVFp);
-        }
-#endif
+        status = writeOneOutput(encoder, output, &outputBuffer, true);
     } while (status != ENCODE_BUFFER_NO_MORE);
 
     encoder->stop();
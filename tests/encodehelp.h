@@ -35,6 +35,9 @@ static int videoWidth = 0, videoHeight = 0, bitRate = 0, fps = 30;
 static int initQp=26;
 static VideoRateControl rcMode = RATE_CONTROL_CQP;
 static int frameCount = 0;
+static int ipPeriod = 1;
+static int lookaheadDepth = 0;
+static char* statsFile = NULL;
 #ifdef __BUILD_GET_MV__
 static FILE *MVFp;
 #endif
@@ -65,7 +68,10 @@ static void print_help(const char* app)
     printf("   -s <fourcc: NV12|IYUV|YV12> Note: not support now\n");
     printf("   -N <number of frames to encode(camera default 50), useful for camera>\n");
     printf("   --qp <initial qp> optional\n");
-    printf("   --rcmode <CBR|CQP> optional\n");
+    printf("   --rcmode <CBR|CQP|ABR|VBR|CVBR|PASS1|PASS2> optional, ABR, VBR, capped VBR and two pass are done by yami\n");
+    printf("   --ipperiod <distance between anchor frames, ipperiod - 1 B frames in between> optional\n");
+    printf("   --lookahead <count of frames analysed ahead for scene cuts and QP, 0 to disable> optional\n");
+    printf("   --stats <statistics file written by PASS1 and read by PASS2> needed for two pass\n");
 }
 
 static VideoRateControl string_to_rc_mode(char *str)
@@ -76,6 +82,16 @@ static VideoRateControl string_to_rc_mode(char *str)
         rcMode = RATE_CONTROL_CBR;
     else if (!strcasecmp (str, "CQP"))
         rcMode = RATE_CONTROL_CQP;
+    else if (!strcasecmp (str, "ABR"))
+        rcMode = RATE_CONTROL_HOST_ABR;
+    else if (!strcasecmp (str, "VBR"))
+        rcMode = RATE_CONTROL_HOST_VBR;
+    else if (!strcasecmp (str, "CVBR"))
+        rcMode = RATE_CONTROL_HOST_CAPPED_VBR;
+    else if (!strcasecmp (str, "PASS1"))
+        rcMode = RATE_CONTROL_HOST_FIRST_PASS;
+    else if (!strcasecmp (str, "PASS2"))
+        rcMode = RATE_CONTROL_HOST_SECOND_PASS;
     else {
         printf("Unsupport  RC mode\n");
         rcMode = RATE_CONTROL_NONE;
@@ -90,6 +106,9 @@ static bool process_cmdline(int argc, char *argv[])
         {"help", no_argument, NULL, 'h' },
         {"qp", required_argument, NULL, 0 },
         {"rcmode", required_argument, NULL, 0 },
+        {"ipperiod", required_argument, NULL, 0 },
+        {"lookahead", required_argument, NULL, 0 },
+        {"stats", required_argument, NULL, 0 },
         {NULL, no_argument, NULL, 0 }};
     int option_index;
 
@@ -141,6 +160,15 @@ static bool process_cmdline(int argc, char *argv[])
                 case 2:
                     rcMode = string_to_rc_mode(optarg);
                     break;
+                case 3:
+                    ipPeriod = atoi(optarg);
+                    break;
+                case 4:
+                    lookaheadDepth = atoi(optarg);
+                    break;
+                case 5:
+                    statsFile = optarg;
+                    break;
             }
         }
     }
@@ -150,8 +178,13 @@ static bool process_cmdline(int argc, char *argv[])
         return false;
     }
 
-    if ((rcMode == RATE_CONTROL_CBR) && (bitRate <= 0)) {
-        fprintf(stderr, "please make sure bitrate is positive when CBR mode\n");
+    if ((rcMode == RATE_CONTROL_HOST_FIRST_PASS || rcMode == RATE_CONTROL_HOST_SECOND_PASS) && !statsFile) {
+        fprintf(stderr, "two pass encoding needs a statistics file\n");
+        return false;
+    }
+
+    if ((rcMode != RATE_CONTROL_CQP && rcMode != RATE_CONTROL_NONE && rcMode != RATE_CONTROL_HOST_FIRST_PASS) && (bitRate <= 0)) {
+        fprintf(stderr, "please make sure bitrate is positive when rate control mode is not CQP\n");
         return false;
     }
 
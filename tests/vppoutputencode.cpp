@@ -108,22 +108,32 @@ bool VppOutputEncode::config(NativeDisplay& nativeDisplay)
     return true;
 }
 
+Encode_Status VppOutputEncode::writeOneOutput(bool withWait)
+{
+    Encode_Status status = m_encoder->getOutput(&m_outputBuffer, withWait);
+    if (status == ENCODE_SUCCESS
+        && !m_output->write(m_outputBuffer.data, m_outputBuffer.dataSize))
+         assert(0);
+    return status;
+}
+
 bool VppOutputEncode::output(const SharedPtr<VideoFrame>& frame)
 {
     Encode_Status status = ENCODE_SUCCESS;
     bool drain = !frame;
-    if (frame) {
+    //a null frame marks the end of stream
+    status = m_encoder->encode(frame);
+    //all frames in flight, wait for the oldest one to make room
+    while (status == ENCODE_IS_BUSY) {
+        writeOneOutput(true);
         status = m_encoder->encode(frame);
-        if (status != ENCODE_SUCCESS) {
-            fprintf(stderr, "encode failed status = %d\n", status);
-            return false;
-        }
+    }
+    if (status != ENCODE_SUCCESS) {
+        fprintf(stderr, "encode failed status = %d\n", status);
+        return false;
     }
     do {
-        status = m_encoder->getOutput(&m_outputBuffer, drain);
-        if (status == ENCODE_SUCCESS
-            && !m_output->write(m_outputBuffer.data, m_outputBuffer.dataSize))
-             assert(0);
+        status = writeOneOutput(drain);
     } while (status != ENCODE_BUFFER_NO_MORE);
     return true;
 
@@ -38,6 +38,7 @@ protected:
     virtual bool init(const char* outputFileName);
 private:
     void initOuputBuffer();
+    Encode_Status writeOneOutput(bool withWait);
     const char* m_mime;
     SharedPtr<IVideoEncoder> m_encoder;
     VideoEncOutputBuffer m_outputBuffer;
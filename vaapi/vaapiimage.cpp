@@ -110,6 +110,23 @@ bool VaapiImageRaw::copyFrom(const uint8_t* src, const uint32_t offsets[3], cons
         src, offsets, pitches);
 }
 
+bool VaapiImageRaw::copyFrom(const uint8_t* src, const uint32_t offsets[3], const uint32_t pitches[3],
+                             uint32_t width, uint32_t height)
+{
+    if (!src)
+        return false;
+    VAImagePtr& image =  m_image->m_image;
+    if (width > image->width || height > image->height)
+        return false;
+    uint32_t w[3];
+    uint32_t h[3];
+    uint32_t planes;
+    if (!YamiMediaCodec::getPlaneResolution(image->format.fourcc, width, height, w, h, planes))
+        return false;
+    uint8_t* dest = reinterpret_cast<uint8_t*>(m_handle);
+    return copy(dest, image->offsets, image->pitches, src, offsets, pitches, w, h, planes);
+}
+
 bool VaapiImageRaw::copyFrom(const uint8_t* src, uint32_t size)
 {
     if (!src || !size)
@@ -87,6 +87,9 @@ public:
     bool copyTo(uint8_t* dest, const uint32_t offsets[3], const uint32_t pitches[3]);
     bool copyFrom(const uint8_t* src, const uint32_t offsets[3], const uint32_t pitches[3]);
     bool copyFrom(const uint8_t* src, uint32_t size);
+    /// copy a @width x @height frame to the top left of the image, which may be bigger
+    bool copyFrom(const uint8_t* src, const uint32_t offsets[3], const uint32_t pitches[3],
+                  uint32_t width, uint32_t height);
     bool getHandle(intptr_t& handle, uint32_t offsets[3], uint32_t pitches[3]);
     ~VaapiImageRaw();
 private:
@@ -35,7 +35,7 @@
 namespace YamiMediaCodec{
 VaapiPicture::VaapiPicture(const ContextPtr& context,
                            const SurfacePtr& surface, int64_t timeStamp)
-:m_display(context->getDisplay()), m_context(context), m_surface(surface),
+:m_display(context ? context->getDisplay() : DisplayPtr()), m_context(context), m_surface(surface),
 m_timeStamp(timeStamp), m_type(VAAPI_PICTURE_TYPE_NONE)
 {
 
@@ -49,6 +49,8 @@ public:
     inline SurfacePtr getSurface() const;
     inline void setSurface(const SurfacePtr&);
     inline bool sync();
+    /// the hardware is done with the picture, sync() won't block
+    inline bool isReady();
 
     int64_t                 m_timeStamp;
     VaapiPictureType        m_type;
@@ -135,6 +137,15 @@ bool VaapiPicture::sync()
 {
     return m_surface->sync();
 }
+
+bool VaapiPicture::isReady()
+{
+    VaapiSurfaceStatus status;
+    //let sync() report the error
+    if (!m_surface->queryStatus(&status))
+        return true;
+    return !(status & VAAPI_SURFACE_STATUS_RENDERING);
+}
 }
 
 #endif //vaapipicture_h
@@ -52,8 +52,17 @@ typedef SharedPtr < VaapiContext > ContextPtr;
 class VaapiDecSurfacePool;
 typedef SharedPtr < VaapiDecSurfacePool > DecSurfacePoolPtr;
 
+class VaapiCodedBufferPool;
+typedef SharedPtr < VaapiCodedBufferPool > CodedBufferPoolPtr;
+
+class VaapiEncSurfacePool;
+typedef SharedPtr < VaapiEncSurfacePool > EncSurfacePoolPtr;
+
 class VaapiImagePool;
 typedef SharedPtr < VaapiImagePool > ImagePoolPtr;
+
+class VaapiRateControl;
+typedef SharedPtr < VaapiRateControl > RateControlPtr;
 } //namespace YamiMediaCodec
 
 #endif                          /* vaapiptr_h */